@@ -0,0 +1,162 @@
+#include "BatchQuery.h"
+#include "DecodeBudget.h"
+#include "ImageHash.h"
+#include "ImageIndexer.h"
+#include "ImageIndex.h"
+#include "MultiIndexHash.h"
+#include "OrbFeatures.h"
+#include "SqliteStore.h"
+#include "TaskScheduler.h"
+#include <QtGui/QImageReader>
+#include <atomic>
+#include <numeric>
+#ifdef HAVE_OPENCV
+#include <opencv2/core.hpp>
+#endif
+
+namespace {
+struct Prepared {
+    bool ok{false};
+#ifdef HAVE_OPENCV
+    cv::Mat desc;
+#endif
+    std::vector<std::pair<int, MultiIndexHash::Match>> candidates;   // target, slot in its index
+};
+}
+
+namespace BatchQuery {
+
+QList<Report> run(const QStringList& queries, const QList<Target>& targets,
+                  const ThumbnailPyramid::Options& thumbOpts, const Options& opts,
+                  const std::function<void(int, int)>& progress) {
+    QElapsedTimer timer;
+    timer.start();
+    const int total = queries.size();
+    std::vector<Prepared> prepared(size_t(total));
+    std::vector<int> order(size_t(total));
+    std::iota(order.begin(), order.end(), 0);
+
+    // 1) Decode each query once: pHash exactly like the indexer, ORB on the cached feature level,
+    //    then probe every target's multi-index. They are read-only here, so queries run fully in parallel.
+    const int featureLevel = thumbOpts.pickSize(256);
+    std::atomic<int> done{0};
+    TaskScheduler::blockingMap(TaskScheduler::Priority::Interactive, order, [&](int i) {
+        Prepared& p = prepared[size_t(i)];
+        QImageReader reader(queries[i]);
+        reader.setAutoTransform(true);
+        QSize sz = reader.size();
+        if (sz.isValid()) { sz.scale(4096, 4096, Qt::KeepAspectRatio); reader.setScaledSize(sz); }
+        DecodeBudget::Lease lease;
+        const QImage img = lease.read(reader);
+        if (!img.isNull()) {
+            p.ok = true;
+            // Rotated/mirrored copies match through the targets' variant indexes (hash/dihedral)
+            const quint64 code = ImageHash::pHash(img);
+            for (int t = 0; t < targets.size(); ++t) {
+                for (const auto& m : MultiIndexHash::searchWithVariants(*targets[t].phashIndex, *targets[t].variants, code, opts.maxHamming))
+                    p.candidates.push_back({t, m});
+            }
+#ifdef HAVE_OPENCV
+            if (!p.candidates.empty()) {
+                for (const auto& lv : ThumbnailPyramid::build(img, thumbOpts)) {
+                    if (lv.first == featureLevel) p.desc = OrbFeatures::describe(OrbFeatures::toBgrMat(lv.second));
+                }
+            }
+#endif
+        }
+        const int n = ++done;
+        if (progress) progress(n, total);
+    });
+    const qint64 hashMs = timer.elapsed();
+
+#ifdef HAVE_OPENCV
+    // 2) One descriptor load per target for the union of its candidates, unpacked once and shared
+    //    (keyed by global id)
+    QHash<qint64, cv::Mat> descs;
+    for (int t = 0; t < targets.size(); ++t) {
+        QList<qint64> ids;
+        QSet<qint64> seen;
+        for (const Prepared& p : prepared) {
+            if (p.desc.empty()) continue;
+            for (const auto& c : p.candidates) {
+                if (c.first != t) continue;
+                const qint64 id = targets[t].index->id(int(c.second.value));
+                if (!seen.contains(id)) { seen.insert(id); ids.push_back(id); }
+            }
+        }
+        for (int i = 0; i < ids.size(); i += 1000) {
+            const auto blobs = targets[t].store->loadDescriptors(ids.mid(i, 1000));
+            for (auto it = blobs.constBegin(); it != blobs.constEnd(); ++it)
+                descs.insert(targets[t].idBase | it.key(), OrbFeatures::unpack(it.value()));
+        }
+    }
+#endif
+
+    // 3) Verify and rank per query
+    std::vector<Report> reports(size_t(total));
+    TaskScheduler::blockingMap(TaskScheduler::Priority::Interactive, order, [&](int i) {
+        const Prepared& p = prepared[size_t(i)];
+        Report& r = reports[size_t(i)];
+        r.query = queries[i];
+        r.readable = p.ok;
+        for (const auto& [t, c] : p.candidates) {
+            const qint64 id = targets[t].idBase | targets[t].index->id(int(c.value));
+            double orb = -1.0;
+#ifdef HAVE_OPENCV
+            const auto d = descs.constFind(id);
+            if (!p.desc.empty() && d != descs.constEnd() && !d.value().empty())
+                orb = double(OrbFeatures::goodMatches(p.desc, d.value())) / double(p.desc.rows);
+#endif
+            if (orb >= 0.0 && orb < opts.minOrbScore) continue;
+            r.matches.push_back({id, c.distance, orb});
+        }
+        std::stable_sort(r.matches.begin(), r.matches.end(), [](const Match& a, const Match& b){
+            return a.hamming != b.hamming ? a.hamming < b.hamming : a.orbScore > b.orbScore;
+        });
+        if (r.matches.size() > opts.maxMatches) r.matches.resize(opts.maxMatches);
+    });
+
+    const qint64 ms = qMax<qint64>(1, timer.elapsed());
+    qInfo() << "Batch query:" << total << "images in" << ms << "ms (hash/join" << hashMs << "ms),"
+            << qRound(total * 1000.0 / ms) << "queries/s on" << TaskScheduler::pool(TaskScheduler::Priority::Interactive)->maxThreadCount() << "threads";
+    return QList<Report>(reports.begin(), reports.end());
+}
+
+QString csvField(const QString& s) {
+    if (!s.contains(QLatin1Char(',')) && !s.contains(QLatin1Char('"')) && !s.contains(QLatin1Char('\n'))) return s;
+    QString q = s;
+    q.replace(QLatin1String("\""), QLatin1String("\"\""));
+    return QLatin1Char('"') + q + QLatin1Char('"');
+}
+
+QStringList collect(const QString& folder) {
+    QStringList files;
+    QDirIterator it(folder, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QString p = it.next();
+        if (ImageIndexer::isImageFile(p)) files.push_back(p);
+    }
+    files.sort();
+    return files;
+}
+
+bool writeCsv(QIODevice* out, const QList<Report>& reports, const std::function<QString(qint64)>& pathOf) {
+    QTextStream ts(out);
+    ts << "query,match,hamming,orb\n";
+    for (const Report& r : reports) {
+        if (r.matches.isEmpty()) {
+            ts << csvField(QDir::toNativeSeparators(r.query)) << (r.readable ? ",,," : ",,-1,") << '\n';
+            continue;
+        }
+        for (const Match& m : r.matches) {
+            ts << csvField(QDir::toNativeSeparators(r.query)) << ','
+               << csvField(pathOf(m.id)) << ','
+               << m.hamming << ','
+               << (m.orbScore >= 0.0 ? QString::number(m.orbScore, 'f', 3) : QString()) << '\n';
+        }
+    }
+    ts.flush();
+    return ts.status() == QTextStream::Ok;
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <QtCore>
+#include "ThumbnailPyramid.h"
+#include <functional>
+
+class ImageIndex;
+class MultiIndexHash;
+class SqliteStore;
+
+// Checks many query images against the library in one pass.
+// Every query is decoded and hashed once (in parallel), candidates come from a
+// single multi-index Hamming join, and the descriptors of all candidates are
+// loaded once and shared by every query that needs them for ORB verification.
+namespace BatchQuery {
+    struct Options {
+        int maxHamming{10};        // pHash radius of the join
+        int maxMatches{20};        // per query
+        double minOrbScore{0.0};   // drop candidates verified below this (0 keeps all)
+    };
+
+    struct Match {
+        qint64 id;
+        int hamming;
+        double orbScore;           // fraction of query descriptors passing the ratio test; -1 if unverified
+    };
+
+    struct Report {
+        QString query;
+        bool readable{false};
+        QList<Match> matches;      // best first
+    };
+
+    // One library shard; match ids are idBase | row id (see LibraryShard::globalId)
+    struct Target {
+        const ImageIndex* index;
+        const MultiIndexHash* phashIndex;
+        const MultiIndexHash* variants;   // rotated/mirrored pHashes (may be empty), see MultiIndexHash::searchWithVariants
+        SqliteStore* store;
+        qint64 idBase;
+    };
+
+    // Image files under folder (recursive), sorted
+    QStringList collect(const QString& folder);
+
+    // Hashes and describes queries once and probes every target; progress(done, total) is
+    // called from worker threads. The stores are only used on the calling thread.
+    QList<Report> run(const QStringList& queries, const QList<Target>& targets,
+                      const ThumbnailPyramid::Options& thumbOpts, const Options& opts,
+                      const std::function<void(int, int)>& progress = {});
+
+    // s quoted for a CSV cell when needed
+    QString csvField(const QString& s);
+
+    // query,match,hamming,orb per line (header first); queries without matches get one row with
+    // empty match, unreadable ones hamming -1
+    bool writeCsv(QIODevice* out, const QList<Report>& reports, const std::function<QString(qint64)>& pathOf);
+}
@@ -0,0 +1,562 @@
+#include "Benchmark.h"
+#include "ColorHistogram.h"
+#include "ImageHash.h"
+#include "ImageIndex.h"
+#include "MultiIndexHash.h"
+#include "OrbFeatures.h"
+#include "ThumbnailDelegate.h"
+#include <QtGui/QImageReader>
+#include <QtGui/QPainter>
+#include <QtWidgets/QListView>
+#include <QtWidgets/QScrollBar>
+#include <cerrno>
+#include <limits>
+#ifdef HAVE_OPENCV
+#include <opencv2/features2d.hpp>
+#endif
+
+#if defined(DIFFER_COUNT_ALLOCS) && defined(__GLIBC__)
+#define DIFFER_ALLOCS_COUNTED 1
+// Thin wrappers over glibc's allocator. Counters are per thread so pool workers
+// and Qt's own threads do not show up in the stage being measured.
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+}
+
+namespace {
+thread_local quint64 t_allocs = 0;
+thread_local quint64 t_bytes = 0;
+inline void note(size_t n) { ++t_allocs; t_bytes += n; }
+}
+
+extern "C" {
+void* malloc(size_t n) { note(n); return __libc_malloc(n); }
+void* calloc(size_t c, size_t n) { note(c * n); return __libc_calloc(c, n); }
+void* realloc(void* p, size_t n) { note(n); return __libc_realloc(p, n); }
+void* memalign(size_t a, size_t n) { note(n); return __libc_memalign(a, n); }
+void* aligned_alloc(size_t a, size_t n) { note(n); return __libc_memalign(a, n); }
+int posix_memalign(void** p, size_t a, size_t n) {
+    if (a % sizeof(void*) != 0 || (a & (a - 1)) != 0) return EINVAL;
+    note(n);
+    *p = __libc_memalign(a, n);
+    return *p ? 0 : ENOMEM;
+}
+}
+#endif
+
+namespace {
+struct Counters { quint64 allocs{0}; quint64 bytes{0}; };
+
+Counters current() {
+#ifdef DIFFER_ALLOCS_COUNTED
+    return {t_allocs, t_bytes};
+#else
+    return {};
+#endif
+}
+
+struct Stage {
+    const char* name;
+    quint64 allocs{0};
+    quint64 bytes{0};
+    qint64 ns{0};
+};
+
+// Adds one run of fn to s unless this is the warm-up image
+template <typename Fn>
+void measure(Stage& s, bool counted, Fn&& fn) {
+    const Counters before = current();
+    QElapsedTimer timer;
+    timer.start();
+    fn();
+    const qint64 ns = timer.nsecsElapsed();
+    const Counters after = current();
+    if (!counted) return;
+    s.allocs += after.allocs - before.allocs;
+    s.bytes += after.bytes - before.bytes;
+    s.ns += ns;
+}
+
+// Stand-in for ThumbnailModel: long camera-style names and one icon per row over a few
+// shared pixmaps, so every row is a separate icon to the delegate
+class GridModel : public QAbstractListModel {
+public:
+    explicit GridModel(int rows) : m_rows(rows) {
+        for (int i = 0; i < 16; ++i) {
+            QImage img(384, 384 - i * 12, QImage::Format_RGB32);
+            QPainter p(&img);
+            QLinearGradient g(0, 0, img.width(), img.height());
+            g.setColorAt(0, QColor::fromHsv(i * 22, 180, 220));
+            g.setColorAt(1, QColor::fromHsv((i * 22 + 120) % 360, 200, 90));
+            p.fillRect(img.rect(), g);
+            p.end();
+            m_pixmaps.push_back(QPixmap::fromImage(img));
+        }
+        m_icons.reserve(rows);
+        for (int r = 0; r < rows; ++r) m_icons.push_back(QIcon(m_pixmaps[r % m_pixmaps.size()]));
+    }
+    int rowCount(const QModelIndex& parent) const override { return parent.isValid() ? 0 : m_rows; }
+    QVariant data(const QModelIndex& index, int role) const override {
+        if (role == Qt::DisplayRole) return QString("IMG_%1_holiday export final (edited).jpg").arg(index.row(), 5, 10, QChar('0'));
+        if (role == Qt::DecorationRole) return m_icons[index.row()];
+        return {};
+    }
+
+private:
+    int m_rows;
+    QVector<QPixmap> m_pixmaps;
+    QVector<QIcon> m_icons;
+};
+
+#ifdef HAVE_OPENCV
+// The search stages as they were before the per-thread workspaces: a converted QImage
+// cloned into a Mat, a new detector per image and a BFMatcher with DMatch vectors per pair
+cv::Mat toBgrMatFresh(const QImage& img) {
+    if (img.isNull()) return cv::Mat();
+    const QImage bgr = img.convertToFormat(QImage::Format_BGR888);
+    return cv::Mat(bgr.height(), bgr.width(), CV_8UC3, const_cast<uchar*>(bgr.constBits()), bgr.bytesPerLine()).clone();
+}
+
+cv::Mat describeFresh(const cv::Mat& bgr) {
+    cv::Mat desc;
+    if (bgr.empty()) return desc;
+    auto orb = cv::ORB::create(OrbFeatures::kMaxFeatures);
+    std::vector<cv::KeyPoint> kps;
+    orb->detectAndCompute(bgr, cv::noArray(), kps, desc);
+    return desc;
+}
+
+int goodMatchesFresh(const cv::Mat& query, const cv::Mat& candidate) {
+    if (query.empty() || candidate.empty()) return 0;
+    cv::BFMatcher matcher(cv::NORM_HAMMING, false);
+    std::vector<std::vector<cv::DMatch>> knn;
+    matcher.knnMatch(query, candidate, knn, 2);
+    int good = 0;
+    for (auto& v : knn) { if (v.size() == 2 && v[0].distance < OrbFeatures::kRatio * v[1].distance) ++good; }
+    return good;
+}
+#endif
+
+// Deep archive layout: a long share prefix, then year/month/event folders of 200 images
+QString syntheticPath(int i) {
+    static const QString prefix = QDir::toNativeSeparators(
+        QStringLiteral("/mnt/nas-archive-01/photography/family-and-events/camera-imports/originals-do-not-edit/"));
+    const int folder = i / 200;
+    return prefix + QDir::toNativeSeparators(QStringLiteral("%1/%2/event-%3-imported/IMG_%4.JPG")
+        .arg(2000 + folder / 600).arg(1 + folder / 50 % 12, 2, 10, QChar('0')).arg(folder, 5, 10, QChar('0'))
+        .arg(i % 10000, 4, 10, QChar('0')));
+}
+
+// Best of three runs of fn, in milliseconds
+template <typename Fn>
+double bestOf3(Fn&& fn) {
+    qint64 best = std::numeric_limits<qint64>::max();
+    for (int run = 0; run < 3; ++run) {
+        QElapsedTimer timer;
+        timer.start();
+        fn();
+        best = qMin(best, timer.nsecsElapsed());
+    }
+    return best / 1e6;
+}
+
+// Scrolls down frames steps from the top, repainting synchronously after each
+double scrollFps(QListView& view, ThumbnailDelegate& delegate, int frames, bool clearEachFrame) {
+    QScrollBar* bar = view.verticalScrollBar();
+    const int step = qMax(1, view.gridSize().height() / 3);
+    bar->setValue(0);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < frames; ++i) {
+        if (clearEachFrame) delegate.clearCache();
+        bar->setValue(qMin(bar->maximum(), (i + 1) * step));
+        view.viewport()->repaint();
+    }
+    return frames / (qMax<qint64>(1, timer.nsecsElapsed()) / 1e9);
+}
+}
+
+bool Benchmark::countingAllocations() {
+#ifdef DIFFER_ALLOCS_COUNTED
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Benchmark::allocations(const QStringList& images, const ThumbnailPyramid::Options& thumbOpts, QTextStream& out) {
+    enum { Decode, Hashes, Pyramid, Encode, Histogram, IndexOrb, SearchDecode, ToBgr, Describe, Match,
+           OldToBgr, OldDescribe, OldMatch, StageCount };
+    Stage stages[StageCount] = {
+        {"index: decode"}, {"index: hashes"}, {"index: pyramid"}, {"index: encode"}, {"index: histogram"}, {"index: orb"},
+        {"search: decode"}, {"search: to bgr"}, {"search: describe"}, {"search: match"},
+        {"old: to bgr"}, {"old: describe"}, {"old: match"},
+    };
+    const int featureLevel = thumbOpts.pickSize(256);
+
+    // Same buffers the indexer and search keep across images
+    QImage img, candidate;
+    QList<QPair<int, QImage>> levels;
+#ifdef HAVE_OPENCV
+    cv::Mat bgr, previous;
+#endif
+    int measured = 0;
+    bool warm = false;
+    for (const QString& path : images) {
+        const bool counted = warm;
+        bool ok = false;
+        measure(stages[Decode], counted, [&]{
+            QImageReader reader(path);
+            reader.setAutoTransform(true);
+            QSize size = reader.size();
+            if (size.isValid()) { size.scale(4096, 4096, Qt::KeepAspectRatio); reader.setScaledSize(size); }
+            ok = reader.read(&img);
+        });
+        if (!ok) continue;
+        measure(stages[Hashes], counted, [&]{
+            ImageHash::pHash(img);
+            ImageHash::aHash(img);
+            ImageHash::dHash(img);
+            ImageHash::compact(img);
+        });
+        measure(stages[Pyramid], counted, [&]{ levels = ThumbnailPyramid::build(img, thumbOpts); });
+        measure(stages[Encode], counted, [&]{
+            for (const auto& lv : levels) {
+                QBuffer buffer;
+                buffer.open(QIODevice::WriteOnly);
+                lv.second.save(&buffer, thumbOpts.format.constData(), thumbOpts.quality);
+            }
+        });
+        QImage feature;
+        for (const auto& lv : levels) if (lv.first == featureLevel) feature = lv.second;
+        levels.clear();
+        measure(stages[Histogram], counted, [&]{ ColorHistogram::compute(feature); });
+#ifdef HAVE_OPENCV
+        measure(stages[IndexOrb], counted, [&]{
+            OrbFeatures::toBgrMat(feature, bgr);
+            OrbFeatures::describe(bgr);
+        });
+        // Search re-ranking: a candidate thumbnail decoded at 384, described and matched
+        measure(stages[SearchDecode], counted, [&]{
+            QImageReader reader(path);
+            reader.setAutoTransform(true);
+            QSize size = reader.size();
+            if (size.isValid()) { size.scale(384, 384, Qt::KeepAspectRatio); reader.setScaledSize(size); }
+            reader.read(&candidate);
+        });
+        measure(stages[ToBgr], counted, [&]{ OrbFeatures::toBgrMat(candidate, bgr); });
+        cv::Mat desc;
+        measure(stages[Describe], counted, [&]{ desc = OrbFeatures::describe(bgr); });
+        measure(stages[Match], counted, [&]{ OrbFeatures::goodMatches(desc, previous); });
+        // The same three stages without the workspaces, for the before/after comparison
+        cv::Mat oldBgr, oldDesc;
+        measure(stages[OldToBgr], counted, [&]{ oldBgr = toBgrMatFresh(candidate); });
+        measure(stages[OldDescribe], counted, [&]{ oldDesc = describeFresh(oldBgr); });
+        measure(stages[OldMatch], counted, [&]{ goodMatchesFresh(oldDesc, previous); });
+        previous = desc;
+#endif
+        if (counted) ++measured;
+        warm = true;
+    }
+    if (measured < 1) { out << "Need at least two readable images\n"; return false; }
+
+    const bool allocs = countingAllocations();
+    out << QString("%1 images (after one warm-up), feature level %2\n").arg(measured).arg(featureLevel);
+    if (!allocs) out << "Allocation counts need a build with -DDIFFER_COUNT_ALLOCS=ON\n";
+#ifdef HAVE_OPENCV
+    out << "old: the search stages without the per-thread workspaces (new Mat, detector and matcher per image)\n";
+#endif
+    out << QString("%1%2%3%4\n").arg("stage", -18).arg("allocs/img", 12).arg("KB/img", 12).arg("us/img", 12);
+    for (const Stage& s : stages) {
+#ifndef HAVE_OPENCV
+        if (&s >= &stages[IndexOrb]) break;
+#endif
+        out << QString("%1").arg(s.name, -18);
+        if (allocs) {
+            out << QString("%1%2").arg(double(s.allocs) / measured, 12, 'f', 1)
+                                  .arg(double(s.bytes) / measured / 1024.0, 12, 'f', 1);
+        } else {
+            out << QString("%1%2").arg("-", 12).arg("-", 12);
+        }
+        out << QString("%1\n").arg(double(s.ns) / measured / 1000.0, 12, 'f', 1);
+    }
+    // Single-thread throughput of the two indexing profiles (file reads and database writes excluded)
+    qint64 hashNs = 0, fullNs = 0;
+    for (int s = Decode; s <= IndexOrb; ++s) {
+        fullNs += stages[s].ns;
+        if (s == Decode || s == Hashes) hashNs += stages[s].ns;
+    }
+    out << QString("index profile full: %1 images/s per thread, hash-only: %2 images/s per thread\n")
+           .arg(measured / (qMax<qint64>(1, fullNs) / 1e9), 0, 'f', 1)
+           .arg(measured / (qMax<qint64>(1, hashNs) / 1e9), 0, 'f', 1);
+    return true;
+}
+
+bool Benchmark::pathStorage(int images, QTextStream& out) {
+    QTemporaryDir dir;
+    if (!dir.isValid() || images < 1) { out << "Cannot create a temporary directory\n"; return false; }
+    const QString file = dir.filePath("index.db");
+
+    // The images table as earlier versions created it, and their loadAll()
+    qint64 oldBytes = 0;
+    double oldLoadMs = 0;
+    const QString conn = QStringLiteral("differ_bench_paths");
+    QString error;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", conn);
+        db.setDatabaseName(file);
+        const bool opened = db.open();
+        QSqlQuery q(db);
+        bool ok = opened
+            && q.exec("CREATE TABLE images (id INTEGER PRIMARY KEY AUTOINCREMENT, path TEXT UNIQUE, mtime INTEGER, size INTEGER,"
+                      " phash INTEGER, ahash INTEGER DEFAULT 0, dhash INTEGER DEFAULT 0, whash INTEGER DEFAULT 0,"
+                      " cmoments INTEGER DEFAULT 0, width INTEGER DEFAULT 0, height INTEGER DEFAULT 0, thumb_state INTEGER DEFAULT 1)")
+            && db.transaction()
+            && q.prepare("INSERT INTO images(path, mtime, size, phash, ahash, dhash, width, height) VALUES(?, ?, ?, ?, ?, ?, 4000, 3000)");
+        QRandomGenerator rng(48);
+        for (int i = 0; ok && i < images; ++i) {
+            q.addBindValue(syntheticPath(i));
+            q.addBindValue(qint64(1600000000) + i);
+            q.addBindValue(qint64(2000000) + rng.bounded(4000000));
+            for (int h = 0; h < 3; ++h) q.addBindValue(qint64(rng.generate64() >> 1));
+            ok = q.exec();
+        }
+        ok = ok && db.commit();
+        if (ok && q.exec("PRAGMA page_count") && q.next()) oldBytes = q.value(0).toLongLong();
+        if (ok && q.exec("PRAGMA page_size") && q.next()) oldBytes *= q.value(0).toLongLong();
+        q.finish();
+        if (ok) {
+            oldLoadMs = bestOf3([&]{
+                QList<ImageEntry> res;
+                QSqlQuery all(db);
+                all.exec("SELECT id, path, mtime, size, phash, ahash, dhash, width, height, whash, cmoments FROM images ORDER BY id DESC");
+                while (all.next()) {
+                    ImageEntry e;
+                    e.id = all.value(0).toLongLong();
+                    e.path = all.value(1).toString();
+                    e.mtime = all.value(2).toLongLong();
+                    e.size = all.value(3).toLongLong();
+                    e.phash = all.value(4).toULongLong();
+                    e.ahash = all.value(5).toULongLong();
+                    e.dhash = all.value(6).toULongLong();
+                    e.width = all.value(7).toInt();
+                    e.height = all.value(8).toInt();
+                    e.whash = all.value(9).toULongLong();
+                    e.cmoments = all.value(10).toULongLong();
+                    res.push_back(e);
+                }
+            });
+        }
+        if (!ok) error = opened ? q.lastError().text() : db.lastError().text();
+        q.finish();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(conn);
+    if (!error.isEmpty()) { out << "Cannot write the benchmark database: " << error << "\n"; return false; }
+
+    // Converted the way open() converts a library database, then loaded as the model does
+    qint64 newBytes = 0;
+    double convertMs = 0, loadAllMs = 0, loadIndexMs = 0;
+    {
+        SqliteStore store;
+        QElapsedTimer timer;
+        timer.start();
+        if (!store.open(file)) { out << "Cannot convert the benchmark database\n"; return false; }
+        convertMs = timer.nsecsElapsed() / 1e6;
+        newBytes = store.databaseBytes();
+        loadAllMs = bestOf3([&]{ store.loadAll(); });
+        ImageIndex index;
+        loadIndexMs = bestOf3([&]{ store.loadIndex(index); });
+    }
+
+    out << QString("%1 images in %2 directories, %3 characters per path\n")
+           .arg(images).arg((images + 199) / 200).arg(syntheticPath(0).size());
+    out << QString("%1%2%3\n").arg("schema", -28).arg("DB MB", 12).arg("load ms", 12);
+    out << QString("%1%2%3\n").arg("full path per row", -28).arg(oldBytes / 1048576.0, 12, 'f', 1).arg(oldLoadMs, 12, 'f', 1);
+    out << QString("%1%2%3\n").arg("directories + names", -28).arg(newBytes / 1048576.0, 12, 'f', 1).arg(loadAllMs, 12, 'f', 1);
+    out << QString("%1%2%3\n").arg("  into ImageIndex", -28).arg("", 12).arg(loadIndexMs, 12, 'f', 1);
+    out << QString("conversion (copy + VACUUM): %1 ms\n").arg(convertMs, 0, 'f', 1);
+    return true;
+}
+
+bool Benchmark::inMemoryIndex(int images, QTextStream& out) {
+    if (images < 1) return false;
+    QRandomGenerator rng(27);
+    auto entry = [&rng](int i) {
+        ImageEntry e;
+        e.id = i + 1;
+        e.path = syntheticPath(i);
+        e.mtime = qint64(1600000000) + i;
+        e.size = qint64(2000000) + rng.bounded(4000000);
+        e.phash = rng.generate64();
+        e.ahash = rng.generate64();
+        e.dhash = rng.generate64();
+        e.width = 4000;
+        e.height = 3000;
+        return e;
+    };
+
+    // Rows as loadAll() returned them; heap bytes counted when malloc is wrapped, else estimated
+    // from the element size and one QString buffer (header + UTF-16 + terminator) per path
+    constexpr qint64 kStringHeader = 24;    // QArrayData header and malloc bookkeeping
+    QList<ImageEntry> list;
+    const Counters before = current();
+    list.reserve(images);
+    for (int i = 0; i < images; ++i) list.push_back(entry(i));
+    const Counters after = current();
+    qint64 pathChars = 0;
+    for (const ImageEntry& e : list) pathChars += e.path.size();
+    const qint64 listBytes = countingAllocations()
+        ? qint64(after.bytes - before.bytes)
+        : qint64(images) * (qint64(sizeof(ImageEntry)) + kStringHeader) + (pathChars + images) * 2;
+
+    ImageIndex index;
+    index.reserve(images, pathChars);
+    for (const ImageEntry& e : list) index.append(e);
+    const qint64 indexBytes = index.memoryUsage();
+
+    // Radius-10 pHash scans of both layouts; the same matches, different bytes touched
+    constexpr int kQueries = 20;
+    constexpr int kRadius = 10;
+    quint64 queries[kQueries];
+    for (quint64& q : queries) q = list[rng.bounded(images)].phash ^ (rng.generate64() & rng.generate64() & rng.generate64());
+    qint64 listMatches = 0, indexMatches = 0;
+    const double listMs = bestOf3([&]{
+        listMatches = 0;
+        for (quint64 q : queries)
+            for (const ImageEntry& e : list) listMatches += ImageHash::hammingDistance(e.phash, q) <= kRadius;
+    });
+    const double indexMs = bestOf3([&]{
+        indexMatches = 0;
+        const quint64* codes = index.phashes();
+        const int n = index.size();
+        for (quint64 q : queries)
+            for (int s = 0; s < n; ++s) indexMatches += ImageHash::hammingDistance(codes[s], q) <= kRadius;
+    });
+    if (listMatches != indexMatches) { out << "Scans disagree\n"; return false; }
+
+    const double scanned = double(images) * kQueries;
+    out << QString("%1 images, %2 characters per path, %3 queries at radius %4\n")
+           .arg(images).arg(syntheticPath(0).size()).arg(kQueries).arg(kRadius);
+    if (!countingAllocations()) out << "QList bytes are estimated; a build with -DDIFFER_COUNT_ALLOCS=ON counts them\n";
+    out << QString("%1%2%3%4\n").arg("layout", -22).arg("bytes/img", 12).arg("Mimg/s", 12).arg("GB/s", 12);
+    // Bandwidth counts the bytes the scan has to bring in: whole elements for the list, the column for the index
+    out << QString("%1%2%3%4\n").arg("QList<ImageEntry>", -22).arg(double(listBytes) / images, 12, 'f', 1)
+           .arg(scanned / listMs / 1e3, 12, 'f', 1).arg(scanned * sizeof(ImageEntry) / listMs / 1e6, 12, 'f', 2);
+    out << QString("%1%2%3%4\n").arg("ImageIndex", -22).arg(double(indexBytes) / images, 12, 'f', 1)
+           .arg(scanned / indexMs / 1e3, 12, 'f', 1).arg(scanned * sizeof(quint64) / indexMs / 1e6, 12, 'f', 2);
+    return true;
+}
+
+bool Benchmark::multiIndex(int images, QTextStream& out) {
+    if (images < 1) return false;
+    constexpr int kQueries = 200;
+    const int variants = MultiIndexHash::kVariants;
+    QRandomGenerator rng(29);
+    // Photo libraries are not uniform: a tenth of the images are near-duplicates of another
+    auto flip = [&rng](quint64 code, int bits) {
+        for (int b = 0; b < bits; ++b) code ^= 1ull << rng.bounded(64);
+        return code;
+    };
+    std::vector<quint64> codes(size_t(images) * variants);
+    for (int i = 0; i < images; ++i) {
+        quint64* c = &codes[size_t(i) * variants];
+        c[0] = i > 0 && rng.bounded(10) == 0 ? flip(codes[size_t(rng.bounded(i)) * variants], 1 + rng.bounded(6)) : rng.generate64();
+        for (int k = 1; k < variants; ++k) c[k] = rng.generate64();
+    }
+    std::vector<quint64> primary(size_t(images));
+    for (int i = 0; i < images; ++i) primary[size_t(i)] = codes[size_t(i) * variants];
+    std::vector<quint64> queries(kQueries);
+    for (quint64& q : queries) q = flip(codes[size_t(rng.bounded(images)) * variants + size_t(rng.bounded(variants))], rng.bounded(5));
+
+    QElapsedTimer timer;
+    timer.start();
+    MultiIndexHash index, variantIndex;
+    index.build(primary.data(), images);
+    const double buildMs = timer.nsecsElapsed() / 1e6;
+    timer.restart();
+    for (int i = 0; i < images; ++i)
+        for (int k = 1; k < variants; ++k) variantIndex.insert(quint32(i * variants + k), codes[size_t(i) * variants + size_t(k)]);
+    const double variantBuildMs = timer.nsecsElapsed() / 1e6;
+
+    out << QString("%1 images, %2 substrings, %3 queries; build %4 ms, variant index (%5 codes) %6 ms\n")
+           .arg(images).arg(index.substrings()).arg(kQueries).arg(buildMs, 0, 'f', 1)
+           .arg(qint64(images) * (variants - 1)).arg(variantBuildMs, 0, 'f', 1);
+    out << QString("%1%2%3%4%5%6%7%8\n").arg("r", 4).arg("matches", 10).arg("mih us", 12).arg("scan us", 12).arg("speedup", 10)
+           .arg("dihedral", 10).arg("mih us", 12).arg("scan us", 12);
+    for (int r = 4; r <= 16; r += 2) {
+        qint64 matches = 0, scanMatches = 0, variantMatches = 0, variantScanMatches = 0;
+        const double mihMs = bestOf3([&]{
+            matches = 0;
+            for (quint64 q : queries) matches += qint64(index.search(q, r).size());
+        });
+        const double scanMs = bestOf3([&]{
+            scanMatches = 0;
+            for (quint64 q : queries) scanMatches += qint64(index.linearSearch(q, r).size());
+        });
+        const double variantMs = bestOf3([&]{
+            variantMatches = 0;
+            for (quint64 q : queries) variantMatches += qint64(MultiIndexHash::searchWithVariants(index, variantIndex, q, r).size());
+        });
+        // Brute force over all eight codes of every image, an image counted once
+        const double variantScanMs = bestOf3([&]{
+            variantScanMatches = 0;
+            for (quint64 q : queries) {
+                for (size_t i = 0; i < codes.size(); i += size_t(variants)) {
+                    for (int k = 0; k < variants; ++k) {
+                        if (ImageHash::hammingDistance(codes[i + size_t(k)], q) <= r) { ++variantScanMatches; break; }
+                    }
+                }
+            }
+        });
+        if (matches != scanMatches || variantMatches != variantScanMatches) {
+            out << QString("r=%1: index and scan disagree (%2/%3, dihedral %4/%5)\n")
+                   .arg(r).arg(matches).arg(scanMatches).arg(variantMatches).arg(variantScanMatches);
+            return false;
+        }
+        const double perQuery = 1e3 / kQueries;
+        out << QString("%1%2%3%4%5").arg(r, 4).arg(double(matches) / kQueries, 10, 'f', 1)
+               .arg(mihMs * perQuery, 12, 'f', 1).arg(scanMs * perQuery, 12, 'f', 1).arg(scanMs / qMax(1e-6, mihMs), 9, 'f', 1) << "x";
+        out << QString("%1%2%3\n").arg(double(variantMatches) / kQueries, 10, 'f', 1)
+               .arg(variantMs * perQuery, 12, 'f', 1).arg(variantScanMs * perQuery, 12, 'f', 1);
+    }
+    return true;
+}
+
+bool Benchmark::scrolling(int rows, QTextStream& out) {
+    GridModel model(rows);
+    QListView view;
+    view.setViewMode(QListView::IconMode);
+    view.setResizeMode(QListView::Adjust);
+    view.setMovement(QListView::Static);
+    view.setUniformItemSizes(true);
+    view.setWordWrap(true);
+    view.setSpacing(6);
+    auto* delegate = new ThumbnailDelegate(&view);
+    view.setItemDelegate(delegate);
+    // Same cell as the main window at its default thumbnail size
+    const QSize iconSize(160, 160);
+    view.setIconSize(iconSize);
+    view.setGridSize(ThumbnailDelegate::cellSizeForIcon(iconSize, QFontMetrics(view.font())));
+    view.setModel(&model);
+    view.resize(1280, 800);
+    view.show();
+    QCoreApplication::processEvents();
+    if (view.verticalScrollBar()->maximum() <= 0) { out << "Grid does not scroll\n"; return false; }
+
+    constexpr int kFrames = 300;
+    const double uncached = scrollFps(view, *delegate, kFrames, true);
+    delegate->clearCache();
+    const double cold = scrollFps(view, *delegate, kFrames, false);
+    const double warm = scrollFps(view, *delegate, kFrames, false);
+    out << QString("%1 rows, %2px icons, %3x%4 viewport, %5 frames per pass\n")
+           .arg(rows).arg(iconSize.width()).arg(view.viewport()->width()).arg(view.viewport()->height()).arg(kFrames);
+    out << QString("%1%2\n").arg("pass", -34).arg("frames/s", 12);
+    out << QString("%1%2\n").arg("no cache (cleared every frame)", -34).arg(uncached, 12, 'f', 1);
+    out << QString("%1%2\n").arg("first pass", -34).arg(cold, 12, 'f', 1);
+    out << QString("%1%2\n").arg("second pass (cached)", -34).arg(warm, 12, 'f', 1);
+    return true;
+}
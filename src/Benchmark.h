@@ -0,0 +1,34 @@
+#pragma once
+#include <QtCore>
+#include "ThumbnailPyramid.h"
+
+// Per-image cost of the indexing and search hot paths: heap allocations, bytes
+// requested and time for each stage. Allocations are counted only in builds
+// configured with -DDIFFER_COUNT_ALLOCS=ON (glibc); other builds report time only.
+namespace Benchmark {
+    // True when malloc is wrapped by this build
+    bool countingAllocations();
+
+    // Runs every stage over images (the first one is a warm-up and not counted)
+    // and writes a table to out; false when fewer than two images decode
+    bool allocations(const QStringList& images, const ThumbnailPyramid::Options& thumbOpts, QTextStream& out);
+
+    // Frames per second of a thumbnail grid of rows synthetic images scrolled through
+    // ThumbnailDelegate: with its caches cleared before every frame (as before they
+    // existed), on the first pass and on a second pass over the same range
+    bool scrolling(int rows, QTextStream& out);
+
+    // Database size and load time of images synthetic rows under deep NAS-style folders,
+    // stored with a full path per row (earlier schema) and after conversion to
+    // directories + file names
+    bool pathStorage(int images, QTextStream& out);
+
+    // Memory per image and Hamming scan bandwidth of ImageIndex against the QList<ImageEntry>
+    // it replaced, over images synthetic rows
+    bool inMemoryIndex(int images, QTextStream& out);
+
+    // Radius queries (r = 4..16) through MultiIndexHash against a linear scan over images
+    // synthetic pHashes, for the primary index alone and with the seven dihedral variants
+    // per image (hash/dihedral); results are checked to agree
+    bool multiIndex(int images, QTextStream& out);
+}
@@ -0,0 +1,85 @@
+#include "BowIndex.h"
+#include <algorithm>
+#include <cmath>
+
+void BowIndex::clear() {
+    m_postings.clear();
+    m_idf.clear();
+    m_norm.clear();
+    m_documents = 0;
+}
+
+void BowIndex::reset(int wordCount) {
+    clear();
+    m_postings.resize(size_t(qMax(0, wordCount)));
+}
+
+void BowIndex::add(quint32 slot, const quint32* words, int count) {
+    if (count <= 0) return;
+    std::vector<quint32> sorted(words, words + count);
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t i = 0; i < sorted.size();) {
+        size_t j = i;
+        while (j < sorted.size() && sorted[j] == sorted[i]) ++j;
+        if (sorted[i] < m_postings.size()) m_postings[sorted[i]].push_back({slot, quint32(j - i)});
+        i = j;
+    }
+    if (slot >= m_norm.size()) m_norm.resize(size_t(slot) + 1, 0.0f);
+    ++m_documents;
+}
+
+void BowIndex::finalize() {
+    m_idf.assign(m_postings.size(), 0.0f);
+    std::fill(m_norm.begin(), m_norm.end(), 0.0f);
+    for (size_t w = 0; w < m_postings.size(); ++w) {
+        const auto& list = m_postings[w];
+        if (list.empty()) continue;
+        m_idf[w] = float(std::log(double(m_documents) / double(list.size())));
+        for (const Posting& p : list) {
+            const float v = float(p.tf) * m_idf[w];
+            m_norm[p.slot] += v * v;
+        }
+    }
+    for (float& n : m_norm) n = n > 0.0f ? 1.0f / std::sqrt(n) : 0.0f;
+}
+
+std::vector<BowIndex::Hit> BowIndex::query(const quint32* words, int count, int maxHits) const {
+    std::vector<Hit> hits;
+    if (count <= 0 || m_documents == 0 || maxHits <= 0) return hits;
+
+    // Query TF-IDF vector (sparse)
+    std::vector<quint32> sorted(words, words + count);
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<std::pair<quint32, float>> q;
+    float qnorm = 0.0f;
+    for (size_t i = 0; i < sorted.size();) {
+        size_t j = i;
+        while (j < sorted.size() && sorted[j] == sorted[i]) ++j;
+        const quint32 w = sorted[i];
+        if (w < m_idf.size() && m_idf[w] > 0.0f) {
+            const float v = float(j - i) * m_idf[w];
+            q.push_back({w, v});
+            qnorm += v * v;
+        }
+        i = j;
+    }
+    if (q.empty()) return hits;
+    qnorm = 1.0f / std::sqrt(qnorm);
+
+    // Accumulate only over documents that share a word with the query
+    std::vector<float> scores(m_norm.size(), 0.0f);
+    std::vector<quint32> touched;
+    for (const auto& [w, qv] : q) {
+        const float wq = qv * qnorm * m_idf[w];
+        for (const Posting& p : m_postings[w]) {
+            if (scores[p.slot] == 0.0f) touched.push_back(p.slot);
+            scores[p.slot] += wq * float(p.tf);
+        }
+    }
+    hits.reserve(touched.size());
+    for (quint32 s : touched) hits.push_back({s, scores[s] * m_norm[s]});
+    const size_t keep = std::min(hits.size(), size_t(maxHits));
+    std::partial_sort(hits.begin(), hits.begin() + keep, hits.end(), [](const Hit& a, const Hit& b){ return a.score > b.score; });
+    hits.resize(keep);
+    return hits;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <QtCore>
+#include <vector>
+
+// Inverted file over visual words with TF-IDF weighting.
+// Documents are identified by slot; a query only touches the posting lists
+// of the words it contains and scores documents by cosine similarity.
+class BowIndex {
+public:
+    struct Hit { quint32 slot; float score; };
+
+    void clear();
+    void reset(int wordCount);
+    int documentCount() const { return m_documents; }
+
+    // words: one entry per descriptor (repeats are the term frequency)
+    void add(quint32 slot, const quint32* words, int count);
+    // Compute IDF and per-document norms; call after the last add()
+    void finalize();
+
+    std::vector<Hit> query(const quint32* words, int count, int maxHits) const;
+
+private:
+    struct Posting { quint32 slot; quint32 tf; };
+    std::vector<std::vector<Posting>> m_postings;   // by word
+    std::vector<float> m_idf;                       // by word
+    std::vector<float> m_norm;                      // by slot
+    int m_documents{0};
+};
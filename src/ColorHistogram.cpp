@@ -0,0 +1,118 @@
+#include "ColorHistogram.h"
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DIFFER_HIST_SSE2 1
+#endif
+
+namespace ColorHistogram {
+
+namespace {
+// OpenCV's fixed-point HSV tables (hsv_shift = 12)
+struct HsvTables {
+    int sdiv[256];
+    int hdiv[256];
+    HsvTables() {
+        sdiv[0] = hdiv[0] = 0;
+        for (int i = 1; i < 256; ++i) {
+            sdiv[i] = int(std::lround((255 << 12) / double(i)));
+            hdiv[i] = int(std::lround((180 << 12) / (6.0 * i)));
+        }
+    }
+};
+}
+
+QByteArray compute(const QImage& img) {
+    if (img.isNull()) return {};
+    static const HsvTables tables;
+    const QImage rgb = img.convertToFormat(QImage::Format_RGB32);
+    quint32 counts[kBins] = {};
+    for (int y = 0; y < rgb.height(); ++y) {
+        const QRgb* line = reinterpret_cast<const QRgb*>(rgb.constScanLine(y));
+        for (int x = 0; x < rgb.width(); ++x) {
+            const int r = qRed(line[x]), g = qGreen(line[x]), b = qBlue(line[x]);
+            const int v = std::max(r, std::max(g, b));
+            const int vmin = std::min(r, std::min(g, b));
+            const int diff = v - vmin;
+            const int s = (diff * tables.sdiv[v] + (1 << 11)) >> 12;
+            int h;
+            if (v == r) h = g - b;
+            else if (v == g) h = b - r + 2 * diff;
+            else h = r - g + 4 * diff;
+            h = (h * tables.hdiv[diff] + (1 << 11)) >> 12;
+            if (h < 0) h += 180;
+            const int hb = std::min(15, h * 16 / 180);
+            const int sb = s >> 4;
+            ++counts[hb * 16 + sb];
+        }
+    }
+    quint32 peak = 0;
+    for (quint32 c : counts) peak = std::max(peak, c);
+    QByteArray out(kBins, '\0');
+    if (peak == 0) return out;
+    for (int i = 0; i < kBins; ++i) out[i] = char(quint8((quint64(counts[i]) * 255 + peak / 2) / peak));
+    return out;
+}
+
+quint32 dot(const quint8* a, const quint8* b) {
+#ifdef DIFFER_HIST_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < kBins; i += 16) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        // 8 x (u16 * u16) pairwise sums into i32; 255*255*2 fits easily
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero)));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return quint32(_mm_cvtsi128_si32(acc));
+#else
+    quint32 s = 0;
+    for (int i = 0; i < kBins; ++i) s += quint32(a[i]) * b[i];
+    return s;
+#endif
+}
+
+quint32 intersection(const quint8* a, const quint8* b) {
+#ifdef DIFFER_HIST_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < kBins; i += 16) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        // Sum of absolute differences against zero adds the 16 minima into two u64 lanes
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_min_epu8(va, vb), zero));
+    }
+    return quint32(_mm_cvtsi128_si32(acc)) + quint32(_mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc)));
+#else
+    quint32 s = 0;
+    for (int i = 0; i < kBins; ++i) s += std::min(a[i], b[i]);
+    return s;
+#endif
+}
+
+void sums(const quint8* h, quint32* sum, quint32* sumSq) {
+    quint32 s = 0;
+    for (int i = 0; i < kBins; ++i) s += h[i];
+    *sum = s;
+    *sumSq = dot(h, h);
+}
+
+double correlation(quint32 dotAB, quint32 sumA, quint32 sumSqA, quint32 sumB, quint32 sumSqB) {
+    const double n = kBins;
+    const double num = n * double(dotAB) - double(sumA) * double(sumB);
+    const double den = (n * double(sumSqA) - double(sumA) * double(sumA)) * (n * double(sumSqB) - double(sumB) * double(sumB));
+    // Same convention as OpenCV for a flat histogram
+    return den > 0 ? num / std::sqrt(den) : 1.0;
+}
+
+double correlation(const quint8* a, const quint8* b) {
+    quint32 sa, qa, sb, qb;
+    sums(a, &sa, &qa);
+    sums(b, &sb, &qb);
+    return correlation(dot(a, b), sa, qa, sb, qb);
+}
+
+}
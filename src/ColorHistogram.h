@@ -0,0 +1,24 @@
+#pragma once
+#include <QtCore>
+#include <QtGui/QImage>
+
+// Hue/saturation histograms for the color term of the similarity score.
+// Binning matches OpenCV's 8-bit BGR2HSV + calcHist (16 hue x 16 saturation
+// bins over H 0..180, S 0..256), so no OpenCV is needed at index time. Bins
+// are stored as bytes scaled so the largest is 255; correlation is scale
+// invariant, so this only adds rounding error.
+namespace ColorHistogram {
+    constexpr int kBins = 256;
+
+    // kBins bytes; empty for a null image
+    QByteArray compute(const QImage& img);
+
+    // Sum of a[i]*b[i] and of min(a[i], b[i]) over kBins bytes (SSE2 when available)
+    quint32 dot(const quint8* a, const quint8* b);
+    quint32 intersection(const quint8* a, const quint8* b);
+
+    // Pearson correlation (OpenCV HISTCMP_CORREL) from the dot product and per-vector sums
+    double correlation(quint32 dotAB, quint32 sumA, quint32 sumSqA, quint32 sumB, quint32 sumSqB);
+    double correlation(const quint8* a, const quint8* b);
+    void sums(const quint8* h, quint32* sum, quint32* sumSq);
+}
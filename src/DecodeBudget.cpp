@@ -0,0 +1,139 @@
+#include "DecodeBudget.h"
+#include <QtGui/QImageIOHandler>
+#include <QtGui/QImageReader>
+#include <cmath>
+
+namespace DecodeBudget {
+
+namespace {
+Options g_options;
+QMutex g_mutex;
+QWaitCondition g_released;
+qint64 g_used = 0;
+
+qint64 budgetBytes() { return qint64(g_options.budgetMb) * 1024 * 1024; }
+
+int bytesPerPixel(const QImageReader& reader) {
+    const QImage::Format fmt = reader.imageFormat();
+    if (fmt == QImage::Format_Invalid) return 4;
+    return qMax(1, QImage::toPixelFormat(fmt).bitsPerPixel() / 8);
+}
+
+qint64 pixels(const QSize& s) { return qint64(s.width()) * s.height(); }
+
+// target scaled by factor (<= 1), keeping the aspect ratio
+QSize scaledBy(const QSize& target, double factor) {
+    return QSize(qMax(1, int(target.width() * factor)), qMax(1, int(target.height() * factor)));
+}
+}
+
+Options Options::fromSettings() {
+    Options o;
+    QSettings s;
+    o.budgetMb = qBound(128, s.value("decode/budgetMb", 2048).toInt(), 1 << 20);
+    o.waitMs = qBound(0, s.value("decode/waitMs", 2000).toInt(), 60000);
+    o.minSide = qBound(64, s.value("decode/minSide", 1024).toInt(), 16384);
+    return o;
+}
+
+void configure(const Options& opts) {
+    QMutexLocker lock(&g_mutex);
+    g_options = opts;
+    qInfo() << "Decode budget:" << opts.budgetMb << "MB";
+}
+
+qint64 capacity() {
+    QMutexLocker lock(&g_mutex);
+    return budgetBytes();
+}
+
+qint64 inUse() {
+    QMutexLocker lock(&g_mutex);
+    return g_used;
+}
+
+bool Lease::read(QImageReader& reader, QImage* out) {
+    release();
+    const QSize full = reader.size();
+    if (!full.isValid()) {
+        // Size unknown until decoded: charge afterwards so later decodes see it
+        const bool ok = reader.read(out);
+        if (ok) {
+            QMutexLocker lock(&g_mutex);
+            m_bytes = out->sizeInBytes();
+            g_used += m_bytes;
+        }
+        return ok;
+    }
+    QSize target = reader.scaledSize().isValid() ? reader.scaledSize() : full;
+    const bool scalable = reader.supportsOption(QImageIOHandler::ScaledSize);
+    const int bpp = bytesPerPixel(reader);
+    // Plugins that cannot scale while decoding hold the full image and the scaled copy
+    auto cost = [&](const QSize& t) {
+        qint64 c = pixels(t) * bpp;
+        if (!scalable && t != full) c += pixels(full) * bpp;
+        return c;
+    };
+    // Fits in free bytes when shrunk, without going below minSide
+    auto shrinkTo = [&](qint64 bytes) -> bool {
+        const double factor = std::sqrt(double(bytes) / double(pixels(target) * bpp));
+        const QSize smaller = scaledBy(target, factor);
+        if (qMax(smaller.width(), smaller.height()) < qMin(g_options.minSide, qMax(target.width(), target.height())))
+            return false;
+        target = smaller;
+        return true;
+    };
+
+    QMutexLocker lock(&g_mutex);
+    const qint64 cap = budgetBytes();
+    const QSize requested = target;
+    qint64 need = cost(target);
+    if (need > cap / 2 && scalable) {
+        shrinkTo(cap / 2);
+        need = cost(target);
+    }
+    // Anything still larger than the whole budget waits until it runs alone
+    need = qMin(need, cap);
+    const QCoreApplication* app = QCoreApplication::instance();
+    if (!app || QThread::currentThread() != app->thread()) {
+        QDeadlineTimer deadline(g_options.waitMs);
+        bool shrunk = !scalable;
+        while (g_used > 0 && g_used + need > cap) {
+            if (shrunk) {
+                g_released.wait(&g_mutex);
+            } else if (!g_released.wait(&g_mutex, deadline)) {
+                // Waited long enough: take what is free now at a lower resolution
+                shrunk = true;
+                const qint64 free = cap - g_used;
+                if (free > 0 && shrinkTo(free)) need = qMin(cost(target), cap);
+            }
+        }
+    }
+    g_used += need;
+    m_bytes = need;
+    lock.unlock();
+
+    if (target != requested) {
+        qInfo() << "Decode budget: reading" << reader.fileName() << "at" << target << "instead of" << requested;
+        reader.setScaledSize(target);
+    }
+    const bool ok = reader.read(out);
+    if (!ok) release();
+    return ok;
+}
+
+QImage Lease::read(QImageReader& reader) {
+    QImage img;
+    read(reader, &img);
+    return img;
+}
+
+void Lease::release() {
+    if (m_bytes == 0) return;
+    QMutexLocker lock(&g_mutex);
+    g_used -= m_bytes;
+    m_bytes = 0;
+    g_released.wakeAll();
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <QtCore>
+#include <QtGui/QImage>
+
+class QImageReader;
+
+// Process-wide budget for the pixels of images being decoded and processed.
+// QImageReader::setAllocationLimit bounds one image; this bounds all of them
+// together (indexer, thumbnail workers, search, previews, batch queries).
+// A decode is charged its estimated size before it starts and waits while the
+// budget is spent. A decode that would need more than half the budget, or that has
+// waited a while, is read at a smaller scaled size when the image plugin supports it.
+// The GUI thread never waits; its decodes are charged but may overdraw the budget.
+namespace DecodeBudget {
+    // QSettings group decode
+    struct Options {
+        int budgetMb{2048};
+        int waitMs{2000};        // wait before a scalable decode is shrunk to what is free
+        int minSide{1024};       // never shrink a decode below this longer side
+        static Options fromSettings();
+    };
+
+    // Call once at startup (otherwise defaults apply)
+    void configure(const Options& opts);
+    qint64 capacity();
+    qint64 inUse();
+
+    // Holds the charge of one decode until destroyed or released; keep it alive while
+    // the decoded image (and what is derived from it) is being processed
+    class Lease {
+    public:
+        Lease() = default;
+        ~Lease() { release(); }
+        Q_DISABLE_COPY(Lease)
+
+        // reader.read(out) within the budget; may lower reader's scaled size first
+        bool read(QImageReader& reader, QImage* out);
+        QImage read(QImageReader& reader);
+        void release();
+
+    private:
+        qint64 m_bytes{0};
+    };
+}
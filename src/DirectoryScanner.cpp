@@ -0,0 +1,175 @@
+#include "DirectoryScanner.h"
+#include <algorithm>
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_LINUX)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace DirectoryScanner {
+
+Options Options::fromSettings() {
+    Options o;
+    QSettings s;
+    o.inodeOrder = s.value("scan/inodeOrder", false).toBool();
+    o.readahead = qBound(0, s.value("scan/readahead", 4).toInt(), 64);
+    return o;
+}
+
+namespace {
+QString join(const QString& dir, const QString& name, QChar sep) {
+    return dir.endsWith(sep) ? dir + name : dir + sep + name;
+}
+
+void finishDirectory(std::vector<Entry>& files, const Options& opts) {
+    if (opts.inodeOrder)
+        std::sort(files.begin(), files.end(), [](const Entry& a, const Entry& b){ return a.inode < b.inode; });
+}
+
+#if defined(Q_OS_WIN)
+// 100 ns ticks since 1601 -> seconds since 1970
+qint64 fileTimeToSecs(const FILETIME& ft) {
+    const quint64 ticks = (quint64(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+    return qint64(ticks / 10000000ULL) - 11644473600LL;
+}
+
+void walk(const QString& root, const Options& opts, const std::function<bool(const QString&)>& accept,
+          const std::function<bool(std::vector<Entry>&)>& sink) {
+    QStringList pending{root};
+    std::vector<Entry> files;
+    while (!pending.isEmpty()) {
+        const QString dir = pending.takeLast();
+        const QString pattern = join(dir, QStringLiteral("*"), QLatin1Char('\\'));
+        WIN32_FIND_DATAW fd;
+        HANDLE h = FindFirstFileExW(reinterpret_cast<const wchar_t*>(pattern.utf16()), FindExInfoBasic, &fd,
+                                    FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+        if (h == INVALID_HANDLE_VALUE) continue;
+        QStringList subdirs;
+        do {
+            const QString name = QString::fromWCharArray(fd.cFileName);
+            if (name == QLatin1String(".") || name == QLatin1String("..")) continue;
+            if (fd.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)) continue;
+            const QString path = join(dir, name, QLatin1Char('\\'));
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) subdirs.push_back(path);
+            } else if (accept(name)) {
+                files.push_back({path, qint64((quint64(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow), fileTimeToSecs(fd.ftLastWriteTime), 0});
+            }
+        } while (FindNextFileW(h, &fd));
+        FindClose(h);
+        // Depth first, in listing order
+        std::reverse(subdirs.begin(), subdirs.end());
+        pending += subdirs;
+        if (files.empty()) continue;
+        finishDirectory(files, opts);
+        if (!sink(files)) return;
+        files.clear();
+    }
+}
+#elif defined(Q_OS_LINUX)
+void walk(const QString& root, const Options& opts, const std::function<bool(const QString&)>& accept,
+          const std::function<bool(std::vector<Entry>&)>& sink) {
+    QStringList pending{root};
+    std::vector<Entry> files;
+    while (!pending.isEmpty()) {
+        const QString dir = pending.takeLast();
+        DIR* d = opendir(QFile::encodeName(dir).constData());
+        if (!d) continue;
+        const int dfd = dirfd(d);
+        QStringList subdirs;
+        while (const dirent* de = readdir(d)) {
+            if (de->d_name[0] == '.') continue;   // ".", ".." and hidden entries
+            const QString name = QFile::decodeName(de->d_name);
+            const bool maybeDir = de->d_type == DT_DIR || de->d_type == DT_UNKNOWN;
+            const bool maybeFile = de->d_type == DT_REG || de->d_type == DT_LNK || de->d_type == DT_UNKNOWN;
+            if (de->d_type == DT_DIR) {
+                subdirs.push_back(join(dir, name, QLatin1Char('/')));
+                continue;
+            }
+            // Only entries that can be images cost a stat, and that one is relative to the open directory
+            if (!maybeFile || (!maybeDir && !accept(name))) continue;
+#if defined(STATX_SIZE)
+            struct statx st;
+            if (statx(dfd, de->d_name, AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO, &st) != 0) continue;
+            const mode_t mode = st.stx_mode;
+            const qint64 size = qint64(st.stx_size), mtime = qint64(st.stx_mtime.tv_sec);
+            const quint64 inode = st.stx_ino;
+#else
+            struct stat st;
+            if (fstatat(dfd, de->d_name, &st, 0) != 0) continue;
+            const mode_t mode = st.st_mode;
+            const qint64 size = qint64(st.st_size), mtime = qint64(st.st_mtime);
+            const quint64 inode = st.st_ino;
+#endif
+            if (S_ISDIR(mode)) {
+                // Unknown type turned out to be a directory; symlinked directories are not followed
+                if (de->d_type == DT_UNKNOWN) {
+                    struct stat lst;
+                    if (fstatat(dfd, de->d_name, &lst, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(lst.st_mode))
+                        subdirs.push_back(join(dir, name, QLatin1Char('/')));
+                }
+                continue;
+            }
+            if (S_ISREG(mode) && accept(name)) files.push_back({join(dir, name, QLatin1Char('/')), size, mtime, inode});
+        }
+        closedir(d);
+        std::reverse(subdirs.begin(), subdirs.end());
+        pending += subdirs;
+        if (files.empty()) continue;
+        finishDirectory(files, opts);
+        if (!sink(files)) return;
+        files.clear();
+    }
+}
+#else
+// Portable fallback: QDirIterator caches the stat it does for filtering
+void walk(const QString& root, const Options& opts, const std::function<bool(const QString&)>& accept,
+          const std::function<bool(std::vector<Entry>&)>& sink) {
+    std::vector<Entry> files;
+    QString currentDir;
+    QDirIterator it(root, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo fi = it.fileInfo();
+        if (fi.absolutePath() != currentDir && !files.empty()) {
+            finishDirectory(files, opts);
+            if (!sink(files)) return;
+            files.clear();
+        }
+        currentDir = fi.absolutePath();
+        if (!accept(fi.fileName())) continue;
+        files.push_back({fi.absoluteFilePath(), fi.size(), fi.lastModified().toSecsSinceEpoch(), 0});
+    }
+    if (!files.empty()) {
+        finishDirectory(files, opts);
+        sink(files);
+    }
+}
+#endif
+}
+
+void scan(const QString& root, const Options& opts, const std::function<bool(const QString& name)>& accept,
+          const std::function<bool(std::vector<Entry>& files)>& sink) {
+    const QString base = QDir::toNativeSeparators(QDir::cleanPath(QDir(root).absolutePath()));
+    walk(base, opts, accept, [&sink](std::vector<Entry>& files){
+        for (Entry& f : files) f.path = QDir::toNativeSeparators(f.path);
+        return sink(files);
+    });
+}
+
+void prefetch(const QString& path) {
+#if defined(Q_OS_LINUX)
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    // Asynchronous: queues readahead of the whole file and returns
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    ::close(fd);
+#else
+    Q_UNUSED(path);
+#endif
+}
+
+}
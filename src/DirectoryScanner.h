@@ -0,0 +1,33 @@
+#pragma once
+#include <QtCore>
+#include <functional>
+#include <vector>
+
+// Streaming recursive directory walk for the indexer.
+// Size and mtime come from the enumeration itself (FindFirstFileEx on Windows,
+// statx relative to the open directory on Linux) instead of a full path stat
+// per file, and each directory's files are handed over as soon as it has been
+// read, so indexing starts before the walk finishes. Hidden entries and
+// directory symlinks are skipped, like QDirIterator with QDir::Files.
+namespace DirectoryScanner {
+    struct Entry {
+        QString path;       // absolute, native separators
+        qint64 size{0};
+        qint64 mtime{0};    // seconds since epoch
+        quint64 inode{0};   // 0 where the platform does not report one
+    };
+
+    // QSettings group scan
+    struct Options {
+        bool inodeOrder{false};   // read each directory's files by inode, roughly disk order on HDDs
+        int readahead{4};         // files to ask the OS to prefetch ahead of the decoder, 0 = off
+        static Options fromSettings();
+    };
+
+    // sink gets the accepted files of one directory at a time; returning false stops the walk
+    void scan(const QString& root, const Options& opts, const std::function<bool(const QString& name)>& accept,
+              const std::function<bool(std::vector<Entry>& files)>& sink);
+
+    // Start reading path into the page cache in the background (posix_fadvise; no-op elsewhere)
+    void prefetch(const QString& path);
+}
@@ -0,0 +1,293 @@
+#include "EmbeddingModel.h"
+#include "HnswIndex.h"
+#include "SqliteStore.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#ifdef HAVE_OPENCV
+#include <opencv2/opencv_modules.hpp>
+#endif
+#ifdef HAVE_OPENCV_DNN
+#include <opencv2/dnn.hpp>
+#endif
+
+namespace EmbeddingModel {
+
+namespace {
+// pack() layout: format, 3 reserved bytes, dim, scale, then the values
+constexpr int kHeaderBytes = 12;
+constexpr quint8 kFloat32 = 0;
+constexpr quint8 kInt8 = 1;
+}
+
+Options Options::fromSettings() {
+    Options o;
+    QSettings s;
+    o.modelPath = s.value("embedding/modelPath").toString();
+    o.inputSize = qBound(32, s.value("embedding/inputSize", 224).toInt(), 1024);
+    o.batch = qBound(1, s.value("embedding/batch", 16).toInt(), 256);
+    o.quantize = s.value("embedding/quantize", true).toBool();
+    o.efSearch = qBound(8, s.value("embedding/efSearch", 64).toInt(), 4096);
+    o.M = qBound(4, s.value("embedding/M", 16).toInt(), 64);
+    o.efConstruction = qBound(16, s.value("embedding/efConstruction", 100).toInt(), 2000);
+    return o;
+}
+
+qint64 Options::modelId() const {
+    const QFileInfo fi(modelPath);
+    if (modelPath.isEmpty() || !fi.isFile()) return 0;
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(fi.absoluteFilePath().toUtf8());
+    hash.addData(QByteArray::number(fi.size()));
+    hash.addData(QByteArray::number(fi.lastModified().toMSecsSinceEpoch()));
+    hash.addData(QByteArray::number(inputSize));
+    qint64 id = 0;
+    std::memcpy(&id, hash.result().constData(), sizeof(id));
+    return id & std::numeric_limits<qint64>::max();
+}
+
+#ifdef HAVE_OPENCV_DNN
+struct Extractor::Net {
+    cv::dnn::Net net;
+};
+#else
+struct Extractor::Net {};
+#endif
+
+Extractor::Extractor(const Options& opts) : m_opts(opts) {
+    if (!opts.enabled()) return;
+#ifdef HAVE_OPENCV_DNN
+    // Read through QFile: OpenCV takes narrow paths, which break on non-ASCII names on Windows
+    QFile file(opts.modelPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot open embedding model" << opts.modelPath << file.errorString();
+        return;
+    }
+    const QByteArray bytes = file.readAll();
+    QElapsedTimer timer;
+    timer.start();
+    try {
+        auto net = std::make_unique<Net>();
+        net->net = cv::dnn::readNetFromONNX(bytes.constData(), size_t(bytes.size()));
+        net->net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+        net->net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+        if (!net->net.empty()) m_net = std::move(net);
+    } catch (const cv::Exception& e) {
+        qWarning() << "Cannot load embedding model" << opts.modelPath << e.what();
+    }
+    if (m_net) qInfo() << "Embedding model loaded:" << opts.modelPath << timer.elapsed() << "ms";
+#else
+    qWarning() << "Embedding model ignored: OpenCV was built without the dnn module";
+#endif
+}
+
+Extractor::~Extractor() = default;
+
+bool Extractor::isValid() const { return m_net != nullptr; }
+
+QImage Extractor::prepare(const QImage& image) const {
+    if (image.isNull()) return {};
+    const int side = m_opts.inputSize;
+    const QImage scaled = image.scaled(side, side, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+    const QRect crop((scaled.width() - side) / 2, (scaled.height() - side) / 2, side, side);
+    return scaled.copy(crop).convertToFormat(QImage::Format_RGB888);
+}
+
+std::vector<std::vector<float>> Extractor::embed(const QList<QImage>& prepared) {
+    std::vector<std::vector<float>> out(prepared.size());
+#ifdef HAVE_OPENCV_DNN
+    if (!m_net) return {};
+    const int side = m_opts.inputSize;
+    std::vector<cv::Mat> mats;
+    std::vector<int> which;
+    for (int i = 0; i < prepared.size(); ++i) {
+        const QImage& img = prepared[i];
+        if (img.isNull() || img.width() != side || img.height() != side || img.format() != QImage::Format_RGB888) continue;
+        mats.emplace_back(side, side, CV_8UC3, const_cast<uchar*>(img.constBits()), size_t(img.bytesPerLine()));
+        which.push_back(i);
+    }
+    if (mats.empty()) return out;
+
+    try {
+        // NCHW in [0, 1], then the ImageNet mean/std most exported encoders expect
+        cv::Mat blob = cv::dnn::blobFromImages(mats, 1.0 / 255.0, cv::Size(side, side), cv::Scalar(), false, false, CV_32F);
+        static const float kMean[3] = {0.485f, 0.456f, 0.406f};
+        static const float kStd[3] = {0.229f, 0.224f, 0.225f};
+        const int plane = side * side;
+        for (int n = 0; n < int(mats.size()); ++n) {
+            for (int c = 0; c < 3; ++c) {
+                float* p = blob.ptr<float>(n, c);
+                for (int k = 0; k < plane; ++k) p[k] = (p[k] - kMean[c]) / kStd[c];
+            }
+        }
+        m_net->net.setInput(blob);
+        cv::Mat result = m_net->net.forward();
+        if (result.type() != CV_32F) result.convertTo(result, CV_32F);
+        if (result.dims < 2 || result.size[0] != int(mats.size())) {
+            qWarning() << "Unexpected embedding output shape, dims" << result.dims;
+            return {};
+        }
+
+        // N x D as is, N x T x D takes the class token, N x C x H x W is averaged over H x W
+        for (int n = 0; n < int(mats.size()); ++n) {
+            std::vector<float>& v = out[which[n]];
+            if (result.dims == 2 || result.dims == 3) {
+                const int dim = result.size[result.dims - 1];
+                const float* p = result.ptr<float>(n);
+                v.assign(p, p + dim);
+            } else if (result.dims == 4) {
+                const int channels = result.size[1];
+                const int area = result.size[2] * result.size[3];
+                v.resize(channels);
+                for (int c = 0; c < channels; ++c) {
+                    const float* p = result.ptr<float>(n, c);
+                    double sum = 0;
+                    for (int k = 0; k < area; ++k) sum += p[k];
+                    v[c] = float(sum / qMax(1, area));
+                }
+            } else {
+                qWarning() << "Unexpected embedding output shape, dims" << result.dims;
+                return {};
+            }
+            double norm = 0;
+            for (float x : v) norm += double(x) * x;
+            norm = std::sqrt(norm);
+            if (norm > 0) for (float& x : v) x = float(x / norm);
+        }
+    } catch (const cv::Exception& e) {
+        qWarning() << "Embedding forward pass failed:" << e.what();
+        return {};
+    }
+#else
+    Q_UNUSED(prepared);
+    return {};
+#endif
+    return out;
+}
+
+Batch::Batch(SqliteStore& store, const Options& opts) : m_store(store), m_extractor(opts) {
+    if (!m_extractor.isValid()) return;
+    const qint64 model = opts.modelId();
+    if (store.embeddingModel() != model && store.resetEmbeddings(model))
+        qInfo() << "Embedding model changed, stored vectors discarded";
+}
+
+bool Batch::add(qint64 id, const QImage& image) {
+    if (!isValid() || image.isNull()) return false;
+    m_ids.push_back(id);
+    m_images.push_back(m_extractor.prepare(image));
+    return m_ids.size() >= m_extractor.options().batch;
+}
+
+int Batch::flush() {
+    if (m_ids.isEmpty()) return 0;
+    const auto vectors = m_extractor.embed(m_images);
+    int written = 0;
+    for (size_t i = 0; i < vectors.size(); ++i) {
+        if (vectors[i].empty()) continue;
+        if (m_store.upsertEmbedding(m_ids[int(i)], pack(vectors[i], m_extractor.options().quantize))) ++written;
+    }
+    m_ids.clear();
+    m_images.clear();
+    return written;
+}
+
+void quantize(const float* v, int dim, std::vector<qint8>& codes, float* scale) {
+    float maxAbs = 0;
+    for (int i = 0; i < dim; ++i) maxAbs = std::max(maxAbs, std::abs(v[i]));
+    *scale = maxAbs > 0 ? maxAbs / 127.0f : 1.0f;
+    codes.resize(dim);
+    for (int i = 0; i < dim; ++i) codes[i] = qint8(qBound(-127, int(std::lround(v[i] / *scale)), 127));
+}
+
+QByteArray pack(const std::vector<float>& v, bool quantize) {
+    const quint32 dim = quint32(v.size());
+    const quint8 format = quantize ? kInt8 : kFloat32;
+    float scale = 1.0f;
+    QByteArray blob(kHeaderBytes + qsizetype(dim) * (quantize ? 1 : int(sizeof(float))), '\0');
+    char* p = blob.data();
+    if (quantize) {
+        std::vector<qint8> codes;
+        EmbeddingModel::quantize(v.data(), int(dim), codes, &scale);
+        std::memcpy(p + kHeaderBytes, codes.data(), dim);
+    } else {
+        std::memcpy(p + kHeaderBytes, v.data(), dim * sizeof(float));
+    }
+    p[0] = char(format);
+    std::memcpy(p + 4, &dim, sizeof(dim));
+    std::memcpy(p + 8, &scale, sizeof(scale));
+    return blob;
+}
+
+bool unpack(const QByteArray& blob, std::vector<qint8>& codes, float* scale) {
+    if (blob.size() < kHeaderBytes) return false;
+    const char* p = blob.constData();
+    const quint8 format = quint8(p[0]);
+    quint32 dim = 0;
+    std::memcpy(&dim, p + 4, sizeof(dim));
+    std::memcpy(scale, p + 8, sizeof(float));
+    if (dim == 0) return false;
+    if (format == kInt8 && blob.size() == kHeaderBytes + qsizetype(dim)) {
+        codes.resize(dim);
+        std::memcpy(codes.data(), p + kHeaderBytes, dim);
+        return *scale > 0;
+    }
+    if (format == kFloat32 && blob.size() == kHeaderBytes + qsizetype(dim) * qsizetype(sizeof(float))) {
+        std::vector<float> v(dim);
+        std::memcpy(v.data(), p + kHeaderBytes, dim * sizeof(float));
+        quantize(v.data(), int(dim), codes, scale);
+        return true;
+    }
+    return false;
+}
+
+bool syncIndex(SqliteStore& store, const Options& opts, HnswIndex& index, const QString& file) {
+    QElapsedTimer timer;
+    timer.start();
+    if (index.isEmpty() && index.removedCount() == 0 && QFileInfo::exists(file)) index.load(file);
+    const HnswIndex::Params params{opts.M, opts.efConstruction};
+
+    QSet<qint64> seen;
+    int added = 0, dropped = 0, skipped = 0;
+    std::vector<qint8> codes;
+    float scale = 0;
+    store.forEachEmbedding([&](qint64 id, const QByteArray& blob) {
+        if (!unpack(blob, codes, &scale)) {
+            ++skipped;
+            return;
+        }
+        if (index.dim() != int(codes.size())) {
+            // A loaded graph of another model; rows of mixed sizes only survive a crash mid-reset
+            if (!seen.isEmpty()) {
+                ++skipped;
+                return;
+            }
+            dropped += index.size();
+            index.reset(int(codes.size()), params);
+        }
+        seen.insert(id);
+        float have = 0;
+        const qint8* old = index.codes(id, &have);
+        if (old && have == scale && std::memcmp(old, codes.data(), codes.size()) == 0) return;
+        if (old) ++dropped;
+        index.insert(id, codes.data(), scale);
+        ++added;
+    });
+
+    for (qint64 id : index.ids()) {
+        if (seen.contains(id)) continue;
+        index.remove(id);
+        ++dropped;
+    }
+    const bool compacted = index.removedCount() > 0 && index.removedCount() > index.size() / 4;
+    if (compacted) index.compact();
+    if (added || dropped || compacted) {
+        if (!index.save(file)) qWarning() << "Cannot save embedding index" << file;
+        qInfo() << "Embedding index" << file << ":" << index.size() << "vectors," << added << "added,"
+                << dropped << "dropped," << skipped << "skipped," << index.memoryUsage() / 1024 << "KB,"
+                << timer.elapsed() << "ms";
+    }
+    return !index.isEmpty();
+}
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <QtCore>
+#include <QtGui/QImage>
+#include <memory>
+#include <vector>
+
+class HnswIndex;
+class SqliteStore;
+
+// Optional neural image embeddings: a locally supplied ONNX model (e.g. a DINOv2 or
+// CLIP image encoder exported to ONNX) run with OpenCV's dnn module on the CPU.
+// Vectors are L2-normalized, stored per image in the shard database and searched
+// through an HnswIndex persisted next to it. Without a model nothing changes.
+namespace EmbeddingModel {
+    // QSettings group embedding
+    struct Options {
+        QString modelPath;        // .onnx file; empty disables embeddings
+        int inputSize{224};       // square network input; images are resized and center-cropped
+        int batch{16};            // images per forward pass while indexing
+        bool quantize{true};      // int8 vectors in the database instead of float32 (the index is int8 either way)
+        int efSearch{64};         // HNSW search breadth; larger is slower and more exact
+        int M{16};
+        int efConstruction{100};
+        static Options fromSettings();
+        bool enabled() const { return !modelPath.isEmpty(); }
+        // Identifies the model file (path, size, mtime); vectors of another model are discarded
+        qint64 modelId() const;
+    };
+
+    // One network; not thread-safe, each user keeps its own
+    class Extractor {
+    public:
+        explicit Extractor(const Options& opts);
+        ~Extractor();
+        Q_DISABLE_COPY(Extractor)
+
+        bool isValid() const;
+        const Options& options() const { return m_opts; }
+        // Input-sized RGB copy (short side scaled, center crop), so pending batches stay small
+        QImage prepare(const QImage& image) const;
+        // One unit vector per image (empty where the image was null); empty on failure
+        std::vector<std::vector<float>> embed(const QList<QImage>& prepared);
+
+    private:
+        struct Net;
+        Options m_opts;
+        std::unique_ptr<Net> m_net;
+    };
+
+    // Images waiting for one forward pass, and the writer that runs it: the indexer and the
+    // thumbnail backfill embed the feature-level thumbnail in batches of Options::batch
+    class Batch {
+    public:
+        // Loads the model; vectors of another model are deleted from store first
+        Batch(SqliteStore& store, const Options& opts);
+        bool isValid() const { return m_extractor.isValid(); }
+        // Queues an input-sized copy; true when a batch is full and flush() is due
+        bool add(qint64 id, const QImage& image);
+        // Embeds and writes the queued images (the caller owns the transaction); returns vectors written
+        int flush();
+        int pending() const { return int(m_ids.size()); }
+
+    private:
+        SqliteStore& m_store;
+        Extractor m_extractor;
+        QList<qint64> m_ids;
+        QList<QImage> m_images;
+    };
+
+    // int8 codes with one scale (value = code * scale)
+    void quantize(const float* v, int dim, std::vector<qint8>& codes, float* scale);
+    // Database blob: quint8 format (0 float32, 1 int8), quint32 dim, float scale, values
+    QByteArray pack(const std::vector<float>& v, bool quantize);
+    bool unpack(const QByteArray& blob, std::vector<qint8>& codes, float* scale);
+
+    // Graph file of a shard directory
+    inline QString indexPath(const QString& shardDir) { return shardDir + QLatin1String("/embeddings.hnsw"); }
+    // Bring index in line with the embeddings table: load file when index is empty, drop
+    // nodes whose rows are gone or changed, add new rows, compact when many nodes are
+    // removed, and save file when anything changed. False if the table has no vectors.
+    bool syncIndex(SqliteStore& store, const Options& opts, HnswIndex& index, const QString& file);
+}
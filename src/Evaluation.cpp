@@ -0,0 +1,394 @@
+#include "Evaluation.h"
+#include "HistogramIndex.h"
+#include "HnswIndex.h"
+#include "ImageIndex.h"
+#include "NeighborGraph.h"
+#include "OrbFeatures.h"
+#include "SignalFusion.h"
+#include "SqliteStore.h"
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#ifdef HAVE_OPENCV
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#endif
+#include <QtGui/QImageReader>
+
+namespace Evaluation {
+
+bool run(const ImageIndex& index, SqliteStore& store, const Options& opts, QTextStream& out) {
+#ifndef HAVE_OPENCV
+    Q_UNUSED(index);
+    Q_UNUSED(store);
+    Q_UNUSED(opts);
+    out << "Evaluation needs OpenCV for the ORB ground truth\n";
+    return false;
+#else
+    const int n = index.size();
+    if (n < 2) { out << "Library is empty\n"; return false; }
+
+    // Rankers: every signal alone, then the configured fusion
+    struct Ranker { QString name; SignalFusion::Weights weights; };
+    QList<Ranker> rankers;
+    for (int s = 0; s < SignalFusion::SignalCount; ++s)
+        rankers.push_back({QString::fromLatin1(SignalFusion::signalName(s)), SignalFusion::Weights::only(s)});
+    rankers.push_back({QStringLiteral("fusion"), SignalFusion::Weights::fromSettings()});
+
+    // Random queries that have cached descriptors
+    std::mt19937 rng(opts.seed);
+    std::vector<int> order(size_t(n));
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+    QList<int> querySlots;
+    QHash<qint64, cv::Mat> descs;
+    for (size_t i = 0; i < order.size() && querySlots.size() < opts.queries; i += 256) {
+        QList<qint64> ids;
+        for (size_t j = i; j < std::min(order.size(), i + 256); ++j) ids.push_back(index.id(order[j]));
+        const auto blobs = store.loadDescriptors(ids);
+        for (size_t j = i; j < std::min(order.size(), i + 256) && querySlots.size() < opts.queries; ++j) {
+            const auto it = blobs.constFind(index.id(order[j]));
+            if (it == blobs.constEnd() || it.value().isEmpty()) continue;
+            descs.insert(it.key(), OrbFeatures::unpack(it.value()));
+            querySlots.push_back(order[j]);
+        }
+    }
+    if (querySlots.isEmpty()) { out << "No cached ORB descriptors; index with OpenCV first\n"; return false; }
+
+    const int maxCut = *std::max_element(opts.cutoffs.begin(), opts.cutoffs.end());
+    const int depth = qMax(opts.poolDepth, maxCut);
+    // Per ranker and cutoff: summed precision, summed recall, queries with any relevant result
+    std::vector<std::vector<double>> precision(rankers.size(), std::vector<double>(opts.cutoffs.size(), 0.0));
+    std::vector<std::vector<double>> recall = precision;
+    std::vector<double> rankNs(rankers.size(), 0.0);
+    int recallQueries = 0;
+    qint64 relevantTotal = 0;
+
+    for (int q : querySlots) {
+        const auto sig = SignalFusion::Signature::fromIndex(index, q);
+        std::vector<std::vector<SignalFusion::Hit>> lists;
+        QSet<int> pool;
+        for (int r = 0; r < rankers.size(); ++r) {
+            QElapsedTimer t;
+            t.start();
+            lists.push_back(SignalFusion::rank(index, sig, rankers[r].weights, depth, q));
+            rankNs[r] += double(t.nsecsElapsed());
+            for (const auto& h : lists.back()) pool.insert(h.slot);
+        }
+
+        // Ground truth over the pool, descriptors loaded in one go
+        QList<qint64> missing;
+        for (int s : pool) if (!descs.contains(index.id(s))) missing.push_back(index.id(s));
+        for (int i = 0; i < missing.size(); i += 1000) {
+            const auto blobs = store.loadDescriptors(missing.mid(i, 1000));
+            for (auto it = blobs.constBegin(); it != blobs.constEnd(); ++it) descs.insert(it.key(), OrbFeatures::unpack(it.value()));
+        }
+        const cv::Mat qdesc = descs.value(index.id(q));
+        std::vector<int> poolSlots(pool.begin(), pool.end());
+        std::vector<char> relevant(poolSlots.size(), 0);
+        TaskScheduler::blockingMap(TaskScheduler::Priority::Interactive, poolSlots, [&](int& slot) {
+            const cv::Mat c = descs.value(index.id(slot));
+            if (qdesc.empty() || c.empty()) return;
+            const double score = double(OrbFeatures::goodMatches(qdesc, c)) / double(qdesc.rows);
+            relevant[size_t(&slot - poolSlots.data())] = score >= opts.orbThreshold;
+        });
+        QSet<int> truth;
+        for (size_t i = 0; i < poolSlots.size(); ++i) if (relevant[i]) truth.insert(poolSlots[i]);
+        relevantTotal += truth.size();
+        if (!truth.isEmpty()) ++recallQueries;
+
+        for (int r = 0; r < rankers.size(); ++r) {
+            for (int c = 0; c < opts.cutoffs.size(); ++c) {
+                const int k = opts.cutoffs[c];
+                int hits = 0;
+                for (int i = 0; i < k && i < int(lists[r].size()); ++i) hits += truth.contains(lists[r][i].slot);
+                precision[r][c] += double(hits) / k;
+                if (!truth.isEmpty()) recall[r][c] += double(hits) / truth.size();
+            }
+        }
+    }
+
+    const int nq = querySlots.size();
+    out << QString("%1 queries over %2 images, ORB threshold %3, pool depth %4, %5 relevant pairs\n")
+               .arg(nq).arg(n).arg(opts.orbThreshold).arg(depth).arg(relevantTotal);
+    out << QString("%1").arg("ranker", -10);
+    for (int k : opts.cutoffs) out << QString("%1%2").arg(QString("P@%1").arg(k), 9).arg(QString("R@%1").arg(k), 9);
+    out << QString("%1\n").arg("ms/query", 11);
+    for (int r = 0; r < rankers.size(); ++r) {
+        out << QString("%1").arg(rankers[r].name, -10);
+        for (int c = 0; c < opts.cutoffs.size(); ++c) {
+            out << QString("%1").arg(precision[r][c] / nq, 9, 'f', 3)
+                << QString("%1").arg(recallQueries ? recall[r][c] / recallQueries : 0.0, 9, 'f', 3);
+        }
+        out << QString("%1\n").arg(rankNs[r] / nq / 1e6, 11, 'f', 2);
+    }
+    out.flush();
+    return true;
+#endif
+}
+
+bool histogramAccuracy(const ImageIndex& index, SqliteStore& store, const QString& thumbDir,
+                       const ThumbnailPyramid::Options& thumbOpts, const Options& opts, QTextStream& out) {
+#ifndef HAVE_OPENCV
+    Q_UNUSED(index);
+    Q_UNUSED(store);
+    Q_UNUSED(thumbDir);
+    Q_UNUSED(thumbOpts);
+    Q_UNUSED(opts);
+    return false;
+#else
+    constexpr int kSample = 1000;
+    HistogramIndex hists;
+    store.forEachHistogram([&](qint64 id, const QByteArray& hist){
+        const int slot = index.slotForId(id);
+        if (slot >= 0 && hist.size() == ColorHistogram::kBins) hists.set(slot, reinterpret_cast<const quint8*>(hist.constData()));
+    });
+    std::vector<int> sample;
+    for (int s = 0; s < index.size(); ++s) if (hists.has(s)) sample.push_back(s);
+    if (sample.size() < 2) { out << "No stored color histograms; reindex to compare them\n"; return false; }
+    std::mt19937 rng(opts.seed);
+    std::shuffle(sample.begin(), sample.end(), rng);
+    if (sample.size() > size_t(kSample)) sample.resize(kSample);
+
+    // The float path as searchSimilar had it: HSV 16x16 calcHist of the decoded thumbnail, L1 normalized
+    const int level = thumbOpts.pickSize(256);
+    std::vector<cv::Mat> floats(sample.size());
+    TaskScheduler::blockingMap(TaskScheduler::Priority::Interactive, sample, [&](int& slot) {
+        const QString thumb = ThumbnailPyramid::thumbPath(thumbDir, index.path(slot), level, thumbOpts);
+        QImageReader r(thumb);
+        const cv::Mat bgr = OrbFeatures::toBgrMat(r.read());
+        if (bgr.empty()) return;
+        cv::Mat hsv; cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+        int histSize[] = {16, 16};
+        float hr[] = {0, 180}; float sr[] = {0, 256}; const float* ranges[] = {hr, sr};
+        int channels[] = {0, 1};
+        cv::Mat h;
+        cv::calcHist(&hsv, 1, channels, cv::Mat(), h, 2, histSize, ranges, true, false);
+        cv::normalize(h, h, 1, 0, cv::NORM_L1);
+        floats[size_t(&slot - sample.data())] = h;
+    });
+    std::vector<int> slots;
+    std::vector<cv::Mat> floatHists;
+    for (size_t i = 0; i < sample.size(); ++i) {
+        if (floats[i].empty()) continue;
+        slots.push_back(sample[i]);
+        floatHists.push_back(floats[i]);
+    }
+    const int m = int(slots.size());
+    if (m < 2) { out << "Thumbnails for the histogram comparison could not be read\n"; return false; }
+
+    const int nq = qMin(opts.queries, m);
+    double errSum = 0.0, errMax = 0.0;
+    qint64 pairs = 0;
+    double floatNs = 0.0, quantNs = 0.0;
+    std::vector<double> overlap(opts.cutoffs.size(), 0.0);
+    std::vector<double> fc(size_t(m)), qc(size_t(m));
+    for (int q = 0; q < nq; ++q) {
+        const auto probe = HistogramIndex::probe(QByteArray(reinterpret_cast<const char*>(hists.at(slots[q])), ColorHistogram::kBins));
+        QElapsedTimer t;
+        t.start();
+        for (int c = 0; c < m; ++c) fc[size_t(c)] = cv::compareHist(floatHists[q], floatHists[c], cv::HISTCMP_CORREL);
+        floatNs += double(t.nsecsElapsed());
+        t.restart();
+        for (int c = 0; c < m; ++c) qc[size_t(c)] = hists.correlation(probe, slots[c]);
+        quantNs += double(t.nsecsElapsed());
+        for (int c = 0; c < m; ++c) {
+            if (c == q) continue;
+            const double err = std::abs(fc[size_t(c)] - qc[size_t(c)]);
+            errSum += err;
+            errMax = std::max(errMax, err);
+            ++pairs;
+        }
+        // Same ranking? Overlap of the top k by each correlation, the query itself excluded
+        auto topK = [&](const std::vector<double>& score, int k) {
+            std::vector<int> idx;
+            for (int c = 0; c < m; ++c) if (c != q) idx.push_back(c);
+            k = qMin(k, int(idx.size()));
+            std::partial_sort(idx.begin(), idx.begin() + k, idx.end(), [&score](int a, int b){
+                return score[size_t(a)] != score[size_t(b)] ? score[size_t(a)] > score[size_t(b)] : a < b;
+            });
+            return QSet<int>(idx.begin(), idx.begin() + k);
+        };
+        for (int c = 0; c < opts.cutoffs.size(); ++c) {
+            const int k = qMin(opts.cutoffs[c], m - 1);
+            if (k > 0) overlap[size_t(c)] += double(topK(fc, k).intersect(topK(qc, k)).size()) / k;
+        }
+    }
+
+    out << QString("\nColor histograms: 8-bit stored vs float on %1 thumbnails, %2 queries\n").arg(m).arg(nq);
+    out << QString("correlation error: mean %1, max %2 (similarity term is 0.15x this)\n")
+               .arg(errSum / qMax<qint64>(1, pairs), 0, 'f', 4).arg(errMax, 0, 'f', 4);
+    for (int c = 0; c < opts.cutoffs.size(); ++c)
+        out << QString("top-%1 overlap: %2\n").arg(opts.cutoffs[c]).arg(overlap[size_t(c)] / nq, 0, 'f', 3);
+    const double comparisons = double(nq) * m;
+    out << QString("ns/comparison: float %1, 8-bit %2\n")
+               .arg(floatNs / comparisons, 0, 'f', 1).arg(quantNs / comparisons, 0, 'f', 1);
+    out.flush();
+    return true;
+#endif
+}
+
+bool embeddingAccuracy(const ImageIndex& index, SqliteStore& store, const HistogramIndex& hists,
+                       const HnswIndex& graph, int efSearch, const Options& opts, QTextStream& out) {
+#ifndef HAVE_OPENCV
+    Q_UNUSED(index);
+    Q_UNUSED(store);
+    Q_UNUSED(hists);
+    Q_UNUSED(graph);
+    Q_UNUSED(efSearch);
+    Q_UNUSED(opts);
+    return false;
+#else
+    // Histogram candidates the ORB+HSV ranker reranks, like the bag-of-words shortlist of searchSimilar
+    constexpr int kShortlist = 300;
+    const int n = index.size();
+    if (graph.isEmpty() || n < 2) return false;
+
+    // Random queries with a vector and cached descriptors
+    std::mt19937 rng(opts.seed);
+    std::vector<int> order(size_t(n));
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+    QList<int> querySlots;
+    QHash<qint64, cv::Mat> descs;
+    for (size_t i = 0; i < order.size() && querySlots.size() < opts.queries; i += 256) {
+        QList<qint64> ids;
+        for (size_t j = i; j < std::min(order.size(), i + 256); ++j)
+            if (graph.contains(index.id(order[j])) && hists.has(order[j])) ids.push_back(index.id(order[j]));
+        const auto blobs = store.loadDescriptors(ids);
+        for (size_t j = i; j < std::min(order.size(), i + 256) && querySlots.size() < opts.queries; ++j) {
+            const auto it = blobs.constFind(index.id(order[j]));
+            if (it == blobs.constEnd() || it.value().isEmpty()) continue;
+            descs.insert(it.key(), OrbFeatures::unpack(it.value()));
+            querySlots.push_back(order[j]);
+        }
+    }
+    if (querySlots.isEmpty()) { out << "\nNo images with both an embedding and ORB descriptors\n"; return false; }
+
+    const int maxCut = *std::max_element(opts.cutoffs.begin(), opts.cutoffs.end());
+    const int depth = qMax(opts.poolDepth, maxCut);
+    const int ef = qMax(efSearch, depth + 1);
+    enum { Hnsw, Exact, OrbHsv, RankerCount };
+    const char* names[RankerCount] = {"hnsw", "exact", "orb+hsv"};
+    std::vector<std::vector<double>> precision(RankerCount, std::vector<double>(opts.cutoffs.size(), 0.0));
+    std::vector<std::vector<double>> recall = precision;
+    std::vector<double> annRecall(opts.cutoffs.size(), 0.0), overlap(opts.cutoffs.size(), 0.0);
+    std::vector<double> rankNs(RankerCount, 0.0);
+    int recallQueries = 0;
+    qint64 relevantTotal = 0;
+    std::vector<float> corr;
+
+    // Pooled descriptors of the slots, loaded in one go
+    auto loadDescs = [&](const QSet<int>& slots) {
+        QList<qint64> missing;
+        for (int s : slots) if (!descs.contains(index.id(s))) missing.push_back(index.id(s));
+        for (int i = 0; i < missing.size(); i += 1000) {
+            const auto blobs = store.loadDescriptors(missing.mid(i, 1000));
+            for (auto it = blobs.constBegin(); it != blobs.constEnd(); ++it) descs.insert(it.key(), OrbFeatures::unpack(it.value()));
+        }
+    };
+    auto toSlots = [&](const std::vector<HnswIndex::Hit>& hits, int q) {
+        std::vector<int> slots;
+        for (const auto& h : hits) {
+            const int s = index.slotForId(h.id);
+            if (s >= 0 && s != q && int(slots.size()) < depth) slots.push_back(s);
+        }
+        return slots;
+    };
+
+    for (int q : querySlots) {
+        float scale = 0;
+        const qint8* codes = graph.codes(index.id(q), &scale);
+        std::vector<std::vector<int>> lists(RankerCount);
+        QElapsedTimer t;
+        t.start();
+        lists[Hnsw] = toSlots(graph.search(codes, scale, depth + 1, ef), q);
+        rankNs[Hnsw] += double(t.nsecsElapsed());
+        t.restart();
+        lists[Exact] = toSlots(graph.exact(codes, scale, depth + 1), q);
+        rankNs[Exact] += double(t.nsecsElapsed());
+
+        // ORB+HSV: every stored histogram correlated, the best reranked by the searchSimilar score
+        t.restart();
+        const cv::Mat qdesc = descs.value(index.id(q));
+        const auto probe = HistogramIndex::probe(QByteArray(reinterpret_cast<const char*>(hists.at(q)), ColorHistogram::kBins));
+        hists.correlateAll(probe, n, corr);
+        std::vector<int> shortlist;
+        for (int s = 0; s < n; ++s) if (s != q && corr[size_t(s)] != HistogramIndex::kMissing) shortlist.push_back(s);
+        const size_t keep = std::min(shortlist.size(), size_t(kShortlist));
+        std::partial_sort(shortlist.begin(), shortlist.begin() + keep, shortlist.end(), [&corr](int a, int b){
+            return corr[size_t(a)] != corr[size_t(b)] ? corr[size_t(a)] > corr[size_t(b)] : a < b;
+        });
+        shortlist.resize(keep);
+        loadDescs(QSet<int>(shortlist.begin(), shortlist.end()));
+        std::vector<double> sims(shortlist.size(), 0.0);
+        TaskScheduler::blockingMap(TaskScheduler::Priority::Interactive, shortlist, [&](int& slot) {
+            const cv::Mat c = descs.value(index.id(slot));
+            const double orb = c.empty() || qdesc.empty() ? 0.0 : double(OrbFeatures::goodMatches(qdesc, c)) / double(qdesc.rows);
+            sims[size_t(&slot - shortlist.data())] = NeighborGraph::similarity(orb, corr[size_t(slot)]);
+        });
+        std::vector<int> byScore(shortlist.size());
+        std::iota(byScore.begin(), byScore.end(), 0);
+        std::stable_sort(byScore.begin(), byScore.end(), [&sims](int a, int b){ return sims[size_t(a)] > sims[size_t(b)]; });
+        for (int i : byScore) if (int(lists[OrbHsv].size()) < depth) lists[OrbHsv].push_back(shortlist[size_t(i)]);
+        rankNs[OrbHsv] += double(t.nsecsElapsed());
+
+        // Ground truth over the union of the lists
+        QSet<int> pool;
+        for (const auto& l : lists) pool.unite(QSet<int>(l.begin(), l.end()));
+        loadDescs(pool);
+        std::vector<int> poolSlots(pool.begin(), pool.end());
+        std::vector<char> relevant(poolSlots.size(), 0);
+        TaskScheduler::blockingMap(TaskScheduler::Priority::Interactive, poolSlots, [&](int& slot) {
+            const cv::Mat c = descs.value(index.id(slot));
+            if (qdesc.empty() || c.empty()) return;
+            const double score = double(OrbFeatures::goodMatches(qdesc, c)) / double(qdesc.rows);
+            relevant[size_t(&slot - poolSlots.data())] = score >= opts.orbThreshold;
+        });
+        QSet<int> truth;
+        for (size_t i = 0; i < poolSlots.size(); ++i) if (relevant[i]) truth.insert(poolSlots[i]);
+        relevantTotal += truth.size();
+        if (!truth.isEmpty()) ++recallQueries;
+
+        auto top = [](const std::vector<int>& l, int k) {
+            return QSet<int>(l.begin(), l.begin() + std::min(size_t(k), l.size()));
+        };
+        for (int c = 0; c < opts.cutoffs.size(); ++c) {
+            const int k = opts.cutoffs[c];
+            for (int r = 0; r < RankerCount; ++r) {
+                const int hits = int(top(lists[r], k).intersect(truth).size());
+                precision[size_t(r)][size_t(c)] += double(hits) / k;
+                if (!truth.isEmpty()) recall[size_t(r)][size_t(c)] += double(hits) / truth.size();
+            }
+            const QSet<int> exactTop = top(lists[Exact], k);
+            if (!exactTop.isEmpty()) annRecall[size_t(c)] += double(top(lists[Hnsw], k).intersect(exactTop).size()) / exactTop.size();
+            overlap[size_t(c)] += double(top(lists[Hnsw], k).intersect(top(lists[OrbHsv], k)).size()) / k;
+        }
+    }
+
+    const int nq = querySlots.size();
+    out << QString("\nEmbeddings: %1 queries, %2 vectors of %3 dims (%4 KB), ef %5, %6 relevant pairs\n")
+               .arg(nq).arg(graph.size()).arg(graph.dim()).arg(graph.memoryUsage() / 1024).arg(ef).arg(relevantTotal);
+    out << QString("%1").arg("ranker", -10);
+    for (int k : opts.cutoffs) out << QString("%1%2").arg(QString("P@%1").arg(k), 9).arg(QString("R@%1").arg(k), 9);
+    out << QString("%1\n").arg("ms/query", 11);
+    for (int r = 0; r < RankerCount; ++r) {
+        out << QString("%1").arg(QString::fromLatin1(names[r]), -10);
+        for (int c = 0; c < opts.cutoffs.size(); ++c) {
+            out << QString("%1").arg(precision[size_t(r)][size_t(c)] / nq, 9, 'f', 3)
+                << QString("%1").arg(recallQueries ? recall[size_t(r)][size_t(c)] / recallQueries : 0.0, 9, 'f', 3);
+        }
+        out << QString("%1\n").arg(rankNs[size_t(r)] / nq / 1e6, 11, 'f', 2);
+    }
+    for (int c = 0; c < opts.cutoffs.size(); ++c) {
+        out << QString("top-%1: hnsw recall vs exact %2, overlap with orb+hsv %3\n").arg(opts.cutoffs[c])
+                   .arg(annRecall[size_t(c)] / nq, 0, 'f', 3).arg(overlap[size_t(c)] / nq, 0, 'f', 3);
+    }
+    out.flush();
+    return true;
+#endif
+}
+
+}
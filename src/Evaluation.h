@@ -0,0 +1,40 @@
+#pragma once
+#include <QtCore>
+#include "ThumbnailPyramid.h"
+
+class HistogramIndex;
+class HnswIndex;
+class ImageIndex;
+class SqliteStore;
+
+// Offline quality check of the cheap signals against ORB ground truth.
+// Queries are random indexed images with cached descriptors. Every signal alone
+// and the configured fusion each rank the library; the union of their top
+// poolDepth results is verified with the ORB ratio test, and candidates scoring
+// at least orbThreshold count as relevant (pooled ground truth, so recall is
+// relative to what any of the rankers found). No image files are read.
+namespace Evaluation {
+    struct Options {
+        int queries{50};
+        double orbThreshold{0.2};
+        int poolDepth{200};
+        QList<int> cutoffs{10, 50};
+        quint32 seed{1};
+    };
+
+    // Writes a precision/recall table to out; false without OpenCV or cached descriptors
+    bool run(const ImageIndex& index, SqliteStore& store, const Options& opts, QTextStream& out);
+
+    // Stored 8-bit histograms against OpenCV float histograms of the same thumbnails:
+    // correlation error, overlap of the top results at each cutoff and time per comparison.
+    // Reads up to 1000 thumbnails; false without OpenCV or stored histograms.
+    bool histogramAccuracy(const ImageIndex& index, SqliteStore& store, const QString& thumbDir,
+                           const ThumbnailPyramid::Options& thumbOpts, const Options& opts, QTextStream& out);
+
+    // Image embeddings against the ORB+HSV scoring of searchSimilar (histogram shortlist
+    // reranked by ORB; the ground truth is ORB too, so it is favoured). Queries need a vector
+    // and descriptors. Reports P@K/R@K and ms/query of the HNSW search, an exact cosine scan
+    // and ORB+HSV, then the HNSW recall against the exact scan and its top-K overlap with ORB+HSV.
+    bool embeddingAccuracy(const ImageIndex& index, SqliteStore& store, const HistogramIndex& hists,
+                           const HnswIndex& graph, int efSearch, const Options& opts, QTextStream& out);
+}
@@ -0,0 +1,46 @@
+#include "HistogramIndex.h"
+#include <cstring>
+
+HistogramIndex::Probe HistogramIndex::probe(const QByteArray& hist) {
+    Probe p;
+    if (hist.size() != ColorHistogram::kBins) return p;
+    p.hist = hist;
+    ColorHistogram::sums(reinterpret_cast<const quint8*>(hist.constData()), &p.sum, &p.sumSq);
+    return p;
+}
+
+void HistogramIndex::clear() {
+    m_data.clear();
+    m_sum.clear();
+    m_sumSq.clear();
+    m_present.clear();
+    m_count = 0;
+}
+
+void HistogramIndex::set(int slot, const quint8* hist) {
+    if (slot < 0) return;
+    if (slot >= int(m_present.size())) {
+        const size_t rows = size_t(slot) + 1;
+        m_data.resize(rows * ColorHistogram::kBins, 0);
+        m_sum.resize(rows, 0);
+        m_sumSq.resize(rows, 0);
+        m_present.resize(rows, 0);
+    }
+    std::memcpy(m_data.data() + size_t(slot) * ColorHistogram::kBins, hist, ColorHistogram::kBins);
+    ColorHistogram::sums(hist, &m_sum[size_t(slot)], &m_sumSq[size_t(slot)]);
+    if (!m_present[size_t(slot)]) { m_present[size_t(slot)] = 1; ++m_count; }
+}
+
+double HistogramIndex::correlation(const Probe& q, int slot) const {
+    const quint32 d = ColorHistogram::dot(reinterpret_cast<const quint8*>(q.hist.constData()), at(slot));
+    return ColorHistogram::correlation(d, q.sum, q.sumSq, m_sum[size_t(slot)], m_sumSq[size_t(slot)]);
+}
+
+void HistogramIndex::correlateAll(const Probe& q, int slots, std::vector<float>& out) const {
+    out.assign(size_t(qMax(0, slots)), kMissing);
+    if (!q.isValid()) return;
+    const int covered = qMin(slots, int(m_present.size()));
+    for (int s = 0; s < covered; ++s) {
+        if (m_present[size_t(s)]) out[size_t(s)] = float(correlation(q, s));
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <QtCore>
+#include <vector>
+#include "ColorHistogram.h"
+
+// Quantized color histograms of the library in one contiguous array
+// (ColorHistogram::kBins bytes per slot), with each row's byte sum and sum of
+// squares cached so a correlation costs one dot product.
+class HistogramIndex {
+public:
+    // A query histogram with its sums, prepared once per search
+    struct Probe {
+        QByteArray hist;
+        quint32 sum{0};
+        quint32 sumSq{0};
+        bool isValid() const { return hist.size() == ColorHistogram::kBins; }
+    };
+    static Probe probe(const QByteArray& hist);
+
+    void clear();
+    // Slots that have a histogram
+    int count() const { return m_count; }
+    // hist must hold kBins bytes; the array grows to cover slot
+    void set(int slot, const quint8* hist);
+    bool has(int slot) const { return slot >= 0 && slot < int(m_present.size()) && m_present[size_t(slot)]; }
+    const quint8* at(int slot) const { return m_data.data() + size_t(slot) * ColorHistogram::kBins; }
+
+    // Pearson correlation (OpenCV HISTCMP_CORREL) with slot; slot must have a histogram
+    double correlation(const Probe& q, int slot) const;
+    // Correlation with slots [0, slots) in one streaming pass; kMissing where there is no histogram
+    static constexpr float kMissing = -2.0f;
+    void correlateAll(const Probe& q, int slots, std::vector<float>& out) const;
+
+private:
+    std::vector<quint8> m_data;
+    std::vector<quint32> m_sum;
+    std::vector<quint32> m_sumSq;
+    std::vector<quint8> m_present;
+    int m_count{0};
+};
@@ -0,0 +1,344 @@
+#include "HnswIndex.h"
+#include <QSaveFile>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+
+namespace {
+constexpr char kMagic[8] = {'D','F','R','H','N','S','W','\0'};
+constexpr quint32 kVersion = 1;
+constexpr quint32 kByteOrderMark = 0x01020304;
+constexpr int kMaxLevel = 15;
+
+struct FileHeader {
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    qint32 dim;
+    qint32 M;
+    qint32 efConstruction;
+    qint32 maxLevel;
+    quint64 nodes;
+    quint64 upperLinks;
+    quint32 entry;
+    quint32 reserved;
+};
+
+inline quint64 align8(quint64 v) { return (v + 7) & ~quint64(7); }
+
+template <typename T>
+bool writeColumn(QSaveFile& f, const std::vector<T>& col) {
+    const qint64 bytes = qint64(col.size() * sizeof(T));
+    if (bytes && f.write(reinterpret_cast<const char*>(col.data()), bytes) != bytes) return false;
+    static const char pad[8] = {};
+    const qint64 padding = qint64(align8(quint64(bytes)) - quint64(bytes));
+    return padding == 0 || f.write(pad, padding) == padding;
+}
+
+template <typename T>
+bool readColumn(const uchar* base, quint64 fileSize, quint64& offset, quint64 count, std::vector<T>& col) {
+    const quint64 bytes = count * sizeof(T);
+    if (offset + bytes > fileSize) return false;
+    col.resize(size_t(count));
+    if (bytes) std::memcpy(col.data(), base + offset, size_t(bytes));
+    offset += align8(bytes);
+    return true;
+}
+
+inline int dot8(const qint8* a, const qint8* b, int n) {
+    int sum = 0;
+    for (int i = 0; i < n; ++i) sum += int(a[i]) * int(b[i]);
+    return sum;
+}
+
+// Per-thread visit marks; a new stamp per search avoids clearing them
+struct Visited {
+    std::vector<quint32> marks;
+    quint32 stamp{0};
+    void begin(size_t n) {
+        if (marks.size() < n) marks.resize(n, 0);
+        if (++stamp == 0) { std::fill(marks.begin(), marks.end(), 0); stamp = 1; }
+    }
+    bool visit(quint32 slot) {
+        if (marks[slot] == stamp) return false;
+        marks[slot] = stamp;
+        return true;
+    }
+};
+thread_local Visited t_visited;
+}
+
+void HnswIndex::clear() {
+    *this = HnswIndex();
+}
+
+void HnswIndex::reset(int dim, const Params& params) {
+    clear();
+    m_dim = dim;
+    m_params = params;
+    m_upperOffset.push_back(0);
+}
+
+const qint8* HnswIndex::codes(qint64 id, float* scale) const {
+    const auto it = m_slotById.constFind(id);
+    if (it == m_slotById.constEnd()) return nullptr;
+    if (scale) *scale = m_scales[it.value()];
+    return &m_codes[size_t(it.value()) * size_t(m_dim)];
+}
+
+float HnswIndex::similarity(quint32 a, quint32 b) const {
+    return m_scales[a] * m_scales[b] * float(dot8(&m_codes[size_t(a) * m_dim], &m_codes[size_t(b) * m_dim], m_dim));
+}
+
+float HnswIndex::similarity(const qint8* q, float qs, quint32 slot) const {
+    return qs * m_scales[slot] * float(dot8(q, &m_codes[size_t(slot) * m_dim], m_dim));
+}
+
+quint32* HnswIndex::links(quint32 slot, int level) {
+    if (level == 0) return &m_links0[size_t(slot) * size_t(1 + 2 * m_params.M)];
+    return &m_upper[m_upperOffset[slot] + size_t(level - 1) * size_t(1 + m_params.M)];
+}
+
+const quint32* HnswIndex::links(quint32 slot, int level) const {
+    return const_cast<HnswIndex*>(this)->links(slot, level);
+}
+
+int HnswIndex::randomLevel() {
+    // Geometric with mL = 1/ln(M), as in the paper
+    m_rng = m_rng * 6364136223846793005ull + 1442695040888963407ull;
+    const double u = double((m_rng >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return std::min(kMaxLevel, int(-std::log(u) / std::log(double(m_params.M))));
+}
+
+std::vector<HnswIndex::Scored> HnswIndex::searchLayer(const qint8* q, float qs, quint32 entry, int ef, int level) const {
+    Visited& visited = t_visited;
+    visited.begin(m_ids.size());
+    std::priority_queue<Scored> candidates;                                        // best on top
+    std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored>> best;   // worst on top
+    const float s0 = similarity(q, qs, entry);
+    candidates.push({s0, entry});
+    best.push({s0, entry});
+    visited.visit(entry);
+    while (!candidates.empty()) {
+        const Scored c = candidates.top();
+        if (int(best.size()) >= ef && c.first < best.top().first) break;
+        candidates.pop();
+        const quint32* l = links(c.second, level);
+        for (quint32 i = 0; i < l[0]; ++i) {
+            const quint32 n = l[1 + i];
+            if (!visited.visit(n)) continue;
+            const float s = similarity(q, qs, n);
+            if (int(best.size()) < ef || s > best.top().first) {
+                candidates.push({s, n});
+                best.push({s, n});
+                if (int(best.size()) > ef) best.pop();
+            }
+        }
+    }
+    std::vector<Scored> out(best.size());
+    for (size_t i = out.size(); i-- > 0; ) {
+        out[i] = best.top();
+        best.pop();
+    }
+    return out;
+}
+
+std::vector<quint32> HnswIndex::selectNeighbors(const std::vector<Scored>& candidates, int cap) const {
+    std::vector<quint32> out;
+    out.reserve(size_t(cap));
+    for (const Scored& c : candidates) {
+        if (int(out.size()) >= cap) break;
+        bool keep = true;
+        for (quint32 r : out) {
+            if (similarity(c.second, r) > c.first) { keep = false; break; }
+        }
+        if (keep) out.push_back(c.second);
+    }
+    return out;
+}
+
+void HnswIndex::connect(quint32 from, quint32 to, int level) {
+    quint32* l = links(from, level);
+    const int cap = capacity(level);
+    if (int(l[0]) < cap) {
+        l[1 + l[0]++] = to;
+        return;
+    }
+    // Full: choose again among the old neighbours and the new one
+    std::vector<Scored> candidates;
+    candidates.reserve(size_t(cap) + 1);
+    for (quint32 i = 0; i < l[0]; ++i) candidates.push_back({similarity(from, l[1 + i]), l[1 + i]});
+    candidates.push_back({similarity(from, to), to});
+    std::sort(candidates.begin(), candidates.end(), std::greater<Scored>());
+    const auto kept = selectNeighbors(candidates, cap);
+    l[0] = quint32(kept.size());
+    std::copy(kept.begin(), kept.end(), l + 1);
+}
+
+void HnswIndex::insert(qint64 id, const qint8* codes, float scale) {
+    Q_ASSERT(m_dim > 0);
+    remove(id);
+    const quint32 slot = quint32(m_ids.size());
+    const int level = randomLevel();
+    m_ids.push_back(id);
+    m_scales.push_back(scale);
+    m_codes.insert(m_codes.end(), codes, codes + m_dim);
+    m_levels.push_back(quint8(level));
+    m_removed.push_back(0);
+    m_links0.resize(m_links0.size() + size_t(1 + 2 * m_params.M), 0);
+    m_upper.resize(m_upper.size() + size_t(level) * size_t(1 + m_params.M), 0);
+    m_upperOffset.push_back(quint32(m_upper.size()));
+    m_slotById.insert(id, slot);
+    if (m_maxLevel < 0) {
+        m_entry = slot;
+        m_maxLevel = level;
+        return;
+    }
+
+    const qint8* q = &m_codes[size_t(slot) * m_dim];
+    quint32 ep = m_entry;
+    for (int l = m_maxLevel; l > level; --l) ep = searchLayer(q, scale, ep, 1, l).front().second;
+    for (int l = std::min(level, m_maxLevel); l >= 0; --l) {
+        const auto found = searchLayer(q, scale, ep, m_params.efConstruction, l);
+        const auto chosen = selectNeighbors(found, capacity(l));
+        quint32* own = links(slot, l);
+        own[0] = quint32(chosen.size());
+        std::copy(chosen.begin(), chosen.end(), own + 1);
+        for (quint32 n : chosen) connect(n, slot, l);
+        ep = found.front().second;
+    }
+    if (level > m_maxLevel) {
+        m_maxLevel = level;
+        m_entry = slot;
+    }
+}
+
+void HnswIndex::remove(qint64 id) {
+    const auto it = m_slotById.constFind(id);
+    if (it == m_slotById.constEnd()) return;
+    m_removed[it.value()] = 1;
+    m_slotById.erase(it);
+}
+
+void HnswIndex::compact() {
+    HnswIndex fresh;
+    fresh.reset(m_dim, m_params);
+    // Slot order, so the graph is the one a rebuild from the database gives
+    for (quint32 slot = 0; slot < quint32(m_ids.size()); ++slot) {
+        if (!m_removed[slot]) fresh.insert(m_ids[slot], &m_codes[size_t(slot) * m_dim], m_scales[slot]);
+    }
+    *this = std::move(fresh);
+}
+
+std::vector<HnswIndex::Hit> HnswIndex::search(const qint8* codes, float scale, int k, int ef) const {
+    std::vector<Hit> out;
+    if (isEmpty() || k <= 0) return out;
+    quint32 ep = m_entry;
+    for (int l = m_maxLevel; l > 0; --l) ep = searchLayer(codes, scale, ep, 1, l).front().second;
+    // Removed nodes still route, but take places in the result list
+    const auto found = searchLayer(codes, scale, ep, std::max(ef, k) + std::min(removedCount(), k), 0);
+    for (const Scored& s : found) {
+        if (m_removed[s.second]) continue;
+        out.push_back({m_ids[s.second], s.first});
+        if (int(out.size()) == k) break;
+    }
+    return out;
+}
+
+std::vector<HnswIndex::Hit> HnswIndex::exact(const qint8* codes, float scale, int k) const {
+    std::vector<Hit> all;
+    all.reserve(size_t(size()));
+    for (auto it = m_slotById.constBegin(); it != m_slotById.constEnd(); ++it)
+        all.push_back({it.key(), similarity(codes, scale, it.value())});
+    const size_t keep = std::min(all.size(), size_t(std::max(0, k)));
+    std::partial_sort(all.begin(), all.begin() + keep, all.end(), [](const Hit& a, const Hit& b){
+        return a.similarity != b.similarity ? a.similarity > b.similarity : a.id < b.id;
+    });
+    all.resize(keep);
+    return all;
+}
+
+bool HnswIndex::save(const QString& file) const {
+    QSaveFile f(file);
+    if (!f.open(QIODevice::WriteOnly)) return false;
+    FileHeader h{};
+    std::memcpy(h.magic, kMagic, sizeof(h.magic));
+    h.version = kVersion;
+    h.byteOrder = kByteOrderMark;
+    h.dim = m_dim;
+    h.M = m_params.M;
+    h.efConstruction = m_params.efConstruction;
+    h.maxLevel = m_maxLevel;
+    h.nodes = quint64(m_ids.size());
+    h.upperLinks = quint64(m_upper.size());
+    h.entry = m_entry;
+    if (f.write(reinterpret_cast<const char*>(&h), sizeof(h)) != qint64(sizeof(h))) { f.cancelWriting(); return false; }
+    const bool ok = writeColumn(f, m_ids) && writeColumn(f, m_scales) && writeColumn(f, m_codes)
+        && writeColumn(f, m_levels) && writeColumn(f, m_removed) && writeColumn(f, m_links0)
+        && writeColumn(f, m_upperOffset) && writeColumn(f, m_upper);
+    if (!ok) { f.cancelWriting(); return false; }
+    return f.commit();
+}
+
+bool HnswIndex::load(const QString& file) {
+    QFile f(file);
+    if (!f.open(QIODevice::ReadOnly)) return false;
+    const quint64 fileSize = quint64(f.size());
+    if (fileSize < sizeof(FileHeader)) return false;
+    const uchar* base = f.map(0, f.size());
+    if (!base) return false;
+
+    FileHeader h;
+    std::memcpy(&h, base, sizeof(h));
+    const bool headerOk = std::memcmp(h.magic, kMagic, sizeof(h.magic)) == 0
+        && h.version == kVersion && h.byteOrder == kByteOrderMark
+        && h.dim > 0 && h.dim <= 65536 && h.M >= 2 && h.M <= 256 && h.efConstruction > 0
+        && h.maxLevel >= -1 && h.maxLevel <= kMaxLevel && h.nodes < (quint64(1) << 31);
+    if (!headerOk) { f.unmap(const_cast<uchar*>(base)); return false; }
+
+    HnswIndex loaded;
+    loaded.m_dim = h.dim;
+    loaded.m_params = {h.M, h.efConstruction};
+    const quint64 n = h.nodes;
+    quint64 offset = align8(sizeof(h));
+    bool ok = readColumn(base, fileSize, offset, n, loaded.m_ids)
+        && readColumn(base, fileSize, offset, n, loaded.m_scales)
+        && readColumn(base, fileSize, offset, n * quint64(h.dim), loaded.m_codes)
+        && readColumn(base, fileSize, offset, n, loaded.m_levels)
+        && readColumn(base, fileSize, offset, n, loaded.m_removed)
+        && readColumn(base, fileSize, offset, n * quint64(1 + 2 * h.M), loaded.m_links0)
+        && readColumn(base, fileSize, offset, n + 1, loaded.m_upperOffset)
+        && readColumn(base, fileSize, offset, h.upperLinks, loaded.m_upper);
+    f.unmap(const_cast<uchar*>(base));
+    if (!ok || (n > 0 && h.entry >= n) || (n == 0) != (h.maxLevel < 0)) return false;
+
+    // Every link must name a node and fit its list, so a damaged file cannot send a search astray
+    for (quint32 slot = 0; slot < quint32(n) && ok; ++slot) {
+        const int level = loaded.m_levels[slot];
+        ok = level <= h.maxLevel && loaded.m_upperOffset[slot + 1] >= loaded.m_upperOffset[slot]
+            && loaded.m_upperOffset[slot + 1] - loaded.m_upperOffset[slot] == quint32(level * (1 + h.M))
+            && loaded.m_upperOffset[slot + 1] <= h.upperLinks;
+        for (int l = 0; l <= level && ok; ++l) {
+            const quint32* links = loaded.links(slot, l);
+            ok = int(links[0]) <= loaded.capacity(l);
+            for (quint32 i = 0; i < links[0] && ok; ++i) ok = links[1 + i] < n;
+        }
+    }
+    if (!ok) return false;
+    loaded.m_entry = h.entry;
+    loaded.m_maxLevel = h.maxLevel;
+    for (quint32 slot = 0; slot < quint32(n); ++slot) {
+        if (!loaded.m_removed[slot]) loaded.m_slotById.insert(loaded.m_ids[slot], slot);
+    }
+    *this = std::move(loaded);
+    return true;
+}
+
+qsizetype HnswIndex::memoryUsage() const {
+    return qsizetype(m_ids.capacity() * sizeof(qint64) + m_scales.capacity() * sizeof(float) + m_codes.capacity()
+                     + m_levels.capacity() + m_removed.capacity() + m_links0.capacity() * sizeof(quint32)
+                     + m_upperOffset.capacity() * sizeof(quint32) + m_upper.capacity() * sizeof(quint32))
+        + m_slotById.size() * qsizetype(sizeof(qint64) + sizeof(quint32) + 16);
+}
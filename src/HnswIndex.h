@@ -0,0 +1,71 @@
+#pragma once
+#include <QtCore>
+#include <vector>
+
+// Approximate nearest neighbours by cosine similarity (HNSW, Malkov & Yashunin).
+// Vectors are int8 codes with one scale each (value = code * scale), so 384-d
+// embeddings take 388 bytes and similarities are integer dot products.
+// Nodes are identified by database id. Removal only marks a node: it keeps routing
+// searches until compact() rebuilds the graph from the live nodes.
+class HnswIndex {
+public:
+    struct Hit { qint64 id; float similarity; };
+    struct Params {
+        int M{16};                // links per node on upper layers, 2*M on layer 0
+        int efConstruction{100};
+    };
+
+    void clear();
+    void reset(int dim, const Params& params = {});
+    int dim() const { return m_dim; }
+    int size() const { return int(m_slotById.size()); }
+    bool isEmpty() const { return m_slotById.isEmpty(); }
+    int removedCount() const { return int(m_ids.size()) - size(); }
+    bool contains(qint64 id) const { return m_slotById.contains(id); }
+    QList<qint64> ids() const { return m_slotById.keys(); }
+    // Stored codes of a live node (dim() values), nullptr if absent
+    const qint8* codes(qint64 id, float* scale) const;
+
+    // Replaces a node with the same id
+    void insert(qint64 id, const qint8* codes, float scale);
+    void remove(qint64 id);
+    // Rebuild from the live nodes, dropping removed ones
+    void compact();
+
+    // Best k live nodes, most similar first; ef >= k widens the search
+    std::vector<Hit> search(const qint8* codes, float scale, int k, int ef) const;
+    // Every live node compared (evaluation baseline)
+    std::vector<Hit> exact(const qint8* codes, float scale, int k) const;
+
+    bool save(const QString& file) const;
+    bool load(const QString& file);
+    qsizetype memoryUsage() const;
+
+private:
+    using Scored = std::pair<float, quint32>;   // similarity, slot
+    float similarity(quint32 a, quint32 b) const;
+    float similarity(const qint8* q, float qs, quint32 slot) const;
+    quint32* links(quint32 slot, int level);
+    const quint32* links(quint32 slot, int level) const;
+    int capacity(int level) const { return level == 0 ? 2 * m_params.M : m_params.M; }
+    int randomLevel();
+    std::vector<Scored> searchLayer(const qint8* q, float qs, quint32 entry, int ef, int level) const;
+    // Heuristic of the paper (alg. 4): skip candidates closer to a kept neighbour than to the base
+    std::vector<quint32> selectNeighbors(const std::vector<Scored>& candidates, int cap) const;
+    void connect(quint32 from, quint32 to, int level);
+
+    int m_dim{0};
+    Params m_params;
+    std::vector<qint64> m_ids;          // by slot, removed nodes included
+    std::vector<float> m_scales;
+    std::vector<qint8> m_codes;         // slot * dim
+    std::vector<quint8> m_levels;
+    std::vector<quint8> m_removed;
+    std::vector<quint32> m_links0;      // slot * (1 + 2M): count, then neighbours
+    std::vector<quint32> m_upperOffset; // slot -> start in m_upper; size slots + 1
+    std::vector<quint32> m_upper;       // levels 1..L of a slot, (1 + M) each
+    QHash<qint64, quint32> m_slotById;  // live nodes
+    quint32 m_entry{0};
+    int m_maxLevel{-1};
+    quint64 m_rng{0x9E3779B97F4A7C15ull};
+};
@@ -1,6 +1,7 @@
 #include "ImageHash.h"
 #include <QtGui/QImage>
 #include <QtGui/QColor>
+#include <algorithm>
 #include <vector>
 #include <cmath>
 
@@ -9,6 +10,7 @@
 // 2) Compute DCT (32x32)
 // 3) Take top-left 8x8 (excluding DC), compute median
 // 4) Set bits based on > median
+// The dihedral variants reuse steps 1-2 and rearrange the 8x8 block.
 
 namespace {
     static void dct1D(const double* in, double* out, int N) {
@@ -25,59 +27,122 @@ namespace {
     }
 }
 
-quint64 ImageHash::pHash(const QImage& src) {
-    if (src.isNull()) return 0;
-    QImage img = src.convertToFormat(QImage::Format_Grayscale8).scaled(32, 32, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+namespace {
+    // Low-frequency 8x8 corner of the 32x32 DCT of the grayscale image ([v][u], DC at [0][0])
+    static bool lowFrequencies(const QImage& src, double block[8][8]) {
+        if (src.isNull()) return false;
+        QImage img = src.convertToFormat(QImage::Format_Grayscale8).scaled(32, 32, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
 
-    // Prepare matrix
-    double a[32][32];
-    for (int y = 0; y < 32; ++y) {
-        const uchar* line = img.constScanLine(y);
+        // Prepare matrix
+        double a[32][32];
+        for (int y = 0; y < 32; ++y) {
+            const uchar* line = img.constScanLine(y);
+            for (int x = 0; x < 32; ++x) {
+                a[y][x] = (double)line[x];
+            }
+        }
+
+        // DCT rows then cols
+        double tmp[32][32];
+        double rowIn[32], rowOut[32];
+        for (int y = 0; y < 32; ++y) {
+            for (int x = 0; x < 32; ++x) rowIn[x] = a[y][x];
+            dct1D(rowIn, rowOut, 32);
+            for (int x = 0; x < 32; ++x) tmp[y][x] = rowOut[x];
+        }
+
+        double colIn[32], colOut[32];
         for (int x = 0; x < 32; ++x) {
-            a[y][x] = (double)line[x];
+            for (int y = 0; y < 32; ++y) colIn[y] = tmp[y][x];
+            dct1D(colIn, colOut, 32);
+            for (int y = 0; y < 32; ++y) tmp[y][x] = colOut[y];
         }
-    }
 
-    // DCT rows then cols
-    double tmp[32][32];
-    double rowIn[32], rowOut[32];
-    for (int y = 0; y < 32; ++y) {
-        for (int x = 0; x < 32; ++x) rowIn[x] = a[y][x];
-        dct1D(rowIn, rowOut, 32);
-        for (int x = 0; x < 32; ++x) tmp[y][x] = rowOut[x];
+        for (int y = 0; y < 8; ++y)
+            for (int x = 0; x < 8; ++x) block[y][x] = tmp[y][x];
+        return true;
     }
 
-    double colIn[32], colOut[32];
-    for (int x = 0; x < 32; ++x) {
-        for (int y = 0; y < 32; ++y) colIn[y] = tmp[y][x];
-        dct1D(colIn, colOut, 32);
-        for (int y = 0; y < 32; ++y) tmp[y][x] = colOut[y];
+    // Bits of the 63 AC coefficients against their median (skip [0,0])
+    static quint64 hashBlock(const double block[8][8]) {
+        std::vector<double> vals;
+        vals.reserve(64);
+        for (int y = 0; y < 8; ++y) {
+            for (int x = 0; x < 8; ++x) {
+                if (y == 0 && x == 0) continue;
+                vals.push_back(block[y][x]);
+            }
+        }
+        std::nth_element(vals.begin(), vals.begin() + vals.size()/2, vals.end());
+        double median = vals[vals.size()/2];
+
+        quint64 hash = 0;
+        int bit = 0;
+        for (int y = 0; y < 8; ++y) {
+            for (int x = 0; x < 8; ++x) {
+                if (y == 0 && x == 0) continue;
+                if (block[y][x] > median) hash |= (1ull << bit);
+                ++bit;
+            }
+        }
+        return hash;
     }
+}
 
-    // Take top-left 8x8 (skip [0,0])
-    std::vector<double> vals;
-    vals.reserve(64);
-    for (int y = 0; y < 8; ++y) {
-        for (int x = 0; x < 8; ++x) {
-            if (y == 0 && x == 0) continue;
-            vals.push_back(tmp[y][x]);
+quint64 ImageHash::pHash(const QImage& src) {
+    double block[8][8];
+    if (!lowFrequencies(src, block)) return 0;
+    return hashBlock(block);
+}
+
+std::array<quint64, 8> ImageHash::pHashDihedral(const QImage& src) {
+    std::array<quint64, 8> out{};
+    double block[8][8];
+    if (!lowFrequencies(src, block)) return out;
+    // Mirroring the input negates the odd DCT frequencies along that axis and
+    // transposing it transposes the coefficients, so every rotation/flip is a
+    // rearrangement of the same block. The median is taken per variant since
+    // the signs change it.
+    for (int k = 0; k < 8; ++k) {
+        double t[8][8];
+        for (int v = 0; v < 8; ++v) {
+            for (int u = 0; u < 8; ++u) {
+                double c = (k & 4) ? block[u][v] : block[v][u];
+                if ((k & 1) && (u & 1)) c = -c;
+                if ((k & 2) && (v & 1)) c = -c;
+                t[v][u] = c;
+            }
         }
+        out[k] = hashBlock(t);
     }
-    std::vector<double> sorted = vals;
-    std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
-    double median = sorted[sorted.size()/2];
+    return out;
+}
 
-    quint64 hash = 0;
-    int bit = 0;
-    for (int y = 0; y < 8; ++y) {
-        for (int x = 0; x < 8; ++x) {
-            if (y == 0 && x == 0) continue;
-            double v = tmp[y][x];
-            if (v > median) hash |= (1ull << bit);
-            ++bit;
+QVector<quint64> ImageHash::regionHashes(const QImage& src, int grid) {
+    QVector<quint64> out;
+    if (src.isNull() || grid <= 0) return out;
+    // Cells only feed 9x8 dHashes, so one cheap downscale is plenty
+    const QImage small = src.convertToFormat(QImage::Format_Grayscale8)
+                            .scaled(QSize(grid * 64, grid * 64), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    const int w = small.width(), h = small.height();
+    out.reserve(grid * grid + 2);
+    for (int gy = 0; gy < grid; ++gy) {
+        for (int gx = 0; gx < grid; ++gx) {
+            const QRect cell(gx * w / grid, gy * h / grid, (gx + 1) * w / grid - gx * w / grid, (gy + 1) * h / grid - gy * h / grid);
+            out.push_back(dHash(small.copy(cell)));
         }
     }
-    return hash;
+    out.push_back(dHash(small.copy(QRect(w / 4, h / 4, w / 2, h / 2))));
+    out.push_back(dHash(small));
+    return out;
+}
+
+bool ImageHash::regionHashesEnabled() {
+    return QSettings().value("hash/tiles", false).toBool();
+}
+
+bool ImageHash::dihedralEnabled() {
+    return QSettings().value("hash/dihedral", false).toBool();
 }
 
 quint64 ImageHash::aHash(const QImage& src) {
@@ -119,3 +184,126 @@ quint64 ImageHash::dHash(const QImage& src) {
     }
     return h;
 }
+
+namespace {
+    constexpr int kSmall = 64;
+
+    // One Haar level on the top-left n x n block of a kSmall-wide matrix (averages first)
+    static void haarStep(double* m, int n) {
+        double tmp[kSmall];
+        const int h = n / 2;
+        for (int y = 0; y < n; ++y) {
+            double* row = m + y * kSmall;
+            for (int i = 0; i < h; ++i) {
+                tmp[i] = (row[2 * i] + row[2 * i + 1]) * 0.5;
+                tmp[h + i] = (row[2 * i] - row[2 * i + 1]) * 0.5;
+            }
+            for (int i = 0; i < n; ++i) row[i] = tmp[i];
+        }
+        for (int x = 0; x < n; ++x) {
+            for (int i = 0; i < h; ++i) {
+                const double a = m[(2 * i) * kSmall + x], b = m[(2 * i + 1) * kSmall + x];
+                tmp[i] = (a + b) * 0.5;
+                tmp[h + i] = (a - b) * 0.5;
+            }
+            for (int i = 0; i < n; ++i) m[i * kSmall + x] = tmp[i];
+        }
+    }
+
+    static quint64 wHashSmall(const QImage& small) {
+        std::vector<double> m(kSmall * kSmall);
+        for (int y = 0; y < kSmall; ++y) {
+            const QRgb* line = reinterpret_cast<const QRgb*>(small.constScanLine(y));
+            for (int x = 0; x < kSmall; ++x) m[y * kSmall + x] = qGray(line[x]);
+        }
+        // 64 -> 8 approximation band, then a full decomposition of that band
+        for (int n = kSmall; n > 8; n /= 2) haarStep(m.data(), n);
+        for (int n = 8; n >= 2; n /= 2) haarStep(m.data(), n);
+
+        std::vector<double> vals;
+        vals.reserve(63);
+        for (int y = 0; y < 8; ++y)
+            for (int x = 0; x < 8; ++x)
+                if (x || y) vals.push_back(m[y * kSmall + x]);
+        std::nth_element(vals.begin(), vals.begin() + vals.size() / 2, vals.end());
+        const double median = vals[vals.size() / 2];
+        quint64 hash = 0;
+        int bit = 0;
+        for (int y = 0; y < 8; ++y) {
+            for (int x = 0; x < 8; ++x) {
+                if (!x && !y) continue;
+                if (m[y * kSmall + x] > median) hash |= (1ull << bit);
+                ++bit;
+            }
+        }
+        return hash;
+    }
+
+    static int quantize7(double v, double lo, double hi) {
+        return qBound(0, int(std::lround((v - lo) / (hi - lo) * 127.0)), 127);
+    }
+
+    static quint64 colorMomentsSmall(const QImage& small) {
+        // Y, Cb, Cr (BT.601, 0..255)
+        constexpr int n = kSmall * kSmall;
+        std::vector<double> ch[3];
+        for (auto& c : ch) c.reserve(n);
+        for (int y = 0; y < kSmall; ++y) {
+            const QRgb* line = reinterpret_cast<const QRgb*>(small.constScanLine(y));
+            for (int x = 0; x < kSmall; ++x) {
+                const double r = qRed(line[x]), g = qGreen(line[x]), b = qBlue(line[x]);
+                ch[0].push_back(0.299 * r + 0.587 * g + 0.114 * b);
+                ch[1].push_back(128.0 - 0.168736 * r - 0.331264 * g + 0.5 * b);
+                ch[2].push_back(128.0 + 0.5 * r - 0.418688 * g - 0.081312 * b);
+            }
+        }
+        quint64 packed = 0;
+        int shift = 0;
+        for (const auto& c : ch) {
+            double mean = 0;
+            for (double v : c) mean += v;
+            mean /= n;
+            double m2 = 0, m3 = 0;
+            for (double v : c) { const double d = v - mean; m2 += d * d; m3 += d * d * d; }
+            const double sd = std::sqrt(m2 / n);
+            const double skew = std::cbrt(m3 / n);   // in pixel units, like sd
+            for (int q : {quantize7(mean, 0, 255), quantize7(sd, 0, 127.5), quantize7(skew, -127.5, 127.5)}) {
+                packed |= quint64(q) << shift;
+                shift += 7;
+            }
+        }
+        return packed;
+    }
+
+    static QImage smallRgb(const QImage& src) {
+        return src.convertToFormat(QImage::Format_RGB32).scaled(kSmall, kSmall, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+}
+
+quint64 ImageHash::wHash(const QImage& src) {
+    if (src.isNull()) return 0;
+    return wHashSmall(smallRgb(src));
+}
+
+quint64 ImageHash::colorMoments(const QImage& src) {
+    if (src.isNull()) return 0;
+    return colorMomentsSmall(smallRgb(src));
+}
+
+ImageHash::Compact ImageHash::compact(const QImage& src) {
+    if (src.isNull()) return {};
+    const QImage small = smallRgb(src);
+    return {wHashSmall(small), colorMomentsSmall(small)};
+}
+
+double ImageHash::colorMomentDistance(quint64 a, quint64 b) {
+    // Means matter most, skewness least
+    static const double weights[3] = {3.0, 2.0, 1.0};
+    double sum = 0, norm = 0;
+    for (int i = 0; i < 9; ++i) {
+        const int qa = int((a >> (7 * i)) & 0x7f), qb = int((b >> (7 * i)) & 0x7f);
+        sum += weights[i % 3] * std::abs(qa - qb);
+        norm += weights[i % 3] * 127.0;
+    }
+    return sum / norm;
+}
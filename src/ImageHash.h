@@ -1,5 +1,6 @@
 #pragma once
 #include <QtCore>
+#include <array>
 #if defined(_MSC_VER)
 #include <intrin.h>
 #endif
@@ -8,12 +9,42 @@ namespace ImageHash {
     // 64-bit perceptual hash
     quint64 pHash(const QImage& src);
 
+    // pHash of all 8 rotations/mirrors of src from a single DCT.
+    // Index bits: 1 = mirror left-right, 2 = mirror top-bottom, 4 = transpose
+    // (applied first). [0] equals pHash(src); rotating 90 degrees clockwise is [5].
+    std::array<quint64, 8> pHashDihedral(const QImage& src);
+
+    // dHash of each cell of a grid x grid layout, of the central half and of the
+    // whole image, all taken from one downscaled copy. Crops and letterboxed
+    // copies share some of these regions even when the global hashes differ.
+    QVector<quint64> regionHashes(const QImage& src, int grid = 3);
+    // QSettings hash/tiles (default off): index region hashes for crop search
+    bool regionHashesEnabled();
+
+    // QSettings hash/dihedral (default off): index and match every rotation/mirror
+    bool dihedralEnabled();
+
         // 64-bit average hash (aHash)
         quint64 aHash(const QImage& src);
 
         // 64-bit difference hash (dHash)
         quint64 dHash(const QImage& src);
 
+    // 63-bit Haar wavelet hash: the 64x64 grayscale image is reduced to its
+    // 8x8 approximation band, fully Haar-decomposed again, and every non-DC
+    // coefficient is compared with their median
+    quint64 wHash(const QImage& src);
+
+    // Mean, standard deviation and skewness of Y, Cb and Cr, 7 bits each
+    // (9 x 7 = 63 bits). Compare with colorMomentDistance, not Hamming distance.
+    quint64 colorMoments(const QImage& src);
+    // Weighted L1 distance of two packed signatures, 0 (same) .. 1
+    double colorMomentDistance(quint64 a, quint64 b);
+
+    // wHash and color moments from one shared 64x64 resample (what the indexer stores)
+    struct Compact { quint64 whash{0}; quint64 cmoments{0}; };
+    Compact compact(const QImage& src);
+
     inline int hammingDistance(quint64 a, quint64 b) {
         quint64 x = a ^ b;
 #if defined(_MSC_VER)
@@ -22,4 +53,10 @@ namespace ImageHash {
         return (int)__builtin_popcountll(x);
 #endif
     }
+
+    // Flat regions (sky, letterbox bars) hash to nearly all-0/all-1 bits and match anything
+    inline bool isInformative(quint64 h) {
+        const int bits = hammingDistance(h, 0);
+        return bits >= 8 && bits <= 56;
+    }
 }
@@ -0,0 +1,252 @@
+#include "ImageIndex.h"
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+constexpr char kSnapshotMagic[8] = {'D','F','R','I','D','X','\0','\0'};
+constexpr quint32 kSnapshotVersion = 2;
+constexpr quint32 kByteOrderMark = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    quint64 rows;
+    quint64 pathChars;
+    qint64 instance;
+    qint64 generation;
+};
+
+inline quint64 align8(quint64 v) { return (v + 7) & ~quint64(7); }
+
+template <typename T>
+bool writeColumn(QSaveFile& f, const std::vector<T>& col) {
+    const qint64 bytes = qint64(col.size() * sizeof(T));
+    if (bytes && f.write(reinterpret_cast<const char*>(col.data()), bytes) != bytes) return false;
+    static const char pad[8] = {};
+    const qint64 padding = qint64(align8(quint64(bytes)) - quint64(bytes));
+    return padding == 0 || f.write(pad, padding) == padding;
+}
+
+template <typename T>
+bool readColumn(const uchar* base, quint64 fileSize, quint64& offset, quint64 count, std::vector<T>& col) {
+    const quint64 bytes = count * sizeof(T);
+    if (offset + bytes > fileSize) return false;
+    const T* p = reinterpret_cast<const T*>(base + offset);
+    col.assign(p, p + count);
+    offset += align8(bytes);
+    return true;
+}
+}
+
+void ImageIndex::clear() {
+    m_ids.clear();
+    m_phash.clear();
+    m_ahash.clear();
+    m_dhash.clear();
+    m_whash.clear();
+    m_cmoments.clear();
+    m_dims.clear();
+    m_mtime.clear();
+    m_size.clear();
+    m_pathPool.clear();
+    m_pathOffset.assign(1, 0);
+    m_slotById.clear();
+    m_slotByPathHash.clear();
+    m_lookupsValid = false;
+}
+
+void ImageIndex::reserve(int rows, qsizetype pathChars) {
+    m_ids.reserve(rows);
+    m_phash.reserve(rows);
+    m_ahash.reserve(rows);
+    m_dhash.reserve(rows);
+    m_whash.reserve(rows);
+    m_cmoments.reserve(rows);
+    m_dims.reserve(rows);
+    m_mtime.reserve(rows);
+    m_size.reserve(rows);
+    m_pathOffset.reserve(size_t(rows) + 1);
+    if (pathChars > 0) m_pathPool.reserve(size_t(pathChars));
+}
+
+void ImageIndex::appendPath(QStringView path) {
+    const auto* p = reinterpret_cast<const char16_t*>(path.utf16());
+    m_pathPool.insert(m_pathPool.end(), p, p + path.size());
+    m_pathOffset.push_back(m_pathPool.size());
+}
+
+int ImageIndex::append(const ImageEntry& e) {
+    const int slot = size();
+    m_ids.push_back(e.id);
+    m_phash.push_back(e.phash);
+    m_ahash.push_back(e.ahash);
+    m_dhash.push_back(e.dhash);
+    m_whash.push_back(e.whash);
+    m_cmoments.push_back(e.cmoments);
+    m_dims.push_back({e.width, e.height});
+    m_mtime.push_back(e.mtime);
+    m_size.push_back(e.size);
+    appendPath(e.path);
+    if (m_lookupsValid) {
+        m_slotById.insert(e.id, slot);
+        m_slotByPathHash.insert(qHash(QStringView(e.path)), slot);
+    }
+    return slot;
+}
+
+int ImageIndex::upsert(const ImageEntry& e) {
+    const int slot = slotForPath(e.path);
+    if (slot < 0) return append(e);
+    if (m_ids[slot] != e.id && e.id != 0) {
+        m_slotById.remove(m_ids[slot]);
+        m_ids[slot] = e.id;
+        m_slotById.insert(e.id, slot);
+    }
+    m_phash[slot] = e.phash;
+    m_ahash[slot] = e.ahash;
+    m_dhash[slot] = e.dhash;
+    m_whash[slot] = e.whash;
+    m_cmoments[slot] = e.cmoments;
+    m_dims[slot] = {e.width, e.height};
+    m_mtime[slot] = e.mtime;
+    m_size[slot] = e.size;
+    return slot;
+}
+
+int ImageIndex::removeIds(const QSet<qint64>& ids) {
+    if (ids.isEmpty()) return 0;
+    ImageIndex kept;
+    kept.reserve(size(), qsizetype(m_pathPool.size()));
+    for (int i = 0; i < size(); ++i) {
+        if (!ids.contains(m_ids[i])) kept.append(entry(i));
+    }
+    const int removed = size() - kept.size();
+    *this = std::move(kept);
+    return removed;
+}
+
+void ImageIndex::ensureLookups() const {
+    if (m_lookupsValid) return;
+    m_slotById.clear();
+    m_slotByPathHash.clear();
+    m_slotById.reserve(size());
+    m_slotByPathHash.reserve(size());
+    for (int i = 0; i < size(); ++i) {
+        m_slotById.insert(m_ids[i], i);
+        m_slotByPathHash.insert(qHash(pathView(i)), i);
+    }
+    m_lookupsValid = true;
+}
+
+int ImageIndex::slotForId(qint64 id) const {
+    ensureLookups();
+    return m_slotById.value(id, -1);
+}
+
+int ImageIndex::slotForPath(QStringView path) const {
+    ensureLookups();
+    const auto range = m_slotByPathHash.equal_range(qHash(path));
+    for (auto it = range.first; it != range.second; ++it) {
+        if (pathView(*it) == path) return *it;
+    }
+    return -1;
+}
+
+QString ImageIndex::fileName(int slot) const {
+    const QStringView p = pathView(slot);
+    const qsizetype cut = std::max(p.lastIndexOf(u'/'), p.lastIndexOf(u'\\'));
+    return p.mid(cut + 1).toString();
+}
+
+ImageEntry ImageIndex::entry(int slot) const {
+    ImageEntry e;
+    e.id = m_ids[slot];
+    e.path = path(slot);
+    e.mtime = m_mtime[slot];
+    e.size = m_size[slot];
+    e.phash = m_phash[slot];
+    e.ahash = m_ahash[slot];
+    e.dhash = m_dhash[slot];
+    e.whash = m_whash[slot];
+    e.cmoments = m_cmoments[slot];
+    e.width = m_dims[slot].width;
+    e.height = m_dims[slot].height;
+    return e;
+}
+
+qsizetype ImageIndex::memoryUsage() const {
+    qsizetype bytes = 0;
+    bytes += m_ids.capacity() * sizeof(qint64);
+    bytes += (m_phash.capacity() + m_ahash.capacity() + m_dhash.capacity()
+              + m_whash.capacity() + m_cmoments.capacity()) * sizeof(quint64);
+    bytes += m_dims.capacity() * sizeof(Dims);
+    bytes += (m_mtime.capacity() + m_size.capacity()) * sizeof(qint64);
+    bytes += m_pathPool.capacity() * sizeof(char16_t);
+    bytes += m_pathOffset.capacity() * sizeof(quint64);
+    if (m_lookupsValid) {
+        // QHash node + bucket overhead, roughly
+        bytes += m_slotById.size() * qsizetype(sizeof(qint64) + sizeof(int) + 16);
+        bytes += m_slotByPathHash.size() * qsizetype(sizeof(size_t) + sizeof(int) + 24);
+    }
+    return bytes;
+}
+
+bool ImageIndex::saveSnapshot(const QString& file, qint64 instance, qint64 generation) const {
+    QSaveFile f(file);
+    if (!f.open(QIODevice::WriteOnly)) return false;
+    SnapshotHeader h{};
+    std::memcpy(h.magic, kSnapshotMagic, sizeof(h.magic));
+    h.version = kSnapshotVersion;
+    h.byteOrder = kByteOrderMark;
+    h.rows = quint64(size());
+    h.pathChars = quint64(m_pathPool.size());
+    h.instance = instance;
+    h.generation = generation;
+    if (f.write(reinterpret_cast<const char*>(&h), sizeof(h)) != qint64(sizeof(h))) { f.cancelWriting(); return false; }
+    const bool ok = writeColumn(f, m_ids) && writeColumn(f, m_phash) && writeColumn(f, m_ahash)
+        && writeColumn(f, m_dhash) && writeColumn(f, m_whash) && writeColumn(f, m_cmoments)
+        && writeColumn(f, m_dims) && writeColumn(f, m_mtime) && writeColumn(f, m_size) && writeColumn(f, m_pathOffset) && writeColumn(f, m_pathPool);
+    if (!ok) { f.cancelWriting(); return false; }
+    return f.commit();
+}
+
+bool ImageIndex::loadSnapshot(const QString& file, qint64 instance, qint64 generation) {
+    QFile f(file);
+    if (!f.open(QIODevice::ReadOnly)) return false;
+    const quint64 fileSize = quint64(f.size());
+    if (fileSize < sizeof(SnapshotHeader)) return false;
+    const uchar* base = f.map(0, f.size());
+    if (!base) return false;
+
+    SnapshotHeader h;
+    std::memcpy(&h, base, sizeof(h));
+    const bool headerOk = std::memcmp(h.magic, kSnapshotMagic, sizeof(h.magic)) == 0
+        && h.version == kSnapshotVersion && h.byteOrder == kByteOrderMark
+        && h.instance == instance && h.generation == generation
+        && h.rows < (quint64(1) << 31);
+    if (!headerOk) { f.unmap(const_cast<uchar*>(base)); return false; }
+
+    ImageIndex loaded;
+    quint64 offset = align8(sizeof(h));
+    const quint64 n = h.rows;
+    bool ok = readColumn(base, fileSize, offset, n, loaded.m_ids)
+        && readColumn(base, fileSize, offset, n, loaded.m_phash)
+        && readColumn(base, fileSize, offset, n, loaded.m_ahash)
+        && readColumn(base, fileSize, offset, n, loaded.m_dhash)
+        && readColumn(base, fileSize, offset, n, loaded.m_whash)
+        && readColumn(base, fileSize, offset, n, loaded.m_cmoments)
+        && readColumn(base, fileSize, offset, n, loaded.m_dims)
+        && readColumn(base, fileSize, offset, n, loaded.m_mtime)
+        && readColumn(base, fileSize, offset, n, loaded.m_size)
+        && readColumn(base, fileSize, offset, n + 1, loaded.m_pathOffset)
+        && readColumn(base, fileSize, offset, h.pathChars, loaded.m_pathPool);
+    f.unmap(const_cast<uchar*>(base));
+    // The offset table must be monotonic and end exactly at the arena size
+    ok = ok && loaded.m_pathOffset.front() == 0 && loaded.m_pathOffset.back() == h.pathChars
+        && std::is_sorted(loaded.m_pathOffset.begin(), loaded.m_pathOffset.end());
+    if (!ok) return false;
+    *this = std::move(loaded);
+    return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <QtCore>
+#include <vector>
+#include "SqliteStore.h"
+
+// Column-oriented in-memory copy of the images table.
+// Every field lives in its own contiguous array so hash scans only touch the
+// bytes they compare; paths are packed into a single UTF-16 arena.
+class ImageIndex {
+public:
+    struct Dims { qint32 width{0}; qint32 height{0}; };
+
+    int size() const { return int(m_ids.size()); }
+    bool isEmpty() const { return m_ids.empty(); }
+    void clear();
+    void reserve(int rows, qsizetype pathChars = 0);
+
+    // Append a row and return its slot
+    int append(const ImageEntry& e);
+    // Update the row with the same path in place, or append it; returns the slot
+    int upsert(const ImageEntry& e);
+    // Drop rows by id and compact the arrays (slots of the survivors change)
+    int removeIds(const QSet<qint64>& ids);
+
+    int slotForId(qint64 id) const;
+    int slotForPath(QStringView path) const;
+
+    qint64 id(int slot) const { return m_ids[slot]; }
+    quint64 phash(int slot) const { return m_phash[slot]; }
+    quint64 ahash(int slot) const { return m_ahash[slot]; }
+    quint64 dhash(int slot) const { return m_dhash[slot]; }
+    quint64 whash(int slot) const { return m_whash[slot]; }
+    quint64 colorMoments(int slot) const { return m_cmoments[slot]; }
+    Dims dims(int slot) const { return m_dims[slot]; }
+    qint64 mtime(int slot) const { return m_mtime[slot]; }
+    qint64 fileSize(int slot) const { return m_size[slot]; }
+    QStringView pathView(int slot) const {
+        return QStringView(m_pathPool.data() + m_pathOffset[slot], qsizetype(m_pathOffset[slot + 1] - m_pathOffset[slot]));
+    }
+    QString path(int slot) const { return pathView(slot).toString(); }
+    QString fileName(int slot) const;
+    ImageEntry entry(int slot) const;
+
+    // Raw columns for scans
+    const qint64* ids() const { return m_ids.data(); }
+    const quint64* phashes() const { return m_phash.data(); }
+    const quint64* ahashes() const { return m_ahash.data(); }
+    const quint64* dhashes() const { return m_dhash.data(); }
+    const quint64* whashes() const { return m_whash.data(); }
+    const quint64* colorMoments() const { return m_cmoments.data(); }
+    const Dims* dims() const { return m_dims.data(); }
+    const qint64* mtimes() const { return m_mtime.data(); }
+
+    // Heap bytes held by the columns, the path arena and the lookup tables
+    qsizetype memoryUsage() const;
+
+    // Binary snapshot of all columns and the path arena (native byte order).
+    // generation/instance come from SqliteStore and tie the file to one DB state.
+    bool saveSnapshot(const QString& file, qint64 instance, qint64 generation) const;
+    // Maps the file and bulk-copies the columns; fails on any header/size mismatch
+    bool loadSnapshot(const QString& file, qint64 instance, qint64 generation);
+
+private:
+    void appendPath(QStringView path);
+    void ensureLookups() const;
+
+    std::vector<qint64> m_ids;
+    std::vector<quint64> m_phash;
+    std::vector<quint64> m_ahash;
+    std::vector<quint64> m_dhash;
+    std::vector<quint64> m_whash;
+    std::vector<quint64> m_cmoments;
+    std::vector<Dims> m_dims;
+    std::vector<qint64> m_mtime;
+    std::vector<qint64> m_size;
+
+    std::vector<char16_t> m_pathPool;       // all paths back to back, no terminators
+    std::vector<quint64> m_pathOffset{0};   // size()+1 entries into m_pathPool
+
+    // Built on first lookup, dropped on compaction
+    mutable QHash<qint64, int> m_slotById;
+    mutable QMultiHash<size_t, int> m_slotByPathHash;
+    mutable bool m_lookupsValid{false};
+};
@@ -1,80 +1,24 @@
 #include "ImageIndexer.h"
 #include "SqliteStore.h"
 #include "ImageHash.h"
+#include "ColorHistogram.h"
+#include "DecodeBudget.h"
+#include "DirectoryScanner.h"
+#include "EmbeddingModel.h"
+#include "HnswIndex.h"
+#include "ThumbnailPyramid.h"
+#include "VisualVocabulary.h"
+#include "OrbFeatures.h"
+#include "TaskScheduler.h"
 #include <QtWidgets>
 
 namespace {
-static inline int clamp255(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
-
-// Simple and fast 3x3 Gaussian blur
-static QImage gaussianBlur3x3(const QImage& src) {
-    if (src.isNull()) return src;
-    QImage in = src.convertToFormat(QImage::Format_ARGB32_Premultiplied);
-    QImage out(in.size(), in.format());
-    const int w = in.width();
-    const int h = in.height();
-    static const int k[3][3] = {{1,2,1},{2,4,2},{1,2,1}}; // sum=16
-    for (int y = 0; y < h; ++y) {
-        const QRgb* prev = reinterpret_cast<const QRgb*>(in.constScanLine(y > 0 ? y-1 : y));
-        const QRgb* curr = reinterpret_cast<const QRgb*>(in.constScanLine(y));
-        const QRgb* next = reinterpret_cast<const QRgb*>(in.constScanLine(y < h-1 ? y+1 : y));
-        QRgb* dst = reinterpret_cast<QRgb*>(out.scanLine(y));
-        for (int x = 0; x < w; ++x) {
-            int x0 = x > 0 ? x-1 : x;
-            int x2 = x < w-1 ? x+1 : x;
-            int b = 0, g = 0, r = 0, a = 0;
-            auto acc = [&](const QRgb* line, int xi, int ky){
-                const QRgb p0 = line[x0];
-                const QRgb p1 = line[xi];
-                const QRgb p2 = line[x2];
-                b += k[ky][0]*qBlue(p0) + k[ky][1]*qBlue(p1) + k[ky][2]*qBlue(p2);
-                g += k[ky][0]*qGreen(p0) + k[ky][1]*qGreen(p1) + k[ky][2]*qGreen(p2);
-                r += k[ky][0]*qRed(p0) + k[ky][1]*qRed(p1) + k[ky][2]*qRed(p2);
-                a += k[ky][0]*qAlpha(p0) + k[ky][1]*qAlpha(p1) + k[ky][2]*qAlpha(p2);
-            };
-            acc(prev, x, 0);
-            acc(curr, x, 1);
-            acc(next, x, 2);
-            dst[x] = qRgba(b/16, g/16, r/16, a/16);
-        }
-    }
-    return out;
-}
+// Descriptors from this many images train the vocabulary once enough are cached
+constexpr int kVocabularyMinImages = 100;
+constexpr int kVocabularySampleImages = 500;
 
-// Unsharp mask to boost perceived sharpness after downscaling
-static QImage unsharpMask(const QImage& src, double amount = 0.6, int threshold = 2) {
-    if (src.isNull() || amount <= 0.0) return src;
-    QImage in = src.convertToFormat(QImage::Format_ARGB32_Premultiplied);
-    QImage blur = gaussianBlur3x3(in);
-    QImage out(in.size(), in.format());
-    const int w = in.width();
-    const int h = in.height();
-    for (int y = 0; y < h; ++y) {
-        const QRgb* s = reinterpret_cast<const QRgb*>(in.constScanLine(y));
-        const QRgb* b = reinterpret_cast<const QRgb*>(blur.constScanLine(y));
-        QRgb* d = reinterpret_cast<QRgb*>(out.scanLine(y));
-        for (int x = 0; x < w; ++x) {
-            int sr = qRed(s[x]), sg = qGreen(s[x]), sb = qBlue(s[x]), sa = qAlpha(s[x]);
-            int br = qRed(b[x]), bg = qGreen(b[x]), bb = qBlue(b[x]);
-            int dr = sr - br, dg = sg - bg, db = sb - bb;
-            if (std::abs(dr) < threshold) dr = 0;
-            if (std::abs(dg) < threshold) dg = 0;
-            if (std::abs(db) < threshold) db = 0;
-            int rr = clamp255(int(sr + amount * dr));
-            int rg = clamp255(int(sg + amount * dg));
-            int rb = clamp255(int(sb + amount * db));
-            d[x] = qRgba(rr, rg, rb, sa);
-        }
-    }
-    return out;
-}
-
-static QImage downscaleHQ(const QImage& src, int maxSide) {
-    if (src.isNull()) return src;
-    QSize target = src.size();
-    target.scale(maxSide, maxSide, Qt::KeepAspectRatio);
-    QImage scaled = src.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-    return unsharpMask(scaled, 0.5, 1);
+static QByteArray packWords(const std::vector<quint32>& words) {
+    return QByteArray(reinterpret_cast<const char*>(words.data()), int(words.size() * sizeof(quint32)));
 }
 }
 
@@ -86,79 +30,250 @@ bool ImageIndexer::isImageFile(const QString& path) {
     return exts.contains("."+l);
 }
 
-void ImageIndexer::startIndex(const QString& folder) {
+ImageIndexer::Profile ImageIndexer::profileFromSettings() {
+    return QSettings().value("index/profile", "full").toString() == QLatin1String("hashes") ? Profile::HashOnly : Profile::Full;
+}
+
+void ImageIndexer::saveProfile(Profile profile) {
+    QSettings().setValue("index/profile", profile == Profile::HashOnly ? "hashes" : "full");
+}
+
+void ImageIndexer::startIndex(const QString& folder, const QString& shardDir) {
     if (m_future.isRunning()) return;
-    m_future = QtConcurrent::run([this, folder]{ doIndex(folder); });
+    const Profile profile = profileFromSettings();
+    m_cancel = false;
+    m_shardDir = shardDir;
+    m_future = TaskScheduler::run(TaskScheduler::Priority::Background, [this, folder, shardDir, profile]{ doIndex(folder, shardDir, profile); });
 }
 
-void ImageIndexer::doIndex(const QString& folder) {
+void ImageIndexer::cancel() {
+    m_cancel = true;
+    m_future.waitForFinished();
+}
+
+void ImageIndexer::storeFeatures(SqliteStore& store, qint64 imageId, const QImage& featureLevel, const VisualVocabulary& vocab) {
+    if (featureLevel.isNull()) return;
+    store.upsertHistogram(imageId, ColorHistogram::compute(featureLevel));
+#ifdef HAVE_OPENCV
+    thread_local cv::Mat bgr;
+    OrbFeatures::toBgrMat(featureLevel, bgr);
+    const cv::Mat desc = OrbFeatures::describe(bgr);
+    QByteArray words;
+    if (!vocab.isEmpty() && !desc.empty()) words = packWords(vocab.quantizeAll(desc.ptr<quint8>(), desc.rows));
+    store.upsertFeatures(imageId, OrbFeatures::pack(desc), words);
+#else
+    Q_UNUSED(vocab);
+#endif
+}
+
+void ImageIndexer::doIndex(const QString& folder, const QString& shardDir, Profile profile) {
     QDir dir(folder);
     if (!dir.exists()) { emit finished(); return; }
 
-    // Open DB under app data dir
-    const QString appData = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
-    QDir().mkpath(appData);
+    // Open the shard's DB (under app data dir, so offline roots stay searchable)
+    QDir().mkpath(shardDir);
     SqliteStore store;
-    if (!store.open(appData + "/index.db")) {
+    if (!store.open(shardDir + "/index.db")) {
         qWarning() << "Failed to open DB";
         emit finished(); return;
     }
 
-    // Enumerate files
-    QStringList files;
-    QDirIterator it(folder, QDir::Files, QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        const QString p = it.next();
-        if (isImageFile(p)) files.push_back(p);
-    }
-
-    const int total = files.size();
+    // The walk is streamed: each directory is indexed as soon as it has been read, so the
+    // total grows while indexing runs
+    const auto scanOpts = DirectoryScanner::Options::fromSettings();
+    int found = 0;
     int indexed = 0;
-    emit progress(indexed, total);
+    emit progress(indexed, found);
+    const bool hashOnly = profile == Profile::HashOnly;
+    QElapsedTimer elapsed;
+    elapsed.start();
 
     // Thumbnail dir
-    const QString thumbDir = appData + "/thumbs";
+    const QString thumbDir = shardDir + "/thumbs";
     QDir().mkpath(thumbDir);
+    const auto thumbOpts = ThumbnailPyramid::Options::fromSettings();
+    const int featureLevel = thumbOpts.pickSize(256);
 
-    for (const QString& path : files) {
-        QFileInfo fi(path);
-        ImageEntry e;
-        e.path = QDir::toNativeSeparators(fi.absoluteFilePath());
-        e.size = fi.size();
-        e.mtime = fi.lastModified().toSecsSinceEpoch();
-
-        QImageReader reader(path);
-        reader.setAutoTransform(true);
-        // Decode at a bounded size to avoid huge memory use
-        const int maxDecodeDim = 4096;
-        const QSize origSize = reader.size();
-        if (origSize.isValid()) {
-            QSize tgt = origSize;
-            tgt.scale(maxDecodeDim, maxDecodeDim, Qt::KeepAspectRatio);
-            reader.setScaledSize(tgt);
-        }
-        QImage img = reader.read();
-        if (!img.isNull()) {
-            e.width = img.width();
-            e.height = img.height();
-            e.phash = ImageHash::pHash(img);
-            e.ahash = ImageHash::aHash(img);
-            e.dhash = ImageHash::dHash(img);
-
-            // Save thumbnails at 256 and 384 for better clarity
-            const QString base = thumbDir + "/" + QString::number(qHash(e.path));
-            QImage th256 = downscaleHQ(img, 256);
-            QImage th384 = downscaleHQ(img, 384);
-            th256.save(base + "_256.jpg", "JPG", 92);
-            th384.save(base + "_384.jpg", "JPG", 92);
-        }
+    VisualVocabulary vocab;
+    vocab.deserialize(store.loadVocabulary());
+    const bool dihedral = ImageHash::dihedralEnabled();
+    const bool regions = ImageHash::regionHashesEnabled();
+    QVector<quint64> regionCodes;
+
+    // Embeddings of the feature level, batched; rows that kept theirs are skipped
+    const auto embedOpts = EmbeddingModel::Options::fromSettings();
+    std::unique_ptr<EmbeddingModel::Batch> embeddings;
+    QSet<qint64> embedded;
+    if (!hashOnly && embedOpts.enabled()) {
+        embeddings = std::make_unique<EmbeddingModel::Batch>(store, embedOpts);
+        if (embeddings->isValid()) embedded = store.idsWithEmbeddings();
+        else embeddings.reset();
+    }
+    int embeddedCount = 0;
+    const auto flushEmbeddings = [&] {
+        store.transaction();
+        embeddedCount += embeddings->flush();
+        store.commit();
+    };
+
+    // Hand rows to the GUI in time-sliced batches so it can merge them incrementally
+    QList<ImageEntry> batch;
+    QElapsedTimer sinceBatch;
+    sinceBatch.start();
+    QList<QPair<int, QImage>> levels;
+    std::array<quint64, 8> variants{};
+    // The decode buffer lives across files; most of a library shares a few sizes
+    QImage img;
+    QSet<qint64> seen;
+    DirectoryScanner::scan(folder, scanOpts, [](const QString& name){ return isImageFile(name); },
+                           [&](std::vector<DirectoryScanner::Entry>& files) {
+        found += int(files.size());
+        for (size_t i = 0; i < files.size(); ++i) {
+            // Step aside while the user searches or scrolls
+            TaskScheduler::yieldToInteractive();
+            if (m_cancel) return false;
+            // Keep the next few files streaming in while this one decodes
+            if (scanOpts.readahead > 0) {
+                if (i == 0) {
+                    for (size_t j = 0; j < std::min(files.size(), size_t(scanOpts.readahead)); ++j) DirectoryScanner::prefetch(files[j].path);
+                } else if (i + size_t(scanOpts.readahead) - 1 < files.size()) {
+                    DirectoryScanner::prefetch(files[i + size_t(scanOpts.readahead) - 1].path);
+                }
+            }
+            const DirectoryScanner::Entry& f = files[i];
+            ImageEntry e;
+            e.path = f.path;
+            e.size = f.size;
+            e.mtime = f.mtime;
+
+            QImageReader reader(f.path);
+            reader.setAutoTransform(true);
+            // Decode at a bounded size to avoid huge memory use
+            const int maxDecodeDim = 4096;
+            const QSize origSize = reader.size();
+            if (origSize.isValid()) {
+                QSize tgt = origSize;
+                tgt.scale(maxDecodeDim, maxDecodeDim, Qt::KeepAspectRatio);
+                reader.setScaledSize(tgt);
+            }
+            // Charged against the decode budget until this file is done
+            DecodeBudget::Lease lease;
+            if (!lease.read(reader, &img)) img = QImage();
+            if (!img.isNull()) {
+                e.width = img.width();
+                e.height = img.height();
+                if (dihedral) {
+                    // Same DCT; variant 0 is the plain pHash
+                    variants = ImageHash::pHashDihedral(img);
+                    e.phash = variants[0];
+                } else {
+                    e.phash = ImageHash::pHash(img);
+                }
+                e.ahash = ImageHash::aHash(img);
+                e.dhash = ImageHash::dHash(img);
+                const auto compact = ImageHash::compact(img);
+                e.whash = compact.whash;
+                e.cmoments = compact.cmoments;
 
-        store.upsertImage(e);
+                if (regions) regionCodes = ImageHash::regionHashes(img);
 
-        ++indexed;
-        if (indexed % 10 == 0) emit progress(indexed, total);
+                // Save the configured thumbnail levels (384 and 256 by default)
+                if (!hashOnly) ThumbnailPyramid::generate(img, thumbDir, e.path, thumbOpts, &levels);
+            }
+
+            const SqliteStore::ThumbState thumbs = !hashOnly ? SqliteStore::ThumbsReady
+                : img.isNull() ? SqliteStore::ThumbsFailed : SqliteStore::ThumbsPending;
+            bool changed = false;
+            if (store.upsertImage(e, &e.id, thumbs, hashOnly ? &changed : nullptr)) {
+                seen.insert(e.id);
+                // Thumbnail names depend on the path only; a changed file's old pyramid would
+                // be shown and fed to the backfill
+                if (changed) ThumbnailPyramid::remove(thumbDir, e.path, thumbOpts);
+                // A changed file lost its vector to the update trigger just now
+                if (embedded.contains(e.id) && !store.hasEmbedding(e.id)) embedded.remove(e.id);
+                batch.push_back(e);
+                if (dihedral && !img.isNull())
+                    store.upsertHashVariants(e.id, QByteArray(reinterpret_cast<const char*>(variants.data()), int(sizeof(variants))));
+                if (regions && !regionCodes.isEmpty())
+                    store.upsertRegionHashes(e.id, QByteArray(reinterpret_cast<const char*>(regionCodes.constData()), int(regionCodes.size() * sizeof(quint64))));
+                for (const auto& lv : levels) {
+                    if (lv.first != featureLevel) continue;
+                    storeFeatures(store, e.id, lv.second, vocab);
+                    if (embeddings && !embedded.contains(e.id) && embeddings->add(e.id, lv.second)) flushEmbeddings();
+                }
+            }
+            levels.clear();
+            regionCodes.clear();
+
+            ++indexed;
+            if (sinceBatch.elapsed() >= 250) {
+                emit entriesIndexed(shardDir, batch);
+                batch.clear();
+                sinceBatch.restart();
+            }
+            if (indexed % 10 == 0) emit progress(indexed, found);
+        }
+        return true;
+    });
+    const int total = found;
+    if (m_cancel) {
+        // The shard is going away; an incomplete walk must not prune rows either
+        qInfo() << "Indexing of" << folder << "cancelled after" << indexed << "images";
+        emit finished();
+        return;
     }
+    if (embeddings && embeddings->pending() > 0) flushEmbeddings();
+
+    if (!batch.isEmpty()) emit entriesIndexed(shardDir, batch);
 
+    // Rows of this subtree the walk did not produce; only those whose file is really gone
+    // are deleted, so a directory that failed to list keeps its rows
+    QList<qint64> stale;
+    const QString nativeFolder = QDir::toNativeSeparators(QDir::cleanPath(dir.absolutePath()));
+    store.transaction();
+    for (const ImageEntry& old : store.loadUnder(nativeFolder)) {
+        if (seen.contains(old.id) || QFileInfo::exists(old.path)) continue;
+        if (store.removeByPath(old.path)) stale.push_back(old.id);
+    }
+    store.commit();
+    if (!stale.isEmpty()) {
+        qInfo() << "Removed" << stale.size() << "rows under" << nativeFolder << "whose files are gone";
+        emit entriesRemoved(shardDir, stale);
+    }
+    const double secs = qMax<qint64>(1, elapsed.elapsed()) / 1000.0;
+    qInfo().noquote() << QString("Indexed %1 images in %2 s (%3 images/s, %4 profile)")
+                         .arg(indexed).arg(secs, 0, 'f', 1).arg(indexed / secs, 0, 'f', 1).arg(hashOnly ? "hash-only" : "full");
+    if (!hashOnly) updateVocabulary(store, vocab);
+    if (embeddings) {
+        qInfo() << "Embedded" << embeddedCount << "images";
+        HnswIndex graph;
+        EmbeddingModel::syncIndex(store, embedOpts, graph, EmbeddingModel::indexPath(shardDir));
+    }
     emit progress(total, total);
     emit finished();
 }
+
+void ImageIndexer::updateVocabulary(SqliteStore& store, VisualVocabulary& vocab) {
+    if (vocab.isEmpty()) {
+        if (store.featureCount() < kVocabularyMinImages) return;
+        const QByteArray sample = store.sampleDescriptors(kVocabularySampleImages);
+        QElapsedTimer timer;
+        timer.start();
+        vocab.train(reinterpret_cast<const quint8*>(sample.constData()), int(sample.size() / VisualVocabulary::kDescBytes));
+        if (vocab.isEmpty() || !store.saveVocabulary(vocab.serialize())) return;
+        qInfo() << "Trained visual vocabulary:" << vocab.wordCount() << "words from"
+                << sample.size() / VisualVocabulary::kDescBytes << "descriptors in" << timer.elapsed() << "ms";
+    }
+    // Quantize everything cached before the vocabulary existed
+    const QList<qint64> pending = store.idsWithoutWords();
+    for (int i = 0; i < pending.size(); i += 256) {
+        const QList<qint64> chunk = pending.mid(i, 256);
+        const auto descs = store.loadDescriptors(chunk);
+        store.transaction();
+        for (auto it = descs.constBegin(); it != descs.constEnd(); ++it) {
+            const auto* d = reinterpret_cast<const quint8*>(it.value().constData());
+            store.updateWords(it.key(), packWords(vocab.quantizeAll(d, int(it.value().size() / VisualVocabulary::kDescBytes))));
+        }
+        store.commit();
+    }
+}
@@ -1,23 +1,53 @@
 #pragma once
 #include <QtCore>
 #include <QtConcurrent>
+#include <atomic>
+#include "SqliteStore.h"
 
-class SqliteStore;
+class QImage;
+class VisualVocabulary;
 
 class ImageIndexer : public QObject {
     Q_OBJECT
 public:
     explicit ImageIndexer(QObject* parent=nullptr);
 
-    void startIndex(const QString& folder);
+    // Full writes thumbnails, color histogram and ORB descriptors with the hashes; HashOnly
+    // stores the hashes and leaves the rest to ThumbnailBackfill (QSettings index/profile)
+    enum class Profile { Full, HashOnly };
+    static Profile profileFromSettings();
+    static void saveProfile(Profile profile);
+
+    // Index folder into the shard directory shardDir (index.db and thumbs/ below it) with the configured profile.
+    // folder may be a subtree of the shard's root; rows under it whose files are gone are deleted.
+    void startIndex(const QString& folder, const QString& shardDir);
+    bool isRunning() const { return m_future.isRunning(); }
+    // Shard directory of the current or last run
+    const QString& shardDir() const { return m_shardDir; }
+    // Stop after the current file and wait; rows of the partial walk stay, nothing is pruned
+    void cancel();
+    // Same without waiting; finished() follows once the current file is done
+    void requestCancel() { m_cancel = true; }
+    static bool isImageFile(const QString& path);
+
+    // Color histogram and ORB descriptors (with visual words once vocab is trained) of the
+    // thumbnail level search scores, so search never decodes or re-detects it
+    static void storeFeatures(SqliteStore& store, qint64 imageId, const QImage& featureLevel, const VisualVocabulary& vocab);
+    // Train the vocabulary once enough descriptors are cached, then quantize pending rows
+    static void updateVocabulary(SqliteStore& store, VisualVocabulary& vocab);
 
 signals:
     void progress(int indexed, int total);
+    // Rows written to shardDir since the last batch (ids filled in), for incremental index updates
+    void entriesIndexed(const QString& shardDir, const QList<ImageEntry>& entries);
+    // Rows deleted from shardDir because their files no longer exist
+    void entriesRemoved(const QString& shardDir, const QList<qint64>& ids);
     void finished();
 
 private:
-    void doIndex(const QString& folder);
-    static bool isImageFile(const QString& path);
+    void doIndex(const QString& folder, const QString& shardDir, Profile profile);
 
     QFuture<void> m_future;
+    QString m_shardDir;
+    std::atomic<bool> m_cancel{false};
 };
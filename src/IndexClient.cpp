@@ -0,0 +1,97 @@
+#include "IndexClient.h"
+
+using namespace IndexProtocol;
+
+bool IndexClient::connectToService(int timeoutMs) {
+    m_socket.connectToServer(serverName());
+    return m_socket.waitForConnected(timeoutMs);
+}
+
+quint32 IndexClient::send(Op op, const QByteArray& payload) {
+    const quint32 id = m_nextId++;
+    m_socket.write(frame(id, quint8(op), payload));
+    return id;
+}
+
+bool IndexClient::receive(quint32 id, Status* status, QByteArray* payload) {
+    auto early = m_early.find(id);
+    if (early != m_early.end()) {
+        *status = Status(early->first);
+        *payload = early->second;
+        m_early.erase(early);
+        return true;
+    }
+    m_socket.flush();
+    const QDeadlineTimer deadline(m_replyTimeoutMs);
+    for (;;) {
+        quint32 rid = 0;
+        quint8 code = 0;
+        QByteArray body;
+        bool bad = false;
+        while (takeFrame(m_buffer, &rid, &code, &body, &bad)) {
+            if (rid == id) {
+                *status = Status(code);
+                *payload = body;
+                return true;
+            }
+            m_early.insert(rid, {code, body});
+        }
+        if (bad) {
+            m_socket.abort();
+            return false;
+        }
+        // Searches over large libraries may take a while; without a timeout only a dropped
+        // connection ends the wait
+        if (!m_socket.waitForReadyRead(int(deadline.remainingTime()))) {
+            if (m_socket.state() == QLocalSocket::ConnectedState) {
+                qWarning() << "Index service did not answer within" << m_replyTimeoutMs << "ms";
+                m_socket.abort();
+            }
+            return false;
+        }
+        m_buffer += m_socket.readAll();
+    }
+}
+
+bool IndexClient::search(Op op, const QStringList& queries, int topK, int maxHamming, QList<QList<Hit>>* out,
+                         const SearchFilter& filter) {
+    QList<quint32> ids;
+    ids.reserve(queries.size());
+    for (const QString& q : queries) {
+        QByteArray payload;
+        QDataStream ds(&payload, QIODevice::WriteOnly);
+        prepare(ds);
+        ds << QFileInfo(q).absoluteFilePath() << qint32(topK) << qint32(maxHamming) << filter;
+        ids.push_back(send(op, payload));
+    }
+    out->clear();
+    for (quint32 id : ids) {
+        Status status = Status::Ok;
+        QByteArray payload;
+        if (!receive(id, &status, &payload)) return false;
+        QList<Hit> hits;
+        if (status == Status::Ok && !decodeHits(payload, &hits)) return false;
+        out->push_back(hits);
+    }
+    return true;
+}
+
+bool IndexClient::batchQuery(const QStringList& queries, const BatchQuery::Options& opts,
+                             QList<BatchQuery::Report>* reports, QHash<qint64, QString>* paths) {
+    QByteArray payload;
+    QDataStream ds(&payload, QIODevice::WriteOnly);
+    prepare(ds);
+    QStringList absolute;
+    for (const QString& q : queries) absolute << QFileInfo(q).absoluteFilePath();
+    ds << absolute << qint32(opts.maxHamming) << qint32(opts.maxMatches) << opts.minOrbScore;
+    Status status = Status::Ok;
+    QByteArray reply;
+    if (!receive(send(Op::BatchQuery, payload), &status, &reply) || status != Status::Ok) return false;
+    return decodeReports(reply, reports, paths);
+}
+
+bool IndexClient::reload() {
+    Status status = Status::Ok;
+    QByteArray reply;
+    return receive(send(Op::Reload), &status, &reply) && status == Status::Ok;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <QtCore>
+#include <QLocalSocket>
+#include "IndexProtocol.h"
+
+// Thin client of a running differ --serve. Blocking, for the CLI and one-off GUI calls.
+// send() only queues a request, so many can be in flight before the first receive().
+class IndexClient {
+public:
+    // Each receive() gives up after replyTimeoutMs (and drops the connection, later replies
+    // would be out of step); -1 waits as long as the connection lives. The GUI always bounds
+    // it and falls back to its own index.
+    explicit IndexClient(int replyTimeoutMs = -1) : m_replyTimeoutMs(replyTimeoutMs) {}
+
+    // False quickly when no service is running
+    bool connectToService(int timeoutMs = 300);
+    bool isConnected() const { return m_socket.state() == QLocalSocket::ConnectedState; }
+
+    quint32 send(IndexProtocol::Op op, const QByteArray& payload = {});
+    // Waits for the reply to request id; false if the connection dropped or the timeout passed
+    bool receive(quint32 id, IndexProtocol::Status* status, QByteArray* payload);
+
+    // One search request per query, all pipelined; out has one hit list per query
+    bool search(IndexProtocol::Op op, const QStringList& queries, int topK, int maxHamming,
+                QList<QList<IndexProtocol::Hit>>* out, const SearchFilter& filter = {});
+    bool batchQuery(const QStringList& queries, const BatchQuery::Options& opts,
+                    QList<BatchQuery::Report>* reports, QHash<qint64, QString>* paths);
+    // Ask the service to re-read the library after this process changed it
+    bool reload();
+
+private:
+    int m_replyTimeoutMs;
+    QLocalSocket m_socket;
+    QByteArray m_buffer;
+    quint32 m_nextId{1};
+    QHash<quint32, QPair<quint8, QByteArray>> m_early;   // replies read while waiting for another
+};
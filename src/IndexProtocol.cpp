@@ -0,0 +1,103 @@
+#include "IndexProtocol.h"
+
+namespace IndexProtocol {
+
+QString serverName() {
+    return QStringLiteral("differ-index-%1").arg(qHash(QDir::homePath()), 8, 16, QLatin1Char('0'));
+}
+
+QDataStream& prepare(QDataStream& ds) {
+    ds.setVersion(QDataStream::Qt_6_2);
+    return ds;
+}
+
+QByteArray frame(quint32 id, quint8 code, const QByteArray& payload) {
+    QByteArray out;
+    out.reserve(9 + payload.size());
+    QDataStream ds(&out, QIODevice::WriteOnly);
+    prepare(ds);
+    ds << quint32(4 + 1 + payload.size()) << id << code;
+    ds.writeRawData(payload.constData(), int(payload.size()));
+    return out;
+}
+
+bool takeFrame(QByteArray& buffer, quint32* id, quint8* code, QByteArray* payload, bool* bad) {
+    *bad = false;
+    if (buffer.size() < 4) return false;
+    QDataStream ds(buffer);
+    prepare(ds);
+    quint32 len = 0;
+    ds >> len;
+    if (len < 5 || len > kMaxFrame) { *bad = true; return false; }
+    if (buffer.size() < qsizetype(4 + len)) return false;
+    ds >> *id >> *code;
+    *payload = buffer.mid(9, len - 5);
+    buffer.remove(0, 4 + len);
+    return true;
+}
+
+QByteArray encodeHits(const QList<Hit>& hits) {
+    QByteArray out;
+    QDataStream ds(&out, QIODevice::WriteOnly);
+    prepare(ds);
+    ds << quint32(hits.size());
+    for (const Hit& h : hits) ds << h.id << qint32(h.distance) << h.path;
+    return out;
+}
+
+bool decodeHits(const QByteArray& payload, QList<Hit>* hits) {
+    QDataStream ds(payload);
+    prepare(ds);
+    quint32 n = 0;
+    ds >> n;
+    hits->clear();
+    for (quint32 i = 0; i < n && ds.status() == QDataStream::Ok; ++i) {
+        Hit h;
+        qint32 d = 0;
+        ds >> h.id >> d >> h.path;
+        h.distance = d;
+        hits->push_back(h);
+    }
+    return ds.status() == QDataStream::Ok;
+}
+
+QByteArray encodeReports(const QList<BatchQuery::Report>& reports, const std::function<QString(qint64)>& pathOf) {
+    QByteArray out;
+    QDataStream ds(&out, QIODevice::WriteOnly);
+    prepare(ds);
+    QHash<qint64, QString> paths;
+    ds << quint32(reports.size());
+    for (const auto& r : reports) {
+        ds << r.query << r.readable << quint32(r.matches.size());
+        for (const auto& m : r.matches) {
+            ds << m.id << qint32(m.hamming) << m.orbScore;
+            if (!paths.contains(m.id)) paths.insert(m.id, pathOf(m.id));
+        }
+    }
+    ds << paths;
+    return out;
+}
+
+bool decodeReports(const QByteArray& payload, QList<BatchQuery::Report>* reports, QHash<qint64, QString>* paths) {
+    QDataStream ds(payload);
+    prepare(ds);
+    quint32 n = 0;
+    ds >> n;
+    reports->clear();
+    for (quint32 i = 0; i < n && ds.status() == QDataStream::Ok; ++i) {
+        BatchQuery::Report r;
+        quint32 matches = 0;
+        ds >> r.query >> r.readable >> matches;
+        for (quint32 j = 0; j < matches && ds.status() == QDataStream::Ok; ++j) {
+            BatchQuery::Match m;
+            qint32 hamming = 0;
+            ds >> m.id >> hamming >> m.orbScore;
+            m.hamming = hamming;
+            r.matches.push_back(m);
+        }
+        reports->push_back(r);
+    }
+    ds >> *paths;
+    return ds.status() == QDataStream::Ok;
+}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <QtCore>
+#include "BatchQuery.h"
+#include "SearchFilter.h"
+
+// Wire format of the resident index (differ --serve) over a QLocalSocket.
+// Every message is a frame: quint32 body length, then the body. A request body is
+// quint32 id, quint8 Op, payload; a reply body is quint32 id, quint8 Status, payload.
+// Payloads are QDataStream (Qt 6.2 format). Clients may pipeline any number of
+// requests; the service answers each connection's requests in order.
+namespace IndexProtocol {
+    enum class Op : quint8 {
+        Ping = 0,
+        SearchHamming,   // QString path, qint32 topK, qint32 maxHamming[, SearchFilter] -> hits
+        SearchSimilar,   // same payload -> hits
+        SearchFused,     // same payload (maxHamming unused) -> hits
+        SearchCrops,     // same payload -> hits
+        BatchQuery,      // QStringList queries, qint32 maxHamming, qint32 maxMatches, double minOrbScore -> reports
+        Index,           // QString folder -> QString shard dir; indexing continues in the service
+        Reload,          // re-read roots and shards after another process changed them -> nothing
+        Remove,          // QStringList paths -> qint32 removed
+        SearchEmbedding, // same payload as SearchHamming (maxHamming unused) -> hits
+    };
+    enum class Status : quint8 { Ok = 0, BadRequest, Failed, Busy };
+
+    // Frames above this are a protocol error and drop the connection
+    constexpr quint32 kMaxFrame = 64u << 20;
+
+    // Per user, so two accounts on one machine never share an index
+    QString serverName();
+
+    QByteArray frame(quint32 id, quint8 code, const QByteArray& payload);
+    // Pops the next complete frame off buffer; false if none is complete yet.
+    // *bad is set (and false returned) for a frame that can never be valid.
+    bool takeFrame(QByteArray& buffer, quint32* id, quint8* code, QByteArray* payload, bool* bad);
+
+    QDataStream& prepare(QDataStream& ds);
+
+    // Search results carry the path, so clients need no index of their own
+    struct Hit { qint64 id; int distance; QString path; };
+    QByteArray encodeHits(const QList<Hit>& hits);
+    bool decodeHits(const QByteArray& payload, QList<Hit>* hits);
+
+    // Reports plus the paths of every matched id
+    QByteArray encodeReports(const QList<BatchQuery::Report>& reports, const std::function<QString(qint64)>& pathOf);
+    bool decodeReports(const QByteArray& payload, QList<BatchQuery::Report>* reports, QHash<qint64, QString>* paths);
+}
@@ -0,0 +1,246 @@
+#include "IndexService.h"
+#include "ImageIndexer.h"
+#include "IndexClient.h"
+#include "TaskScheduler.h"
+#include "ThumbnailModel.h"
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <utility>
+
+using namespace IndexProtocol;
+
+namespace {
+QList<Hit> toHits(const ThumbnailModel& model, const QList<ThumbnailModel::ResultItem>& results) {
+    QList<Hit> hits;
+    hits.reserve(results.size());
+    for (const auto& r : results) hits.push_back({r.id, r.distance, model.pathForId(r.id)});
+    return hits;
+}
+}
+
+IndexService::IndexService(QObject* parent) : QObject(parent) {
+    // Created here (its placeholder icon needs the GUI thread), then handed to the query thread
+    m_model = new ThumbnailModel;
+    m_queryThread.setObjectName("IndexService query");
+    m_model->moveToThread(&m_queryThread);
+    m_queryThread.start();
+    m_indexer = new ImageIndexer(this);
+    m_server = new QLocalServer(this);
+    m_server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(m_server, &QLocalServer::newConnection, this, &IndexService::onNewConnection);
+    // Queued to the query thread, ahead of the finished() work posted from here
+    connect(m_indexer, &ImageIndexer::entriesIndexed, m_model, &ThumbnailModel::applyIndexed);
+    connect(m_indexer, &ImageIndexer::entriesRemoved, m_model, &ThumbnailModel::applyRemoved);
+    connect(m_indexer, &ImageIndexer::finished, this, &IndexService::onIndexFinished);
+}
+
+IndexService::~IndexService() {
+    m_indexer->cancel();
+    // The shard stores are closed on the thread that opened them
+    QMetaObject::invokeMethod(m_model, [model = m_model]{ delete model; }, Qt::BlockingQueuedConnection);
+    m_queryThread.quit();
+    m_queryThread.wait();
+}
+
+bool IndexService::start() {
+    // A live service answers; a stale socket file from a crashed one is removed
+    IndexClient probe;
+    if (probe.connectToService()) {
+        qWarning() << "An index service is already running on" << serverName();
+        return false;
+    }
+    QLocalServer::removeServer(serverName());
+
+    QElapsedTimer timer;
+    timer.start();
+    QMetaObject::invokeMethod(m_model, [this]{
+        m_model->loadAll();
+        m_model->warmUp();
+        m_model->backfillThumbnails();
+        m_model->updateNeighborGraph();
+    }, Qt::BlockingQueuedConnection);
+    if (!m_server->listen(serverName())) {
+        qWarning() << "Cannot listen on" << serverName() << ":" << m_server->errorString();
+        return false;
+    }
+    qInfo() << "Index service ready on" << m_server->fullServerName() << "after" << timer.elapsed() << "ms";
+    return true;
+}
+
+void IndexService::onModel(std::function<void()> fn) {
+    QMetaObject::invokeMethod(m_model, std::move(fn), Qt::QueuedConnection);
+}
+
+void IndexService::onNewConnection() {
+    while (QLocalSocket* socket = m_server->nextPendingConnection()) {
+        m_buffers.insert(socket, {});
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]{ onReadyRead(socket); });
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]{
+            m_buffers.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void IndexService::onReadyRead(QLocalSocket* socket) {
+    QByteArray& buffer = m_buffers[socket];
+    buffer += socket->readAll();
+    // Start every complete request that arrived; pipelined ones are already queued here
+    quint32 id = 0;
+    quint8 code = 0;
+    QByteArray payload;
+    bool bad = false;
+    const QPointer<IndexService> self(this);
+    const QPointer<QLocalSocket> guard(socket);
+    while (takeFrame(buffer, &id, &code, &payload, &bad)) {
+        handle(Op(code), payload, [self, guard, id](Status status, const QByteArray& reply) {
+            // Pool jobs may finish after the service is gone, and a client may go away first;
+            // qApp outlives both and the guards are checked there
+            QMetaObject::invokeMethod(QCoreApplication::instance(), [self, guard, id, status, reply]{
+                if (!self) return;
+                if (guard) guard->write(frame(id, quint8(status), reply));
+                ++self->m_served;
+            }, Qt::QueuedConnection);
+        });
+    }
+    if (bad) {
+        qWarning() << "Dropping client after a malformed frame";
+        socket->disconnectFromServer();
+    }
+}
+
+void IndexService::handle(Op op, const QByteArray& payload, const Reply& reply) {
+    QDataStream in(payload);
+    prepare(in);
+    switch (op) {
+    case Op::Ping: {
+        QByteArray out;
+        QDataStream ds(&out, QIODevice::WriteOnly);
+        prepare(ds);
+        ds << m_served;
+        reply(Status::Ok, out);
+        return;
+    }
+    case Op::SearchHamming:
+    case Op::SearchSimilar:
+    case Op::SearchFused:
+    case Op::SearchCrops:
+    case Op::SearchEmbedding: {
+        QString path;
+        qint32 topK = 0, maxHamming = 0;
+        SearchFilter filter;
+        in >> path >> topK >> maxHamming;
+        // Older clients send no filter
+        if (!in.atEnd()) in >> filter;
+        if (in.status() != QDataStream::Ok || topK <= 0) break;
+        onModel([this, op, path, topK, maxHamming, filter, reply]{
+            QList<ThumbnailModel::ResultItem> results;
+            if (op == Op::SearchHamming) results = m_model->searchHamming(path, topK, maxHamming, filter);
+            else if (op == Op::SearchSimilar) results = m_model->searchSimilar(path, topK, maxHamming, filter);
+            else if (op == Op::SearchFused) results = m_model->searchFused(path, topK, filter);
+            else if (op == Op::SearchEmbedding) results = m_model->searchEmbedding(path, topK, filter);
+            else results = m_model->searchCrops(path, topK, maxHamming, filter);
+            reply(Status::Ok, encodeHits(toHits(*m_model, results)));
+        });
+        return;
+    }
+    case Op::BatchQuery: {
+        QStringList queries;
+        qint32 maxHamming = 0, maxMatches = 0;
+        BatchQuery::Options opts;
+        in >> queries >> maxHamming >> maxMatches >> opts.minOrbScore;
+        if (in.status() != QDataStream::Ok || maxMatches <= 0) break;
+        opts.maxHamming = qBound(0, int(maxHamming), 64);
+        opts.maxMatches = maxMatches;
+        // Only the copies are made on the query thread; the queries run on the pool
+        onModel([this, queries, opts, reply]{
+            const ThumbnailModel::BatchJob job = m_model->batchQueryJob(queries, opts);
+            (void)TaskScheduler::run(TaskScheduler::Priority::Interactive, [job, reply]{
+                QHash<qint64, QString> paths;
+                const auto reports = job({}, &paths);
+                reply(Status::Ok, encodeReports(reports, [&paths](qint64 id){ return paths.value(id); }));
+            });
+        });
+        return;
+    }
+    case Op::Index: {
+        QString folder;
+        in >> folder;
+        if (in.status() != QDataStream::Ok || !QDir(folder).exists()) break;
+        if (m_indexing || m_indexer->isRunning()) { reply(Status::Busy, {}); return; }
+        m_indexing = true;
+        onModel([this, folder, reply]{
+            const QString shardDir = m_model->attachRoot(folder);
+            QMetaObject::invokeMethod(this, [this, folder, shardDir, reply]{
+                if (shardDir.isEmpty()) {
+                    m_indexing = false;
+                    reply(Status::Failed, {});
+                    return;
+                }
+                m_indexer->startIndex(folder, shardDir);
+                QByteArray out;
+                QDataStream ds(&out, QIODevice::WriteOnly);
+                prepare(ds);
+                ds << shardDir;
+                reply(Status::Ok, out);
+            }, Qt::QueuedConnection);
+        });
+        return;
+    }
+    case Op::Reload:
+        reload(reply);
+        return;
+    case Op::Remove: {
+        QStringList paths;
+        in >> paths;
+        if (in.status() != QDataStream::Ok) break;
+        onModel([this, paths, reply]{
+            QByteArray out;
+            QDataStream ds(&out, QIODevice::WriteOnly);
+            prepare(ds);
+            ds << qint32(m_model->removePaths(paths));
+            reply(Status::Ok, out);
+        });
+        return;
+    }
+    default:
+        break;
+    }
+    reply(Status::BadRequest, {});
+}
+
+void IndexService::reload(const Reply& reply) {
+    if (m_indexing) {
+        // A root detached by another process may be the one being indexed; its data is going
+        // away. Stop without waiting here and answer once the indexer has let go of it, so
+        // the client deletes the files only after that.
+        if (!m_indexer->isRunning() || ThumbnailModel::registeredShardDirs().contains(m_indexer->shardDir())) {
+            reply(Status::Busy, {});
+            return;
+        }
+        m_indexer->requestCancel();
+        m_reloadWaiting.push_back(reply);
+        return;
+    }
+    onModel([this, reply]{
+        m_model->loadAll();
+        // Reply first; the indexes are rebuilt before the next request runs here
+        reply(Status::Ok, {});
+        m_model->warmUp();
+    });
+}
+
+void IndexService::onIndexFinished() {
+    m_indexing = false;
+    const QList<Reply> waiting = std::exchange(m_reloadWaiting, {});
+    onModel([this, waiting]{
+        // A cancelled run's shard may be gone from the registry: reload instead of saving it
+        if (waiting.isEmpty()) m_model->saveSnapshot();
+        else m_model->loadAll();
+        for (const Reply& r : waiting) r(Status::Ok, {});
+        m_model->warmUp();
+        m_model->backfillThumbnails();
+        m_model->updateNeighborGraph();
+        qInfo() << "Indexing finished";
+    });
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <QtCore>
+#include <functional>
+#include "IndexProtocol.h"
+
+class QLocalServer;
+class QLocalSocket;
+class ThumbnailModel;
+class ImageIndexer;
+
+// Resident index for differ --serve: loads every shard once, keeps the hash,
+// bag-of-words, region and histogram indexes warm, and answers IndexProtocol
+// requests from any number of local clients. The model and its shard stores live on a
+// query thread, where searches and library changes run in arrival order; batch queries
+// run on the interactive pool from copies of the indexes. This thread only reads and
+// writes the sockets and drives the indexer, so pings, reloads and other clients never
+// wait behind a slow search. Replies may leave out of order; clients match them by id.
+class IndexService : public QObject {
+    Q_OBJECT
+public:
+    explicit IndexService(QObject* parent = nullptr);
+    ~IndexService() override;
+
+    // Load the library and start listening; false if another service is already running
+    bool start();
+
+private:
+    // Callable from any thread; the frame is written from this one
+    using Reply = std::function<void(IndexProtocol::Status status, const QByteArray& payload)>;
+
+    void onNewConnection();
+    void onReadyRead(QLocalSocket* socket);
+    void handle(IndexProtocol::Op op, const QByteArray& payload, const Reply& reply);
+    void reload(const Reply& reply);
+    void onIndexFinished();
+    // Queue fn on the query thread
+    void onModel(std::function<void()> fn);
+
+    QThread m_queryThread;
+    QLocalServer* m_server{};
+    ThumbnailModel* m_model{};      // lives on m_queryThread
+    ImageIndexer* m_indexer{};
+    bool m_indexing{false};         // from an Index request until finished() arrives here
+    QList<Reply> m_reloadWaiting;   // Reloads answered once the cancelled indexer has stopped
+    QHash<QLocalSocket*, QByteArray> m_buffers;   // bytes of incomplete frames
+    qint64 m_served{0};
+};
@@ -0,0 +1,232 @@
+#include "LibraryShard.h"
+#include "ImageHash.h"
+
+namespace {
+// Reachability probes may block for as long as the OS takes to give up on a share,
+// so they never run on the global pool that searches use
+QThreadPool* probePool() {
+    static QThreadPool* pool = []{
+        auto* p = new QThreadPool;
+        p->setMaxThreadCount(2);
+        return p;
+    }();
+    return pool;
+}
+}
+
+LibraryShard::LibraryShard(int tag, const QString& root, const QString& dir)
+    : m_tag(tag), m_root(QDir::toNativeSeparators(root)), m_dir(dir),
+      m_online(std::make_shared<std::atomic<bool>>(root.isEmpty())),
+      m_probing(std::make_shared<std::atomic<bool>>(false)) {
+    QDir().mkpath(m_dir);
+}
+
+bool LibraryShard::pathUnder(QStringView nativePath, QStringView nativeRoot) {
+#ifdef Q_OS_WIN
+    constexpr Qt::CaseSensitivity cs = Qt::CaseInsensitive;
+#else
+    constexpr Qt::CaseSensitivity cs = Qt::CaseSensitive;
+#endif
+    if (nativeRoot.isEmpty() || !nativePath.startsWith(nativeRoot, cs)) return false;
+    if (nativePath.size() == nativeRoot.size()) return true;
+    const QChar sep = QDir::separator();
+    return nativeRoot.endsWith(sep) || nativePath.at(nativeRoot.size()) == sep;
+}
+
+void LibraryShard::probeOnline() {
+    if (isLegacy() || m_probing->exchange(true)) return;
+    QThreadPool* pool = probePool();
+    pool->start([online = m_online, probing = m_probing, root = m_root, changed = m_onlineChanged]{
+        const bool now = QFileInfo(root).isDir();
+        const bool before = online->exchange(now);
+        probing->store(false);
+        if (now != before && changed) changed();
+    });
+}
+
+SqliteStore& LibraryShard::store() {
+    if (!m_store) {
+        m_store = std::make_unique<SqliteStore>();
+        if (!m_store->open(m_dir + QLatin1String("/index.db")))
+            qWarning() << "Failed to open shard database in" << m_dir;
+    }
+    return *m_store;
+}
+
+void LibraryShard::load() {
+    SqliteStore& db = store();
+    QElapsedTimer timer;
+    timer.start();
+    const QString snapshot = m_dir + QLatin1String("/index.snap");
+    // The snapshot is only trusted if it was written for this exact table state
+    const bool fromSnapshot = m_index.loadSnapshot(snapshot, db.instanceId(), db.generation());
+    if (!fromSnapshot) {
+        m_index.clear();
+        db.loadIndex(m_index);
+    }
+    rebuildHashIndex();
+    markDirty();
+    probeOnline();
+    if (!m_index.isEmpty()) {
+        qInfo() << "Loaded" << m_index.size() << "images of" << (isLegacy() ? QStringLiteral("<legacy>") : m_root)
+                << (fromSnapshot ? "from snapshot" : "from database") << "in" << timer.elapsed() << "ms,"
+                << m_index.memoryUsage() / m_index.size() << "bytes/image in memory";
+    }
+    if (!fromSnapshot) saveSnapshot();
+}
+
+void LibraryShard::saveSnapshot() {
+    SqliteStore& db = store();
+    if (!m_index.saveSnapshot(m_dir + QLatin1String("/index.snap"), db.instanceId(), db.generation()))
+        qWarning() << "Failed to write index snapshot in" << m_dir;
+}
+
+void LibraryShard::rebuildHashIndex() {
+    QElapsedTimer timer;
+    timer.start();
+    m_phashIndex.build(m_index.phashes(), m_index.size());
+    if (!m_index.isEmpty())
+        qInfo() << "Built pHash multi-index over" << m_index.size() << "images in" << timer.elapsed() << "ms";
+}
+
+void LibraryShard::markDirty() {
+    m_variantsDirty = true;
+    m_bowDirty = true;
+    m_regionsDirty = true;
+    m_histDirty = true;
+    m_embeddingsDirty = true;
+}
+
+QVector<int> LibraryShard::applyIndexed(const QList<ImageEntry>& entries) {
+    QVector<int> added;
+    if (entries.isEmpty()) return added;
+    markDirty();
+    for (const ImageEntry& e : entries) {
+        const int before = m_index.size();
+        const int slot = m_index.upsert(e);
+        m_phashIndex.insert(quint32(slot), e.phash);
+        if (slot >= before) added.push_back(slot);
+    }
+    return added;
+}
+
+int LibraryShard::removePaths(const QStringList& nativePaths) {
+    SqliteStore& db = store();
+    QSet<qint64> ids;
+    db.transaction();
+    for (const QString& p : nativePaths) {
+        const int slot = m_index.slotForPath(p);
+        if (slot < 0) continue;
+        if (db.removeByPath(p)) ids.insert(m_index.id(slot));
+    }
+    db.commit();
+    return forgetIds(ids);
+}
+
+int LibraryShard::removeUnder(const QString& nativeDir) {
+    // The directories table finds the subtree without looking at every path
+    SqliteStore& db = store();
+    const QList<qint64> idList = db.idsUnder(nativeDir);
+    if (idList.isEmpty()) return 0;
+    db.removeUnder(nativeDir);
+    return forgetIds(QSet<qint64>(idList.begin(), idList.end()));
+}
+
+int LibraryShard::forgetIds(const QSet<qint64>& ids) {
+    if (ids.isEmpty()) return 0;
+    // Drop the rows in memory instead of reloading the whole table
+    const int removed = m_index.removeIds(ids);
+    if (removed == 0) return 0;
+    rebuildHashIndex();
+    markDirty();
+    saveSnapshot();
+    return removed;
+}
+
+bool LibraryShard::ensureBowIndex() {
+    if (!m_bowDirty) return !m_vocab.isEmpty() && m_bow.documentCount() > 0;
+    m_bowDirty = false;
+    m_bow.clear();
+    if (!m_vocab.deserialize(store().loadVocabulary())) return false;
+    QElapsedTimer timer;
+    timer.start();
+    m_bow.reset(m_vocab.wordCount());
+    store().forEachWords([this](qint64 id, const QByteArray& words){
+        const int slot = m_index.slotForId(id);
+        if (slot >= 0) m_bow.add(quint32(slot), reinterpret_cast<const quint32*>(words.constData()), int(words.size() / sizeof(quint32)));
+    });
+    m_bow.finalize();
+    qInfo() << "Built bag-of-words index over" << m_bow.documentCount() << "images in" << timer.elapsed() << "ms";
+    return m_bow.documentCount() > 0;
+}
+
+bool LibraryShard::ensureRegionIndex() {
+    if (!m_regionsDirty) return m_regions.imageCount() > 0;
+    m_regionsDirty = false;
+    QElapsedTimer timer;
+    timer.start();
+    m_regions.clear();
+    store().forEachRegionHashes([this](qint64 id, const QByteArray& codes){
+        const int slot = m_index.slotForId(id);
+        if (slot >= 0) m_regions.add(quint32(slot), reinterpret_cast<const quint64*>(codes.constData()), int(codes.size() / sizeof(quint64)));
+    });
+    m_regions.build();
+    if (m_regions.imageCount() > 0)
+        qInfo() << "Built region-hash index over" << m_regions.imageCount() << "images in" << timer.elapsed() << "ms";
+    return m_regions.imageCount() > 0;
+}
+
+bool LibraryShard::ensureVariantIndex() {
+    if (!ImageHash::dihedralEnabled()) {
+        if (m_variantIndex.size() > 0) m_variantIndex.clear();
+        m_variantsDirty = true;
+        return false;
+    }
+    if (!m_variantsDirty) return m_variantIndex.size() > 0;
+    m_variantsDirty = false;
+    QElapsedTimer timer;
+    timer.start();
+    m_variantIndex.clear();
+    int images = 0;
+    store().forEachHashVariants([this, &images](qint64 id, const QByteArray& blob){
+        const int slot = m_index.slotForId(id);
+        if (slot < 0 || blob.size() != MultiIndexHash::kVariants * int(sizeof(quint64))) return;
+        const auto* codes = reinterpret_cast<const quint64*>(blob.constData());
+        // [0] is the pHash itself, already in the primary index
+        for (int k = 1; k < MultiIndexHash::kVariants; ++k)
+            m_variantIndex.insert(quint32(slot) * MultiIndexHash::kVariants + quint32(k), codes[k]);
+        ++images;
+    });
+    if (images > 0)
+        qInfo() << "Built rotation/mirror pHash index over" << images << "images in" << timer.elapsed() << "ms";
+    return images > 0;
+}
+
+bool LibraryShard::ensureEmbeddingIndex(const EmbeddingModel::Options& opts) {
+    const qint64 model = opts.modelId();
+    if (!m_embeddingsDirty && model == m_embeddingsModel) return !m_embeddings.isEmpty();
+    m_embeddingsDirty = false;
+    m_embeddingsModel = model;
+    const qint64 stored = store().embeddingModel();
+    if (model == 0 || stored != model) {
+        if (model != 0 && stored != 0) qInfo() << "Embeddings of" << m_dir << "come from another model; re-index to use them";
+        m_embeddings.clear();
+        return false;
+    }
+    return EmbeddingModel::syncIndex(store(), opts, m_embeddings, EmbeddingModel::indexPath(m_dir));
+}
+
+bool LibraryShard::ensureHistogramIndex() {
+    if (!m_histDirty) return m_hist.count() > 0;
+    m_histDirty = false;
+    QElapsedTimer timer;
+    timer.start();
+    m_hist.clear();
+    store().forEachHistogram([this](qint64 id, const QByteArray& hist){
+        const int slot = m_index.slotForId(id);
+        if (slot >= 0 && hist.size() == ColorHistogram::kBins) m_hist.set(slot, reinterpret_cast<const quint8*>(hist.constData()));
+    });
+    if (m_hist.count() > 0)
+        qInfo() << "Loaded" << m_hist.count() << "color histograms in" << timer.elapsed() << "ms";
+    return m_hist.count() > 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <QtCore>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "SqliteStore.h"
+#include "ImageIndex.h"
+#include "MultiIndexHash.h"
+#include "VisualVocabulary.h"
+#include "BowIndex.h"
+#include "RegionIndex.h"
+#include "HistogramIndex.h"
+#include "HnswIndex.h"
+#include "EmbeddingModel.h"
+
+// One library root and everything indexed from it: database, snapshot and
+// thumbnails live in the shard's own directory, and the in-memory indexes are
+// built from that database only, so shards load, re-index and detach
+// independently. Ids inside a shard are its database row ids; globalId()
+// tags them with the shard so merged results stay unambiguous.
+// The store belongs to the thread that loaded the shard (the GUI thread);
+// the read-only indexes may be scanned from any thread.
+class LibraryShard {
+public:
+    static constexpr int kTagBits = 40;
+
+    // tag 0 is the database that predates roots (root empty, dir = the app data dir)
+    LibraryShard(int tag, const QString& root, const QString& dir);
+
+    int tag() const { return m_tag; }
+    const QString& root() const { return m_root; }
+    const QString& dir() const { return m_dir; }
+    QString thumbDir() const { return m_dir + QLatin1String("/thumbs"); }
+    bool isLegacy() const { return m_root.isEmpty(); }
+    // True for paths under root (native separators); the legacy shard claims none
+    bool covers(QStringView nativePath) const { return pathUnder(nativePath, m_root); }
+    static bool pathUnder(QStringView nativePath, QStringView nativeRoot);
+
+    qint64 globalId(qint64 localId) const { return (qint64(m_tag) << kTagBits) | localId; }
+    static int tagOf(qint64 globalId) { return int(globalId >> kTagBits); }
+    static qint64 localId(qint64 globalId) { return globalId & ((qint64(1) << kTagBits) - 1); }
+
+    // Whether root is reachable. Probed on a separate pool so a sleeping disk or dead share
+    // never stalls the caller; reports offline until the first probe answers.
+    bool isOnline() const { return m_online->load(); }
+    void probeOnline();
+    // Called on the probe thread whenever an answer differs from the previous state
+    void setOnlineChanged(std::function<void()> fn) { m_onlineChanged = std::move(fn); }
+
+    SqliteStore& store();
+    const ImageIndex& index() const { return m_index; }
+    const MultiIndexHash& phashIndex() const { return m_phashIndex; }
+
+    // Snapshot if it matches the database, the database otherwise
+    void load();
+    void saveSnapshot();
+    // Merge rows from the indexer; returns the slots that are new
+    QVector<int> applyIndexed(const QList<ImageEntry>& entries);
+    // Delete rows by path (native) from database and memory; returns how many existed
+    int removePaths(const QStringList& nativePaths);
+    // Delete every row under dir (native): a root taking over part of the legacy database,
+    // or a subtree removed from the library
+    int removeUnder(const QString& nativeDir);
+    // Rows another connection already deleted (stale files found by a re-index)
+    int forgetIds(const QSet<qint64>& ids);
+
+    // Histograms or descriptors were written by another connection (thumbnail backfill)
+    void featuresChanged() { m_bowDirty = true; m_histDirty = true; m_embeddingsDirty = true; }
+
+    // Lazily (re)built from the database after any change
+    bool ensureBowIndex();
+    bool ensureRegionIndex();
+    // Rotated/mirrored pHashes (hash/dihedral) of the images that have them stored; empty
+    // while the option is off. See MultiIndexHash::searchWithVariants.
+    bool ensureVariantIndex();
+    bool ensureHistogramIndex();
+    // Synced with the embeddings table and saved next to it; false when the stored vectors
+    // come from another model than opts names (the shard needs a re-index)
+    bool ensureEmbeddingIndex(const EmbeddingModel::Options& opts);
+    const VisualVocabulary& vocabulary() const { return m_vocab; }
+    const BowIndex& bow() const { return m_bow; }
+    const RegionIndex& regions() const { return m_regions; }
+    const MultiIndexHash& variantIndex() const { return m_variantIndex; }
+    const HistogramIndex& histograms() const { return m_hist; }
+    const HnswIndex& embeddings() const { return m_embeddings; }
+
+private:
+    void rebuildHashIndex();
+    void markDirty();
+
+    int m_tag;
+    QString m_root;
+    QString m_dir;
+    std::shared_ptr<std::atomic<bool>> m_online;
+    std::shared_ptr<std::atomic<bool>> m_probing;
+    std::function<void()> m_onlineChanged;
+
+    std::unique_ptr<SqliteStore> m_store;
+    ImageIndex m_index;            // newest first
+    MultiIndexHash m_phashIndex;   // values are slots in m_index
+    MultiIndexHash m_variantIndex; // values are slot * kVariants + variant
+    bool m_variantsDirty{true};
+    VisualVocabulary m_vocab;
+    BowIndex m_bow;                // documents are slots in m_index
+    bool m_bowDirty{true};
+    RegionIndex m_regions;         // owners are slots in m_index
+    bool m_regionsDirty{true};
+    HistogramIndex m_hist;         // rows are slots in m_index
+    bool m_histDirty{true};
+    HnswIndex m_embeddings;        // nodes are database ids
+    bool m_embeddingsDirty{true};
+    qint64 m_embeddingsModel{0};
+};
@@ -3,8 +3,14 @@
 #include "ThumbnailModel.h"
 #include "ThumbnailDelegate.h"
 #include "ImageIndexer.h"
+#include "ThumbnailPyramid.h"
+#include "PreviewLoader.h"
+#include "IndexClient.h"
+#include "SearchFilter.h"
+#include "TaskScheduler.h"
 
 #include <QtWidgets>
+#include <atomic>
 #ifdef Q_OS_WIN
 #  include <windows.h>
 #  include <shellapi.h>
@@ -25,6 +31,7 @@ MainWindow::MainWindow(QWidget* parent)
     // Create workers and model before wiring signals
     m_indexer = new ImageIndexer(this);
     m_model = new ThumbnailModel(this);
+    m_previewLoader = new PreviewLoader(this);
     m_listView->setModel(m_model);
 
     setupConnections();
@@ -56,7 +63,8 @@ void MainWindow::setupUi() {
     // 启用 hover 探测，并安装自定义委托，让悬停框覆盖整格
     m_listView->setMouseTracking(true);
     m_listView->viewport()->setAttribute(Qt::WA_Hover, true);
-    m_listView->setItemDelegate(new ThumbnailDelegate(m_listView));
+    m_delegate = new ThumbnailDelegate(m_listView);
+    m_listView->setItemDelegate(m_delegate);
     m_listView->setContextMenuPolicy(Qt::CustomContextMenu);
     setCentralWidget(m_listView);
 
@@ -67,6 +75,8 @@ void MainWindow::setupUi() {
     m_folderEdit = new QLineEdit(left);
     m_browseBtn = new QPushButton("选择文件夹", left);
     m_indexBtn = new QPushButton("开始索引", left);
+    m_hashOnlyCheck = new QCheckBox("仅计算哈希（缩略图稍后生成）", left);
+    m_hashOnlyCheck->setToolTip("首次快速查重用：索引时只计算哈希，缩略图在浏览时或后台空闲时生成");
 
     auto folderRow = new QHBoxLayout();
     folderRow->addWidget(m_folderEdit, 1);
@@ -77,11 +87,59 @@ void MainWindow::setupUi() {
     m_thumbSizeSlider->setValue(160);
     m_thumbSizeLabel = new QLabel("缩略图: 160px", left);
 
+    m_rootList = new QListWidget(left);
+    m_rootList->setToolTip("已加入图库的目录，每个目录单独索引；离线目录仍可查找，但不会读取原图");
+    m_detachBtn = new QPushButton("移除目录", left);
+
+    // 查询筛选：在计算任何特征之前按尺寸、目录和日期排除图片
+    m_aspectSpin = new QSpinBox(left);
+    m_aspectSpin->setRange(0, 100);
+    m_aspectSpin->setSuffix("%");
+    m_aspectSpin->setSpecialValueText("不限");
+    m_aspectSpin->setToolTip("只查找宽高比与查询图片相差不超过该比例的图片");
+    m_minWidthSpin = new QSpinBox(left);
+    m_minWidthSpin->setRange(0, 100000);
+    m_minWidthSpin->setSuffix(" px");
+    m_minWidthSpin->setSpecialValueText("不限");
+    m_minHeightSpin = new QSpinBox(left);
+    m_minHeightSpin->setRange(0, 100000);
+    m_minHeightSpin->setSuffix(" px");
+    m_minHeightSpin->setSpecialValueText("不限");
+    auto sizeRow = new QHBoxLayout();
+    sizeRow->addWidget(m_minWidthSpin);
+    sizeRow->addWidget(new QLabel("×", left));
+    sizeRow->addWidget(m_minHeightSpin);
+    m_scopeEdit = new QLineEdit(left);
+    m_scopeEdit->setPlaceholderText("整个图库");
+    m_scopeEdit->setClearButtonEnabled(true);
+    m_dateCheck = new QCheckBox("修改日期", left);
+    m_fromDate = new QDateEdit(QDate::currentDate().addYears(-1), left);
+    m_toDate = new QDateEdit(QDate::currentDate(), left);
+    for (QDateEdit* edit : {m_fromDate, m_toDate}) {
+        edit->setCalendarPopup(true);
+        edit->setDisplayFormat("yyyy-MM-dd");
+        edit->setEnabled(false);
+    }
+    auto dateRow = new QHBoxLayout();
+    dateRow->addWidget(m_fromDate);
+    dateRow->addWidget(new QLabel("至", left));
+    dateRow->addWidget(m_toDate);
+
     leftLay->addRow("目录", new QWidget(left));
     leftLay->addRow(folderRow);
+    leftLay->addRow(m_hashOnlyCheck);
     leftLay->addRow(m_indexBtn);
+    leftLay->addRow("图库目录", new QWidget(left));
+    leftLay->addRow(m_rootList);
+    leftLay->addRow(m_detachBtn);
     leftLay->addRow(m_thumbSizeLabel);
     leftLay->addRow(m_thumbSizeSlider);
+    leftLay->addRow("查询筛选", new QWidget(left));
+    leftLay->addRow("宽高比误差", m_aspectSpin);
+    leftLay->addRow("最小尺寸", sizeRow);
+    leftLay->addRow("仅此目录", m_scopeEdit);
+    leftLay->addRow(m_dateCheck);
+    leftLay->addRow(dateRow);
 
     left->setLayout(leftLay);
     m_leftDock->setWidget(left);
@@ -116,6 +174,16 @@ void MainWindow::setupUi() {
     auto tb = addToolBar("工具");
     m_openQueryAction = tb->addAction("打开查询图片");
     m_showAllAction = tb->addAction("显示全部");
+    m_hashQueryAction = tb->addAction("哈希快速查找");
+    m_hashQueryAction->setToolTip("仅比较感知哈希 (pHash)，在最大汉明距离内查找近似重复");
+    m_fusedQueryAction = tb->addAction("签名快速查找");
+    m_fusedQueryAction->setToolTip("只用已存储的哈希与颜色矩加权排序，不读取图片文件（权重见 fusion 设置）");
+    m_embedQueryAction = tb->addAction("语义相似");
+    m_embedQueryAction->setToolTip("用图像嵌入模型 (ONNX) 查找内容相近的图片（需设置 embedding/modelPath 并重新索引）");
+    m_cropQueryAction = tb->addAction("裁剪查找");
+    m_cropQueryAction->setToolTip("按区域哈希查找被裁剪或加了黑边的副本（需启用 hash/tiles 并重新索引）");
+    m_batchQueryAction = tb->addAction("批量查重");
+    m_batchQueryAction->setToolTip("将一个目录中的所有图片与图库比对，并导出匹配报告 (CSV)");
 
     tb->addSeparator();
     tb->addWidget(new QLabel("TopK:"));
@@ -152,25 +220,56 @@ void MainWindow::setupUi() {
 void MainWindow::setupConnections() {
     connect(m_browseBtn, &QPushButton::clicked, this, &MainWindow::chooseFolder);
     connect(m_indexBtn, &QPushButton::clicked, [this]{ startIndexing(m_folderEdit->text()); });
+    connect(m_detachBtn, &QPushButton::clicked, this, &MainWindow::detachSelectedRoot);
+    connect(m_rootList, &QListWidget::itemDoubleClicked, [this](QListWidgetItem* item){
+        // Re-index just this root
+        const QString root = item->data(Qt::UserRole).toString();
+        if (!root.isEmpty()) { m_folderEdit->setText(root); startIndexing(root); }
+    });
     connect(m_listView, &QListView::customContextMenuRequested, this, &MainWindow::showListContextMenu);
     connect(m_showAllAction, &QAction::triggered, [this]{ loadAllFromDb(); });
     connect(m_thumbSizeSlider, &QSlider::valueChanged, [this](int v){
         m_thumbSizeLabel->setText(QString("缩略图: %1px").arg(v));
         const QSize iconSize(v, v);
         QFontMetrics fm(m_listView->font());
+        // Scaled pixmaps and wrapped names were made for the old cell size
+        m_delegate->clearCache();
         m_listView->setIconSize(iconSize);
         m_listView->setGridSize(ThumbnailDelegate::cellSizeForIcon(iconSize, fm));
         m_listView->doItemsLayout();
         m_listView->viewport()->update();
     });
     connect(m_openQueryAction, &QAction::triggered, this, &MainWindow::openQueryImage);
+    connect(m_hashQueryAction, &QAction::triggered, this, &MainWindow::findByHash);
+    connect(m_cropQueryAction, &QAction::triggered, this, &MainWindow::findCrops);
+    connect(m_fusedQueryAction, &QAction::triggered, this, &MainWindow::findFused);
+    connect(m_embedQueryAction, &QAction::triggered, this, &MainWindow::findEmbedding);
+    connect(m_batchQueryAction, &QAction::triggered, this, &MainWindow::batchQuery);
     connect(m_queryBtn, &QPushButton::clicked, this, &MainWindow::findSimilar);
     connect(m_listView->selectionModel(), &QItemSelectionModel::selectionChanged, this, &MainWindow::onSelectionChanged);
-    connect(m_hammingSlider, &QSlider::valueChanged, [this](int v){ m_hammingValue->setText(QString::number(v)); });
+    connect(m_hammingSlider, &QSlider::valueChanged, [this](int v){
+        m_hammingValue->setText(QString::number(v));
+        refineResults();
+    });
+    connect(m_topKSpin, qOverload<int>(&QSpinBox::valueChanged), this, [this]{ refineResults(); });
+    connect(m_previewLoader, &PreviewLoader::previewReady, this, &MainWindow::onPreviewReady);
 
     // Indexer signals
     connect(m_indexer, &ImageIndexer::progress, this, &MainWindow::onIndexingProgress);
     connect(m_indexer, &ImageIndexer::finished, this, &MainWindow::onIndexingFinished);
+    // Roots are probed in the background and start out offline
+    connect(m_model, &ThumbnailModel::rootsChanged, this, &MainWindow::refreshRoots);
+    connect(m_indexer, &ImageIndexer::entriesIndexed, m_model, &ThumbnailModel::applyIndexed);
+    connect(m_indexer, &ImageIndexer::entriesRemoved, m_model, &ThumbnailModel::applyRemoved);
+    connect(m_dateCheck, &QCheckBox::toggled, m_fromDate, &QWidget::setEnabled);
+    connect(m_dateCheck, &QCheckBox::toggled, m_toDate, &QWidget::setEnabled);
+    connect(m_hashOnlyCheck, &QCheckBox::toggled, this, [](bool on){
+        ImageIndexer::saveProfile(on ? ImageIndexer::Profile::HashOnly : ImageIndexer::Profile::Full);
+    });
+    connect(m_model, &ThumbnailModel::thumbnailProgress, this, [this](int done, int total){
+        if (m_indexer->isRunning()) return;
+        statusBar()->showMessage(QString("后台生成缩略图 %1/%2").arg(done).arg(total), 3000);
+    });
 }
 
 void MainWindow::chooseFolder() {
@@ -185,9 +284,16 @@ void MainWindow::startIndexing(const QString& folder) {
         QMessageBox::warning(this, "提示", "请选择有效的目录");
         return;
     }
+    // Each root indexes into its own shard
+    const QString shardDir = m_model->attachRoot(folder);
+    if (shardDir.isEmpty()) {
+        QMessageBox::warning(this, "提示", "该目录包含已加入图库的目录，请先移除这些目录");
+        return;
+    }
+    refreshRoots();
     m_progress->setValue(0);
     m_indexBtn->setEnabled(false);
-    m_indexer->startIndex(folder);
+    m_indexer->startIndex(folder, shardDir);
 }
 
 void MainWindow::onIndexingProgress(int indexed, int total) {
@@ -202,32 +308,73 @@ void MainWindow::onIndexingFinished() {
     m_indexBtn->setEnabled(true);
     m_progress->setValue(100);
     statusBar()->showMessage("索引完成", 5000);
-    loadAllFromDb();
+    // Rows were merged incrementally while indexing; just show them and persist the snapshot
+    m_model->showAll();
+    m_model->saveSnapshot();
+    m_model->backfillThumbnails();
+    m_model->updateNeighborGraph();
+    refreshRoots();
+    notifyService();
+}
+
+void MainWindow::detachSelectedRoot() {
+    QListWidgetItem* item = m_rootList->currentItem();
+    if (!item) return;
+    const QString root = item->data(Qt::UserRole).toString();
+    QMessageBox box(QMessageBox::Question, "移除目录",
+                    QString("从图库中移除 %1？\n原图不会被删除。").arg(item->text()), QMessageBox::NoButton, this);
+    QPushButton* keep = box.addButton("移除，保留索引数据", QMessageBox::AcceptRole);
+    QPushButton* drop = box.addButton("移除并删除索引数据", QMessageBox::DestructiveRole);
+    box.addButton(QMessageBox::Cancel);
+    box.exec();
+    if (box.clickedButton() != keep && box.clickedButton() != drop) return;
+    if (box.clickedButton() == drop && m_indexer->isRunning()) {
+        // The indexer would keep writing into the files about to be deleted
+        for (const auto& r : m_model->roots()) {
+            if (r.root == root && r.dir == m_indexer->shardDir()) m_indexer->cancel();
+        }
+    }
+    // The service is told before the files go, so it stops indexing into them and closes them
+    bool notified = false;
+    m_model->detachRoot(root, box.clickedButton() == drop, [this, &notified]{ notifyService(); notified = true; });
+    refreshRoots();
+    if (!notified) notifyService();
+}
+
+int MainWindow::serviceTimeoutMs() {
+    return qBound(100, QSettings().value("service/timeoutMs", 10000).toInt(), 600000);
+}
+
+void MainWindow::notifyService() {
+    IndexClient client(serviceTimeoutMs());
+    if (client.connectToService() && !client.reload())
+        qWarning() << "Index service did not reload the library";
+}
+
+void MainWindow::refreshRoots() {
+    m_rootList->clear();
+    for (const auto& r : m_model->roots()) {
+        QString text = r.root.isEmpty() ? QStringLiteral("旧索引") : r.root;
+        text += QString(" (%1)").arg(r.images);
+        if (!r.online && !r.root.isEmpty()) text += " [离线]";
+        auto item = new QListWidgetItem(text, m_rootList);
+        item->setData(Qt::UserRole, r.root);
+    }
 }
 
 void MainWindow::openQueryImage() {
     QString fn = QFileDialog::getOpenFileName(this, "选择查询图片", QString(), "Images (*.png *.jpg *.jpeg *.bmp *.gif *.webp *.tiff)");
     if (fn.isEmpty()) return;
 
-    QImageReader reader(fn);
-    reader.setAutoTransform(true);
-    QSize pv = m_previewLabel->size();
-    if (pv.width() > 0 && pv.height() > 0) {
-        QSize tgt = reader.size();
-        if (tgt.isValid()) {
-            tgt.scale(qMax(512, pv.width()), qMax(512, pv.height()), Qt::KeepAspectRatio);
-            reader.setScaledSize(tgt);
-        }
-    }
-    QImage img = reader.read();
-    if (img.isNull()) {
+    if (!QImageReader(fn).canRead()) {
         QMessageBox::warning(this, "错误", "无法打开图片");
         return;
     }
-    setPreviewFromImage(img);
+    m_metaLabel->setText(QFileInfo(fn).fileName());
+    showPreview(fn);
 
     // Perform search
-    auto results = m_model->searchSimilar(fn, m_topKSpin->value(), m_hammingSlider->value());
+    auto results = search(IndexProtocol::Op::SearchSimilar, fn, currentFilter());
     m_model->showResults(results);
     if (results.isEmpty()) {
         // Give a helpful hint when nothing is found
@@ -248,7 +395,7 @@ void MainWindow::findSimilar() {
         return;
     }
     QString path = m_model->pathForIndex(sel.first());
-    auto results = m_model->searchSimilar(path, m_topKSpin->value(), m_hammingSlider->value());
+    auto results = search(IndexProtocol::Op::SearchSimilar, path, currentFilter());
     m_model->showResults(results);
     if (results.isEmpty()) {
         QMessageBox::information(this, "未找到相似图片",
@@ -257,45 +404,320 @@ void MainWindow::findSimilar() {
     }
 }
 
-void MainWindow::onSelectionChanged() {
+void MainWindow::refineResults() {
+    // The service keeps its own cached scores; asking again is cheap
+    if (m_remoteQuery.op != IndexProtocol::Op::Ping) {
+        const RemoteQuery last = m_remoteQuery;
+        m_model->showResults(search(last.op, last.path, last.filter));
+        return;
+    }
+    // Limits changed while results are shown: re-filter the cached scores instead of searching again
+    if (!m_model->hasActiveQuery()) return;
+    m_model->showResults(m_model->refineQuery(m_topKSpin->value(), m_hammingSlider->value()));
+}
+
+QList<ThumbnailModel::ResultItem> MainWindow::search(IndexProtocol::Op op, const QString& path, const SearchFilter& filter) {
+    using IndexProtocol::Op;
+    const int topK = m_topKSpin->value();
+    const int maxHamming = m_hammingSlider->value();
+    // A running service answers from its warm indexes, so this process never builds the
+    // bag-of-words, region, histogram or embedding indexes; it is only waited for so long
+    IndexClient client(serviceTimeoutMs());
+    QList<QList<IndexProtocol::Hit>> hits;
+    if (client.connectToService() && client.search(op, {path}, topK, maxHamming, &hits, filter) && hits.size() == 1) {
+        QList<ThumbnailModel::ResultItem> results;
+        for (const auto& h : hits.front()) {
+            // Ids agree while both processes have loaded the same registry; images this
+            // window has not loaded yet are left out
+            if (m_model->pathForId(h.id) == h.path) results.push_back({h.id, h.distance});
+        }
+        m_remoteQuery = {op, path, filter};
+        return results;
+    }
+    m_remoteQuery = {};
+    switch (op) {
+    case Op::SearchHamming: return m_model->searchHamming(path, topK, maxHamming, filter);
+    case Op::SearchFused: return m_model->searchFused(path, topK, filter);
+    case Op::SearchCrops: return m_model->searchCrops(path, topK, maxHamming, filter);
+    case Op::SearchEmbedding: return m_model->searchEmbedding(path, topK, filter);
+    default: return m_model->searchSimilar(path, topK, maxHamming, filter);
+    }
+}
+
+SearchFilter MainWindow::currentFilter() const {
+    SearchFilter filter;
+    filter.aspectTolerance = m_aspectSpin->value() / 100.0;
+    filter.minWidth = m_minWidthSpin->value();
+    filter.minHeight = m_minHeightSpin->value();
+    const QString scope = m_scopeEdit->text().trimmed();
+    if (!scope.isEmpty()) filter.folder = QDir::toNativeSeparators(QDir::cleanPath(QFileInfo(scope).absoluteFilePath()));
+    if (m_dateCheck->isChecked()) {
+        // Inclusive whole days
+        filter.modifiedFrom = m_fromDate->date().startOfDay().toSecsSinceEpoch();
+        filter.modifiedTo = m_toDate->date().addDays(1).startOfDay().toSecsSinceEpoch() - 1;
+    }
+    return filter;
+}
+
+void MainWindow::findByHash() {
+    QString path;
     auto sel = m_listView->selectionModel()->selectedIndexes();
-    if (sel.isEmpty()) return;
-    QString path = m_model->pathForIndex(sel.first());
-    QImageReader reader(path);
-    reader.setAutoTransform(true);
-    QSize pv = m_previewLabel->size();
-    if (pv.width() > 0 && pv.height() > 0) {
-        QSize tgt = reader.size();
-        if (tgt.isValid()) {
-            tgt.scale(qMax(512, pv.width()), qMax(512, pv.height()), Qt::KeepAspectRatio);
-            reader.setScaledSize(tgt);
+    if (!sel.isEmpty()) {
+        path = m_model->pathForIndex(sel.first());
+    } else {
+        path = QFileDialog::getOpenFileName(this, "选择查询图片", QString(), "Images (*.png *.jpg *.jpeg *.bmp *.gif *.webp *.tiff)");
+        if (path.isEmpty()) return;
+    }
+    auto results = search(IndexProtocol::Op::SearchHamming, path, currentFilter());
+    m_model->showResults(results);
+    if (results.isEmpty()) {
+        QMessageBox::information(this, "未找到相似图片",
+            "没有在当前汉明距离内找到近似重复的图片。\n建议：调大‘最大汉明距离’，或使用完整的相似查找。");
+    }
+}
+
+void MainWindow::findFused() {
+    QString path;
+    auto sel = m_listView->selectionModel()->selectedIndexes();
+    if (!sel.isEmpty()) {
+        path = m_model->pathForIndex(sel.first());
+    } else {
+        path = QFileDialog::getOpenFileName(this, "选择查询图片", QString(), "Images (*.png *.jpg *.jpeg *.bmp *.gif *.webp *.tiff)");
+        if (path.isEmpty()) return;
+    }
+    m_model->showResults(search(IndexProtocol::Op::SearchFused, path, currentFilter()));
+}
+
+void MainWindow::findEmbedding() {
+    if (!EmbeddingModel::Options::fromSettings().enabled()) {
+        QMessageBox::information(this, "未配置嵌入模型",
+            "语义相似查找需要本地的 ONNX 图像编码模型。\n请在设置中填写 embedding/modelPath，然后重新索引图库。");
+        return;
+    }
+    QString path;
+    auto sel = m_listView->selectionModel()->selectedIndexes();
+    if (!sel.isEmpty()) {
+        path = m_model->pathForIndex(sel.first());
+    } else {
+        path = QFileDialog::getOpenFileName(this, "选择查询图片", QString(), "Images (*.png *.jpg *.jpeg *.bmp *.gif *.webp *.tiff)");
+        if (path.isEmpty()) return;
+    }
+    const auto results = search(IndexProtocol::Op::SearchEmbedding, path, currentFilter());
+    m_model->showResults(results);
+    if (results.isEmpty()) {
+        QMessageBox::information(this, "未找到相似图片",
+            "没有可用的图像嵌入。\n建议：确认模型能够加载，并在设置模型后重新索引图库。");
+    }
+}
+
+void MainWindow::findCrops() {
+    QString path;
+    auto sel = m_listView->selectionModel()->selectedIndexes();
+    if (!sel.isEmpty()) {
+        path = m_model->pathForIndex(sel.first());
+    } else {
+        path = QFileDialog::getOpenFileName(this, "选择查询图片", QString(), "Images (*.png *.jpg *.jpeg *.bmp *.gif *.webp *.tiff)");
+        if (path.isEmpty()) return;
+    }
+    auto results = search(IndexProtocol::Op::SearchCrops, path, currentFilter());
+    m_model->showResults(results);
+    if (results.isEmpty()) {
+        QMessageBox::information(this, "未找到相似图片",
+            "没有找到共享图像区域的图片。\n建议：在设置中启用 hash/tiles 后重新索引，或调大‘最大汉明距离’。");
+    }
+}
+
+void MainWindow::batchQuery() {
+    const QString dir = QFileDialog::getExistingDirectory(this, "选择待查重的图片目录");
+    if (dir.isEmpty()) return;
+    const QStringList queries = BatchQuery::collect(dir);
+    if (queries.isEmpty()) {
+        QMessageBox::information(this, "提示", "该目录中没有图片");
+        return;
+    }
+
+    BatchQuery::Options opts;
+    opts.maxHamming = m_hammingSlider->value();
+    opts.maxMatches = m_topKSpin->value();
+    m_batchQueryAction->setEnabled(false);
+    IndexClient probe;
+    startBatchQuery(queries, opts, probe.connectToService());
+}
+
+void MainWindow::startBatchQuery(const QStringList& queries, const BatchQuery::Options& opts, bool viaService) {
+    statusBar()->showMessage(QString("正在批量查重 %1 张图片…").arg(queries.size()));
+    // Off the GUI thread: a running index service answers from its warm index, else the job
+    // works on copies of the loaded indexes (only made when needed, they are large). Paths
+    // come with the result either way.
+    const ThumbnailModel::BatchJob job = viaService ? ThumbnailModel::BatchJob() : m_model->batchQueryJob(queries, opts);
+    // The service reports no progress; allow it the timeout per started 100 queries
+    const int timeoutMs = int(qMin<qint64>(qint64(serviceTimeoutMs()) * (1 + queries.size() / 100), std::numeric_limits<int>::max()));
+    QPointer<MainWindow> self(this);
+    (void)TaskScheduler::run(TaskScheduler::Priority::Interactive, [self, queries, opts, job, timeoutMs]{
+        QList<BatchQuery::Report> reports;
+        QHash<qint64, QString> paths;
+        bool ok = true;
+        if (!job) {
+            IndexClient client(timeoutMs);
+            ok = client.connectToService() && client.batchQuery(queries, opts, &reports, &paths);
+        } else {
+            std::atomic<int> lastPct{-1};
+            reports = job([self, &lastPct](int done, int total){
+                const int pct = done * 100 / total;
+                int seen = lastPct.load();
+                if (pct <= seen || !lastPct.compare_exchange_strong(seen, pct)) return;
+                QMetaObject::invokeMethod(qApp, [self, done, total]{
+                    if (self) self->statusBar()->showMessage(QString("正在批量查重 %1/%2").arg(done).arg(total));
+                }, Qt::QueuedConnection);
+            }, &paths);
+        }
+        QMetaObject::invokeMethod(qApp, [self, ok, queries, opts, reports, paths]{
+            if (!self) return;
+            // A service that went away or did not answer in time: run it here instead
+            if (ok) self->showBatchReport(queries.size(), reports, paths);
+            else self->startBatchQuery(queries, opts, false);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void MainWindow::showBatchReport(int queryCount, const QList<BatchQuery::Report>& reports, const QHash<qint64, QString>& paths) {
+    m_batchQueryAction->setEnabled(true);
+    statusBar()->clearMessage();
+
+    // Show every library image that matched anything; the best distance wins
+    QHash<qint64, int> matched;
+    int withMatches = 0;
+    for (const auto& r : reports) {
+        if (!r.matches.isEmpty()) ++withMatches;
+        for (const auto& m : r.matches) {
+            auto it = matched.find(m.id);
+            if (it == matched.end()) matched.insert(m.id, m.hamming);
+            else it.value() = qMin(it.value(), m.hamming);
         }
     }
-    QImage img = reader.read();
-    if (!img.isNull()) {
-        setPreviewFromImage(img);
-        QFileInfo fi(path);
+    QList<ThumbnailModel::ResultItem> results;
+    results.reserve(matched.size());
+    for (auto it = matched.constBegin(); it != matched.constEnd(); ++it) results.push_back({it.key(), it.value()});
+    std::sort(results.begin(), results.end(), [](const auto& a, const auto& b){ return a.distance < b.distance; });
+    m_model->showResults(results);
+
+    const auto answer = QMessageBox::question(this, "批量查重完成",
+        QString("%1 张图片中有 %2 张在图库中找到近似图片。\n是否导出匹配报告？").arg(queryCount).arg(withMatches));
+    if (answer != QMessageBox::Yes) return;
+    const QString fn = QFileDialog::getSaveFileName(this, "保存匹配报告", "batch-report.csv", "CSV (*.csv)");
+    if (fn.isEmpty()) return;
+    QSaveFile f(fn);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Text) || !BatchQuery::writeCsv(&f, reports, [&paths](qint64 id){ return paths.value(id); }) || !f.commit())
+        QMessageBox::warning(this, "错误", "无法写入报告文件");
+}
+
+void MainWindow::onSelectionChanged() {
+    auto sel = m_listView->selectionModel()->selectedIndexes();
+    if (sel.isEmpty()) return;
+    const QModelIndex cur = sel.first();
+    const QString path = m_model->pathForIndex(cur);
+
+    // Metadata comes from the index, so nothing here touches the file
+    ImageEntry entry;
+    if (m_model->entryForPath(path, &entry)) {
         m_metaLabel->setText(QString("%1\n%2\n%3x%4")
-            .arg(fi.fileName())
-            .arg(humanSize(fi.size()))
-            .arg(img.width()).arg(img.height()));
+            .arg(QFileInfo(entry.path).fileName())
+            .arg(humanSize(entry.size))
+            .arg(entry.width).arg(entry.height));
+    } else {
+        m_metaLabel->setText(QFileInfo(path).fileName());
+    }
+    showPreview(path);
+
+    // Neighbours are the likely next selection when stepping with the keyboard
+    QStringList next;
+    for (int d : {1, -1, 2}) {
+        const QModelIndex n = m_model->index(cur.row() + d);
+        if (n.isValid()) next << m_model->pathForIndex(n);
+    }
+    m_previewLoader->prefetch(next, m_previewLabel->size());
+}
+
+void MainWindow::showPreview(const QString& path) {
+    m_previewPath = path;
+    // Show the cached thumbnail right away; the full preview replaces it when decoded
+    const QPixmap thumb = m_model->cachedThumbnail(path);
+    if (!thumb.isNull()) setPreviewPixmap(thumb);
+    else m_previewLabel->clear();
+    m_previewLoader->request(path, m_previewLabel->size());
+}
+
+void MainWindow::onPreviewReady(const QString& path, const QImage& image, const QSize& originalSize) {
+    if (path != m_previewPath) return;
+    setPreviewFromImage(image);
+    // Images outside the index (opened query files) only get their size once decoded
+    ImageEntry entry;
+    if (!m_model->entryForPath(path, &entry) && originalSize.isValid()) {
+        m_metaLabel->setText(QString("%1\n%2x%3")
+            .arg(QFileInfo(path).fileName())
+            .arg(originalSize.width()).arg(originalSize.height()));
     }
 }
 
 void MainWindow::setPreviewFromImage(const QImage& img) {
     if (img.isNull()) { m_previewLabel->clear(); return; }
-    m_previewLabel->clear();
+    setPreviewPixmap(QPixmap::fromImage(img));
+}
+
+void MainWindow::setPreviewPixmap(const QPixmap& src) {
     QSize target = m_previewLabel->size();
     if (target.width() <= 0 || target.height() <= 0) {
-        m_previewLabel->setPixmap(QPixmap::fromImage(img));
+        m_previewLabel->setPixmap(src);
         return;
     }
-    QPixmap pm = QPixmap::fromImage(img.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation));
-    m_previewLabel->setPixmap(pm);
+    m_previewLabel->setPixmap(src.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation));
 }
 
 void MainWindow::loadAllFromDb() {
+    const QStringList old = ThumbnailModel::databasesToUpgrade();
+    if (old.isEmpty()) loadLibrary();
+    else upgradeDatabases(old);
+}
+
+void MainWindow::upgradeDatabases(const QStringList& files) {
+    m_showAllAction->setEnabled(false);
+    auto* dialog = new QProgressDialog("正在升级图库数据库…", QString(), 0, 0, this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->setWindowModality(Qt::WindowModal);
+    dialog->setMinimumDuration(0);
+    dialog->show();
+    QPointer<MainWindow> self(this);
+    QPointer<QProgressDialog> progress(dialog);
+    (void)TaskScheduler::run(TaskScheduler::Priority::Interactive, [self, progress, files]{
+        for (int i = 0; i < files.size(); ++i) {
+            const QString label = QString("正在升级图库数据库 %1/%2…").arg(i + 1).arg(files.size());
+            SqliteStore store;
+            store.setUpgradeProgress([progress, label](int done, int total){
+                QMetaObject::invokeMethod(qApp, [progress, label, done, total]{
+                    if (!progress) return;
+                    progress->setLabelText(label);
+                    progress->setMaximum(total);
+                    progress->setValue(qMin(done, total));
+                }, Qt::QueuedConnection);
+            });
+            if (!store.open(files[i])) qWarning() << "Cannot upgrade database" << files[i];
+        }
+        QMetaObject::invokeMethod(qApp, [self, progress]{
+            if (progress) progress->close();
+            if (!self) return;
+            self->m_showAllAction->setEnabled(true);
+            // Not loadAllFromDb(): a database that failed to convert would loop
+            self->loadLibrary();
+        }, Qt::QueuedConnection);
+    });
+}
+
+void MainWindow::loadLibrary() {
+    m_remoteQuery = {};
     m_model->loadAll();
+    m_model->backfillThumbnails();
+    m_model->updateNeighborGraph();
+    refreshRoots();
 }
 
 void MainWindow::loadSettings() {
@@ -307,6 +729,7 @@ void MainWindow::loadSettings() {
     m_topKSpin->setValue(topk);
     int ham = s.value("maxHamming", 16).toInt();
     m_hammingSlider->setValue(ham);
+    m_hashOnlyCheck->setChecked(ImageIndexer::profileFromSettings() == ImageIndexer::Profile::HashOnly);
 }
 
 void MainWindow::saveSettings() {
@@ -357,7 +780,7 @@ void MainWindow::showListContextMenu(const QPoint& pos) {
     } else if (chosen == actCopy) {
         QGuiApplication::clipboard()->setText(paths.join("\n"));
     } else if (chosen == actQuery) {
-        auto results = m_model->searchSimilar(firstPath, m_topKSpin->value(), m_hammingSlider->value());
+        auto results = search(IndexProtocol::Op::SearchSimilar, firstPath, currentFilter());
         m_model->showResults(results);
         if (results.isEmpty()) {
             QMessageBox::information(this, "未找到相似图片",
@@ -378,15 +801,14 @@ void MainWindow::showListContextMenu(const QPoint& pos) {
             op.fFlags = FOF_ALLOWUNDO | FOF_NOCONFIRMATION | FOF_SILENT;
             int res = SHFileOperationW(&op);
             if (res == 0 && !op.fAnyOperationsAborted) {
-                // Remove DB entries and cached thumbs
+                // Remove DB entries and cached thumbs (each in its shard's thumbnail dir)
+                QStringList thumbDirs;
+                for (const QString& p : paths) thumbDirs << m_model->thumbDirForPath(p);
                 m_model->removePaths(paths);
+                notifyService();
                 // also purge cached thumbnails on disk
-                const QString baseDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/thumbs";
-                for (const QString& p : paths) {
-                    const QString h = QString::number(qHash(QDir::toNativeSeparators(p)));
-                    QFile::remove(baseDir + "/" + h + "_256.jpg");
-                    QFile::remove(baseDir + "/" + h + "_384.jpg");
-                }
+                const auto thumbOpts = ThumbnailPyramid::Options::fromSettings();
+                for (int i = 0; i < paths.size(); ++i) ThumbnailPyramid::remove(thumbDirs[i], paths[i], thumbOpts);
             } else {
                 QMessageBox::warning(this, "操作失败", "移动到回收站失败或已取消。");
             }
@@ -405,16 +827,16 @@ void MainWindow::showListContextMenu(const QPoint& pos) {
                 }
             }
             if (okCount > 0) {
+                QStringList thumbDirs;
+                for (const QString& p : paths) thumbDirs << m_model->thumbDirForPath(p);
                 m_model->removePaths(paths);
-                const QString baseDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/thumbs";
-                for (const QString& p : paths) {
-                    const QString h = QString::number(qHash(QDir::toNativeSeparators(p)));
-                    QFile::remove(baseDir + "/" + h + "_256.jpg");
-                    QFile::remove(baseDir + "/" + h + "_384.jpg");
-                }
+                notifyService();
+                const auto thumbOpts = ThumbnailPyramid::Options::fromSettings();
+                for (int i = 0; i < paths.size(); ++i) ThumbnailPyramid::remove(thumbDirs[i], paths[i], thumbOpts);
             } else {
                 // 即便文件不存在，也尝试从库中移除
                 m_model->removePaths(paths);
+                notifyService();
             }
         }
     }
@@ -2,19 +2,25 @@
 #include <QMainWindow>
 #include <QPointer>
 #include <QFutureWatcher>
+#include "IndexProtocol.h"
+#include "ThumbnailModel.h"
 
 class QListView;
 class QLabel;
 class QProgressBar;
 class QLineEdit;
+class QListWidget;
 class QSpinBox;
 class QPushButton;
 class QSlider;
 class QDockWidget;
 class QAction;
+class QCheckBox;
+class QDateEdit;
 class QFileSystemWatcher;
-class ThumbnailModel;
+class ThumbnailDelegate;
 class ImageIndexer;
+class PreviewLoader;
 class QCloseEvent;
 
 class MainWindow : public QMainWindow {
@@ -30,41 +36,85 @@ private slots:
     void startIndexing(const QString& folder);
     void onIndexingProgress(int indexed, int total);
     void onIndexingFinished();
+    void detachSelectedRoot();
 
     void openQueryImage();
     void findSimilar();
+    void findByHash();
+    void findCrops();
+    void findFused();
+    void findEmbedding();
+    void batchQuery();
     void onSelectionChanged();
+    void onPreviewReady(const QString& path, const QImage& image, const QSize& originalSize);
     void showListContextMenu(const QPoint& pos);
 
 private:
     void setupUi();
     void setupConnections();
     void loadAllFromDb();
+    // Converts databases of an earlier schema in the background, then loads the library
+    void upgradeDatabases(const QStringList& files);
+    void loadLibrary();
+    void refreshRoots();
+    // Runs in the background, through a running index service if viaService
+    void startBatchQuery(const QStringList& queries, const BatchQuery::Options& opts, bool viaService);
+    // Results of a batch query that ran in the background
+    void showBatchReport(int queryCount, const QList<BatchQuery::Report>& reports, const QHash<qint64, QString>& paths);
+    // Reply timeout of calls into the index service (QSettings service/timeoutMs)
+    static int serviceTimeoutMs();
+    // Tell a running index service that this process changed the library
+    void notifyService();
     void loadSettings();
     void saveSettings();
     void setPreviewFromImage(const QImage& img);
+    void setPreviewPixmap(const QPixmap& pm);
+    void showPreview(const QString& path);
+    void refineResults();
+    // Query restrictions from the left dock, applied by every search
+    SearchFilter currentFilter() const;
+    // Through a running index service (bounded wait), else the local model; TopK and the
+    // Hamming limit come from the toolbar
+    QList<ThumbnailModel::ResultItem> search(IndexProtocol::Op op, const QString& path, const SearchFilter& filter);
 
     // UI
     QListView* m_listView{};
     ThumbnailModel* m_model{};
+    ThumbnailDelegate* m_delegate{};
 
     // Left dock controls
     QDockWidget* m_leftDock{};
     QLineEdit* m_folderEdit{};
     QPushButton* m_browseBtn{};
     QPushButton* m_indexBtn{};
+    QCheckBox* m_hashOnlyCheck{};   // index/profile: hashes now, thumbnails in the background
+    QListWidget* m_rootList{};      // library roots, one shard each
+    QPushButton* m_detachBtn{};
     QSlider* m_thumbSizeSlider{};
     QLabel* m_thumbSizeLabel{};
+    QSpinBox* m_aspectSpin{};       // percent; 0 = any aspect ratio
+    QSpinBox* m_minWidthSpin{};
+    QSpinBox* m_minHeightSpin{};
+    QLineEdit* m_scopeEdit{};       // only search under this folder
+    QCheckBox* m_dateCheck{};
+    QDateEdit* m_fromDate{};
+    QDateEdit* m_toDate{};
 
     // Right dock controls
     QDockWidget* m_rightDock{};
     QLabel* m_previewLabel{};
     QLabel* m_metaLabel{};
     QPushButton* m_queryBtn{};
+    QString m_previewPath;          // path the preview pane is currently showing
 
     // Toolbar/search
     QAction* m_openQueryAction{};
     QAction* m_showAllAction{};
+    QAction* m_hashQueryAction{};
+    QAction* m_cropQueryAction{};
+    QAction* m_fusedQueryAction{};
+    QAction* m_embedQueryAction{};
+    QAction* m_batchQueryAction{};
     QSpinBox* m_topKSpin{};
     QSlider* m_hammingSlider{};
     QLabel* m_hammingValue{};
@@ -72,6 +122,15 @@ private:
     // Status
     QProgressBar* m_progress{};
 
+    // Last search answered by the service (op Ping: none); refined by asking again
+    struct RemoteQuery {
+        IndexProtocol::Op op{IndexProtocol::Op::Ping};
+        QString path;
+        SearchFilter filter;
+    };
+    RemoteQuery m_remoteQuery;
+
     // Workers
     ImageIndexer* m_indexer{};
+    PreviewLoader* m_previewLoader{};
 };
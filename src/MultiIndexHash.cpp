@@ -0,0 +1,165 @@
+#include "MultiIndexHash.h"
+#include "ImageHash.h"
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+// Number of keys within Hamming distance r of a bits-wide key
+static quint64 ballSize(int bits, int r) {
+    quint64 total = 0, c = 1;
+    for (int i = 0; i <= r && i <= bits; ++i) {
+        total += c;
+        c = c * quint64(bits - i) / quint64(i + 1);
+    }
+    return total;
+}
+}
+
+const std::vector<quint32>* MultiIndexHash::Table::bucket(quint32 key) const {
+    if (bits <= 16) return &direct[key];
+    auto it = sparse.find(key);
+    return it == sparse.end() ? nullptr : &it->second;
+}
+
+std::vector<quint32>& MultiIndexHash::Table::bucketForWrite(quint32 key) {
+    if (bits <= 16) return direct[key];
+    return sparse[key];
+}
+
+MultiIndexHash::MultiIndexHash(int substrings)
+    : m_m(qBound(2, substrings, 8))
+{
+    clear();
+}
+
+void MultiIndexHash::clear() {
+    m_tables.clear();
+    m_tables.resize(m_m);
+    const int base = 64 / m_m;
+    const int extra = 64 % m_m;
+    int shift = 0;
+    for (int i = 0; i < m_m; ++i) {
+        Table& t = m_tables[i];
+        t.bits = base + (i < extra ? 1 : 0);
+        t.shift = shift;
+        shift += t.bits;
+        if (t.bits <= 16) t.direct.resize(size_t(1) << t.bits);
+    }
+    m_codes.clear();
+    m_present.clear();
+    m_count = 0;
+}
+
+void MultiIndexHash::build(const quint64* codes, int count) {
+    clear();
+    m_codes.assign(codes, codes + count);
+    m_present.assign(size_t(count), 1);
+    m_count = count;
+    for (Table& t : m_tables) {
+        if (t.bits <= 16) {
+            // Two passes so every bucket is allocated exactly once
+            std::vector<quint32> counts(t.direct.size(), 0);
+            for (int v = 0; v < count; ++v) ++counts[substring(t, codes[v])];
+            for (size_t k = 0; k < counts.size(); ++k) t.direct[k].reserve(counts[k]);
+        }
+        for (int v = 0; v < count; ++v) t.bucketForWrite(substring(t, codes[v])).push_back(quint32(v));
+    }
+}
+
+void MultiIndexHash::insert(quint32 value, quint64 code) {
+    if (value < m_present.size() && m_present[value]) {
+        if (m_codes[value] == code) return;
+        remove(value);
+    }
+    if (value >= m_codes.size()) {
+        m_codes.resize(size_t(value) + 1, 0);
+        m_present.resize(size_t(value) + 1, 0);
+    }
+    m_codes[value] = code;
+    m_present[value] = 1;
+    ++m_count;
+    for (Table& t : m_tables) t.bucketForWrite(substring(t, code)).push_back(value);
+}
+
+void MultiIndexHash::remove(quint32 value) {
+    if (value >= m_present.size() || !m_present[value]) return;
+    const quint64 code = m_codes[value];
+    for (Table& t : m_tables) {
+        auto& b = t.bucketForWrite(substring(t, code));
+        auto it = std::find(b.begin(), b.end(), value);
+        if (it != b.end()) { *it = b.back(); b.pop_back(); }
+    }
+    m_present[value] = 0;
+    --m_count;
+}
+
+void MultiIndexHash::probe(const Table& t, quint32 key, int bitFrom, int flipsLeft, std::vector<quint32>& out) const {
+    if (const auto* b = t.bucket(key)) out.insert(out.end(), b->begin(), b->end());
+    if (flipsLeft == 0) return;
+    for (int bit = bitFrom; bit < t.bits; ++bit)
+        probe(t, key ^ (quint32(1) << bit), bit + 1, flipsLeft - 1, out);
+}
+
+std::vector<MultiIndexHash::Match> MultiIndexHash::search(quint64 query, int radius) const {
+    if (radius < 0 || m_count == 0) return {};
+    const int subRadius = radius / m_m;
+    // Expected probes plus bucket hits, assuming uniformly spread codes. Random
+    // candidate access costs roughly 16x a sequential popcount, so past that point
+    // the linear scan wins.
+    const Table& widest = m_tables.front();
+    const double probes = double(m_m) * double(ballSize(widest.bits, subRadius));
+    const double perBucket = double(m_count) / double(quint64(1) << widest.bits);
+    if (probes * (1.0 + perBucket) * 16.0 > double(m_count))
+        return linearSearch(query, radius);
+
+    std::vector<quint32> candidates;
+    for (const Table& t : m_tables) probe(t, substring(t, query), 0, subRadius, candidates);
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    std::vector<Match> out;
+    for (quint32 v : candidates) {
+        const int d = ImageHash::hammingDistance(query, m_codes[v]);
+        if (d <= radius) out.push_back({v, d});
+    }
+    std::sort(out.begin(), out.end(), [](const Match& a, const Match& b){
+        return a.distance != b.distance ? a.distance < b.distance : a.value < b.value;
+    });
+    return out;
+}
+
+std::vector<MultiIndexHash::Match> MultiIndexHash::searchWithVariants(const MultiIndexHash& primary, const MultiIndexHash& variants,
+                                                                     quint64 query, int radius) {
+    std::vector<Match> all = primary.search(query, radius);
+    if (variants.size() == 0) return all;
+    const std::vector<Match> more = variants.search(query, radius);
+    if (more.empty()) return all;
+    all.reserve(all.size() + more.size());
+    for (const Match& m : more) all.push_back({m.value / quint32(kVariants), m.distance});
+    std::sort(all.begin(), all.end(), [](const Match& a, const Match& b){
+        return a.distance != b.distance ? a.distance < b.distance : a.value < b.value;
+    });
+    // Sorted by distance, so a value's first occurrence is its best
+    std::vector<Match> out;
+    out.reserve(all.size());
+    std::unordered_set<quint32> seen;
+    for (const Match& m : all) {
+        if (seen.insert(m.value).second) out.push_back(m);
+    }
+    return out;
+}
+
+std::vector<MultiIndexHash::Match> MultiIndexHash::linearSearch(quint64 query, int radius) const {
+    std::vector<Match> out;
+    if (radius < 0) return out;
+    const size_t n = m_codes.size();
+    for (size_t v = 0; v < n; ++v) {
+        if (!m_present[v]) continue;
+        const int d = ImageHash::hammingDistance(query, m_codes[v]);
+        if (d <= radius) out.push_back({quint32(v), d});
+    }
+    std::sort(out.begin(), out.end(), [](const Match& a, const Match& b){
+        return a.distance != b.distance ? a.distance < b.distance : a.value < b.value;
+    });
+    return out;
+}
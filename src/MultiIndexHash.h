@@ -0,0 +1,60 @@
+#pragma once
+#include <QtCore>
+#include <unordered_map>
+#include <vector>
+
+// Multi-index hashing (Norouzi et al.) over 64-bit codes.
+// The code is split into m disjoint substrings, each with its own table.
+// Two codes within Hamming radius r agree to within floor(r/m) bits on at
+// least one substring, so a query only probes those buckets and verifies
+// the candidates against the full code.
+class MultiIndexHash {
+public:
+    struct Match { quint32 value; int distance; };
+
+    explicit MultiIndexHash(int substrings = 4);
+
+    int substrings() const { return m_m; }
+    int size() const { return m_count; }
+    void clear();
+
+    // Index codes[0..count-1] under values 0..count-1
+    void build(const quint64* codes, int count);
+    // Add or replace the code stored for value
+    void insert(quint32 value, quint64 code);
+    void remove(quint32 value);
+
+    // All values within radius of query, ascending by distance
+    std::vector<Match> search(quint64 query, int radius) const;
+    // Reference linear scan over the same data
+    std::vector<Match> linearSearch(quint64 query, int radius) const;
+
+    // search() over primary and over an index of further codes per value, stored under
+    // value * kVariants + k (the rotated/mirrored pHashes of an image, k = 1..7): each value
+    // once, with its best distance. The query is probed once per index instead of once per
+    // variant; variants may be empty.
+    static constexpr int kVariants = 8;
+    static std::vector<Match> searchWithVariants(const MultiIndexHash& primary, const MultiIndexHash& variants,
+                                                 quint64 query, int radius);
+
+private:
+    struct Table {
+        int shift{0};
+        int bits{0};
+        std::vector<std::vector<quint32>> direct;                    // bits <= 16
+        std::unordered_map<quint32, std::vector<quint32>> sparse;    // wider substrings
+        const std::vector<quint32>* bucket(quint32 key) const;
+        std::vector<quint32>& bucketForWrite(quint32 key);
+    };
+
+    quint32 substring(const Table& t, quint64 code) const {
+        return quint32((code >> t.shift) & ((t.bits == 32) ? 0xffffffffull : ((1ull << t.bits) - 1)));
+    }
+    void probe(const Table& t, quint32 key, int bitFrom, int flipsLeft, std::vector<quint32>& out) const;
+
+    int m_m;
+    int m_count{0};
+    std::vector<Table> m_tables;
+    std::vector<quint64> m_codes;    // by value
+    std::vector<quint8> m_present;   // by value
+};
@@ -0,0 +1,254 @@
+#include "NeighborGraph.h"
+#include "SqliteStore.h"
+#include "ImageIndex.h"
+#include "HistogramIndex.h"
+#include "VisualVocabulary.h"
+#include "BowIndex.h"
+#include "LibraryShard.h"
+#include "OrbFeatures.h"
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <numeric>
+
+namespace {
+// Candidates per shard scored with the ratio test, like the interactive search
+constexpr int kShortlist = 300;
+// Unpacked descriptors kept between images; neighbouring images share most candidates
+constexpr int kDescriptorCache = 4000;
+
+#ifdef HAVE_OPENCV
+// The builder's own read-mostly copy of one shard
+struct Shard {
+    int tag{0};
+    std::unique_ptr<SqliteStore> store;
+    ImageIndex index;
+    HistogramIndex hist;
+    VisualVocabulary vocab;
+    BowIndex bow;
+    bool hasBow{false};
+
+    qint64 globalId(qint64 local) const { return (qint64(tag) << LibraryShard::kTagBits) | local; }
+};
+
+static void loadShard(Shard& s) {
+    s.store->loadIndex(s.index);
+    s.store->forEachHistogram([&s](qint64 id, const QByteArray& hist){
+        const int slot = s.index.slotForId(id);
+        if (slot >= 0 && hist.size() == ColorHistogram::kBins) s.hist.set(slot, reinterpret_cast<const quint8*>(hist.constData()));
+    });
+    if (s.vocab.deserialize(s.store->loadVocabulary())) {
+        s.bow.reset(s.vocab.wordCount());
+        s.store->forEachWords([&s](qint64 id, const QByteArray& words){
+            const int slot = s.index.slotForId(id);
+            if (slot >= 0) s.bow.add(quint32(slot), reinterpret_cast<const quint32*>(words.constData()), int(words.size() / sizeof(quint32)));
+        });
+        s.bow.finalize();
+        s.hasBow = s.bow.documentCount() > 0;
+    }
+}
+#endif
+}
+
+namespace NeighborGraph {
+
+QByteArray encode(const QList<Edge>& edges) {
+    return QByteArray(reinterpret_cast<const char*>(edges.constData()), edges.size() * qsizetype(sizeof(Edge)));
+}
+
+QList<Edge> decode(const QByteArray& blob) {
+    QList<Edge> edges(blob.size() / qsizetype(sizeof(Edge)));
+    if (!edges.isEmpty()) std::memcpy(edges.data(), blob.constData(), size_t(edges.size()) * sizeof(Edge));
+    return edges;
+}
+}
+
+NeighborGraphBuilder::NeighborGraphBuilder(QObject* parent) : QObject(parent) {}
+
+NeighborGraphBuilder::~NeighborGraphBuilder() {
+    cancel();
+}
+
+void NeighborGraphBuilder::cancel() {
+    m_cancel = true;
+    m_future.waitForFinished();
+}
+
+void NeighborGraphBuilder::start(const QList<ShardRef>& shards) {
+    if (m_future.isRunning()) return;
+    m_cancel = false;
+    m_future = TaskScheduler::run(TaskScheduler::Priority::Background, [this, shards]{ run(shards); });
+}
+
+void NeighborGraphBuilder::run(const QList<ShardRef>& refs) {
+#ifndef HAVE_OPENCV
+    Q_UNUSED(refs);
+    emit finished(0);
+#else
+    using NeighborGraph::Edge;
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<std::unique_ptr<Shard>> shards;
+    for (const auto& ref : refs) {
+        auto s = std::make_unique<Shard>();
+        s->tag = ref.tag;
+        s->store = std::make_unique<SqliteStore>();
+        if (s->store->open(ref.dir + QLatin1String("/index.db"))) shards.push_back(std::move(s));
+        else qWarning() << "Neighbour graph: cannot open shard" << ref.dir;
+    }
+    QList<QPair<int, qint64>> pending;   // shard, row id
+    for (int s = 0; s < int(shards.size()); ++s) {
+        for (qint64 id : shards[s]->store->idsWithoutNeighbors()) pending.push_back({s, id});
+    }
+    if (pending.isEmpty()) { emit finished(0); return; }
+    // Candidates come from every shard, so all of them are loaded
+    for (const auto& s : shards) loadShard(*s);
+    qInfo() << "Neighbour graph: building lists for" << pending.size() << "images";
+
+    QCache<qint64, cv::Mat> cache(kDescriptorCache);
+    // Descriptors of (shard, slot)s by global id, loading the uncached ones in one query per shard
+    auto descriptorsFor = [&](const std::vector<std::pair<int, int>>& items) {
+        std::vector<cv::Mat> out(items.size());
+        QHash<int, QList<qint64>> missing;
+        QHash<qint64, size_t> slotOf;   // global id -> position in items
+        for (size_t i = 0; i < items.size(); ++i) {
+            const Shard& s = *shards[size_t(items[i].first)];
+            const qint64 local = s.index.id(items[i].second);
+            if (const cv::Mat* m = cache.object(s.globalId(local))) {
+                out[i] = *m;
+            } else {
+                missing[items[i].first].push_back(local);
+                slotOf.insert(s.globalId(local), i);
+            }
+        }
+        for (auto it = missing.constBegin(); it != missing.constEnd(); ++it) {
+            const Shard& s = *shards[size_t(it.key())];
+            const auto blobs = s.store->loadDescriptors(it.value());
+            for (qint64 local : it.value()) {
+                const cv::Mat m = OrbFeatures::unpack(blobs.value(local));
+                out[slotOf.value(s.globalId(local))] = m;
+                cache.insert(s.globalId(local), new cv::Mat(m));
+            }
+        }
+        return out;
+    };
+
+    int updated = 0, done = 0;
+    for (const auto& [qs, qid] : pending) {
+        if (m_cancel) break;
+        TaskScheduler::yieldToInteractive();
+        if (++done % 50 == 0) emit progress(done, pending.size());
+        Shard& qshard = *shards[size_t(qs)];
+        const int qslot = qshard.index.slotForId(qid);
+        if (qslot < 0) continue;
+        const qint64 qgid = qshard.globalId(qid);
+        const cv::Mat qdesc = descriptorsFor({{qs, qslot}}).front();
+        if (qdesc.empty()) {
+            // Nothing to match with until the image is re-indexed; the search handles it
+            qshard.store->upsertNeighbors(qid, {});
+            continue;
+        }
+        HistogramIndex::Probe qprobe;
+        if (qshard.hist.has(qslot))
+            qprobe = HistogramIndex::probe(QByteArray(reinterpret_cast<const char*>(qshard.hist.at(qslot)), ColorHistogram::kBins));
+
+        // Shortlist in every shard: its bag-of-words index, else the best color correlations
+        std::vector<std::pair<int, int>> cands;
+        for (int t = 0; t < int(shards.size()); ++t) {
+            const Shard& s = *shards[size_t(t)];
+            std::vector<int> slots;
+            if (s.hasBow) {
+                const auto words = s.vocab.quantizeAll(qdesc.ptr<quint8>(), qdesc.rows);
+                for (const auto& h : s.bow.query(words.data(), int(words.size()), kShortlist)) slots.push_back(int(h.slot));
+            } else if (qprobe.isValid() && s.hist.count() > 0) {
+                std::vector<float> corr;
+                s.hist.correlateAll(qprobe, s.index.size(), corr);
+                slots.resize(corr.size());
+                std::iota(slots.begin(), slots.end(), 0);
+                const size_t keep = std::min(slots.size(), size_t(kShortlist));
+                std::partial_sort(slots.begin(), slots.begin() + keep, slots.end(), [&corr](int a, int b){ return corr[size_t(a)] > corr[size_t(b)]; });
+                slots.resize(keep);
+            } else if (s.index.size() <= kShortlist) {
+                slots.resize(size_t(s.index.size()));
+                std::iota(slots.begin(), slots.end(), 0);
+            }
+            for (int slot : slots) {
+                if (slot < s.index.size() && !(t == qs && slot == qslot)) cands.push_back({t, slot});
+            }
+        }
+        const std::vector<cv::Mat> cdescs = descriptorsFor(cands);
+
+        // Score like searchSimilar; images without a stored histogram count as uncorrelated
+        std::vector<double> corrs(cands.size(), 0.0);
+        std::vector<double> sims(cands.size(), 0.0);
+        std::vector<int> order(cands.size());
+        std::iota(order.begin(), order.end(), 0);
+        TaskScheduler::blockingMap(TaskScheduler::Priority::Background, order, [&](int i) {
+            const Shard& s = *shards[size_t(cands[size_t(i)].first)];
+            const int slot = cands[size_t(i)].second;
+            if (qprobe.isValid() && s.hist.has(slot)) corrs[size_t(i)] = s.hist.correlation(qprobe, slot);
+            const double orb = double(OrbFeatures::goodMatches(qdesc, cdescs[size_t(i)])) / double(qdesc.rows);
+            sims[size_t(i)] = NeighborGraph::similarity(orb, corrs[size_t(i)]);
+        });
+        const size_t keep = std::min(order.size(), size_t(NeighborGraph::kDegree));
+        std::partial_sort(order.begin(), order.begin() + keep, order.end(), [&sims](int a, int b){
+            return sims[size_t(a)] != sims[size_t(b)] ? sims[size_t(a)] > sims[size_t(b)] : a < b;
+        });
+        order.resize(keep);
+
+        QList<Edge> edges;
+        edges.reserve(int(keep));
+        for (int i : order) {
+            const Shard& s = *shards[size_t(cands[size_t(i)].first)];
+            edges.push_back({s.globalId(s.index.id(cands[size_t(i)].second)), NeighborGraph::distance(sims[size_t(i)]), 0});
+        }
+
+        // Offer the image to the lists of its neighbours (scored from their side, the ratio test
+        // is not symmetric). Images with no list yet get theirs from their own pass.
+        QMap<int, QList<QPair<qint64, Edge>>> offers;   // shard -> (neighbour row id, edge)
+        offers[qs];
+        for (int i : order) {
+            const int t = cands[size_t(i)].first;
+            const qint64 nid = shards[size_t(t)]->index.id(cands[size_t(i)].second);
+            const cv::Mat& ndesc = cdescs[size_t(i)];
+            if (ndesc.empty()) continue;
+            // Cheap pre-check before the ratio test; the list is read again under the write lock
+            const QList<Edge> theirs = NeighborGraph::decode(shards[size_t(t)]->store->loadNeighbors(nid));
+            if (theirs.isEmpty()) continue;
+            if (std::any_of(theirs.cbegin(), theirs.cend(), [qgid](const Edge& e){ return e.id == qgid; })) continue;
+            const double orb = double(OrbFeatures::goodMatches(ndesc, qdesc)) / double(ndesc.rows);
+            const Edge e{qgid, NeighborGraph::distance(NeighborGraph::similarity(orb, corrs[size_t(i)])), 0};
+            if (theirs.size() >= NeighborGraph::kDegree && e.distance >= theirs.back().distance) continue;
+            offers[t].push_back({nid, e});
+        }
+
+        // One short write transaction per shard touched, after all the scoring: the indexer writes
+        // to the same files, and a list it cleared meanwhile must not be written back
+        for (auto it = offers.constBegin(); it != offers.constEnd(); ++it) {
+            SqliteStore& store = *shards[size_t(it.key())]->store;
+            if (!store.writeTransaction()) {
+                qWarning() << "Neighbour graph: shard busy, lists of image" << qid << "skipped";
+                continue;
+            }
+            bool ok = it.key() != qs || store.upsertNeighbors(qid, NeighborGraph::encode(edges));
+            for (const auto& [nid, e] : it.value()) {
+                QList<Edge> theirs = NeighborGraph::decode(store.loadNeighbors(nid));
+                if (theirs.isEmpty() || std::any_of(theirs.cbegin(), theirs.cend(), [qgid](const Edge& x){ return x.id == qgid; })) continue;
+                if (theirs.size() >= NeighborGraph::kDegree && e.distance >= theirs.back().distance) continue;
+                const auto at = std::upper_bound(theirs.begin(), theirs.end(), e, [](const Edge& a, const Edge& b){ return a.distance < b.distance; });
+                theirs.insert(at, e);
+                if (theirs.size() > NeighborGraph::kDegree) theirs.resize(NeighborGraph::kDegree);
+                ok = ok && store.upsertNeighbors(nid, NeighborGraph::encode(theirs));
+            }
+            if (ok && store.commit()) {
+                if (it.key() == qs) ++updated;
+            } else {
+                store.rollback();
+            }
+        }
+    }
+    qInfo() << "Neighbour graph: updated" << updated << "lists in" << timer.elapsed() << "ms" << (m_cancel ? "(cancelled)" : "");
+    emit finished(updated);
+#endif
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <QtCore>
+#include <QFuture>
+#include <atomic>
+#include <cmath>
+
+// Persisted k-nearest-neighbour graph: for every indexed image the best kDegree
+// other images of the whole library under the "查找相似" score, stored in the
+// image's shard (table neighbors). Similar-image queries for indexed images are
+// then one keyed lookup; external files still go through the full search.
+namespace NeighborGraph {
+    constexpr int kDegree = 64;
+
+    // id is global (LibraryShard::globalId), distance as in ThumbnailModel::ResultItem
+    struct Edge {
+        qint64 id;
+        qint32 distance;
+        qint32 reserved;
+    };
+    QByteArray encode(const QList<Edge>& edges);
+    QList<Edge> decode(const QByteArray& blob);
+
+    // The similarity searchSimilar ranks by: ORB ratio-test score and hue/saturation
+    // correlation, mapped to a 0..1000 distance
+    inline double similarity(double orbScore, double correlation) {
+        return std::max(0.0, std::min(1.0, 0.7 * orbScore + 0.3 * ((correlation + 1.0) / 2.0)));
+    }
+    inline int distance(double similarity) { return int(std::lround((1.0 - similarity) * 1000.0)); }
+}
+
+// Background job that fills the graph for images that have no neighbour list yet
+// (new, or re-indexed since) and offers each new image to its neighbours' lists.
+// It opens its own connections to the shard databases.
+class NeighborGraphBuilder : public QObject {
+    Q_OBJECT
+public:
+    struct ShardRef { int tag; QString dir; };
+
+    explicit NeighborGraphBuilder(QObject* parent = nullptr);
+    ~NeighborGraphBuilder() override;
+
+    // No-op while a build is running
+    void start(const QList<ShardRef>& shards);
+    // Stop a running build and wait for it
+    void cancel();
+    bool isRunning() const { return m_future.isRunning(); }
+
+signals:
+    void progress(int done, int total);
+    void finished(int updated);
+
+private:
+    void run(const QList<ShardRef>& shards);
+
+    QFuture<void> m_future;
+    std::atomic<bool> m_cancel{false};
+};
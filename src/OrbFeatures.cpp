@@ -0,0 +1,90 @@
+#include "OrbFeatures.h"
+#ifdef HAVE_OPENCV
+#include <opencv2/features2d.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+// Detector and scratch buffers kept per worker thread; search and indexing call these
+// once per image, and creating the ORB pyramid or the match matrices each time dominated the allocations
+struct Workspace {
+    cv::Ptr<cv::ORB> orb = cv::ORB::create(OrbFeatures::kMaxFeatures);
+    std::vector<cv::KeyPoint> keypoints;
+    cv::Mat dist, nidx;
+};
+
+Workspace& workspace() {
+    thread_local Workspace ws;
+    return ws;
+}
+}
+
+void OrbFeatures::toBgrMat(const QImage& img, cv::Mat& out) {
+    if (img.isNull()) { out.release(); return; }
+    // Wrap the source pixels and convert straight into out, which keeps its buffer when the size repeats
+    switch (img.format()) {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+        cv::cvtColor(cv::Mat(img.height(), img.width(), CV_8UC4, const_cast<uchar*>(img.constBits()), img.bytesPerLine()), out, cv::COLOR_BGRA2BGR);
+        return;
+#endif
+    case QImage::Format_RGB888:
+        cv::cvtColor(cv::Mat(img.height(), img.width(), CV_8UC3, const_cast<uchar*>(img.constBits()), img.bytesPerLine()), out, cv::COLOR_RGB2BGR);
+        return;
+    case QImage::Format_BGR888:
+        cv::Mat(img.height(), img.width(), CV_8UC3, const_cast<uchar*>(img.constBits()), img.bytesPerLine()).copyTo(out);
+        return;
+    case QImage::Format_Grayscale8:
+        cv::cvtColor(cv::Mat(img.height(), img.width(), CV_8UC1, const_cast<uchar*>(img.constBits()), img.bytesPerLine()), out, cv::COLOR_GRAY2BGR);
+        return;
+    default: {
+        const QImage bgr = img.convertToFormat(QImage::Format_BGR888);
+        cv::Mat(bgr.height(), bgr.width(), CV_8UC3, const_cast<uchar*>(bgr.constBits()), bgr.bytesPerLine()).copyTo(out);
+        return;
+    }
+    }
+}
+
+cv::Mat OrbFeatures::toBgrMat(const QImage& img) {
+    cv::Mat m;
+    toBgrMat(img, m);
+    return m;
+}
+
+cv::Mat OrbFeatures::describe(const cv::Mat& bgr) {
+    cv::Mat desc;
+    if (bgr.empty()) return desc;
+    Workspace& ws = workspace();
+    ws.orb->detectAndCompute(bgr, cv::noArray(), ws.keypoints, desc);
+    return desc;
+}
+
+QByteArray OrbFeatures::pack(const cv::Mat& descriptors) {
+    if (descriptors.empty() || descriptors.cols != 32 || descriptors.type() != CV_8U) return {};
+    const cv::Mat c = descriptors.isContinuous() ? descriptors : descriptors.clone();
+    return QByteArray(reinterpret_cast<const char*>(c.data), int(c.total()));
+}
+
+cv::Mat OrbFeatures::unpack(const QByteArray& blob) {
+    return view(blob).clone();
+}
+
+cv::Mat OrbFeatures::view(const QByteArray& blob) {
+    if (blob.isEmpty() || blob.size() % 32 != 0) return cv::Mat();
+    return cv::Mat(int(blob.size() / 32), 32, CV_8U, const_cast<char*>(blob.constData()));
+}
+
+int OrbFeatures::goodMatches(const cv::Mat& query, const cv::Mat& candidate) {
+    if (query.empty() || candidate.empty()) return 0;
+    // Same two-nearest search BFMatcher::knnMatch runs, minus the per-call DMatch vectors
+    Workspace& ws = workspace();
+    cv::batchDistance(query, candidate, ws.dist, CV_32S, ws.nidx, cv::NORM_HAMMING, 2);
+    int good = 0;
+    for (int r = 0; r < ws.nidx.rows; ++r) {
+        const int* idx = ws.nidx.ptr<int>(r);
+        const int* d = ws.dist.ptr<int>(r);
+        if (idx[0] >= 0 && idx[1] >= 0 && d[0] < kRatio * d[1]) ++good;
+    }
+    return good;
+}
+#endif
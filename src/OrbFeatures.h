@@ -0,0 +1,27 @@
+#pragma once
+#include <QtCore>
+#include <QtGui/QImage>
+#ifdef HAVE_OPENCV
+#include <opencv2/core.hpp>
+
+// ORB helpers shared by the indexer (descriptor cache) and search (re-ranking)
+namespace OrbFeatures {
+    constexpr int kMaxFeatures = 300;
+    constexpr double kRatio = 0.75;
+
+    // Deep BGR copy of img
+    cv::Mat toBgrMat(const QImage& img);
+    // Same, converting into out so a caller looping over images reuses its buffer
+    void toBgrMat(const QImage& img, cv::Mat& out);
+    // Up to kMaxFeatures rows of 32-byte descriptors (CV_8U)
+    cv::Mat describe(const cv::Mat& bgr);
+
+    QByteArray pack(const cv::Mat& descriptors);
+    cv::Mat unpack(const QByteArray& blob);
+    // Non-owning view of blob; valid only while blob is alive and unmodified
+    cv::Mat view(const QByteArray& blob);
+
+    // Query descriptors passing Lowe's ratio test against candidate
+    int goodMatches(const cv::Mat& query, const cv::Mat& candidate);
+}
+#endif
@@ -0,0 +1,90 @@
+#include "PreviewLoader.h"
+#include "DecodeBudget.h"
+#include <QtGui/QImageReader>
+
+PreviewLoader::PreviewLoader(QObject* parent)
+    : QObject(parent)
+    , m_generation(std::make_shared<std::atomic<quint64>>(0))
+{
+    // One decoder for the visible request, one for prefetch
+    m_pool.setMaxThreadCount(2);
+    setCacheLimit(96);
+}
+
+PreviewLoader::~PreviewLoader() {
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+void PreviewLoader::setCacheLimit(int megabytes) {
+    m_cache.setMaxCost(qMax(1, megabytes) * 1024);
+}
+
+QSize PreviewLoader::decodeTarget(const QSize& minSize) {
+    return QSize(qMax(512, minSize.width()), qMax(512, minSize.height()));
+}
+
+const PreviewLoader::Decoded* PreviewLoader::cached(const QString& path, const QSize& target) const {
+    const Decoded* d = m_cache.object(path);
+    if (!d) return nullptr;
+    // Good enough if it already fills the target or is the full-resolution image
+    const QSize s = d->image.size();
+    QSize want = d->originalSize.isValid() ? d->originalSize : s;
+    want.scale(target, Qt::KeepAspectRatio);
+    const bool full = d->originalSize.isValid() && s == d->originalSize;
+    return (full || (s.width() >= want.width() && s.height() >= want.height())) ? d : nullptr;
+}
+
+void PreviewLoader::request(const QString& path, const QSize& minSize) {
+    const quint64 gen = ++*m_generation;
+    const QSize target = decodeTarget(minSize);
+    if (const Decoded* d = cached(path, target)) {
+        emit previewReady(path, d->image, d->originalSize);
+        return;
+    }
+    enqueue(path, target, gen, true);
+}
+
+void PreviewLoader::prefetch(const QStringList& paths, const QSize& minSize) {
+    const QSize target = decodeTarget(minSize);
+    for (const QString& p : paths) {
+        if (p.isEmpty() || m_inFlight.contains(p) || cached(p, target)) continue;
+        enqueue(p, target, 0, false);
+    }
+}
+
+void PreviewLoader::enqueue(const QString& path, const QSize& target, quint64 generation, bool deliver) {
+    m_inFlight.insert(path);
+    auto genCounter = m_generation;
+    QPointer<PreviewLoader> self(this);
+    m_pool.start(QRunnable::create([self, genCounter, path, target, generation, deliver]{
+        // Superseded before we got a thread: don't spend a decode on it
+        if (deliver && genCounter->load() != generation) {
+            QMetaObject::invokeMethod(self, [self, path]{ if (self) self->m_inFlight.remove(path); }, Qt::QueuedConnection);
+            return;
+        }
+        QImageReader reader(path);
+        reader.setAutoTransform(true);
+        QSize original = reader.size();
+        if (original.isValid()) {
+            QSize tgt = original;
+            if (tgt.width() > target.width() || tgt.height() > target.height()) {
+                tgt.scale(target, Qt::KeepAspectRatio);
+                reader.setScaledSize(tgt);
+            }
+        }
+        DecodeBudget::Lease lease;
+        const QImage img = lease.read(reader);
+        // Rotated EXIF images report the unrotated size
+        if (!img.isNull() && original.isValid() && (img.width() > img.height()) != (original.width() > original.height()))
+            original.transpose();
+        QMetaObject::invokeMethod(self, [self, path, img, original, generation, deliver]{
+            if (!self) return;
+            self->m_inFlight.remove(path);
+            if (img.isNull()) return;
+            self->m_cache.insert(path, new Decoded{img, original}, qMax<qsizetype>(1, img.sizeInBytes() / 1024));
+            if (deliver && self->m_generation->load() == generation)
+                emit self->previewReady(path, img, original);
+        }, Qt::QueuedConnection);
+    }), deliver ? 1 : 0);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <QtCore>
+#include <QtGui/QImage>
+#include <atomic>
+#include <memory>
+
+// Decodes previews for the right dock off the GUI thread.
+// Only the most recent request is delivered; queued work for superseded
+// requests is skipped before it starts decoding. Decoded images are kept in
+// a small LRU so stepping back and forth through a folder is instant.
+class PreviewLoader : public QObject {
+    Q_OBJECT
+public:
+    explicit PreviewLoader(QObject* parent=nullptr);
+    ~PreviewLoader() override;
+
+    // Decode path to fit minSize (at least 512px); emits previewReady when done,
+    // synchronously if the LRU already holds a large enough image
+    void request(const QString& path, const QSize& minSize);
+    // Warm the LRU for likely next requests (lower priority, never emitted)
+    void prefetch(const QStringList& paths, const QSize& minSize);
+
+    // Cache budget in megabytes of decoded pixels
+    void setCacheLimit(int megabytes);
+
+signals:
+    void previewReady(const QString& path, const QImage& image, const QSize& originalSize);
+
+private:
+    struct Decoded { QImage image; QSize originalSize; };
+    const Decoded* cached(const QString& path, const QSize& target) const;
+    void enqueue(const QString& path, const QSize& target, quint64 generation, bool deliver);
+    static QSize decodeTarget(const QSize& minSize);
+
+    QThreadPool m_pool;
+    QCache<QString, Decoded> m_cache;          // cost in KB
+    QSet<QString> m_inFlight;
+    std::shared_ptr<std::atomic<quint64>> m_generation;
+};
@@ -0,0 +1,59 @@
+#include "RegionIndex.h"
+#include "ImageHash.h"
+#include <algorithm>
+#include <unordered_map>
+
+void RegionIndex::clear() {
+    m_codes.clear();
+    m_owner.clear();
+    m_index.clear();
+    m_images = 0;
+}
+
+void RegionIndex::add(quint32 slot, const quint64* codes, int count) {
+    bool any = false;
+    for (int i = 0; i < count; ++i) {
+        if (!ImageHash::isInformative(codes[i])) continue;
+        m_codes.push_back(codes[i]);
+        m_owner.push_back(slot);
+        any = true;
+    }
+    if (any) ++m_images;
+}
+
+void RegionIndex::build() {
+    m_index.build(m_codes.data(), int(m_codes.size()));
+    // The multi-index keeps its own copy
+    m_codes.clear();
+    m_codes.shrink_to_fit();
+}
+
+std::vector<RegionIndex::Hit> RegionIndex::query(const quint64* codes, int count, int radius, int maxHits) const {
+    std::unordered_map<quint32, Hit> bySlot;
+    for (int i = 0; i < count; ++i) {
+        if (!ImageHash::isInformative(codes[i])) continue;
+        // One vote per query region, however many of the image's regions it hit
+        std::unordered_map<quint32, int> best;
+        for (const auto& m : m_index.search(codes[i], radius)) {
+            const quint32 slot = m_owner[m.value];
+            auto it = best.find(slot);
+            if (it == best.end()) best.emplace(slot, m.distance);
+            else it->second = std::min(it->second, m.distance);
+        }
+        for (const auto& [slot, d] : best) {
+            auto it = bySlot.find(slot);
+            if (it == bySlot.end()) bySlot.emplace(slot, Hit{slot, 1, d});
+            else { ++it->second.votes; it->second.distance = std::min(it->second.distance, d); }
+        }
+    }
+    std::vector<Hit> hits;
+    hits.reserve(bySlot.size());
+    for (const auto& kv : bySlot) hits.push_back(kv.second);
+    const size_t keep = std::min(hits.size(), size_t(std::max(0, maxHits)));
+    std::partial_sort(hits.begin(), hits.begin() + keep, hits.end(), [](const Hit& a, const Hit& b){
+        if (a.votes != b.votes) return a.votes > b.votes;
+        return a.distance != b.distance ? a.distance < b.distance : a.slot < b.slot;
+    });
+    hits.resize(keep);
+    return hits;
+}
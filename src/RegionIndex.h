@@ -0,0 +1,29 @@
+#pragma once
+#include <QtCore>
+#include <vector>
+#include "MultiIndexHash.h"
+
+// Inverted index over per-image region hashes (see ImageHash::regionHashes).
+// Every region code is one entry of a multi-index keyed by its owner; a query
+// probes with each of its own region codes and images are ranked by how many
+// distinct query regions found one of theirs.
+class RegionIndex {
+public:
+    struct Hit { quint32 slot; int votes; int distance; };
+
+    void clear();
+    int imageCount() const { return m_images; }
+
+    // Uninformative codes are skipped; call build() after the last add()
+    void add(quint32 slot, const quint64* codes, int count);
+    void build();
+
+    // Best first: most voting query regions, then smallest distance
+    std::vector<Hit> query(const quint64* codes, int count, int radius, int maxHits) const;
+
+private:
+    std::vector<quint64> m_codes;
+    std::vector<quint32> m_owner;   // by entry
+    MultiIndexHash m_index;         // values are entries
+    int m_images{0};
+};
@@ -0,0 +1,60 @@
+#include "SearchFilter.h"
+#include "ImageIndex.h"
+#include "LibraryShard.h"
+#include <cmath>
+#include <limits>
+
+bool SearchFilter::isActive() const {
+    return aspectTolerance > 0.0 || minWidth > 0 || minHeight > 0 || !folder.isEmpty()
+        || modifiedFrom > 0 || modifiedTo > 0;
+}
+
+QString SearchFilter::key() const {
+    if (!isActive()) return {};
+    return QString("\nfilter %1 %2x%3 %4-%5 %6").arg(aspectTolerance).arg(minWidth).arg(minHeight)
+        .arg(modifiedFrom).arg(modifiedTo).arg(folder);
+}
+
+std::vector<char> SearchFilter::admitted(const ImageIndex& index, const QString& root, const QSize& queryDims) const {
+    const int n = index.size();
+    bool checkFolder = !folder.isEmpty();
+    if (checkFolder && !root.isEmpty()) {
+        // Whole shard inside the folder, or nothing of it
+        if (LibraryShard::pathUnder(root, folder)) checkFolder = false;
+        else if (!LibraryShard::pathUnder(folder, root)) return std::vector<char>(size_t(n), 0);
+    }
+    // Aspect ratios compared on a log scale, so wider and taller count the same
+    const bool checkAspect = aspectTolerance > 0.0 && queryDims.width() > 0 && queryDims.height() > 0;
+    const double queryAspect = checkAspect ? std::log(double(queryDims.width()) / queryDims.height()) : 0.0;
+    const double maxAspectDiff = std::log1p(aspectTolerance);
+    const bool checkSize = minWidth > 0 || minHeight > 0 || checkAspect;
+    const qint64 to = modifiedTo > 0 ? modifiedTo : std::numeric_limits<qint64>::max();
+
+    std::vector<char> out(size_t(n), 0);
+    const ImageIndex::Dims* dims = index.dims();
+    const qint64* mtimes = index.mtimes();
+    for (int slot = 0; slot < n; ++slot) {
+        if (mtimes[slot] < modifiedFrom || mtimes[slot] > to) continue;
+        if (checkSize) {
+            const ImageIndex::Dims d = dims[slot];
+            if (d.width <= 0 || d.height <= 0 || d.width < minWidth || d.height < minHeight) continue;
+            if (checkAspect && std::abs(std::log(double(d.width) / d.height) - queryAspect) > maxAspectDiff) continue;
+        }
+        if (checkFolder && !LibraryShard::pathUnder(index.pathView(slot), folder)) continue;
+        out[size_t(slot)] = 1;
+    }
+    return out;
+}
+
+QDataStream& operator<<(QDataStream& ds, const SearchFilter& f) {
+    return ds << f.aspectTolerance << qint32(f.minWidth) << qint32(f.minHeight) << f.folder
+              << f.modifiedFrom << f.modifiedTo;
+}
+
+QDataStream& operator>>(QDataStream& ds, SearchFilter& f) {
+    qint32 minWidth = 0, minHeight = 0;
+    ds >> f.aspectTolerance >> minWidth >> minHeight >> f.folder >> f.modifiedFrom >> f.modifiedTo;
+    f.minWidth = minWidth;
+    f.minHeight = minHeight;
+    return ds;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <QtCore>
+#include <vector>
+
+class ImageIndex;
+
+// Optional metadata restrictions for a search, applied before any hash, histogram or
+// descriptor work. They are evaluated on the in-memory columns of each shard (dims,
+// mtime, path arena), which mirror the images table, so the database is not queried
+// and excluded images are never scored, loaded or decoded. A shard whose root lies
+// outside the folder is skipped as a whole.
+struct SearchFilter {
+    double aspectTolerance{0.0};   // max relative difference of width/height from the query's; 0 = any
+    int minWidth{0};
+    int minHeight{0};
+    QString folder;                // native absolute path; empty = whole library
+    qint64 modifiedFrom{0};        // file mtime range, seconds since epoch; 0 = open end
+    qint64 modifiedTo{0};
+
+    bool isActive() const;
+    // Appended to result cache keys; empty when inactive
+    QString key() const;
+
+    // One flag per slot of index (1 = searched). root is the shard's root (empty for the
+    // legacy shard). Rows without stored dimensions fail the size and aspect tests;
+    // queryDims is only used with aspectTolerance.
+    std::vector<char> admitted(const ImageIndex& index, const QString& root, const QSize& queryDims) const;
+};
+
+QDataStream& operator<<(QDataStream& ds, const SearchFilter& f);
+QDataStream& operator>>(QDataStream& ds, SearchFilter& f);
@@ -0,0 +1,90 @@
+#include "SignalFusion.h"
+#include "ImageHash.h"
+#include "ImageIndex.h"
+#include <algorithm>
+
+namespace SignalFusion {
+
+namespace {
+const char* const kNames[SignalCount] = {"phash", "dhash", "ahash", "whash", "color"};
+}
+
+const char* signalName(int signal) {
+    return signal >= 0 && signal < SignalCount ? kNames[signal] : "";
+}
+
+Weights Weights::fromSettings() {
+    Weights w;
+    QSettings s;
+    s.beginGroup("fusion");
+    for (int i = 0; i < SignalCount; ++i) w.w[i] = qMax(0.0, s.value(kNames[i], w.w[i]).toDouble());
+    return w;
+}
+
+Weights Weights::only(int signal) {
+    Weights w;
+    for (int i = 0; i < SignalCount; ++i) w.w[i] = (i == signal) ? 1.0 : 0.0;
+    return w;
+}
+
+Signature Signature::fromIndex(const ImageIndex& index, int slot) {
+    Signature s;
+    s.code[PHash] = index.phash(slot);
+    s.code[DHash] = index.dhash(slot);
+    s.code[AHash] = index.ahash(slot);
+    s.code[WHash] = index.whash(slot);
+    s.code[Color] = index.colorMoments(slot);
+    return s;
+}
+
+Signature Signature::fromImage(const QImage& img) {
+    Signature s;
+    if (img.isNull()) return s;
+    s.code[PHash] = ImageHash::pHash(img);
+    s.code[DHash] = ImageHash::dHash(img);
+    s.code[AHash] = ImageHash::aHash(img);
+    const auto compact = ImageHash::compact(img);
+    s.code[WHash] = compact.whash;
+    s.code[Color] = compact.cmoments;
+    return s;
+}
+
+double similarity(const Signature& q, const ImageIndex& index, int slot, const Weights& weights) {
+    const quint64 codes[SignalCount] = {index.phash(slot), index.dhash(slot), index.ahash(slot),
+                                        index.whash(slot), index.colorMoments(slot)};
+    double sum = 0, total = 0;
+    for (int i = 0; i < SignalCount; ++i) {
+        const double w = weights.w[i];
+        if (w <= 0) continue;
+        const double sim = (i == Color) ? 1.0 - ImageHash::colorMomentDistance(q.code[i], codes[i])
+                                        : 1.0 - ImageHash::hammingDistance(q.code[i], codes[i]) / 64.0;
+        sum += w * sim;
+        total += w;
+    }
+    return total > 0 ? sum / total : 0.0;
+}
+
+std::vector<Hit> rank(const ImageIndex& index, const Signature& query, const Weights& weights,
+                      int maxHits, int excludeSlot, const char* admitted) {
+    std::vector<Hit> heap;
+    if (maxHits <= 0) return heap;
+    heap.reserve(size_t(maxHits));
+    // Heap ordered by better(): the front is the weakest kept hit
+    auto better = [](const Hit& a, const Hit& b){ return a.score != b.score ? a.score > b.score : a.slot < b.slot; };
+    for (int slot = 0; slot < index.size(); ++slot) {
+        if (slot == excludeSlot || (admitted && !admitted[slot])) continue;
+        const Hit h{slot, similarity(query, index, slot, weights)};
+        if (int(heap.size()) < maxHits) {
+            heap.push_back(h);
+            std::push_heap(heap.begin(), heap.end(), better);
+        } else if (better(h, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = h;
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), better);
+    return heap;
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <QtCore>
+#include <QtGui/QImage>
+#include <vector>
+
+class ImageIndex;
+
+// Ranks images purely from the signatures stored in ImageIndex (no file access).
+// Each signal is turned into a 0..1 similarity and the weighted mean is the score.
+namespace SignalFusion {
+    enum Signal { PHash, DHash, AHash, WHash, Color, SignalCount };
+    const char* signalName(int signal);
+
+    struct Weights {
+        double w[SignalCount]{1.0, 0.5, 0.25, 0.5, 0.75};
+        // QSettings group fusion: phash, dhash, ahash, whash, color
+        static Weights fromSettings();
+        // Weight 1 on one signal, 0 elsewhere
+        static Weights only(int signal);
+    };
+
+    struct Signature {
+        quint64 code[SignalCount]{};
+        static Signature fromIndex(const ImageIndex& index, int slot);
+        // Same hashing as the indexer; img is the bounded decode
+        static Signature fromImage(const QImage& img);
+    };
+
+    double similarity(const Signature& query, const ImageIndex& index, int slot, const Weights& weights);
+
+    struct Hit { int slot; double score; };
+    // Best maxHits by score (ties by slot); excludeSlot is skipped when >= 0, and with
+    // admitted every slot whose flag is 0 (see SearchFilter::admitted)
+    std::vector<Hit> rank(const ImageIndex& index, const Signature& query, const Weights& weights,
+                          int maxHits, int excludeSlot = -1, const char* admitted = nullptr);
+}
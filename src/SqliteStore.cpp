@@ -1,5 +1,60 @@
 #include "SqliteStore.h"
+#include "ImageIndex.h"
 #include <QUuid>
+#include <QRandomGenerator>
+
+namespace {
+// images columns; a path is directories.path (with trailing separator) + name
+const char* const kImagesColumns =
+    " id INTEGER PRIMARY KEY AUTOINCREMENT,\n"
+    " dir_id INTEGER,\n"
+    " name TEXT,\n"
+    " mtime INTEGER,\n"
+    " size INTEGER,\n"
+    " phash INTEGER,\n"
+    " ahash INTEGER DEFAULT 0,\n"
+    " dhash INTEGER DEFAULT 0,\n"
+    " whash INTEGER DEFAULT 0,\n"
+    " cmoments INTEGER DEFAULT 0,\n"
+    " width INTEGER DEFAULT 0,\n"
+    " height INTEGER DEFAULT 0,\n"
+    " thumb_state INTEGER DEFAULT 1,\n"
+    " UNIQUE(dir_id, name)\n";
+
+const char* const kSelectImages =
+    "SELECT id, dir_id, name, mtime, size, phash, ahash, dhash, width, height, whash, cmoments FROM images";
+
+// Length of the directory part of a native path, trailing separator included
+int dirLength(const QString& path) {
+    return int(path.lastIndexOf(QDir::separator()) + 1);
+}
+
+void readEntry(const QSqlQuery& q, const QHash<qint64, QString>& dirs, ImageEntry& e) {
+    e.id = q.value(0).toLongLong();
+    // Reuses the capacity of e.path when e is recycled
+    e.path.clear();
+    e.path += dirs.value(q.value(1).toLongLong());
+    e.path += q.value(2).toString();
+    e.mtime = q.value(3).toLongLong();
+    e.size = q.value(4).toLongLong();
+    e.phash = q.value(5).toULongLong();
+    e.ahash = q.value(6).toULongLong();
+    e.dhash = q.value(7).toULongLong();
+    e.width = q.value(8).toInt();
+    e.height = q.value(9).toInt();
+    e.whash = q.value(10).toULongLong();
+    e.cmoments = q.value(11).toULongLong();
+}
+
+QString idList(const QList<qint64>& ids) {
+    QString out;
+    for (int i = 0; i < ids.size(); ++i) {
+        if (i) out += ',';
+        out += QString::number(ids[i]);
+    }
+    return out;
+}
+}
 
 SqliteStore::SqliteStore(QObject* parent) : QObject(parent) {}
 SqliteStore::~SqliteStore() {
@@ -26,22 +81,35 @@ bool SqliteStore::open(const QString& dbPath) {
     QSqlQuery q(m_db);
     q.exec("PRAGMA journal_mode=WAL");
     q.exec("PRAGMA synchronous=NORMAL");
+    // The indexer, the neighbour graph builder and the service write to the same files
+    q.exec("PRAGMA busy_timeout=10000");
     return ensureSchema();
 }
 
+bool SqliteStore::needsUpgrade(const QString& dbPath) {
+    if (!QFileInfo::exists(dbPath)) return false;
+    const QString name = QStringLiteral("differ_check_%1").arg(QUuid::createUuid().toString(QUuid::Id128));
+    bool old = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
+        db.setDatabaseName(dbPath);
+        db.setConnectOptions("QSQLITE_OPEN_READONLY");
+        QSqlQuery q(db);
+        if (db.open() && q.exec("PRAGMA table_info(images)")) {
+            while (q.next()) {
+                if (q.value(1).toString().compare("path", Qt::CaseInsensitive) == 0) old = true;
+            }
+        }
+    }
+    QSqlDatabase::removeDatabase(name);
+    return old;
+}
+
 bool SqliteStore::ensureSchema() {
     QSqlQuery q(m_db);
-    bool ok = q.exec("CREATE TABLE IF NOT EXISTS images (\n"
-                  " id INTEGER PRIMARY KEY AUTOINCREMENT,\n"
-                  " path TEXT UNIQUE,\n"
-                  " mtime INTEGER,\n"
-                  " size INTEGER,\n"
-                  " phash INTEGER,\n"
-                  " ahash INTEGER DEFAULT 0,\n"
-                  " dhash INTEGER DEFAULT 0,\n"
-                  " width INTEGER DEFAULT 0,\n"
-                  " height INTEGER DEFAULT 0\n"
-                  ")");
+    // Deep library paths share long prefixes; each directory is stored once
+    bool ok = q.exec("CREATE TABLE IF NOT EXISTS directories (id INTEGER PRIMARY KEY, path TEXT UNIQUE)")
+        && q.exec(QString("CREATE TABLE IF NOT EXISTS images (\n%1)").arg(QLatin1String(kImagesColumns)));
     if (!ok) return false;
     // Ensure new columns exist for older DBs
     auto hasCol = [this](const QString& name){
@@ -56,8 +124,11 @@ bool SqliteStore::ensureSchema() {
     struct { const char* name; const char* type; const char* defv; } cols[] = {
         {"ahash", "INTEGER", "0"},
         {"dhash", "INTEGER", "0"},
+        {"whash", "INTEGER", "0"},
+        {"cmoments", "INTEGER", "0"},
         {"width", "INTEGER", "0"},
-        {"height", "INTEGER", "0"}
+        {"height", "INTEGER", "0"},
+        {"thumb_state", "INTEGER", "1"}
     };
     for (auto& c : cols) {
         if (!hasCol(c.name)) {
@@ -66,21 +137,259 @@ bool SqliteStore::ensureSchema() {
                 .arg(c.name).arg(c.type).arg(c.defv));
         }
     }
+    // Older DBs store the full path in every row
+    if (hasCol("path") && !migratePaths()) return false;
+
+    // Change tracking for the in-memory index snapshot
+    ok = q.exec("CREATE TABLE IF NOT EXISTS meta (key TEXT PRIMARY KEY, value INTEGER)");
+    if (!ok) return false;
+    q.prepare("INSERT OR IGNORE INTO meta(key, value) VALUES('instance', ?)");
+    q.addBindValue((qlonglong)(QRandomGenerator::global()->generate64() >> 1));
+    q.exec();
+    q.exec("INSERT OR IGNORE INTO meta(key, value) VALUES('generation', 0)");
+    // Only the columns the snapshot holds count as a change (not thumb_state); older DBs
+    // have a trigger on every update or on the path column, replaced here once
+    if (q.exec("SELECT sql FROM sqlite_master WHERE type='trigger' AND name='images_gen_upd'") && q.next()
+        && !q.value(0).toString().contains("dir_id", Qt::CaseInsensitive)) {
+        q.finish();
+        q.exec("DROP TRIGGER images_gen_upd");
+    }
+    q.finish();
+    static const char* const triggers[] = {
+        "CREATE TRIGGER IF NOT EXISTS images_gen_ins AFTER INSERT ON images BEGIN UPDATE meta SET value=value+1 WHERE key='generation'; END",
+        "CREATE TRIGGER IF NOT EXISTS images_gen_upd AFTER UPDATE OF dir_id, name, mtime, size, phash, ahash, dhash, whash, cmoments, width, height ON images"
+        " BEGIN UPDATE meta SET value=value+1 WHERE key='generation'; END",
+        "CREATE TRIGGER IF NOT EXISTS images_gen_del AFTER DELETE ON images BEGIN UPDATE meta SET value=value+1 WHERE key='generation'; END"
+    };
+    for (const char* t : triggers) {
+        if (!q.exec(t)) return false;
+    }
+
+    // ORB descriptor cache + bag-of-visual-words vocabulary
+    ok = q.exec("CREATE TABLE IF NOT EXISTS features (\n"
+                " image_id INTEGER PRIMARY KEY,\n"
+                " descriptors BLOB,\n"
+                " words BLOB\n"
+                ")")
+        && q.exec("CREATE TABLE IF NOT EXISTS vocabulary (id INTEGER PRIMARY KEY CHECK(id = 1), data BLOB)")
+        && q.exec("CREATE TRIGGER IF NOT EXISTS images_features_del AFTER DELETE ON images BEGIN DELETE FROM features WHERE image_id=old.id; END");
+    if (!ok) return false;
+
+    // Rotation/mirror hash variants (only filled when hash/dihedral is enabled)
+    ok = q.exec("CREATE TABLE IF NOT EXISTS hash_variants (image_id INTEGER PRIMARY KEY, phash BLOB)")
+        && q.exec("CREATE TRIGGER IF NOT EXISTS images_hash_variants_del AFTER DELETE ON images BEGIN DELETE FROM hash_variants WHERE image_id=old.id; END")
+        && q.exec("CREATE TABLE IF NOT EXISTS region_hashes (image_id INTEGER PRIMARY KEY, codes BLOB)")
+        && q.exec("CREATE TRIGGER IF NOT EXISTS images_region_hashes_del AFTER DELETE ON images BEGIN DELETE FROM region_hashes WHERE image_id=old.id; END")
+        && q.exec("CREATE TABLE IF NOT EXISTS color_histograms (image_id INTEGER PRIMARY KEY, hist BLOB)")
+        && q.exec("CREATE TRIGGER IF NOT EXISTS images_color_histograms_del AFTER DELETE ON images BEGIN DELETE FROM color_histograms WHERE image_id=old.id; END");
+    if (!ok) return false;
+
+    // kNN graph (see NeighborGraph); a changed file loses its list so the builder redoes it
+    ok = q.exec("CREATE TABLE IF NOT EXISTS neighbors (image_id INTEGER PRIMARY KEY, edges BLOB)")
+        && q.exec("CREATE TRIGGER IF NOT EXISTS images_neighbors_del AFTER DELETE ON images BEGIN DELETE FROM neighbors WHERE image_id=old.id; END")
+        && q.exec("CREATE TRIGGER IF NOT EXISTS images_neighbors_upd AFTER UPDATE OF mtime, size ON images"
+                  " WHEN old.mtime IS NOT new.mtime OR old.size IS NOT new.size"
+                  " BEGIN DELETE FROM neighbors WHERE image_id=old.id; END")
+        // Lists built before the backfill reached an image lacked its features
+        && q.exec("CREATE TRIGGER IF NOT EXISTS images_neighbors_thumbs AFTER UPDATE OF thumb_state ON images"
+                  " WHEN new.thumb_state = 1 AND old.thumb_state IS NOT 1"
+                  " BEGIN DELETE FROM neighbors WHERE image_id=old.id; END");
+    if (!ok) return false;
+
+    // Image embeddings (see EmbeddingModel); meta 'embedding_model' names the model that wrote them
+    ok = q.exec("CREATE TABLE IF NOT EXISTS embeddings (image_id INTEGER PRIMARY KEY, vec BLOB)")
+        && q.exec("CREATE TRIGGER IF NOT EXISTS images_embeddings_del AFTER DELETE ON images BEGIN DELETE FROM embeddings WHERE image_id=old.id; END")
+        && q.exec("CREATE TRIGGER IF NOT EXISTS images_embeddings_upd AFTER UPDATE OF mtime, size ON images"
+                  " WHEN old.mtime IS NOT new.mtime OR old.size IS NOT new.size"
+                  " BEGIN DELETE FROM embeddings WHERE image_id=old.id; END");
+    return ok;
+}
+
+bool SqliteStore::migratePaths() {
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 before = databaseBytes();
+    QSqlQuery q(m_db);
+    if (!m_db.transaction()) return false;
+    // Ids must survive (features, neighbours and snapshots refer to them), including the
+    // AUTOINCREMENT high-water mark so deleted ids are not handed out again
+    qint64 seq = 0;
+    if (q.exec("SELECT seq FROM sqlite_sequence WHERE name='images'") && q.next()) seq = q.value(0).toLongLong();
+    int total = 0;
+    if (m_upgradeProgress && q.exec("SELECT COUNT(*) FROM images") && q.next()) total = q.value(0).toInt();
+    bool ok = q.exec(QString("CREATE TABLE images_split (\n%1)").arg(QLatin1String(kImagesColumns)));
+    QSqlQuery rows(m_db);
+    rows.setForwardOnly(true);
+    ok = ok && rows.exec("SELECT id, path FROM images");
+    QSqlQuery ins(m_db);
+    ok = ok && ins.prepare("INSERT INTO images_split(id, dir_id, name, mtime, size, phash, ahash, dhash, whash, cmoments, width, height, thumb_state)"
+                           " SELECT id, ?, ?, mtime, size, phash, ahash, dhash, whash, cmoments, width, height, thumb_state FROM images WHERE id=?");
+    int moved = 0;
+    while (ok && rows.next()) {
+        const QString path = rows.value(1).toString();
+        const int cut = dirLength(path);
+        const qint64 dirId = directoryId(path.left(cut), true);
+        ins.addBindValue(dirId);
+        ins.addBindValue(path.mid(cut));
+        ins.addBindValue(rows.value(0));
+        ok = dirId > 0 && ins.exec();
+        if (++moved % 1000 == 0 && m_upgradeProgress) m_upgradeProgress(moved, total);
+    }
+    rows.finish();
+    ins.finish();
+    // Dropping the table drops its triggers too; ensureSchema() creates them again
+    ok = ok && q.exec("DROP TABLE images") && q.exec("ALTER TABLE images_split RENAME TO images");
+    if (ok && seq > 0) {
+        q.prepare("UPDATE sqlite_sequence SET seq=MAX(seq, ?) WHERE name='images'");
+        q.addBindValue(seq);
+        ok = q.exec();
+    }
+    if (!ok || !m_db.commit()) {
+        qWarning() << "Failed to move image paths into the directories table:" << q.lastError().text() << ins.lastError().text();
+        m_db.rollback();
+        m_dirIds.clear();
+        return false;
+    }
+    // One-off, so the space freed by the shorter rows goes back to the file system
+    q.exec("VACUUM");
+    qInfo() << "Moved" << moved << "image paths into" << m_dirIds.size() << "directories in" << timer.elapsed() << "ms;"
+            << "database" << before / 1024 << "KB ->" << databaseBytes() / 1024 << "KB";
     return true;
 }
 
-bool SqliteStore::upsertImage(const ImageEntry& e) {
+qint64 SqliteStore::directoryId(const QString& dir, bool create) {
+    const auto it = m_dirIds.constFind(dir);
+    if (it != m_dirIds.constEnd()) return it.value();
+    QSqlQuery q(m_db);
+    auto lookup = [&]{
+        q.prepare("SELECT id FROM directories WHERE path=?");
+        q.addBindValue(dir);
+        return q.exec() && q.next() ? q.value(0).toLongLong() : qint64(0);
+    };
+    qint64 id = lookup();
+    if (id == 0 && create) {
+        // Another connection may add the same directory at the same time
+        q.prepare("INSERT OR IGNORE INTO directories(path) VALUES(?)");
+        q.addBindValue(dir);
+        if (q.exec()) id = lookup();
+    }
+    if (id > 0) m_dirIds.insert(dir, id);
+    return id;
+}
+
+QHash<qint64, QString> SqliteStore::loadDirectories() {
+    QHash<qint64, QString> dirs;
     QSqlQuery q(m_db);
-    q.prepare("INSERT INTO images(path, mtime, size, phash, ahash, dhash, width, height) VALUES(?,?,?,?,?,?,?,?)\n"
-              "ON CONFLICT(path) DO UPDATE SET mtime=excluded.mtime, size=excluded.size, phash=excluded.phash, ahash=excluded.ahash, dhash=excluded.dhash, width=excluded.width, height=excluded.height");
-    q.addBindValue(e.path);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT id, path FROM directories")) return dirs;
+    while (q.next()) dirs.insert(q.value(0).toLongLong(), q.value(1).toString());
+    return dirs;
+}
+
+QList<qint64> SqliteStore::directoriesUnder(const QString& nativeDir) {
+#ifdef Q_OS_WIN
+    constexpr Qt::CaseSensitivity cs = Qt::CaseInsensitive;
+#else
+    constexpr Qt::CaseSensitivity cs = Qt::CaseSensitive;
+#endif
+    QList<qint64> ids;
+    if (nativeDir.isEmpty()) return ids;
+    QString prefix = nativeDir;
+    if (!prefix.endsWith(QDir::separator())) prefix += QDir::separator();
+    // A library has far fewer directories than images; matching them here follows the
+    // platform's case rules like LibraryShard::pathUnder, which SQL comparisons would not
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT id, path FROM directories")) return ids;
+    while (q.next()) {
+        if (q.value(1).toString().startsWith(prefix, cs)) ids.push_back(q.value(0).toLongLong());
+    }
+    return ids;
+}
+
+QList<ImageEntry> SqliteStore::loadWhere(const QString& where) {
+    QList<ImageEntry> res;
+    const QHash<qint64, QString> dirs = loadDirectories();
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec(QLatin1String(kSelectImages) + where)) return res;
+    while (q.next()) {
+        ImageEntry e;
+        readEntry(q, dirs, e);
+        res.push_back(e);
+    }
+    return res;
+}
+
+qint64 SqliteStore::databaseBytes() {
+    QSqlQuery q(m_db);
+    qint64 pages = 0, pageSize = 0;
+    if (q.exec("PRAGMA page_count") && q.next()) pages = q.value(0).toLongLong();
+    if (q.exec("PRAGMA page_size") && q.next()) pageSize = q.value(0).toLongLong();
+    return pages * pageSize;
+}
+
+qint64 SqliteStore::instanceId() {
+    QSqlQuery q(m_db);
+    if (q.exec("SELECT value FROM meta WHERE key='instance'") && q.next()) return q.value(0).toLongLong();
+    return -1;
+}
+
+qint64 SqliteStore::generation() {
+    QSqlQuery q(m_db);
+    if (q.exec("SELECT value FROM meta WHERE key='generation'") && q.next()) return q.value(0).toLongLong();
+    return -1;
+}
+
+bool SqliteStore::upsertImage(const ImageEntry& e, qint64* id, ThumbState thumbs, bool* changed) {
+    const int cut = dirLength(e.path);
+    const qint64 dirId = directoryId(e.path.left(cut), true);
+    if (dirId <= 0) return false;
+    QSqlQuery q(m_db);
+    if (changed) {
+        q.prepare("SELECT mtime, size FROM images WHERE dir_id=? AND name=?");
+        q.addBindValue(dirId);
+        q.addBindValue(e.path.mid(cut));
+        *changed = !(q.exec() && q.next() && q.value(0).toLongLong() == e.mtime && q.value(1).toLongLong() == e.size);
+    }
+    // A pending state (hash-only profile) never downgrades the thumbnails of an unchanged file
+    q.prepare("INSERT INTO images(dir_id, name, mtime, size, phash, ahash, dhash, whash, cmoments, width, height, thumb_state) VALUES(?,?,?,?,?,?,?,?,?,?,?,?)\n"
+              "ON CONFLICT(dir_id, name) DO UPDATE SET mtime=excluded.mtime, size=excluded.size, phash=excluded.phash, ahash=excluded.ahash, dhash=excluded.dhash, whash=excluded.whash, cmoments=excluded.cmoments, width=excluded.width, height=excluded.height,"
+              " thumb_state=CASE WHEN excluded.thumb_state = 0 AND images.mtime IS excluded.mtime AND images.size IS excluded.size"
+              " THEN images.thumb_state ELSE excluded.thumb_state END\n"
+              "RETURNING id");
+    q.addBindValue(dirId);
+    q.addBindValue(e.path.mid(cut));
     q.addBindValue(e.mtime);
     q.addBindValue(e.size);
     q.addBindValue((qlonglong)e.phash);
     q.addBindValue((qlonglong)e.ahash);
     q.addBindValue((qlonglong)e.dhash);
+    q.addBindValue((qlonglong)e.whash);
+    q.addBindValue((qlonglong)e.cmoments);
     q.addBindValue(e.width);
     q.addBindValue(e.height);
+    q.addBindValue(int(thumbs));
+    if (!q.exec()) return false;
+    if (id && q.next()) *id = q.value(0).toLongLong();
+    return true;
+}
+
+QList<QPair<qint64, QString>> SqliteStore::pendingThumbnails() {
+    QList<QPair<qint64, QString>> res;
+    const QHash<qint64, QString> dirs = loadDirectories();
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT id, dir_id, name FROM images WHERE thumb_state = 0 ORDER BY id DESC")) return res;
+    while (q.next()) res.push_back({q.value(0).toLongLong(), dirs.value(q.value(1).toLongLong()) + q.value(2).toString()});
+    return res;
+}
+
+bool SqliteStore::setThumbState(qint64 imageId, ThumbState state) {
+    QSqlQuery q(m_db);
+    q.prepare("UPDATE images SET thumb_state=? WHERE id=?");
+    q.addBindValue(int(state));
+    q.addBindValue(imageId);
     return q.exec();
 }
 
@@ -92,49 +401,28 @@ bool SqliteStore::removeMissingPaths(const QStringList& existingPaths) {
 }
 
 QList<ImageEntry> SqliteStore::loadAll() {
-    QList<ImageEntry> res;
+    return loadWhere(" ORDER BY id DESC");
+}
+
+bool SqliteStore::loadIndex(ImageIndex& index) {
+    index.clear();
+    const QHash<qint64, QString> dirs = loadDirectories();
     QSqlQuery q(m_db);
-    if (!q.exec("SELECT id, path, mtime, size, phash, ahash, dhash, width, height FROM images ORDER BY id DESC")) return res;
+    q.setForwardOnly(true);
+    if (q.exec("SELECT COUNT(*), COALESCE(SUM(LENGTH(i.name) + LENGTH(d.path)), 0) FROM images i JOIN directories d ON d.id = i.dir_id") && q.next())
+        index.reserve(q.value(0).toInt(), q.value(1).toLongLong());
+    if (!q.exec(QLatin1String(kSelectImages) + " ORDER BY id DESC")) return false;
+    ImageEntry e;
     while (q.next()) {
-        ImageEntry e;
-        e.id = q.value(0).toLongLong();
-        e.path = q.value(1).toString();
-        e.mtime = q.value(2).toLongLong();
-        e.size = q.value(3).toLongLong();
-        e.phash = q.value(4).toULongLong();
-        e.ahash = q.value(5).toULongLong();
-        e.dhash = q.value(6).toULongLong();
-        e.width = q.value(7).toInt();
-        e.height = q.value(8).toInt();
-        res.push_back(e);
+        readEntry(q, dirs, e);
+        index.append(e);
     }
-    return res;
+    return true;
 }
 
 QList<ImageEntry> SqliteStore::loadByIds(const QList<qint64>& ids) {
-    QList<ImageEntry> res;
-    if (ids.isEmpty()) return res;
-    QString inClause;
-    for (int i=0;i<ids.size();++i) {
-        if (i) inClause += ",";
-        inClause += QString::number(ids[i]);
-    }
-    QSqlQuery q(m_db);
-    if (!q.exec("SELECT id, path, mtime, size, phash, ahash, dhash, width, height FROM images WHERE id IN (" + inClause + ")")) return res;
-    while (q.next()) {
-        ImageEntry e;
-        e.id = q.value(0).toLongLong();
-        e.path = q.value(1).toString();
-        e.mtime = q.value(2).toLongLong();
-        e.size = q.value(3).toLongLong();
-        e.phash = q.value(4).toULongLong();
-        e.ahash = q.value(5).toULongLong();
-        e.dhash = q.value(6).toULongLong();
-        e.width = q.value(7).toInt();
-        e.height = q.value(8).toInt();
-        res.push_back(e);
-    }
-    return res;
+    if (ids.isEmpty()) return {};
+    return loadWhere(" WHERE id IN (" + idList(ids) + ")");
 }
 
 QList<ImageEntry> SqliteStore::queryAllBasic() {
@@ -142,8 +430,265 @@ QList<ImageEntry> SqliteStore::queryAllBasic() {
 }
 
 bool SqliteStore::removeByPath(const QString& path) {
+    const int cut = dirLength(path);
+    const qint64 dirId = directoryId(path.left(cut), false);
+    if (dirId <= 0) return true;
+    QSqlQuery q(m_db);
+    q.prepare("DELETE FROM images WHERE dir_id=? AND name=?");
+    q.addBindValue(dirId);
+    q.addBindValue(path.mid(cut));
+    return q.exec();
+}
+
+QList<ImageEntry> SqliteStore::loadUnder(const QString& nativeDir) {
+    const QList<qint64> dirIds = directoriesUnder(nativeDir);
+    if (dirIds.isEmpty()) return {};
+    return loadWhere(" WHERE dir_id IN (" + idList(dirIds) + ") ORDER BY id DESC");
+}
+
+QList<qint64> SqliteStore::idsUnder(const QString& nativeDir) {
+    QList<qint64> res;
+    const QList<qint64> dirIds = directoriesUnder(nativeDir);
+    if (dirIds.isEmpty()) return res;
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT id FROM images WHERE dir_id IN (" + idList(dirIds) + ")")) return res;
+    while (q.next()) res.push_back(q.value(0).toLongLong());
+    return res;
+}
+
+int SqliteStore::removeUnder(const QString& nativeDir) {
+    const QList<qint64> dirIds = directoriesUnder(nativeDir);
+    if (dirIds.isEmpty()) return 0;
+    // Directory rows stay, so ids other connections cached remain valid
     QSqlQuery q(m_db);
-    q.prepare("DELETE FROM images WHERE path=?");
-    q.addBindValue(path);
+    if (!q.exec("DELETE FROM images WHERE dir_id IN (" + idList(dirIds) + ")")) return 0;
+    return q.numRowsAffected();
+}
+
+bool SqliteStore::upsertFeatures(qint64 imageId, const QByteArray& descriptors, const QByteArray& words) {
+    QSqlQuery q(m_db);
+    q.prepare("INSERT INTO features(image_id, descriptors, words) VALUES(?,?,?)\n"
+              "ON CONFLICT(image_id) DO UPDATE SET descriptors=excluded.descriptors, words=excluded.words");
+    q.addBindValue(imageId);
+    q.addBindValue(descriptors);
+    q.addBindValue(words.isEmpty() ? QVariant(QMetaType::fromType<QByteArray>()) : QVariant(words));
+    return q.exec();
+}
+
+bool SqliteStore::updateWords(qint64 imageId, const QByteArray& words) {
+    QSqlQuery q(m_db);
+    q.prepare("UPDATE features SET words=? WHERE image_id=?");
+    q.addBindValue(words);
+    q.addBindValue(imageId);
+    return q.exec();
+}
+
+QHash<qint64, QByteArray> SqliteStore::loadDescriptors(const QList<qint64>& ids) {
+    QHash<qint64, QByteArray> res;
+    if (ids.isEmpty()) return res;
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT image_id, descriptors FROM features WHERE image_id IN (" + idList(ids) + ")")) return res;
+    while (q.next()) res.insert(q.value(0).toLongLong(), q.value(1).toByteArray());
+    return res;
+}
+
+int SqliteStore::featureCount() {
+    QSqlQuery q(m_db);
+    if (q.exec("SELECT COUNT(*) FROM features WHERE descriptors IS NOT NULL") && q.next()) return q.value(0).toInt();
+    return 0;
+}
+
+QByteArray SqliteStore::sampleDescriptors(int maxImages) {
+    QByteArray out;
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    q.prepare("SELECT descriptors FROM features WHERE descriptors IS NOT NULL ORDER BY RANDOM() LIMIT ?");
+    q.addBindValue(maxImages);
+    if (!q.exec()) return out;
+    while (q.next()) out += q.value(0).toByteArray();
+    return out;
+}
+
+QList<qint64> SqliteStore::idsWithoutWords() {
+    QList<qint64> res;
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT image_id FROM features WHERE words IS NULL AND descriptors IS NOT NULL")) return res;
+    while (q.next()) res.push_back(q.value(0).toLongLong());
+    return res;
+}
+
+void SqliteStore::forEachWords(const std::function<void(qint64 id, const QByteArray& words)>& fn) {
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT image_id, words FROM features WHERE words IS NOT NULL")) return;
+    while (q.next()) fn(q.value(0).toLongLong(), q.value(1).toByteArray());
+}
+
+QByteArray SqliteStore::loadVocabulary() {
+    QSqlQuery q(m_db);
+    if (q.exec("SELECT data FROM vocabulary WHERE id=1") && q.next()) return q.value(0).toByteArray();
+    return {};
+}
+
+bool SqliteStore::saveVocabulary(const QByteArray& data) {
+    QSqlQuery q(m_db);
+    q.prepare("INSERT INTO vocabulary(id, data) VALUES(1, ?) ON CONFLICT(id) DO UPDATE SET data=excluded.data");
+    q.addBindValue(data);
     return q.exec();
 }
+
+bool SqliteStore::upsertHashVariants(qint64 imageId, const QByteArray& variants) {
+    QSqlQuery q(m_db);
+    q.prepare("INSERT INTO hash_variants(image_id, phash) VALUES(?, ?) ON CONFLICT(image_id) DO UPDATE SET phash=excluded.phash");
+    q.addBindValue(imageId);
+    q.addBindValue(variants);
+    return q.exec();
+}
+
+QByteArray SqliteStore::loadHashVariants(qint64 imageId) {
+    QSqlQuery q(m_db);
+    q.prepare("SELECT phash FROM hash_variants WHERE image_id=?");
+    q.addBindValue(imageId);
+    if (q.exec() && q.next()) return q.value(0).toByteArray();
+    return {};
+}
+
+bool SqliteStore::upsertRegionHashes(qint64 imageId, const QByteArray& codes) {
+    QSqlQuery q(m_db);
+    q.prepare("INSERT INTO region_hashes(image_id, codes) VALUES(?, ?) ON CONFLICT(image_id) DO UPDATE SET codes=excluded.codes");
+    q.addBindValue(imageId);
+    q.addBindValue(codes);
+    return q.exec();
+}
+
+QByteArray SqliteStore::loadRegionHashes(qint64 imageId) {
+    QSqlQuery q(m_db);
+    q.prepare("SELECT codes FROM region_hashes WHERE image_id=?");
+    q.addBindValue(imageId);
+    if (q.exec() && q.next()) return q.value(0).toByteArray();
+    return {};
+}
+
+void SqliteStore::forEachHashVariants(const std::function<void(qint64 id, const QByteArray& variants)>& fn) {
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT image_id, phash FROM hash_variants")) return;
+    while (q.next()) fn(q.value(0).toLongLong(), q.value(1).toByteArray());
+}
+
+void SqliteStore::forEachRegionHashes(const std::function<void(qint64 id, const QByteArray& codes)>& fn) {
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT image_id, codes FROM region_hashes")) return;
+    while (q.next()) fn(q.value(0).toLongLong(), q.value(1).toByteArray());
+}
+
+bool SqliteStore::upsertHistogram(qint64 imageId, const QByteArray& hist) {
+    QSqlQuery q(m_db);
+    q.prepare("INSERT INTO color_histograms(image_id, hist) VALUES(?, ?) ON CONFLICT(image_id) DO UPDATE SET hist=excluded.hist");
+    q.addBindValue(imageId);
+    q.addBindValue(hist);
+    return q.exec();
+}
+
+bool SqliteStore::writeTransaction() {
+    QSqlQuery q(m_db);
+    return q.exec("BEGIN IMMEDIATE");
+}
+
+bool SqliteStore::upsertNeighbors(qint64 imageId, const QByteArray& edges) {
+    QSqlQuery q(m_db);
+    q.prepare("INSERT INTO neighbors(image_id, edges) VALUES(?, ?) ON CONFLICT(image_id) DO UPDATE SET edges=excluded.edges");
+    q.addBindValue(imageId);
+    q.addBindValue(edges);
+    return q.exec();
+}
+
+QByteArray SqliteStore::loadNeighbors(qint64 imageId) {
+    QSqlQuery q(m_db);
+    q.prepare("SELECT edges FROM neighbors WHERE image_id=?");
+    q.addBindValue(imageId);
+    if (q.exec() && q.next()) return q.value(0).toByteArray();
+    return {};
+}
+
+QList<qint64> SqliteStore::idsWithoutNeighbors() {
+    QList<qint64> res;
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT i.id FROM images i LEFT JOIN neighbors n ON n.image_id = i.id WHERE n.image_id IS NULL AND i.thumb_state <> 0 ORDER BY i.id")) return res;
+    while (q.next()) res.push_back(q.value(0).toLongLong());
+    return res;
+}
+
+bool SqliteStore::upsertEmbedding(qint64 imageId, const QByteArray& vec) {
+    QSqlQuery q(m_db);
+    q.prepare("INSERT INTO embeddings(image_id, vec) VALUES(?, ?) ON CONFLICT(image_id) DO UPDATE SET vec=excluded.vec");
+    q.addBindValue(imageId);
+    q.addBindValue(vec);
+    return q.exec();
+}
+
+QByteArray SqliteStore::loadEmbedding(qint64 imageId) {
+    QSqlQuery q(m_db);
+    q.prepare("SELECT vec FROM embeddings WHERE image_id=?");
+    q.addBindValue(imageId);
+    if (q.exec() && q.next()) return q.value(0).toByteArray();
+    return {};
+}
+
+QSet<qint64> SqliteStore::idsWithEmbeddings() {
+    QSet<qint64> res;
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT image_id FROM embeddings")) return res;
+    while (q.next()) res.insert(q.value(0).toLongLong());
+    return res;
+}
+
+bool SqliteStore::hasEmbedding(qint64 imageId) {
+    QSqlQuery q(m_db);
+    q.prepare("SELECT 1 FROM embeddings WHERE image_id=?");
+    q.addBindValue(imageId);
+    return q.exec() && q.next();
+}
+
+void SqliteStore::forEachEmbedding(const std::function<void(qint64 id, const QByteArray& vec)>& fn) {
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT image_id, vec FROM embeddings ORDER BY image_id")) return;
+    while (q.next()) fn(q.value(0).toLongLong(), q.value(1).toByteArray());
+}
+
+qint64 SqliteStore::embeddingModel() {
+    QSqlQuery q(m_db);
+    if (q.exec("SELECT value FROM meta WHERE key='embedding_model'") && q.next()) return q.value(0).toLongLong();
+    return 0;
+}
+
+bool SqliteStore::resetEmbeddings(qint64 modelId) {
+    if (!m_db.transaction()) return false;
+    QSqlQuery q(m_db);
+    bool ok = q.exec("DELETE FROM embeddings");
+    if (ok) {
+        q.prepare("INSERT INTO meta(key, value) VALUES('embedding_model', ?) ON CONFLICT(key) DO UPDATE SET value=excluded.value");
+        q.addBindValue(modelId);
+        ok = q.exec();
+    }
+    if (!ok) {
+        qWarning() << "Failed to reset embeddings:" << q.lastError().text();
+        m_db.rollback();
+        return false;
+    }
+    return m_db.commit();
+}
+
+void SqliteStore::forEachHistogram(const std::function<void(qint64 id, const QByteArray& hist)>& fn) {
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    if (!q.exec("SELECT image_id, hist FROM color_histograms")) return;
+    while (q.next()) fn(q.value(0).toLongLong(), q.value(1).toByteArray());
+}
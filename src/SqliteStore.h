@@ -1,6 +1,7 @@
 #pragma once
 #include <QtCore>
 #include <QtSql>
+#include <functional>
 
 struct ImageEntry {
     qint64 id{0};
@@ -10,9 +11,14 @@ struct ImageEntry {
     quint64 phash{0};
     quint64 ahash{0};
     quint64 dhash{0};
+    quint64 whash{0};       // Haar wavelet hash
+    quint64 cmoments{0};    // packed color moments, see ImageHash::colorMoments
     int width{0};
     int height{0};
 };
+Q_DECLARE_METATYPE(ImageEntry)
+
+class ImageIndex;
 
 class SqliteStore : public QObject {
     Q_OBJECT
@@ -20,19 +26,105 @@ public:
     explicit SqliteStore(QObject* parent=nullptr);
     ~SqliteStore() override;
 
+    // images.thumb_state: whether thumbnails, color histogram and ORB descriptors exist.
+    // The hash-only indexing profile leaves rows pending for ThumbnailBackfill.
+    enum ThumbState { ThumbsPending = 0, ThumbsReady = 1, ThumbsFailed = 2 };
+
     bool open(const QString& dbPath);
     bool ensureSchema();
+    // Whether open() converts dbPath from an earlier schema first (a full copy of the images
+    // table and a VACUUM, minutes on large libraries); read-only check
+    static bool needsUpgrade(const QString& dbPath);
+    // Called with rows converted so far while open() upgrades, on the opening thread
+    void setUpgradeProgress(std::function<void(int done, int total)> fn) { m_upgradeProgress = std::move(fn); }
 
-    bool upsertImage(const ImageEntry& e);
+    // Insert or update by path; id receives the row id when non-null, changed whether the row
+    // is new or its mtime/size differ. ThumbsPending keeps the state of an unchanged row.
+    // Rows store a directory id and the file name; paths are joined again on load.
+    bool upsertImage(const ImageEntry& e, qint64* id = nullptr, ThumbState thumbs = ThumbsReady, bool* changed = nullptr);
+    // Pending rows as (id, path), newest first
+    QList<QPair<qint64, QString>> pendingThumbnails();
+    bool setThumbState(qint64 imageId, ThumbState state);
     bool removeMissingPaths(const QStringList& existingPaths);
     QList<ImageEntry> loadAll();
+    // Stream every row straight into the column index (same order as loadAll)
+    bool loadIndex(ImageIndex& index);
     QList<ImageEntry> loadByIds(const QList<qint64>& ids);
 
     QList<ImageEntry> queryAllBasic();
 
     bool removeByPath(const QString& path);
 
+    // Directory subtrees (native path, the directory itself included). Matched against the
+    // directories table, then the images rows are read by directory id.
+    QList<ImageEntry> loadUnder(const QString& nativeDir);
+    QList<qint64> idsUnder(const QString& nativeDir);
+    // Returns the number of rows deleted
+    int removeUnder(const QString& nativeDir);
+    // page_count * page_size
+    qint64 databaseBytes();
+
+    // Random id chosen when the DB file is created, and a counter bumped by
+    // triggers on every insert/update/delete of images. Together they identify
+    // one exact state of the table (used to validate the index snapshot).
+    qint64 instanceId();
+    qint64 generation();
+
+    // Cached ORB descriptors (rows of 32 bytes) and their visual words (quint32 each)
+    bool upsertFeatures(qint64 imageId, const QByteArray& descriptors, const QByteArray& words);
+    bool updateWords(qint64 imageId, const QByteArray& words);
+    QHash<qint64, QByteArray> loadDescriptors(const QList<qint64>& ids);
+    int featureCount();
+    // Concatenated descriptors of up to maxImages randomly chosen images
+    QByteArray sampleDescriptors(int maxImages);
+    QList<qint64> idsWithoutWords();
+    void forEachWords(const std::function<void(qint64 id, const QByteArray& words)>& fn);
+    QByteArray loadVocabulary();
+    // pHash of the 8 rotations/mirrors (8 x quint64, see ImageHash::pHashDihedral)
+    bool upsertHashVariants(qint64 imageId, const QByteArray& variants);
+    QByteArray loadHashVariants(qint64 imageId);
+    void forEachHashVariants(const std::function<void(qint64 id, const QByteArray& variants)>& fn);
+    // Region dHashes for crop search (quint64 each, see ImageHash::regionHashes)
+    bool upsertRegionHashes(qint64 imageId, const QByteArray& codes);
+    QByteArray loadRegionHashes(qint64 imageId);
+    void forEachRegionHashes(const std::function<void(qint64 id, const QByteArray& codes)>& fn);
+    // Quantized hue/saturation histogram (ColorHistogram::kBins bytes)
+    bool upsertHistogram(qint64 imageId, const QByteArray& hist);
+    void forEachHistogram(const std::function<void(qint64 id, const QByteArray& hist)>& fn);
+    bool saveVocabulary(const QByteArray& data);
+    // Neighbour list of an image (NeighborGraph::Edge array); empty if not built yet
+    bool upsertNeighbors(qint64 imageId, const QByteArray& edges);
+    QByteArray loadNeighbors(qint64 imageId);
+    // Rows whose thumbnails are pending are left out until the backfill reaches them
+    QList<qint64> idsWithoutNeighbors();
+    // Packed image embedding (EmbeddingModel::pack); a changed file loses its vector
+    bool upsertEmbedding(qint64 imageId, const QByteArray& vec);
+    QByteArray loadEmbedding(qint64 imageId);
+    QSet<qint64> idsWithEmbeddings();
+    bool hasEmbedding(qint64 imageId);
+    void forEachEmbedding(const std::function<void(qint64 id, const QByteArray& vec)>& fn);
+    // EmbeddingModel::Options::modelId of the stored vectors (0 if none); reset deletes them all
+    qint64 embeddingModel();
+    bool resetEmbeddings(qint64 modelId);
+
+    bool transaction() { return m_db.transaction(); }
+    // Takes the write lock up front, so reads inside see no concurrent writer (read-modify-write)
+    bool writeTransaction();
+    bool commit() { return m_db.commit(); }
+    bool rollback() { return m_db.rollback(); }
+
 private:
+    // Split table from before the directories table existed
+    bool migratePaths();
+    // Id of a directory (native, with trailing separator); 0 if absent and !create.
+    // Rows are never deleted, so ids cached by any connection stay valid.
+    qint64 directoryId(const QString& dir, bool create);
+    QHash<qint64, QString> loadDirectories();
+    QList<qint64> directoriesUnder(const QString& nativeDir);
+    QList<ImageEntry> loadWhere(const QString& where);
+
     QSqlDatabase m_db;
     QString m_connName;
+    QHash<QString, qint64> m_dirIds;
+    std::function<void(int, int)> m_upgradeProgress;
 };
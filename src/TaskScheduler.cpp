@@ -0,0 +1,159 @@
+#include "TaskScheduler.h"
+#include <atomic>
+#ifdef Q_OS_WIN
+#  include <windows.h>
+#endif
+#ifdef Q_OS_LINUX
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+#ifdef HAVE_OPENCV
+#include <opencv2/core.hpp>
+#endif
+
+namespace TaskScheduler {
+
+namespace {
+Options g_options;
+std::atomic<bool> g_configured{false};
+std::atomic<int> g_interactive{0};
+std::atomic<qint64> g_lastInput{0};   // ms on g_clock
+QElapsedTimer g_clock;
+
+// Longest single wait in yieldToInteractive, so background work always progresses
+constexpr int kMaxYieldMs = 3000;
+
+QThreadPool* makePool(int threads, QThread::Priority priority) {
+    auto* p = new QThreadPool;
+    p->setMaxThreadCount(qMax(1, threads));
+    p->setThreadPriority(priority);
+    return p;
+}
+
+struct Pools {
+    QThreadPool* interactive;
+    QThreadPool* visible;
+    QThreadPool* background;
+};
+
+const Pools& pools() {
+    // Built on first use with whatever configure() set; never destroyed (threads may outlive main)
+    static const Pools p = []{
+        const int ideal = QThread::idealThreadCount();
+        const Options& o = g_options;
+        return Pools{
+            makePool(o.interactive > 0 ? o.interactive : ideal, QThread::InheritPriority),
+            makePool(o.visible, QThread::LowPriority),
+            makePool(o.background > 0 ? o.background : qMax(1, ideal / 2), QThread::LowestPriority),
+        };
+    }();
+    return p;
+}
+
+// Idle I/O class for the calling thread, once per thread
+void lowerIoPriority() {
+    thread_local bool done = false;
+    if (done) return;
+    done = true;
+#if defined(Q_OS_LINUX) && defined(SYS_ioprio_set)
+    constexpr int kWhoProcess = 1;          // IOPRIO_WHO_PROCESS; id 0 is the calling thread
+    constexpr int kClassIdle = 3;           // IOPRIO_CLASS_IDLE
+    syscall(SYS_ioprio_set, kWhoProcess, 0, kClassIdle << 13);
+#elif defined(Q_OS_WIN)
+    // Lowers CPU, I/O and memory priority of this thread
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#endif
+}
+
+class InteractionFilter : public QObject {
+public:
+    using QObject::QObject;
+protected:
+    bool eventFilter(QObject* watched, QEvent* event) override {
+        switch (event->type()) {
+        case QEvent::MouseButtonPress:
+        case QEvent::MouseMove:
+        case QEvent::Wheel:
+        case QEvent::KeyPress:
+        case QEvent::TouchBegin:
+            noteInteraction();
+            break;
+        default:
+            break;
+        }
+        return QObject::eventFilter(watched, event);
+    }
+};
+}
+
+Options Options::fromSettings() {
+    Options o;
+    QSettings s;
+    o.interactive = qBound(0, s.value("scheduler/interactive", 0).toInt(), 256);
+    o.visible = qBound(1, s.value("scheduler/visible", 2).toInt(), 64);
+    o.background = qBound(0, s.value("scheduler/background", 0).toInt(), 256);
+    o.opencvThreads = qBound(0, s.value("scheduler/opencvThreads", 1).toInt(), 256);
+    o.backoffMs = qBound(0, s.value("scheduler/backoffMs", 1500).toInt(), 60000);
+    return o;
+}
+
+void configure(const Options& opts) {
+    if (g_configured.exchange(true)) return;
+    g_options = opts;
+    g_clock.start();
+#ifdef HAVE_OPENCV
+    cv::setNumThreads(opts.opencvThreads);
+#endif
+    const Pools& p = pools();
+    qInfo() << "Scheduler: interactive" << p.interactive->maxThreadCount() << "visible" << p.visible->maxThreadCount()
+            << "background" << p.background->maxThreadCount() << "workers, OpenCV" << opts.opencvThreads;
+}
+
+QThreadPool* pool(Priority p) {
+    if (!g_configured) configure(Options{});
+    const Pools& all = pools();
+    switch (p) {
+    case Priority::Interactive: return all.interactive;
+    case Priority::Visible: return all.visible;
+    case Priority::Background: return all.background;
+    }
+    return all.interactive;
+}
+
+void watchInteraction() {
+    if (auto* app = QCoreApplication::instance()) app->installEventFilter(new InteractionFilter(app));
+}
+
+void noteInteraction() {
+    if (!g_configured) return;
+    g_lastInput = g_clock.elapsed();
+}
+
+void yieldToInteractive() {
+    if (!g_configured) return;
+    QElapsedTimer waited;
+    waited.start();
+    for (;;) {
+        const bool searching = g_interactive.load() > 0;
+        const bool recentInput = g_lastInput.load() > 0 && g_clock.elapsed() - g_lastInput.load() < g_options.backoffMs;
+        if ((!searching && !recentInput) || waited.elapsed() >= kMaxYieldMs) return;
+        QThread::msleep(25);
+    }
+}
+
+ActiveScope::ActiveScope(Priority p) : m_priority(p) {
+    if (m_priority == Priority::Interactive) ++g_interactive;
+}
+
+ActiveScope::~ActiveScope() {
+    if (m_priority == Priority::Interactive) --g_interactive;
+}
+
+QFuture<void> run(Priority p, std::function<void()> fn) {
+    if (p != Priority::Background) return QtConcurrent::run(pool(p), std::move(fn));
+    return QtConcurrent::run(pool(p), [fn = std::move(fn)]{
+        lowerIoPriority();
+        fn();
+    });
+}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <QtCore>
+#include <QtConcurrent>
+#include <utility>
+
+// Separate thread pools per priority class, so background indexing and thumbnail
+// generation never queue in front of (or oversubscribe) an interactive search:
+//   Interactive  searches, batch queries, evaluation
+//   Visible      thumbnails of rows on screen
+//   Background   indexing, neighbour graph
+// Background threads run at low CPU and I/O priority and wait between work items
+// while a search runs or the user has just touched the UI. OpenCV's own thread pool
+// is sized here too, since every OpenCV call already runs inside one of these pools.
+namespace TaskScheduler {
+    enum class Priority { Interactive, Visible, Background };
+
+    // QSettings group scheduler
+    struct Options {
+        int interactive{0};     // workers; 0 = QThread::idealThreadCount()
+        int visible{2};
+        int background{0};      // 0 = half the cores
+        int opencvThreads{1};   // cv::setNumThreads; 0 lets OpenCV pick
+        int backoffMs{1500};    // background pauses this long after the last input event
+        static Options fromSettings();
+    };
+
+    // Call once at startup, before any pool is used (otherwise defaults apply)
+    void configure(const Options& opts);
+    QThreadPool* pool(Priority p);
+
+    // Input events on the application count as interaction from now on
+    void watchInteraction();
+    void noteInteraction();
+    // Called by background work between items: waits while interactive work runs or the
+    // user interacted recently, but never longer than a few seconds per call
+    void yieldToInteractive();
+
+    // Marks interactive work for the duration of a scope
+    class ActiveScope {
+    public:
+        explicit ActiveScope(Priority p);
+        ~ActiveScope();
+        Q_DISABLE_COPY(ActiveScope)
+    private:
+        Priority m_priority;
+    };
+
+    template <typename Sequence, typename Fn>
+    void blockingMap(Priority p, Sequence& sequence, Fn&& fn) {
+        ActiveScope scope(p);
+        QtConcurrent::blockingMap(pool(p), sequence, std::forward<Fn>(fn));
+    }
+
+    // Background tasks also drop the I/O priority of their thread
+    QFuture<void> run(Priority p, std::function<void()> fn);
+}
@@ -0,0 +1,142 @@
+#include "ThumbnailBackfill.h"
+#include "DecodeBudget.h"
+#include "EmbeddingModel.h"
+#include "HnswIndex.h"
+#include "ImageIndexer.h"
+#include "SqliteStore.h"
+#include "TaskScheduler.h"
+#include "ThumbnailPyramid.h"
+#include "VisualVocabulary.h"
+#include <QtGui/QImageReader>
+
+namespace {
+// Rows decoded in parallel between two database transactions
+constexpr int kChunk = 32;
+
+struct Item {
+    qint64 id{0};
+    QString path;
+    QImage feature;     // the level histogram and descriptors are computed on; null if unreadable
+};
+
+// Feature level of path: from thumbnails written on first view when all levels exist,
+// otherwise decoded from the original and written as the indexer would have
+static QImage generate(const QString& path, const QString& thumbDir, const ThumbnailPyramid::Options& opts, int featureLevel) {
+    bool complete = true;
+    for (int size : opts.sizes) complete = complete && QFile::exists(ThumbnailPyramid::thumbPath(thumbDir, path, size, opts));
+    if (complete) {
+        const QImage img(ThumbnailPyramid::thumbPath(thumbDir, path, featureLevel, opts));
+        if (!img.isNull()) return img;
+    }
+    QImageReader reader(path);
+    reader.setAutoTransform(true);
+    QSize sz = reader.size();
+    if (sz.isValid()) { sz.scale(4096, 4096, Qt::KeepAspectRatio); reader.setScaledSize(sz); }
+    DecodeBudget::Lease lease;
+    const QImage img = lease.read(reader);
+    if (img.isNull()) return {};
+    QList<QPair<int, QImage>> levels;
+    ThumbnailPyramid::generate(img, thumbDir, path, opts, &levels);
+    for (const auto& lv : levels) {
+        if (lv.first == featureLevel) return lv.second;
+    }
+    return {};
+}
+}
+
+ThumbnailBackfill::ThumbnailBackfill(QObject* parent) : QObject(parent) {}
+
+ThumbnailBackfill::~ThumbnailBackfill() {
+    cancel();
+}
+
+void ThumbnailBackfill::cancel() {
+    m_cancel = true;
+    m_future.waitForFinished();
+}
+
+void ThumbnailBackfill::start(const QList<ShardRef>& shards) {
+    if (m_future.isRunning()) return;
+    m_cancel = false;
+    m_future = TaskScheduler::run(TaskScheduler::Priority::Background, [this, shards]{ run(shards); });
+}
+
+void ThumbnailBackfill::run(const QList<ShardRef>& shards) {
+    const auto opts = ThumbnailPyramid::Options::fromSettings();
+    const int featureLevel = opts.pickSize(256);
+    const auto embedOpts = EmbeddingModel::Options::fromSettings();
+    QElapsedTimer timer;
+    timer.start();
+    int generated = 0;
+    int failed = 0;
+    for (const ShardRef& ref : shards) {
+        if (m_cancel) break;
+        if (!ref.root.isEmpty() && !QFileInfo::exists(ref.root)) continue;
+        SqliteStore store;
+        if (!store.open(ref.dir + QLatin1String("/index.db"))) {
+            qWarning() << "Thumbnail backfill: cannot open shard" << ref.dir;
+            continue;
+        }
+        const auto pending = store.pendingThumbnails();
+        if (pending.isEmpty()) continue;
+        const QString thumbDir = ref.dir + QLatin1String("/thumbs");
+        QDir().mkpath(thumbDir);
+        VisualVocabulary vocab;
+        vocab.deserialize(store.loadVocabulary());
+        std::unique_ptr<EmbeddingModel::Batch> embeddings;
+        if (embedOpts.enabled()) {
+            embeddings = std::make_unique<EmbeddingModel::Batch>(store, embedOpts);
+            if (!embeddings->isValid()) embeddings.reset();
+        }
+        const auto flushEmbeddings = [&] {
+            store.transaction();
+            embeddings->flush();
+            store.commit();
+        };
+        qInfo() << "Thumbnail backfill:" << pending.size() << "images of" << (ref.root.isEmpty() ? QStringLiteral("<legacy>") : ref.root);
+
+        for (int begin = 0; begin < pending.size() && !m_cancel; begin += kChunk) {
+            // A root that went away mid-run keeps its rows pending instead of failing them
+            if (!ref.root.isEmpty() && !QFileInfo::exists(ref.root)) break;
+            std::vector<Item> items;
+            for (int i = begin; i < qMin(begin + kChunk, int(pending.size())); ++i) items.push_back({pending[i].first, pending[i].second, {}});
+            TaskScheduler::blockingMap(TaskScheduler::Priority::Background, items, [&](Item& item) {
+                TaskScheduler::yieldToInteractive();
+                if (m_cancel) return;
+                item.feature = generate(item.path, thumbDir, opts, featureLevel);
+            });
+            if (m_cancel) break;
+            store.transaction();
+            for (const Item& item : items) {
+                if (item.feature.isNull()) {
+                    store.setThumbState(item.id, SqliteStore::ThumbsFailed);
+                    ++failed;
+                    continue;
+                }
+                ImageIndexer::storeFeatures(store, item.id, item.feature, vocab);
+                store.setThumbState(item.id, SqliteStore::ThumbsReady);
+                ++generated;
+            }
+            store.commit();
+            // Outside the chunk's transaction: a forward pass takes a while
+            if (embeddings) {
+                for (const Item& item : items) {
+                    if (!item.feature.isNull() && embeddings->add(item.id, item.feature)) flushEmbeddings();
+                }
+            }
+            emit progress(begin + int(items.size()), pending.size());
+        }
+        ImageIndexer::updateVocabulary(store, vocab);
+        if (embeddings) {
+            if (embeddings->pending() > 0) flushEmbeddings();
+            HnswIndex graph;
+            EmbeddingModel::syncIndex(store, embedOpts, graph, EmbeddingModel::indexPath(ref.dir));
+        }
+    }
+    if (generated + failed > 0) {
+        const double secs = qMax<qint64>(1, timer.elapsed()) / 1000.0;
+        qInfo().noquote() << QString("Thumbnail backfill: %1 images in %2 s (%3 images/s), %4 unreadable")
+                             .arg(generated).arg(secs, 0, 'f', 1).arg(generated / secs, 0, 'f', 1).arg(failed);
+    }
+    emit finished(generated);
+}
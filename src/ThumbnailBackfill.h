@@ -0,0 +1,35 @@
+#pragma once
+#include <QtCore>
+#include <QFuture>
+#include <atomic>
+
+// Background job for images indexed with the hash-only profile (thumb_state pending):
+// writes their thumbnail pyramid, color histogram and ORB descriptors, newest first,
+// and marks them ready. Thumbnails the grid already generated on first view are
+// reused rather than decoded again. Roots that are offline are skipped.
+// It opens its own connections to the shard databases.
+class ThumbnailBackfill : public QObject {
+    Q_OBJECT
+public:
+    // root is empty for the legacy shard
+    struct ShardRef { QString root; QString dir; };
+
+    explicit ThumbnailBackfill(QObject* parent = nullptr);
+    ~ThumbnailBackfill() override;
+
+    // No-op while a backfill is running
+    void start(const QList<ShardRef>& shards);
+    // Stop a running backfill and wait for it; finished rows stay finished
+    void cancel();
+    bool isRunning() const { return m_future.isRunning(); }
+
+signals:
+    void progress(int done, int total);
+    void finished(int generated);
+
+private:
+    void run(const QList<ShardRef>& shards);
+
+    QFuture<void> m_future;
+    std::atomic<bool> m_cancel{false};
+};
@@ -17,17 +17,17 @@ constexpr int kImageTextSpacing = 6;
 constexpr int kMaxTextLines = 2;
 constexpr qreal kHighlightRadius = 8.0;
 constexpr int kHighlightPenWidth = 2;
+// Scaled thumbnails kept for repaints while scrolling (in KB, QCache cost units)
+constexpr int kPixmapCacheKb = 96 * 1024;
+constexpr int kTextCacheEntries = 20000;
 
-QPixmap requestPixmap(const QIcon& icon, const QSize& desiredSize, const QWidget* widget, const QStyleOptionViewItem& opt) {
+QPixmap requestPixmap(const QIcon& icon, const QSize& desiredSize, qreal deviceRatio, QIcon::Mode mode, QIcon::State state) {
     if (icon.isNull()) return {};
     QSize size = desiredSize;
     if (!size.isValid() || size.isEmpty()) {
         size = QSize(128, 128);
     }
-    qreal deviceRatio = widget ? widget->devicePixelRatioF() : qApp->devicePixelRatio();
     QSize deviceSize = QSize(int(size.width() * deviceRatio), int(size.height() * deviceRatio));
-    QIcon::Mode mode = opt.state.testFlag(QStyle::State_Enabled) ? QIcon::Normal : QIcon::Disabled;
-    QIcon::State state = opt.state.testFlag(QStyle::State_Open) ? QIcon::On : QIcon::Off;
     QPixmap pix = icon.pixmap(deviceSize, mode, state);
     if (!pix.isNull()) {
         pix.setDevicePixelRatio(deviceRatio);
@@ -36,6 +36,52 @@ QPixmap requestPixmap(const QIcon& icon, const QSize& desiredSize, const QWidget
 }
 }
 
+ThumbnailDelegate::ThumbnailDelegate(QObject* parent)
+    : QStyledItemDelegate(parent), m_pixmaps(kPixmapCacheKb), m_text(kTextCacheEntries) {}
+
+void ThumbnailDelegate::clearCache() {
+    m_pixmaps.clear();
+    m_text.clear();
+}
+
+const ThumbnailDelegate::TextLines& ThumbnailDelegate::textLines(const QString& text, const QFont& font, int width) const {
+    if (width != m_textWidth || font != m_textFont) {
+        m_text.clear();
+        m_textWidth = width;
+        m_textFont = font;
+    }
+    if (const TextLines* cached = m_text.object(text)) return *cached;
+
+    auto* out = new TextLines;
+    QTextOption textOpt(Qt::AlignHCenter | Qt::AlignTop);
+    textOpt.setWrapMode(QTextOption::WordWrap);
+    QTextLayout layout(text, font);
+    layout.setTextOption(textOpt);
+    layout.beginLayout();
+    QVector<QTextLine> lines;
+    while (true) {
+        QTextLine line = layout.createLine();
+        if (!line.isValid()) break;
+        line.setLineWidth(width);
+        lines.append(line);
+    }
+    layout.endLayout();
+
+    const QFontMetrics fm(font);
+    const int linesToDraw = qMin(kMaxTextLines, int(lines.size()));
+    for (int i = 0; i < linesToDraw; ++i) {
+        const QTextLine& line = lines.at(i);
+        if (i == linesToDraw - 1 && lines.size() > linesToDraw) {
+            out->lines.push_back(fm.elidedText(text.mid(line.textStart()), Qt::ElideMiddle, width));
+        } else {
+            out->lines.push_back(text.mid(line.textStart(), line.textLength()).trimmed());
+        }
+        out->heights.push_back(line.height());
+    }
+    m_text.insert(text, out);
+    return *out;
+}
+
 QSize ThumbnailDelegate::cellSizeForIcon(const QSize& iconSize, const QFontMetrics& fm, bool hasText) {
     QSize icon = iconSize.isValid() && !iconSize.isEmpty() ? iconSize : QSize(128, 128);
     int textBlock = 0;
@@ -49,15 +95,9 @@ QSize ThumbnailDelegate::cellSizeForIcon(const QSize& iconSize, const QFontMetri
 
 QSize ThumbnailDelegate::sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const {
     const QString text = index.data(Qt::DisplayRole).toString();
-    QSize iconSize = option.decorationSize;
-    if (!iconSize.isValid() || iconSize.isEmpty()) {
-        const QIcon icon = index.data(Qt::DecorationRole).value<QIcon>();
-        if (!icon.isNull()) {
-            iconSize = icon.actualSize(QSize(256, 256));
-        }
-    }
+    // Cells are sized by the view's icon size; asking for the icon here would load the thumbnail
     QFontMetrics fm(option.font);
-    return cellSizeForIcon(iconSize, fm, !text.isEmpty());
+    return cellSizeForIcon(option.decorationSize, fm, !text.isEmpty());
 }
 
 void ThumbnailDelegate::paint(QPainter* painter, const QStyleOptionViewItem& option,
@@ -79,7 +119,7 @@ void ThumbnailDelegate::paint(QPainter* painter, const QStyleOptionViewItem& opt
     style->drawPrimitive(QStyle::PE_PanelItemViewItem, &panelOpt, painter, widget);
 
     const QRect contentRect = opt.rect.adjusted(kSideMargin, kTopMargin, -kSideMargin, -kBottomMargin);
-    const QString text = index.data(Qt::DisplayRole).toString();
+    const QString text = opt.text;
     QFontMetrics fm(opt.font);
     const int reservedTextHeight = text.isEmpty() ? 0 : fm.lineSpacing() * kMaxTextLines;
 
@@ -95,16 +135,36 @@ void ThumbnailDelegate::paint(QPainter* painter, const QStyleOptionViewItem& opt
     QRect textArea(contentRect.left(), imageArea.bottom() + (text.isEmpty() ? 0 : kImageTextSpacing),
                    contentRect.width(), contentRect.bottom() - (imageArea.bottom() + (text.isEmpty() ? 0 : kImageTextSpacing)));
 
-    // Fetch pixmap to render
-    const QIcon icon = index.data(Qt::DecorationRole).value<QIcon>();
-    QPixmap pix = requestPixmap(icon, opt.decorationSize, widget, opt);
+    // Pixmap already scaled to its final rect; scaled once per icon and cell size, not per paint
+    const qreal deviceRatio = widget ? widget->devicePixelRatioF() : qApp->devicePixelRatio();
+    if (imageArea.size() != m_pixmapArea || deviceRatio != m_pixmapRatio) {
+        m_pixmaps.clear();
+        m_pixmapArea = imageArea.size();
+        m_pixmapRatio = deviceRatio;
+    }
+    const QIcon::Mode mode = opt.state.testFlag(QStyle::State_Enabled) ? QIcon::Normal : QIcon::Disabled;
+    const QIcon::State state = opt.state.testFlag(QStyle::State_Open) ? QIcon::On : QIcon::Off;
+    const QPixmap* pix = nullptr;
+    if (!opt.icon.isNull() && imageArea.height() > 0 && imageArea.width() > 0) {
+        const QPair<qint64, int> key(opt.icon.cacheKey(), int(mode) | (int(state) << 4));
+        pix = m_pixmaps.object(key);
+        if (!pix) {
+            const QPixmap src = requestPixmap(opt.icon, opt.decorationSize, deviceRatio, mode, state);
+            if (!src.isNull()) {
+                QSize target = src.size() / src.devicePixelRatio();
+                target.scale(imageArea.size(), Qt::KeepAspectRatio);
+                auto* scaled = new QPixmap(src.scaled(target * deviceRatio, Qt::KeepAspectRatio, Qt::SmoothTransformation));
+                scaled->setDevicePixelRatio(deviceRatio);
+                const int costKb = qMax(1, int(qint64(scaled->width()) * scaled->height() * scaled->depth() / 8 / 1024));
+                pix = m_pixmaps.insert(key, scaled, costKb) ? scaled : nullptr;
+            }
+        }
+    }
 
     QRect imageRect = imageArea;
-    if (!pix.isNull() && imageArea.height() > 0 && imageArea.width() > 0) {
-        QSize target = pix.size() / pix.devicePixelRatio();
-        target.scale(imageArea.size(), Qt::KeepAspectRatio);
-        imageRect = QStyle::alignedRect(opt.direction, Qt::AlignCenter, target, imageArea);
-        painter->drawPixmap(imageRect, pix.scaled(imageRect.size(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
+    if (pix) {
+        imageRect = QStyle::alignedRect(opt.direction, Qt::AlignCenter, pix->deviceIndependentSize().toSize(), imageArea);
+        painter->drawPixmap(imageRect.topLeft(), *pix);
     } else if (imageArea.height() > 0 && imageArea.width() > 0) {
         painter->setPen(Qt::NoPen);
         painter->setBrush(opt.palette.mid());
@@ -125,39 +185,16 @@ void ThumbnailDelegate::paint(QPainter* painter, const QStyleOptionViewItem& opt
     }
 
     if (!text.isEmpty() && textArea.height() > 0) {
-        QTextOption textOpt(Qt::AlignHCenter | Qt::AlignTop);
-        textOpt.setWrapMode(QTextOption::WordWrap);
         painter->setPen(opt.palette.color(selected ? QPalette::HighlightedText : QPalette::Text));
         painter->setFont(opt.font);
-
-        QTextLayout layout(text, opt.font);
-        layout.setTextOption(textOpt);
-        layout.beginLayout();
-        QVector<QTextLine> lines;
-        while (true) {
-            QTextLine line = layout.createLine();
-            if (!line.isValid()) break;
-            line.setLineWidth(textArea.width());
-            lines.append(line);
-        }
-        layout.endLayout();
-
-        if (!lines.isEmpty()) {
-            const int linesToDraw = qMin(kMaxTextLines, lines.size());
-            qreal y = textArea.top();
-            for (int i = 0; i < linesToDraw && y <= textArea.bottom(); ++i) {
-                const QTextLine& line = lines.at(i);
-                qreal height = line.height();
-                QRectF lineRect(textArea.left(), y, textArea.width(), height);
-                QString segment = text.mid(line.textStart(), line.textLength());
-                if (i == linesToDraw - 1 && lines.size() > linesToDraw) {
-                    segment = fm.elidedText(text.mid(line.textStart()), Qt::ElideMiddle, textArea.width());
-                } else {
-                    segment = segment.trimmed();
-                }
-                painter->drawText(lineRect, Qt::AlignHCenter | Qt::AlignTop, segment);
-                y += height;
-            }
+        // Wrapped and elided once per file name and cell width
+        const TextLines& lines = textLines(text, opt.font, textArea.width());
+        qreal y = textArea.top();
+        for (int i = 0; i < lines.lines.size() && y <= textArea.bottom(); ++i) {
+            const qreal height = lines.heights[i];
+            QRectF lineRect(textArea.left(), y, textArea.width(), height);
+            painter->drawText(lineRect, Qt::AlignHCenter | Qt::AlignTop, lines.lines[i]);
+            y += height;
         }
     }
 
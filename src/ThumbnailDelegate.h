@@ -1,17 +1,42 @@
 #pragma once
+#include <QCache>
+#include <QFont>
 #include <QFontMetrics>
+#include <QPixmap>
 #include <QStyledItemDelegate>
 #include <QSize>
+#include <QStringList>
+#include <QVector>
 
 class ThumbnailDelegate : public QStyledItemDelegate {
     Q_OBJECT
 public:
-    explicit ThumbnailDelegate(QObject* parent = nullptr)
-        : QStyledItemDelegate(parent) {}
+    explicit ThumbnailDelegate(QObject* parent = nullptr);
 
     static QSize cellSizeForIcon(const QSize& iconSize, const QFontMetrics& fm, bool hasText = true);
 
     void paint(QPainter* painter, const QStyleOptionViewItem& option,
                const QModelIndex& index) const override;
     QSize sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const override;
+
+    // Drop the scaled pixmaps and text layouts (the icon size changed). Both caches also
+    // reset themselves when the cell geometry, font or device pixel ratio they were made for changes.
+    void clearCache();
+
+private:
+    // Lines of a file name wrapped to the cell width, the last one elided
+    struct TextLines {
+        QStringList lines;
+        QVector<qreal> heights;
+    };
+    const TextLines& textLines(const QString& text, const QFont& font, int width) const;
+
+    // Scaled to the final image rect in device pixels, keyed by QIcon::cacheKey() and icon mode
+    mutable QCache<QPair<qint64, int>, QPixmap> m_pixmaps;
+    mutable QSize m_pixmapArea;
+    mutable qreal m_pixmapRatio{0.0};
+    // Keyed by file name; names repeat across rows only when they are the same layout
+    mutable QCache<QString, TextLines> m_text;
+    mutable int m_textWidth{-1};
+    mutable QFont m_textFont;
 };
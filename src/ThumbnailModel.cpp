@@ -1,92 +1,132 @@
 #include "ThumbnailModel.h"
+#include "DecodeBudget.h"
 #include "ImageHash.h"
+#include "ThumbnailPyramid.h"
+#include "OrbFeatures.h"
+#include "NeighborGraph.h"
+#include "ThumbnailBackfill.h"
+#include "TaskScheduler.h"
 #include <QtGui/QImageReader>
-#include <QtConcurrent>
 #include <QMutex>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <random>
 #ifdef HAVE_OPENCV
 #include <opencv2/opencv.hpp>
 #include <opencv2/features2d.hpp>
 #endif
 
 namespace {
-static inline int clamp255(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
-static QImage gaussianBlur3x3(const QImage& src) {
-    if (src.isNull()) return src;
-    QImage in = src.convertToFormat(QImage::Format_ARGB32_Premultiplied);
-    QImage out(in.size(), in.format());
-    const int w = in.width(), h = in.height();
-    static const int k[3][3] = {{1,2,1},{2,4,2},{1,2,1}};
-    for (int y=0;y<h;++y){
-        const QRgb* prev = reinterpret_cast<const QRgb*>(in.constScanLine(y>0?y-1:y));
-        const QRgb* curr = reinterpret_cast<const QRgb*>(in.constScanLine(y));
-        const QRgb* next = reinterpret_cast<const QRgb*>(in.constScanLine(y<h-1?y+1:y));
-        QRgb* dst = reinterpret_cast<QRgb*>(out.scanLine(y));
-        for (int x=0;x<w;++x){
-            int x0=x>0?x-1:x, x2=x<w-1?x+1:x;
-            int b=0,g=0,r=0,a=0;
-            auto acc=[&](const QRgb* line,int xi,int ky){
-                const QRgb p0=line[x0], p1=line[xi], p2=line[x2];
-                b+=k[ky][0]*qBlue(p0)+k[ky][1]*qBlue(p1)+k[ky][2]*qBlue(p2);
-                g+=k[ky][0]*qGreen(p0)+k[ky][1]*qGreen(p1)+k[ky][2]*qGreen(p2);
-                r+=k[ky][0]*qRed(p0)+k[ky][1]*qRed(p1)+k[ky][2]*qRed(p2);
-                a+=k[ky][0]*qAlpha(p0)+k[ky][1]*qAlpha(p1)+k[ky][2]*qAlpha(p2);
-            }; acc(prev,x,0); acc(curr,x,1); acc(next,x,2);
-            dst[x]=qRgba(b/16,g/16,r/16,a/16);
-        }
+// Images re-ranked with the exact ORB ratio test after the bag-of-words lookup (per shard)
+constexpr int kBowShortlist = 300;
+// Scored candidates kept per similarity query; matches the TopK spin box maximum
+constexpr int kMaxResults = 500;
+
+// Entries of QSettings library/shards: tag and root
+using Registry = QList<QPair<int, QString>>;
+
+static Registry readRegistry(QSettings& s) {
+    Registry entries;
+    const int n = s.beginReadArray("library/shards");
+    for (int i = 0; i < n; ++i) {
+        s.setArrayIndex(i);
+        entries.push_back({s.value("tag").toInt(), s.value("root").toString()});
     }
-    return out;
+    s.endArray();
+    return entries;
 }
-static QImage unsharpMask(const QImage& src, double amount=0.5, int threshold=1){
-    if (src.isNull()||amount<=0.0) return src;
-    QImage in=src.convertToFormat(QImage::Format_ARGB32_Premultiplied);
-    QImage blur=gaussianBlur3x3(in); QImage out(in.size(), in.format());
-    const int w=in.width(), h=in.height();
-    for (int y=0;y<h;++y){
-        const QRgb* s=reinterpret_cast<const QRgb*>(in.constScanLine(y));
-        const QRgb* b=reinterpret_cast<const QRgb*>(blur.constScanLine(y));
-        QRgb* d=reinterpret_cast<QRgb*>(out.scanLine(y));
-        for (int x=0;x<w;++x){
-            int sr=qRed(s[x]), sg=qGreen(s[x]), sb=qBlue(s[x]), sa=qAlpha(s[x]);
-            int br=qRed(b[x]), bg=qGreen(b[x]), bb=qBlue(b[x]);
-            int dr=sr-br, dg=sg-bg, db=sb-bb;
-            if (std::abs(dr)<threshold) dr=0; if (std::abs(dg)<threshold) dg=0; if (std::abs(db)<threshold) db=0;
-            int rr=clamp255(int(sr+amount*dr)); int rg=clamp255(int(sg+amount*dg)); int rb=clamp255(int(sb+amount*db));
-            d[x]=qRgba(rr,rg,rb,sa);
-        }
+
+static void writeRegistry(QSettings& s, const Registry& entries) {
+    s.remove("library/shards");
+    s.beginWriteArray("library/shards", entries.size());
+    for (int i = 0; i < entries.size(); ++i) {
+        s.setArrayIndex(i);
+        s.setValue("tag", entries[i].first);
+        s.setValue("root", entries[i].second);
     }
-    return out;
+    s.endArray();
 }
-static QImage downscaleHQ(const QImage& src, int maxSide){
-    if (src.isNull()) return src;
-    QSize target=src.size(); target.scale(maxSide,maxSide,Qt::KeepAspectRatio);
-    QImage scaled=src.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-    return unsharpMask(scaled, 0.5, 1);
+
+// Held around every read-modify-write of the registry: the GUI and the index service both
+// change it. The settings are re-read once the lock is taken and written before it is let go.
+struct RegistryLock {
+    explicit RegistryLock(const QString& appData) : file(appData + QLatin1String("/library.lock")) {
+        if (!file.lock()) qWarning() << "Cannot lock the library registry" << file.fileName();
+        settings.sync();
+    }
+    ~RegistryLock() { settings.sync(); }
+
+    QLockFile file;
+    QSettings settings;
+};
+
+// External query images are decoded the way the indexer decodes before hashing
+static QImage decodeForHashing(const QString& path) {
+    QImageReader reader(path);
+    reader.setAutoTransform(true);
+    QSize sz = reader.size();
+    if (sz.isValid()) { sz.scale(4096, 4096, Qt::KeepAspectRatio); reader.setScaledSize(sz); }
+    DecodeBudget::Lease lease;
+    return lease.read(reader);
+}
+
+// Run fn(shard) for every shard index on the interactive pool; the per-shard indexes are read-only here
+template <typename Fn>
+void forEachShard(int count, Fn fn) {
+    std::vector<int> shards(size_t(count));
+    std::iota(shards.begin(), shards.end(), 0);
+    TaskScheduler::blockingMap(TaskScheduler::Priority::Interactive, shards, [&fn](int s){ fn(s); });
 }
 }
 
 ThumbnailModel::ThumbnailModel(QObject* parent) : QAbstractListModel(parent) {
     m_appData = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
     QDir().mkpath(m_appData);
+    m_thumbOpts = ThumbnailPyramid::Options::fromSettings();
+    QPixmap placeholder(64, 64);
+    placeholder.fill(Qt::lightGray);
+    m_placeholderIcon.addPixmap(placeholder);
+    m_graph = new NeighborGraphBuilder(this);
+    connect(m_graph, &NeighborGraphBuilder::finished, this, [this]{
+        if (m_graphAgain) { m_graphAgain = false; updateNeighborGraph(); }
+    });
+    m_backfill = new ThumbnailBackfill(this);
+    connect(m_backfill, &ThumbnailBackfill::progress, this, &ThumbnailModel::thumbnailProgress);
+    connect(m_backfill, &ThumbnailBackfill::finished, this, [this](int generated){
+        if (generated > 0) {
+            // New histograms and descriptors; backfilled images now get neighbour lists
+            for (const auto& shard : m_shards) shard->featuresChanged();
+            invalidateQueryCache();
+            updateNeighborGraph();
+        }
+        if (m_backfillAgain) { m_backfillAgain = false; backfillThumbnails(); }
+    });
+    loadRegistry();
 }
 
 int ThumbnailModel::rowCount(const QModelIndex& parent) const {
     if (parent.isValid()) return 0;
-    return m_items.size();
+    return m_rows.size();
 }
 
 QVariant ThumbnailModel::data(const QModelIndex& index, int role) const {
-    if (!index.isValid() || index.row()<0 || index.row()>=m_items.size()) return {};
-    const auto& e = m_items[index.row()];
+    if (!index.isValid() || index.row()<0 || index.row()>=m_rows.size()) return {};
+    const Row r = m_rows[index.row()];
+    const LibraryShard& shard = *m_shards[r.shard];
     if (role == Qt::DisplayRole)
-        return QFileInfo(e.path).fileName();
+        return shard.index().fileName(r.slot);
     if (role == Qt::DecorationRole)
-        return iconForPath(e.path);
+        return iconForPath(shard.index().path(r.slot), shard.thumbDir(), shard.isOnline());
     if (role == PathRole)
-        return e.path;
+        return shard.index().path(r.slot);
     if (role == IdRole)
-        return (qlonglong)e.id;
+        return (qlonglong)shard.globalId(shard.index().id(r.slot));
     if (role == HashRole)
-        return (qulonglong)e.phash;
+        return (qulonglong)shard.index().phash(r.slot);
     return {};
 }
 
@@ -94,68 +134,352 @@ Qt::ItemFlags ThumbnailModel::flags(const QModelIndex& index) const {
     return QAbstractListModel::flags(index) | Qt::ItemIsSelectable | Qt::ItemIsEnabled;
 }
 
-void ThumbnailModel::ensureDb() {
-    if (m_store) return;
-    m_store = std::make_unique<SqliteStore>();
-    m_store->open(m_appData + "/index.db");
+QString ThumbnailModel::shardDir(int tag) const {
+    return tag == 0 ? m_appData : m_appData + QStringLiteral("/shards/%1").arg(tag);
+}
+
+std::unique_ptr<LibraryShard> ThumbnailModel::makeShard(int tag, const QString& root, const QString& dir) {
+    auto shard = std::make_unique<LibraryShard>(tag, root, dir);
+    // The probe thread may answer after this model is gone; qApp outlives it and the guard is checked there
+    QPointer<ThumbnailModel> self(this);
+    shard->setOnlineChanged([self]{
+        if (QCoreApplication* app = QCoreApplication::instance())
+            QMetaObject::invokeMethod(app, [self]{ if (self) emit self->rootsChanged(); }, Qt::QueuedConnection);
+    });
+    return shard;
+}
+
+void ThumbnailModel::loadRegistry() {
+    m_shards.clear();
+    RegistryLock lock(m_appData);
+    if (!lock.settings.contains("library/shards/size")) {
+        // First start with roots: the single database of earlier versions becomes the legacy shard
+        Registry entries;
+        if (QFile::exists(m_appData + "/index.db")) entries.push_back({0, QString()});
+        writeRegistry(lock.settings, entries);
+    }
+    for (const auto& [tag, root] : readRegistry(lock.settings)) {
+        if (tag < 0 || (tag == 0) != root.isEmpty() || shardIndexForTag(tag) >= 0) continue;
+        m_shards.push_back(makeShard(tag, root, shardDir(tag)));
+    }
+}
+
+QStringList ThumbnailModel::registeredShardDirs() {
+    const QString appData = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QStringList dirs;
+    QSettings s;
+    s.sync();
+    for (const auto& entry : readRegistry(s))
+        dirs.push_back(entry.first == 0 ? appData : appData + QStringLiteral("/shards/%1").arg(entry.first));
+    return dirs;
+}
+
+QStringList ThumbnailModel::databasesToUpgrade() {
+    QStringList dirs = registeredShardDirs();
+    // Before the first start with roots the legacy database is not registered yet
+    const QString appData = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if (!dirs.contains(appData)) dirs.push_back(appData);
+    QStringList files;
+    for (const QString& dir : dirs) {
+        const QString file = dir + QLatin1String("/index.db");
+        if (SqliteStore::needsUpgrade(file)) files.push_back(file);
+    }
+    return files;
+}
+
+int ThumbnailModel::shardIndexForTag(int tag) const {
+    for (int i = 0; i < int(m_shards.size()); ++i) {
+        if (m_shards[i]->tag() == tag) return i;
+    }
+    return -1;
+}
+
+ThumbnailModel::Row ThumbnailModel::locate(const QString& nativePath) const {
+    for (int i = 0; i < int(m_shards.size()); ++i) {
+        const int slot = m_shards[i]->index().slotForPath(nativePath);
+        if (slot >= 0) return {i, slot};
+    }
+    return {-1, -1};
+}
+
+QList<ThumbnailModel::RootInfo> ThumbnailModel::roots() const {
+    QList<RootInfo> out;
+    for (const auto& shard : m_shards) out.push_back({shard->root(), shard->dir(), shard->index().size(), shard->isOnline()});
+    return out;
+}
+
+QString ThumbnailModel::attachRoot(const QString& folder) {
+    const QString root = QDir::toNativeSeparators(QDir::cleanPath(QDir(folder).absolutePath()));
+    for (const auto& shard : m_shards) {
+        if (shard->covers(root)) return shard->dir();
+    }
+    // A root inside the new folder would index its images twice
+    for (const auto& shard : m_shards) {
+        if (!shard->isLegacy() && LibraryShard::pathUnder(shard->root(), root)) {
+            qWarning() << "Cannot add" << root << "because it contains the root" << shard->root();
+            return {};
+        }
+    }
+    int tag = -1;
+    QString shardRoot = root;
+    {
+        RegistryLock lock(m_appData);
+        Registry entries = readRegistry(lock.settings);
+        // The other process (GUI or service) may have added this root, or one covering or
+        // inside it, since the registry was loaded here
+        for (const auto& [t, r] : entries) {
+            if (r.isEmpty() || shardIndexForTag(t) >= 0) continue;
+            if (LibraryShard::pathUnder(root, r)) {
+                tag = t;
+                shardRoot = r;
+            } else if (LibraryShard::pathUnder(r, root)) {
+                qWarning() << "Cannot add" << root << "because it contains the root" << r;
+                return {};
+            }
+        }
+        if (tag < 0) {
+            // Tags are never reused: a root detached with its data kept still owns its directory
+            tag = qMax(1, lock.settings.value("library/nextTag", 1).toInt());
+            for (const auto& entry : entries) tag = qMax(tag, entry.first + 1);
+            for (const auto& shard : m_shards) tag = qMax(tag, shard->tag() + 1);
+            while (QFileInfo::exists(shardDir(tag))) ++tag;
+            lock.settings.setValue("library/nextTag", tag + 1);
+            entries.push_back({tag, root});
+            writeRegistry(lock.settings, entries);
+        }
+    }
+    auto shard = makeShard(tag, shardRoot, shardDir(tag));
+    shard->load();
+    const QString dir = shard->dir();
+
+    beginResetModel();
+    m_shards.push_back(std::move(shard));
+    const int legacy = shardIndexForTag(0);
+    if (legacy >= 0) {
+        const int moved = m_shards[legacy]->removeUnder(root);
+        if (moved > 0) qInfo() << "Dropped" << moved << "legacy rows under" << root << "(re-indexed into its own shard)";
+    }
+    invalidateQueryCache();
+    resetRowsToAll();
+    endResetModel();
+    return dir;
+}
+
+bool ThumbnailModel::detachRoot(const QString& root, bool deleteData, const std::function<void()>& beforeDelete) {
+    const QString native = QDir::toNativeSeparators(root);
+    int i = 0;
+    while (i < int(m_shards.size()) && m_shards[i]->root() != native) ++i;
+    if (i == int(m_shards.size())) return false;
+
+    beginResetModel();
+    std::unique_ptr<LibraryShard> shard = std::move(m_shards[i]);
+    m_shards.erase(m_shards.begin() + i);
+    {
+        RegistryLock lock(m_appData);
+        Registry entries = readRegistry(lock.settings);
+        entries.removeIf([tag = shard->tag()](const QPair<int, QString>& e){ return e.first == tag; });
+        writeRegistry(lock.settings, entries);
+    }
+    invalidateQueryCache();
+    resetRowsToAll();
+    endResetModel();
+    m_iconCache.clear();
+
+    const QString dir = shard->dir();
+    const bool legacy = shard->isLegacy();
+    shard.reset();   // closes the database before its files go
+    // The graph builder has its own connection to the files; it restarts without the shard.
+    // Lists elsewhere that name this shard's images are filtered on lookup.
+    if (deleteData && m_graph->isRunning()) {
+        m_graph->cancel();
+        m_graphAgain = true;
+    }
+    if (deleteData && m_backfill->isRunning()) {
+        m_backfill->cancel();
+        m_backfillAgain = true;
+    }
+    if (deleteData && beforeDelete) beforeDelete();
+    if (deleteData) {
+        if (legacy) {
+            // The legacy shard shares the app data directory with everything else
+            for (const char* f : {"/index.db", "/index.db-wal", "/index.db-shm", "/index.snap"}) QFile::remove(dir + QLatin1String(f));
+            QDir(dir + "/thumbs").removeRecursively();
+        } else {
+            QDir(dir).removeRecursively();
+        }
+    }
+    return true;
 }
 
 void ThumbnailModel::loadAll() {
-    ensureDb();
     beginResetModel();
-    m_items = m_store->loadAll();
+    // Another process (GUI or service) may have added or removed roots
+    loadRegistry();
+    // Shards load one after another on this thread: each owns a database connection
+    for (const auto& shard : m_shards) shard->load();
+    invalidateQueryCache();
+    resetRowsToAll();
+    endResetModel();
+}
+
+void ThumbnailModel::warmUp() {
+    for (const auto& shard : m_shards) {
+        shard->ensureHistogramIndex();
+        shard->ensureBowIndex();
+        shard->ensureRegionIndex();
+        shard->ensureVariantIndex();
+    }
+}
+
+void ThumbnailModel::updateNeighborGraph() {
+    if (m_graph->isRunning()) { m_graphAgain = true; return; }
+    QList<NeighborGraphBuilder::ShardRef> refs;
+    for (const auto& shard : m_shards) refs.push_back({shard->tag(), shard->dir()});
+    if (!refs.isEmpty()) m_graph->start(refs);
+}
+
+void ThumbnailModel::backfillThumbnails() {
+    if (m_backfill->isRunning()) { m_backfillAgain = true; return; }
+    QList<ThumbnailBackfill::ShardRef> refs;
+    // Reachability is checked by the job itself, off this thread
+    for (const auto& shard : m_shards) refs.push_back({shard->root(), shard->dir()});
+    if (!refs.isEmpty()) m_backfill->start(refs);
+}
+
+void ThumbnailModel::saveSnapshot() {
+    for (const auto& shard : m_shards) shard->saveSnapshot();
+}
+
+void ThumbnailModel::resetRowsToAll() {
+    m_rows.clear();
+    int total = 0;
+    for (const auto& shard : m_shards) total += shard->index().size();
+    m_rows.reserve(total);
+    for (int s = 0; s < int(m_shards.size()); ++s) {
+        for (int i = 0; i < m_shards[s]->index().size(); ++i) m_rows.push_back({s, i});
+    }
+    m_showingAll = true;
+    m_lastQuery = {};
+}
+
+void ThumbnailModel::showAll() {
+    beginResetModel();
+    resetRowsToAll();
+    endResetModel();
+}
+
+void ThumbnailModel::applyIndexed(const QString& shardDir, const QList<ImageEntry>& entries) {
+    if (entries.isEmpty()) return;
+    int s = 0;
+    while (s < int(m_shards.size()) && m_shards[s]->dir() != shardDir) ++s;
+    if (s == int(m_shards.size())) return;
+    invalidateQueryCache();
+    QVector<int> added = m_shards[s]->applyIndexed(entries);
+    // Thumbnails were regenerated on disk; views pick them up on the next reset
+    for (const ImageEntry& e : entries) m_iconCache.remove(e.path);
+    if (m_showingAll && !added.isEmpty()) {
+        // Newest first, matching the id DESC order of a full load
+        std::reverse(added.begin(), added.end());
+        QVector<Row> rows;
+        rows.reserve(added.size());
+        for (int slot : added) rows.push_back({s, slot});
+        beginInsertRows(QModelIndex(), 0, rows.size() - 1);
+        m_rows = rows + m_rows;
+        endInsertRows();
+    }
+}
+
+void ThumbnailModel::applyRemoved(const QString& shardDir, const QList<qint64>& ids) {
+    if (ids.isEmpty()) return;
+    int s = 0;
+    while (s < int(m_shards.size()) && m_shards[s]->dir() != shardDir) ++s;
+    if (s == int(m_shards.size())) return;
+    beginResetModel();
+    m_shards[s]->forgetIds(QSet<qint64>(ids.begin(), ids.end()));
+    invalidateQueryCache();
+    resetRowsToAll();
     endResetModel();
 }
 
 QString ThumbnailModel::pathForIndex(const QModelIndex& idx) const {
     if (!idx.isValid()) return {};
-    return m_items[idx.row()].path;
+    return pathView(m_rows[idx.row()]).toString();
 }
 
-QIcon ThumbnailModel::iconForPath(const QString& path) const {
+bool ThumbnailModel::entryForPath(const QString& path, ImageEntry* entry) const {
+    const Row r = locate(QDir::toNativeSeparators(path));
+    if (r.shard < 0) return false;
+    const LibraryShard& shard = *m_shards[r.shard];
+    *entry = shard.index().entry(r.slot);
+    entry->id = shard.globalId(entry->id);
+    return true;
+}
+
+QString ThumbnailModel::pathForId(qint64 id) const {
+    const int s = shardIndexForTag(LibraryShard::tagOf(id));
+    if (s < 0) return {};
+    const int slot = m_shards[s]->index().slotForId(LibraryShard::localId(id));
+    return slot >= 0 ? m_shards[s]->index().path(slot) : QString();
+}
+
+QString ThumbnailModel::thumbDirForPath(const QString& path) const {
+    const QString native = QDir::toNativeSeparators(path);
+    const Row r = locate(native);
+    if (r.shard >= 0) return m_shards[r.shard]->thumbDir();
+    for (const auto& shard : m_shards) {
+        if (shard->covers(native)) return shard->thumbDir();
+    }
+    return m_appData + "/thumbs";
+}
+
+QPixmap ThumbnailModel::cachedThumbnail(const QString& path) const {
+    const int largest = m_thumbOpts.largest();
+    auto it = m_iconCache.constFind(path);
+    if (it != m_iconCache.constEnd()) return it.value().pixmap(QSize(largest, largest));
+    QPixmap pm;
+    const QString file = ThumbnailPyramid::thumbPath(thumbDirForPath(path), path, largest, m_thumbOpts);
+    if (QFile::exists(file)) pm.load(file);
+    return pm;
+}
+
+QIcon ThumbnailModel::iconForPath(const QString& path, const QString& thumbDir, bool mayDecode) const {
     // Return from memory cache if available
     auto it = m_iconCache.constFind(path);
     if (it != m_iconCache.constEnd()) return it.value();
 
-    const QString base = m_appData + "/thumbs/" + QString::number(qHash(QDir::toNativeSeparators(path)));
-    const QString p256 = base + "_256.jpg";
-    const QString p384 = base + "_384.jpg";
-
     // Fast-path: load cached files once and store in memory
-    QPixmap pm384, pm256;
-    if (QFile::exists(p384)) pm384.load(p384);
-    if (QFile::exists(p256)) pm256.load(p256);
-    if (!pm384.isNull() || !pm256.isNull()) {
-        QIcon icon;
-        if (!pm384.isNull()) icon.addPixmap(pm384);
-        if (!pm256.isNull()) icon.addPixmap(pm256);
+    QIcon icon;
+    for (int size : m_thumbOpts.sizes) {
+        const QString file = ThumbnailPyramid::thumbPath(thumbDir, path, size, m_thumbOpts);
+        QPixmap pm;
+        if (QFile::exists(file) && pm.load(file)) icon.addPixmap(pm);
+    }
+    if (!icon.isNull()) {
         m_iconCache.insert(path, icon);
         return icon;
     }
 
     // If no cache on disk and not already generating, kick off a background task
-    if (!m_iconInFlight.contains(path)) {
+    // (not for roots that are offline: the read would only block a worker)
+    if (mayDecode && !m_iconInFlight.contains(path)) {
         m_iconInFlight.insert(path);
         // Capture copies for worker
         const QString cPath = path;
-        const QString cP256 = p256;
-        const QString cP384 = p384;
+        const auto opts = m_thumbOpts;
         ThumbnailModel* self = const_cast<ThumbnailModel*>(this);
-        (void)QtConcurrent::run([self, cPath, cP256, cP384]() {
+        (void)TaskScheduler::run(TaskScheduler::Priority::Visible, [self, cPath, thumbDir, opts]() {
             // Load and generate HQ thumbs
             QImageReader reader(cPath);
             reader.setAutoTransform(true);
             QSize osz = reader.size();
             if (osz.isValid()) { osz.scale(4096,4096,Qt::KeepAspectRatio); reader.setScaledSize(osz); }
-            QImage img = reader.read();
+            DecodeBudget::Lease lease;
+            QImage img = lease.read(reader);
             QIcon icon;
+            QList<QPair<int, QImage>> levels;
             if (!img.isNull()) {
-                QImage th384 = downscaleHQ(img, 384);
-                QImage th256 = downscaleHQ(img, 256);
-                th384.save(cP384, "JPG", 92);
-                th256.save(cP256, "JPG", 92);
-                icon.addPixmap(QPixmap::fromImage(th384));
-                icon.addPixmap(QPixmap::fromImage(th256));
+                ThumbnailPyramid::generate(img, thumbDir, cPath, opts, &levels);
+                for (const auto& lv : levels) icon.addPixmap(QPixmap::fromImage(lv.second));
             }
             // Post result back to UI thread
             QMetaObject::invokeMethod(self, [self, cPath, icon]() {
@@ -163,8 +487,8 @@ QIcon ThumbnailModel::iconForPath(const QString& path) const {
                 if (!icon.isNull()) {
                     self->m_iconCache.insert(cPath, icon);
                     // Notify views that decoration changed for all rows with this path
-                    for (int row = 0; row < self->m_items.size(); ++row) {
-                        if (self->m_items[row].path == cPath) {
+                    for (int row = 0; row < self->m_rows.size(); ++row) {
+                        if (self->pathView(self->m_rows[row]) == cPath) {
                             const QModelIndex idx = self->index(row, 0);
                             self->dataChanged(idx, idx, {Qt::DecorationRole});
                         }
@@ -175,142 +499,796 @@ QIcon ThumbnailModel::iconForPath(const QString& path) const {
     }
 
     // Return a lightweight placeholder immediately
-    QPixmap placeholder(64,64); placeholder.fill(Qt::lightGray);
-    QIcon ph; ph.addPixmap(placeholder);
-    return ph;
+    return m_placeholderIcon;
 }
 
-QList<ThumbnailModel::ResultItem> ThumbnailModel::searchSimilar(const QString& queryImage, int topK, int /*maxHamming*/) {
-    ensureDb();
+QList<ThumbnailModel::ResultItem> ThumbnailModel::searchSimilar(const QString& queryImage, int topK, int /*maxHamming*/,
+                                                                const SearchFilter& filter) {
 #ifndef HAVE_OPENCV
     Q_UNUSED(queryImage);
     Q_UNUSED(topK);
+    Q_UNUSED(filter);
     // OpenCV not available, return empty to trigger UI hint
     return {};
 #else
+    // Repeat queries on an unchanged file and library are answered from memory
+    const QString key = queryKey(queryImage) + filter.key();
+    const CachedScores* cached = m_similarCache.object(key);
+    if (cached && topK <= cached->exact) {
+        m_lastQuery = {QueryKind::Similar, cached->items, {}, 0, filter, {}, queryImage, cached->exact};
+        return cached->items.mid(0, topK);
+    }
+    const auto admitted = admittedSlots(filter, filter.aspectTolerance > 0.0 ? queryDims(queryImage) : QSize());
+
+    // Indexed images with a built neighbour list need neither decoding nor a library scan,
+    // if enough of the list is left (filter, removed images). The list ranks only its own
+    // entries, so it is exact up to its length and a larger TopK runs the full search.
+    const Row self = locate(QDir::toNativeSeparators(queryImage));
+    if (self.shard >= 0 && topK <= NeighborGraph::kDegree + 1) {
+        LibraryShard& shard = *m_shards[self.shard];
+        const auto edges = NeighborGraph::decode(shard.store().loadNeighbors(shard.index().id(self.slot)));
+        if (!edges.isEmpty()) {
+            // The query itself leads, unless the filter excludes it like any other image
+            QList<ResultItem> scored;
+            if (admitted.empty() || admitted[size_t(self.shard)][size_t(self.slot)])
+                scored.push_back({shard.globalId(shard.index().id(self.slot)), 0});
+            for (const auto& e : edges) {
+                // Lists may still name images removed since they were built
+                const int s = shardIndexForTag(LibraryShard::tagOf(e.id));
+                const int slot = s >= 0 ? m_shards[s]->index().slotForId(LibraryShard::localId(e.id)) : -1;
+                if (slot >= 0 && (admitted.empty() || admitted[size_t(s)][size_t(slot)])) scored.push_back({e.id, e.distance});
+            }
+            if (scored.size() >= topK) {
+                m_lastQuery = {QueryKind::Similar, scored, {}, 0, filter, {}, queryImage, int(scored.size())};
+                return scored.mid(0, topK);
+            }
+        }
+    }
+
     // Load query image (respect EXIF), convert to BGR for OpenCV
     QImageReader qreader(queryImage);
     qreader.setAutoTransform(true);
     QSize qsz = qreader.size();
     if (qsz.isValid()) { qsz.scale(2048, 2048, Qt::KeepAspectRatio); qreader.setScaledSize(qsz); }
-    QImage qimg = qreader.read();
+    DecodeBudget::Lease qlease;
+    QImage qimg = qlease.read(qreader);
     if (qimg.isNull()) return {};
-    QImage qbgr = qimg.convertToFormat(QImage::Format_BGR888);
-    cv::Mat qMat(qbgr.height(), qbgr.width(), CV_8UC3, const_cast<uchar*>(qbgr.constBits()), qbgr.bytesPerLine());
-    qMat = qMat.clone();
+    cv::Mat qMat = OrbFeatures::toBgrMat(qimg);
 
     // Query descriptors and histogram - reduce ORB features to 300 for speed
-    auto orb = cv::ORB::create(300);
-    std::vector<cv::KeyPoint> qkps; cv::Mat qdesc;
-    orb->detectAndCompute(qMat, cv::noArray(), qkps, qdesc);
-    
-    // Calculate query histogram with reduced bins for speed
-    cv::Mat qhsv; cv::cvtColor(qMat, qhsv, cv::COLOR_BGR2HSV);
+    const cv::Mat qdesc = OrbFeatures::describe(qMat);
+    const int candidateLevel = m_thumbOpts.pickSize(256);
+
+    // Per shard, on this thread (the stores belong to it): lazily built indexes, the candidate
+    // list (bag-of-words shortlist once the shard has a vocabulary, otherwise all of it) and
+    // the cached descriptors of the shortlist, keyed by global id
+    const int shardCount = int(m_shards.size());
+    struct ShardWork {
+        std::vector<int> candidates;
+        std::vector<float> corr;
+        bool all{false};
+        bool hists{false};
+    };
+    std::vector<ShardWork> work(size_t(shardCount));
+    QHash<qint64, QByteArray> cachedDesc;
+    bool anyStored = false, needFloat = false;
+    for (int s = 0; s < shardCount; ++s) {
+        LibraryShard& shard = *m_shards[s];
+        ShardWork& w = work[size_t(s)];
+        shard.probeOnline();
+        w.hists = shard.ensureHistogramIndex();
+        anyStored = anyStored || w.hists;
+        needFloat = needFloat || shard.histograms().count() < shard.index().size();
+        const char* mask = admitted.empty() ? nullptr : admitted[size_t(s)].data();
+        std::vector<int> inScope;
+        if (mask) {
+            for (int slot = 0; slot < shard.index().size(); ++slot)
+                if (mask[slot]) inScope.push_back(slot);
+        }
+        // A filter that leaves no more than a shortlist scores all of it exactly
+        const bool smallScope = mask && int(inScope.size()) <= kBowShortlist;
+        if (smallScope || (!qdesc.empty() && shard.ensureBowIndex())) {
+            if (smallScope) {
+                w.candidates = std::move(inScope);
+            } else {
+                const auto words = shard.vocabulary().quantizeAll(qdesc.ptr<quint8>(), qdesc.rows);
+                // Filtered: ask for more, most of the shortlist may be out of scope
+                const auto hits = shard.bow().query(words.data(), int(words.size()), mask ? kBowShortlist * 4 : kBowShortlist);
+                for (const auto& h : hits) {
+                    if (int(h.slot) >= shard.index().size() || (mask && !mask[h.slot])) continue;
+                    w.candidates.push_back(int(h.slot));
+                    if (int(w.candidates.size()) == kBowShortlist) break;
+                }
+            }
+            QList<qint64> ids;
+            ids.reserve(int(w.candidates.size()));
+            for (int slot : w.candidates) ids.push_back(shard.index().id(slot));
+            const auto blobs = shard.store().loadDescriptors(ids);
+            for (auto it = blobs.constBegin(); it != blobs.constEnd(); ++it) cachedDesc.insert(shard.globalId(it.key()), it.value());
+        } else if (mask) {
+            w.candidates = std::move(inScope);
+        } else {
+            w.all = true;
+            w.candidates.resize(size_t(shard.index().size()));
+            std::iota(w.candidates.begin(), w.candidates.end(), 0);
+        }
+    }
+
+    // Stored quantized histograms are compared against the query's own stored one, or one
+    // computed from the query scaled like the level they were taken from
+    HistogramIndex::Probe qprobe;
+    if (anyStored) {
+        qprobe = self.shard >= 0 && m_shards[self.shard]->histograms().has(self.slot)
+            ? HistogramIndex::probe(QByteArray(reinterpret_cast<const char*>(m_shards[self.shard]->histograms().at(self.slot)), ColorHistogram::kBins))
+            : HistogramIndex::probe(ColorHistogram::compute(qimg.scaled(candidateLevel, candidateLevel, Qt::KeepAspectRatio, Qt::SmoothTransformation)));
+    }
+
+    // Float histogram for candidates indexed before histograms were stored
     int hbins=16, sbins=16; int histSize[] = {hbins, sbins};
     float hranges[] = {0,180}; float sranges[] = {0,256}; const float* ranges[] = {hranges, sranges};
     int channels[] = {0,1}; cv::Mat qhist;
-    cv::calcHist(&qhsv, 1, channels, cv::Mat(), qhist, 2, histSize, ranges, true, false);
-    cv::normalize(qhist, qhist, 1, 0, cv::NORM_L1);
-
-    // Iterate all entries and compute similarity in parallel
-    const auto entries = m_store->loadAll();
-    struct Pair { ImageEntry e; double sim; };
-    std::vector<Pair> pairs; pairs.resize(entries.size());
-
-    auto loadCandidate = [this](const QString& path)->cv::Mat{
-        // Prefer cached 256 thumb (faster to load than 384)
-        const QString base = m_appData + "/thumbs/" + QString::number(qHash(QDir::toNativeSeparators(path)));
-        const QString p256 = base + "_256.jpg";
-        const QString p384 = base + "_384.jpg";
-        QString use = QFile::exists(p256) ? p256 : (QFile::exists(p384) ? p384 : path);
+    if (needFloat) {
+        cv::Mat qhsv; cv::cvtColor(qMat, qhsv, cv::COLOR_BGR2HSV);
+        cv::calcHist(&qhsv, 1, channels, cv::Mat(), qhist, 2, histSize, ranges, true, false);
+        cv::normalize(qhist, qhist, 1, 0, cv::NORM_L1);
+    }
+    auto floatCorrelation = [&](const cv::Mat& cMat)->double{
+        // Per-thread buffers; every candidate has the same histogram shape and similar size
+        thread_local cv::Mat chsv, chist;
+        cv::cvtColor(cMat, chsv, cv::COLOR_BGR2HSV);
+        cv::calcHist(&chsv, 1, channels, cv::Mat(), chist, 2, histSize, ranges, true, false);
+        cv::normalize(chist, chist, 1, 0, cv::NORM_L1);
+        return cv::compareHist(qhist, chist, cv::HISTCMP_CORREL);
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    // Stored color correlations, all shards in parallel: a whole shard in one pass over its
+    // histogram array, a shortlist slot by slot. kMissing marks candidates scored on the float path.
+    forEachShard(shardCount, [&](int s) {
+        const LibraryShard& shard = *m_shards[s];
+        ShardWork& w = work[size_t(s)];
+        const int n = int(w.candidates.size());
+        w.corr.assign(size_t(n), HistogramIndex::kMissing);
+        if (!qprobe.isValid() || !w.hists) return;
+        if (w.all) {
+            shard.histograms().correlateAll(qprobe, n, w.corr);
+        } else {
+            for (int i = 0; i < n; ++i)
+                if (shard.histograms().has(w.candidates[i])) w.corr[size_t(i)] = float(shard.histograms().correlation(qprobe, w.candidates[i]));
+        }
+    });
+    const qint64 histMs = timer.elapsed();
+
+    // One flat candidate list over all shards, so the scoring below balances across them
+    struct Candidate { int shard; int slot; float corr; };
+    std::vector<Candidate> cands;
+    for (int s = 0; s < shardCount; ++s) {
+        const ShardWork& w = work[size_t(s)];
+        for (size_t i = 0; i < w.candidates.size(); ++i) cands.push_back({s, w.candidates[i], w.corr[i]});
+    }
+    work.clear();
+    const int n = int(cands.size());
+
+    auto loadCandidate = [this, candidateLevel](const LibraryShard& shard, bool online, const QString& path, cv::Mat& out)->bool{
+        // Prefer the cached pyramid level closest to 256 (faster to load than 384)
+        const QString thumbDir = shard.thumbDir();
+        const QString thumb = ThumbnailPyramid::thumbPath(thumbDir, path, candidateLevel, m_thumbOpts);
+        const QString top = ThumbnailPyramid::thumbPath(thumbDir, path, m_thumbOpts.largest(), m_thumbOpts);
+        // The original is only a fallback while its root is reachable
+        QString use = QFile::exists(thumb) ? thumb : (QFile::exists(top) ? top : (online ? path : QString()));
+        if (use.isEmpty()) return false;
         QImageReader r(use); r.setAutoTransform(true);
         QSize osz = r.size(); 
         // Further reduce size for faster processing (384 is enough)
         if (osz.isValid()) { osz.scale(384, 384, Qt::KeepAspectRatio); r.setScaledSize(osz); }
-        QImage img = r.read();
-        if (img.isNull()) return cv::Mat();
-        QImage bgr = img.convertToFormat(QImage::Format_BGR888);
-        cv::Mat m(bgr.height(), bgr.width(), CV_8UC3, const_cast<uchar*>(bgr.constBits()), bgr.bytesPerLine());
-        return m.clone();
+        // Thumbnails of one level mostly share a size, so the decode buffer is reused
+        thread_local QImage decodedImage;
+        DecodeBudget::Lease lease;
+        if (!lease.read(r, &decodedImage)) return false;
+        OrbFeatures::toBgrMat(decodedImage, out);
+        return !out.empty();
     };
+    std::vector<char> online(size_t(shardCount));
+    for (int s = 0; s < shardCount; ++s) online[size_t(s)] = m_shards[s]->isOnline();
 
-    // Parallel computation using QtConcurrent
-    QtConcurrent::blockingMap(pairs, [&](Pair& pair) {
-        int idx = &pair - pairs.data();
-        const auto& e = entries[idx];
-        pair.e = e;
-        
-        cv::Mat cMat = loadCandidate(e.path);
-        if (cMat.empty()) { pair.sim = 0.0; return; }
-        
-        // ORB with reduced features for speed
-        auto orbLocal = cv::ORB::create(300);
-        std::vector<cv::KeyPoint> ckps; cv::Mat cdesc;
-        orbLocal->detectAndCompute(cMat, cv::noArray(), ckps, cdesc);
-        double orbScore = 0.0;
-        if (!qdesc.empty() && !cdesc.empty()) {
-            cv::BFMatcher matcher(cv::NORM_HAMMING, false);
-            std::vector<std::vector<cv::DMatch>> knn;
-            matcher.knnMatch(qdesc, cdesc, knn, 2);
-            int good=0; for (auto& v: knn){ if (v.size()==2 && v[0].distance < 0.75*v[1].distance) ++good; }
-            orbScore = (qkps.empty()?0.0: (double)good / (double)qkps.size());
+    // Candidates are scored in chunks, each keeping a bounded min-heap of its best kMaxResults
+    // for later refinement. sim <= 0.7 + 0.3*hist, so once topK scores above that bound exist
+    // anywhere the ORB match (the expensive part) is skipped; the best topK are shared across
+    // chunks and their worst is the floor. Candidates are visited by descending stored bound and
+    // dealt round-robin to the chunks, so the floor rises early; with cached descriptors and a
+    // stored histogram no thumbnail is read at all.
+    struct Scored { double sim; int order; };
+    auto better = [](const Scored& a, const Scored& b){ return a.sim != b.sim ? a.sim > b.sim : a.order < b.order; };
+    std::vector<int> visit(size_t(n));
+    std::iota(visit.begin(), visit.end(), 0);
+    if (qprobe.isValid()) {
+        // Unknown bounds (float path) go first, they may be anything up to 1
+        std::stable_sort(visit.begin(), visit.end(), [&cands](int a, int b){
+            const float ka = cands[size_t(a)].corr == HistogramIndex::kMissing ? 2.0f : cands[size_t(a)].corr;
+            const float kb = cands[size_t(b)].corr == HistogramIndex::kMissing ? 2.0f : cands[size_t(b)].corr;
+            return ka > kb;
+        });
+    }
+    const int chunkCount = qBound(1, TaskScheduler::pool(TaskScheduler::Priority::Interactive)->maxThreadCount() * 4, qMax(1, n));
+    std::vector<std::vector<Scored>> heaps(chunkCount);
+    std::vector<int> chunks(chunkCount);
+    std::iota(chunks.begin(), chunks.end(), 0);
+    std::atomic<double> admit{-1.0};
+    QMutex floorMutex;
+    std::vector<double> topScores;      // min-heap of the best topK over all chunks
+    const int floorK = qBound(1, topK, kMaxResults);
+    topScores.reserve(size_t(floorK));
+    const auto raiseFloor = [&](double sim) {
+        if (sim <= admit.load(std::memory_order_relaxed)) return;
+        QMutexLocker lock(&floorMutex);
+        if (int(topScores.size()) < floorK) {
+            topScores.push_back(sim);
+            std::push_heap(topScores.begin(), topScores.end(), std::greater<double>());
+        } else if (sim > topScores.front()) {
+            std::pop_heap(topScores.begin(), topScores.end(), std::greater<double>());
+            topScores.back() = sim;
+            std::push_heap(topScores.begin(), topScores.end(), std::greater<double>());
+        } else {
+            return;
+        }
+        if (int(topScores.size()) == floorK) admit.store(topScores.front(), std::memory_order_relaxed);
+    };
+    std::atomic<int> pruned{0};
+    std::atomic<int> decoded{0};
+    TaskScheduler::blockingMap(TaskScheduler::Priority::Interactive, chunks, [&](int chunk) {
+        std::vector<Scored>& heap = heaps[chunk];
+        heap.reserve(kMaxResults);
+        cv::Mat cMat;   // reused by every candidate of the chunk
+        for (int v = chunk; v < n; v += chunkCount) {
+            const int i = visit[size_t(v)];
+            const Candidate& c = cands[size_t(i)];
+            const LibraryShard& shard = *m_shards[c.shard];
+            bool haveMat = false;
+            double corr = c.corr;
+            bool readable = true;
+            if (corr == HistogramIndex::kMissing) {
+                haveMat = loadCandidate(shard, online[size_t(c.shard)], shard.index().path(c.slot), cMat);
+                ++decoded;
+                readable = haveMat;
+                if (readable) corr = floatCorrelation(cMat);
+            }
+            double sim = 0.0;
+            if (readable) {
+                const double histScore = 0.3 * ((corr + 1.0) / 2.0);
+                double orbScore = 0.0;
+                if (!qdesc.empty()) {
+                    if (0.7 + histScore < admit.load(std::memory_order_relaxed)) { ++pruned; continue; }
+                    // Exact kNN ratio test; cached descriptors skip re-detection
+                    const auto cached = cachedDesc.constFind(shard.globalId(shard.index().id(c.slot)));
+                    cv::Mat cdesc;
+                    if (cached != cachedDesc.constEnd()) {
+                        cdesc = OrbFeatures::view(cached.value());
+                    } else {
+                        if (!haveMat) { haveMat = loadCandidate(shard, online[size_t(c.shard)], shard.index().path(c.slot), cMat); ++decoded; }
+                        if (haveMat) cdesc = OrbFeatures::describe(cMat);
+                    }
+                    orbScore = (double)OrbFeatures::goodMatches(qdesc, cdesc) / (double)qdesc.rows;
+                }
+                sim = NeighborGraph::similarity(orbScore, corr);
+            }
+            raiseFloor(sim);
+            const Scored s{sim, i};
+            if (int(heap.size()) < kMaxResults) {
+                heap.push_back(s);
+                std::push_heap(heap.begin(), heap.end(), better);
+            } else if (better(s, heap.front())) {
+                std::pop_heap(heap.begin(), heap.end(), better);
+                heap.back() = s;
+                std::push_heap(heap.begin(), heap.end(), better);
+            }
         }
-        
-        // HSV hist - use smaller bins for faster computation
-        cv::Mat chsv; cv::cvtColor(cMat, chsv, cv::COLOR_BGR2HSV);
-        int hb=16, sb=16; int hs[] = {hb, sb};
-        float hr[] = {0,180}; float sr[] = {0,256}; const float* r[] = {hr, sr};
-        int ch[] = {0,1}; cv::Mat chist;
-        cv::calcHist(&chsv, 1, ch, cv::Mat(), chist, 2, hs, r, true, false);
-        cv::normalize(chist, chist, 1, 0, cv::NORM_L1);
-        double histCorr = cv::compareHist(qhist, chist, cv::HISTCMP_CORREL);
-        
-        pair.sim = std::max(0.0, std::min(1.0, 0.7*orbScore + 0.3*((histCorr+1.0)/2.0)));
     });
 
-    std::stable_sort(pairs.begin(), pairs.end(), [](const Pair& a, const Pair& b){ return a.sim > b.sim; });
+    std::vector<Scored> best;
+    for (const auto& h : heaps) best.insert(best.end(), h.begin(), h.end());
+    const size_t keep = std::min(best.size(), size_t(kMaxResults));
+    std::partial_sort(best.begin(), best.begin() + keep, best.end(), better);
+    best.resize(keep);
+    // Skipped candidates score below the final floor, so everything at or above it is final
+    int exact = std::numeric_limits<int>::max();
+    if (pruned.load() > 0) {
+        const double floor = admit.load();
+        exact = int(std::count_if(best.begin(), best.end(), [floor](const Scored& p){ return p.sim >= floor; }));
+    }
+    qInfo() << "Scored" << n << "candidates from" << shardCount << "shards in" << timer.elapsed() << "ms (color" << histMs << "ms),"
+            << pruned.load() << "skipped ORB below the top" << topK << "floor," << decoded.load() << "thumbnails read";
 
-    // Build results
-    QList<ResultItem> out;
-    out.reserve(std::min<int>(topK, pairs.size()));
-    for (int i = 0; i < pairs.size() && i < topK; ++i) {
+    // Keep the best kMaxResults so any TopK the UI allows is refined without rescoring
+    QList<ResultItem> scored;
+    scored.reserve(int(best.size()));
+    int selfIdx = -1;
+    for (const Scored& p : best) {
+        const Candidate& c = cands[size_t(p.order)];
+        if (selfIdx < 0 && c.shard == self.shard && c.slot == self.slot) selfIdx = scored.size();
         // Encode similarity as inverse distance (0..1000)
-        int dist = (int)std::lround((1.0 - pairs[i].sim) * 1000.0);
-        out.push_back({pairs[i].e, dist});
+        const LibraryShard& shard = *m_shards[c.shard];
+        scored.push_back({shard.globalId(shard.index().id(c.slot)), NeighborGraph::distance(p.sim)});
     }
-
     // Ensure exact same image first if present
-    if (!out.isEmpty()) {
-        int selfIdx = -1;
-        for (int i = 0; i < out.size(); ++i) {
-            if (QDir::toNativeSeparators(out[i].entry.path) == QDir::toNativeSeparators(queryImage)) { selfIdx = i; break; }
+    if (selfIdx > 0) std::rotate(scored.begin(), scored.begin() + selfIdx, scored.begin() + selfIdx + 1);
+
+    m_similarCache.insert(key, new CachedScores{scored, exact});
+    m_lastQuery = {QueryKind::Similar, scored, {}, 0, filter, {}, queryImage, exact};
+    return scored.mid(0, topK);
+#endif
+}
+
+QList<ThumbnailModel::ResultItem> ThumbnailModel::searchFused(const QString& queryImage, int topK, const SearchFilter& filter) {
+    const Row self = locate(QDir::toNativeSeparators(queryImage));
+    SignalFusion::Signature sig;
+    QSize dims;
+    if (self.shard >= 0) {
+        sig = SignalFusion::Signature::fromIndex(m_shards[self.shard]->index(), self.slot);
+        const auto d = m_shards[self.shard]->index().dims(self.slot);
+        dims = QSize(d.width, d.height);
+    } else {
+        const QImage img = decodeForHashing(queryImage);
+        if (img.isNull()) return {};
+        sig = SignalFusion::Signature::fromImage(img);
+        dims = img.size();
+    }
+    QElapsedTimer timer;
+    timer.start();
+    const auto admitted = admittedSlots(filter, dims);
+    const auto weights = SignalFusion::Weights::fromSettings();
+    const int shardCount = int(m_shards.size());
+    std::vector<std::vector<SignalFusion::Hit>> perShard(size_t(shardCount));
+    forEachShard(shardCount, [&](int s) {
+        perShard[size_t(s)] = SignalFusion::rank(m_shards[s]->index(), sig, weights, kMaxResults, -1,
+                                                 admitted.empty() ? nullptr : admitted[size_t(s)].data());
+    });
+    // Each list is sorted; the global best are the best of their union
+    struct Merged { double score; int shard; int slot; };
+    std::vector<Merged> all;
+    for (int s = 0; s < shardCount; ++s)
+        for (const auto& h : perShard[size_t(s)]) all.push_back({h.score, s, h.slot});
+    const size_t keep = std::min(all.size(), size_t(kMaxResults));
+    std::partial_sort(all.begin(), all.begin() + keep, all.end(), [](const Merged& a, const Merged& b){
+        if (a.score != b.score) return a.score > b.score;
+        return a.shard != b.shard ? a.shard < b.shard : a.slot < b.slot;
+    });
+    all.resize(keep);
+    qInfo() << "Fused signature ranking over" << shardCount << "shards in" << timer.elapsed() << "ms";
+    QList<ResultItem> scored;
+    scored.reserve(int(all.size()));
+    for (const auto& h : all) {
+        const LibraryShard& shard = *m_shards[h.shard];
+        scored.push_back({shard.globalId(shard.index().id(h.slot)), int(std::lround((1.0 - h.score) * 1000.0))});
+    }
+    m_lastQuery = {QueryKind::Fused, scored, {}, 0};
+    return scored.mid(0, topK);
+}
+
+std::vector<float> ThumbnailModel::embedFile(const QString& path, const EmbeddingModel::Options& opts, QSize* decodedSize) {
+    if (!m_embedder || m_embedder->options().modelId() != opts.modelId())
+        m_embedder = std::make_unique<EmbeddingModel::Extractor>(opts);
+    if (!m_embedder->isValid()) return {};
+    const QImage img = decodeForHashing(path);
+    if (img.isNull()) return {};
+    if (decodedSize) *decodedSize = img.size();
+    // Library vectors come from the sharpened feature level of the pyramid, not the original
+    const int featureLevel = m_thumbOpts.pickSize(256);
+    QImage feature;
+    for (const auto& lv : ThumbnailPyramid::build(img, m_thumbOpts)) {
+        if (lv.first == featureLevel) feature = lv.second;
+    }
+    if (feature.isNull()) return {};
+    auto vectors = m_embedder->embed({m_embedder->prepare(feature)});
+    return vectors.empty() ? std::vector<float>() : std::move(vectors[0]);
+}
+
+QList<ThumbnailModel::ResultItem> ThumbnailModel::searchEmbedding(const QString& queryImage, int topK, const SearchFilter& filter) {
+    const auto opts = EmbeddingModel::Options::fromSettings();
+    if (!opts.enabled()) return {};
+    const int shardCount = int(m_shards.size());
+    std::vector<char> ready(size_t(shardCount));
+    bool any = false;
+    for (int s = 0; s < shardCount; ++s) any = (ready[size_t(s)] = m_shards[s]->ensureEmbeddingIndex(opts)) || any;
+    if (!any) return {};
+
+    // An indexed query reuses its stored vector; anything else goes through the model
+    std::vector<qint8> codes;
+    float scale = 0;
+    QSize dims;
+    const Row self = locate(QDir::toNativeSeparators(queryImage));
+    if (self.shard >= 0) {
+        LibraryShard& shard = *m_shards[self.shard];
+        const auto d = shard.index().dims(self.slot);
+        dims = QSize(d.width, d.height);
+        if (ready[size_t(self.shard)] && !EmbeddingModel::unpack(shard.store().loadEmbedding(shard.index().id(self.slot)), codes, &scale))
+            codes.clear();
+    }
+    if (codes.empty()) {
+        QSize decoded;
+        const std::vector<float> v = embedFile(queryImage, opts, &decoded);
+        if (v.empty()) return {};
+        if (!dims.isValid()) dims = decoded;
+        EmbeddingModel::quantize(v.data(), int(v.size()), codes, &scale);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const auto admitted = admittedSlots(filter, dims);
+    const int ef = qMax(opts.efSearch, kMaxResults);
+    std::vector<std::vector<HnswIndex::Hit>> perShard(size_t(shardCount));
+    forEachShard(shardCount, [&](int s) {
+        const HnswIndex& graph = m_shards[s]->embeddings();
+        if (ready[size_t(s)] && graph.dim() == int(codes.size()))
+            perShard[size_t(s)] = graph.search(codes.data(), scale, kMaxResults, ef);
+    });
+    struct Merged { float similarity; int shard; int slot; };
+    std::vector<Merged> all;
+    for (int s = 0; s < shardCount; ++s) {
+        const LibraryShard& shard = *m_shards[s];
+        for (const auto& h : perShard[size_t(s)]) {
+            const int slot = shard.index().slotForId(h.id);
+            if (slot < 0 || (s == self.shard && slot == self.slot)) continue;
+            if (!admitted.empty() && !admitted[size_t(s)][size_t(slot)]) continue;
+            all.push_back({h.similarity, s, slot});
+        }
+    }
+    const size_t keep = std::min(all.size(), size_t(kMaxResults));
+    std::partial_sort(all.begin(), all.begin() + keep, all.end(), [](const Merged& a, const Merged& b){
+        if (a.similarity != b.similarity) return a.similarity > b.similarity;
+        return a.shard != b.shard ? a.shard < b.shard : a.slot < b.slot;
+    });
+    all.resize(keep);
+    qInfo() << "Embedding search over" << shardCount << "shards in" << timer.elapsed() << "ms";
+    QList<ResultItem> scored;
+    scored.reserve(int(all.size()));
+    for (const auto& h : all) {
+        const LibraryShard& shard = *m_shards[h.shard];
+        scored.push_back({shard.globalId(shard.index().id(h.slot)), int(std::lround((1.0 - h.similarity) * 1000.0))});
+    }
+    m_lastQuery = {QueryKind::Embedding, scored, {}, 0};
+    return scored.mid(0, topK);
+}
+
+bool ThumbnailModel::evaluate(const Evaluation::Options& opts, QTextStream& out) {
+    bool ok = false;
+    for (const auto& shard : m_shards) {
+        if (shard->index().size() < 2) continue;
+        if (m_shards.size() > 1) out << "\n== " << (shard->isLegacy() ? QStringLiteral("<legacy>") : shard->root()) << " ==\n";
+        ok = Evaluation::run(shard->index(), shard->store(), opts, out) || ok;
+        Evaluation::histogramAccuracy(shard->index(), shard->store(), shard->thumbDir(), m_thumbOpts, opts, out);
+        const auto embedOpts = EmbeddingModel::Options::fromSettings();
+        if (shard->ensureEmbeddingIndex(embedOpts) && shard->ensureHistogramIndex()) {
+            Evaluation::embeddingAccuracy(shard->index(), shard->store(), shard->histograms(), shard->embeddings(),
+                                          embedOpts.efSearch, opts, out);
+            if (shard->isOnline()) evaluateFileQueries(*shard, embedOpts, opts, out);
+        }
+    }
+    if (!ok && m_shards.empty()) out << "Library is empty\n";
+    return ok;
+}
+
+void ThumbnailModel::evaluateFileQueries(LibraryShard& shard, const EmbeddingModel::Options& embedOpts,
+                                         const Evaluation::Options& opts, QTextStream& out) {
+    const ImageIndex& index = shard.index();
+    const HnswIndex& graph = shard.embeddings();
+    const int k = opts.cutoffs.isEmpty() ? 10 : opts.cutoffs.first();
+    const int ef = qMax(embedOpts.efSearch, k + 1);
+    std::vector<int> order(size_t(index.size()));
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937(opts.seed));
+
+    int queries = 0, self = 0;
+    double cosine = 0, overlap = 0, embedNs = 0, searchNs = 0;
+    std::vector<qint8> codes;
+    for (int slot : order) {
+        if (queries >= opts.queries) break;
+        float storedScale = 0;
+        const qint8* stored = graph.codes(index.id(slot), &storedScale);
+        if (!stored) continue;
+        QElapsedTimer t;
+        t.start();
+        const std::vector<float> v = embedFile(index.path(slot), embedOpts);
+        if (int(v.size()) != graph.dim()) continue;
+        float scale = 0;
+        EmbeddingModel::quantize(v.data(), int(v.size()), codes, &scale);
+        embedNs += double(t.nsecsElapsed());
+        t.restart();
+        const auto fromFile = graph.search(codes.data(), scale, k + 1, ef);
+        searchNs += double(t.nsecsElapsed());
+        const auto fromStored = graph.search(stored, storedScale, k + 1, ef);
+        ++queries;
+
+        double dot = 0, a = 0, b = 0;
+        for (int i = 0; i < graph.dim(); ++i) {
+            dot += double(codes[size_t(i)]) * stored[i];
+            a += double(codes[size_t(i)]) * codes[size_t(i)];
+            b += double(stored[i]) * stored[i];
         }
-        if (selfIdx > 0) std::swap(out[0], out[selfIdx]);
+        if (a > 0 && b > 0) cosine += dot / std::sqrt(a * b);
+        if (!fromFile.empty() && fromFile.front().id == index.id(slot)) ++self;
+        QSet<qint64> expected;
+        for (const auto& h : fromStored) if (h.id != index.id(slot) && expected.size() < k) expected.insert(h.id);
+        int found = 0, listed = 0;
+        for (const auto& h : fromFile) {
+            if (h.id == index.id(slot) || listed >= k) continue;
+            ++listed;
+            if (expected.contains(h.id)) ++found;
+        }
+        if (!expected.isEmpty()) overlap += double(found) / expected.size();
+    }
+    if (queries == 0) { out << "\nNo indexed image could be embedded from its file\n"; return; }
+    out << QString("File queries: %1, decode+embed %2 ms/query, search %3 ms/query\n")
+               .arg(queries).arg(embedNs / queries / 1e6, 0, 'f', 1).arg(searchNs / queries / 1e6, 0, 'f', 2);
+    out << QString("cosine to stored vector %1, finds itself first %2, top-%3 overlap with the stored-vector query %4\n")
+               .arg(cosine / queries, 0, 'f', 4).arg(double(self) / queries, 0, 'f', 3).arg(k)
+               .arg(overlap / queries, 0, 'f', 3);
+    out.flush();
+}
+
+QList<ThumbnailModel::ResultItem> ThumbnailModel::searchCrops(const QString& queryImage, int topK, int maxHamming,
+                                                              const SearchFilter& filter) {
+    if (!QFileInfo::exists(queryImage)) return {};
+    const int shardCount = int(m_shards.size());
+    std::vector<char> ready(size_t(shardCount));
+    bool any = false;
+    for (int s = 0; s < shardCount; ++s) any = (ready[size_t(s)] = m_shards[s]->ensureRegionIndex()) || any;
+    if (!any) return {};
+
+    QVector<quint64> codes;
+    const Row self = locate(QDir::toNativeSeparators(queryImage));
+    if (self.shard >= 0) {
+        LibraryShard& shard = *m_shards[self.shard];
+        const QByteArray stored = shard.store().loadRegionHashes(shard.index().id(self.slot));
+        codes.resize(int(stored.size() / sizeof(quint64)));
+        std::memcpy(codes.data(), stored.constData(), size_t(codes.size()) * sizeof(quint64));
+    }
+    if (codes.isEmpty()) codes = ImageHash::regionHashes(decodeForHashing(queryImage));
+    if (codes.isEmpty()) return {};
+
+    QElapsedTimer timer;
+    timer.start();
+    // The region index is an inverted lookup that touches only matching regions, so the
+    // filter is applied to its hits. Crops rarely keep the query's aspect ratio.
+    const auto admitted = admittedSlots(filter, filter.aspectTolerance > 0.0 ? queryDims(queryImage) : QSize());
+    std::vector<std::vector<RegionIndex::Hit>> perShard(size_t(shardCount));
+    forEachShard(shardCount, [&](int s) {
+        if (!ready[size_t(s)]) return;
+        auto& hits = perShard[size_t(s)];
+        hits = m_shards[s]->regions().query(codes.constData(), codes.size(), maxHamming, kMaxResults);
+        if (!admitted.empty()) {
+            const auto& mask = admitted[size_t(s)];
+            hits.erase(std::remove_if(hits.begin(), hits.end(), [&mask](const RegionIndex::Hit& h){ return !mask[size_t(h.slot)]; }), hits.end());
+        }
+    });
+    struct Merged { RegionIndex::Hit hit; int shard; };
+    std::vector<Merged> all;
+    for (int s = 0; s < shardCount; ++s)
+        for (const auto& h : perShard[size_t(s)]) all.push_back({h, s});
+    // Same order as RegionIndex::query: most voting regions, then smallest distance
+    std::stable_sort(all.begin(), all.end(), [](const Merged& a, const Merged& b){
+        return a.hit.votes != b.hit.votes ? a.hit.votes > b.hit.votes : a.hit.distance < b.hit.distance;
+    });
+    if (all.size() > size_t(kMaxResults)) all.resize(size_t(kMaxResults));
+    qInfo() << "Region query radius" << maxHamming << ":" << all.size() << "images in" << timer.nsecsElapsed() / 1000 << "us";
+    QList<ResultItem> scored;
+    scored.reserve(int(all.size()));
+    for (const auto& m : all) {
+        const LibraryShard& shard = *m_shards[m.shard];
+        scored.push_back({shard.globalId(shard.index().id(int(m.hit.slot))), m.hit.distance});
+    }
+    m_lastQuery = {QueryKind::Region, scored, {}, 0};
+    return scored.mid(0, topK);
+}
+
+QVector<quint64> ThumbnailModel::queryHashes(const QString& queryImage) {
+    // Indexed images reuse the stored hash; external files are decoded like the indexer does.
+    // Rotated/mirrored copies are found through the library's variants, not the query's.
+    const Row self = locate(QDir::toNativeSeparators(queryImage));
+    if (self.shard >= 0) return {m_shards[self.shard]->index().phash(self.slot)};
+    const QImage img = decodeForHashing(queryImage);
+    if (img.isNull()) return {};
+    return {ImageHash::pHash(img)};
+}
+
+QList<ThumbnailModel::ResultItem> ThumbnailModel::searchHamming(const QString& queryImage, int topK, int maxHamming,
+                                                                const SearchFilter& filter) {
+    if (!QFileInfo::exists(queryImage)) return {};
+    // Radius -1 forces the first lookup; later refinements only search again when widened
+    m_lastQuery = {QueryKind::Hamming, {}, queryHashes(queryImage), -1, filter,
+                   filter.aspectTolerance > 0.0 ? queryDims(queryImage) : QSize()};
+    if (m_lastQuery.codes.isEmpty()) return {};
+    return refineQuery(topK, maxHamming);
+}
+
+QList<ThumbnailModel::ResultItem> ThumbnailModel::refineQuery(int topK, int maxHamming) {
+    QList<ResultItem> out;
+    switch (m_lastQuery.kind) {
+    case QueryKind::None:
+        break;
+    case QueryKind::Similar:
+        // Past the proven prefix (skipped by the bound, or the end of a neighbour list) it rescores
+        if (topK > m_lastQuery.exact) {
+            const LastQuery last = m_lastQuery;
+            return searchSimilar(last.query, topK, maxHamming, last.filter);
+        }
+        out = m_lastQuery.scored.mid(0, topK);
+        break;
+    case QueryKind::Region:
+    case QueryKind::Fused:
+    case QueryKind::Embedding:
+        out = m_lastQuery.scored.mid(0, topK);
+        break;
+    case QueryKind::Hamming: {
+        if (maxHamming > m_lastQuery.radius) {
+            QElapsedTimer timer;
+            timer.start();
+            // With hash/dihedral the rotations/mirrors of every image are probed too; shards in parallel.
+            // The multi-index only visits codes near the query, so the filter is applied to its matches.
+            const int shardCount = int(m_shards.size());
+            const auto admitted = admittedSlots(m_lastQuery.filter, m_lastQuery.dims);
+            for (const auto& shard : m_shards) shard->ensureVariantIndex();
+            std::vector<std::vector<MultiIndexHash::Match>> perShard(size_t(shardCount));
+            const quint64 code = m_lastQuery.codes.front();
+            forEachShard(shardCount, [&](int s) {
+                perShard[size_t(s)] = MultiIndexHash::searchWithVariants(m_shards[s]->phashIndex(), m_shards[s]->variantIndex(), code, maxHamming);
+            });
+            m_lastQuery.scored.clear();
+            for (int s = 0; s < shardCount; ++s) {
+                const LibraryShard& shard = *m_shards[s];
+                for (const auto& m : perShard[size_t(s)]) {
+                    if (!admitted.empty() && !admitted[size_t(s)][size_t(m.value)]) continue;
+                    m_lastQuery.scored.push_back({shard.globalId(shard.index().id(int(m.value))), m.distance});
+                }
+            }
+            std::stable_sort(m_lastQuery.scored.begin(), m_lastQuery.scored.end(), [](const ResultItem& a, const ResultItem& b){ return a.distance < b.distance; });
+            qInfo() << "Hamming radius" << maxHamming << "query:" << m_lastQuery.scored.size() << "matches in" << timer.nsecsElapsed() / 1000 << "us";
+            m_lastQuery.radius = maxHamming;
+        }
+        // Matches are sorted by distance, so a narrower radius is a prefix
+        for (const ResultItem& r : m_lastQuery.scored) {
+            if (out.size() >= topK || r.distance > maxHamming) break;
+            out.push_back(r);
+        }
+        break;
+    }
     }
     return out;
-#endif
+}
+
+QList<BatchQuery::Report> ThumbnailModel::batchQuery(const QStringList& queries, const BatchQuery::Options& opts,
+                                                     const std::function<void(int, int)>& progress) {
+    QList<BatchQuery::Target> targets;
+    for (const auto& shard : m_shards) {
+        shard->ensureVariantIndex();
+        targets.push_back({&shard->index(), &shard->phashIndex(), &shard->variantIndex(), &shard->store(), shard->globalId(0)});
+    }
+    return BatchQuery::run(queries, targets, m_thumbOpts, opts, progress);
+}
+
+ThumbnailModel::BatchJob ThumbnailModel::batchQueryJob(const QStringList& queries, const BatchQuery::Options& opts) const {
+    struct Copy {
+        ImageIndex index;
+        MultiIndexHash phash;
+        MultiIndexHash variants;
+        QString dir;
+        qint64 idBase;
+    };
+    auto copies = std::make_shared<std::vector<Copy>>();
+    copies->reserve(m_shards.size());
+    for (const auto& shard : m_shards) {
+        shard->ensureVariantIndex();
+        copies->push_back({shard->index(), shard->phashIndex(), shard->variantIndex(), shard->dir(), shard->globalId(0)});
+    }
+    return [copies, queries, opts, thumbOpts = m_thumbOpts](const std::function<void(int, int)>& progress,
+                                                            QHash<qint64, QString>* paths) {
+        std::vector<std::unique_ptr<SqliteStore>> stores;
+        QList<BatchQuery::Target> targets;
+        QList<const Copy*> owners;   // per target
+        for (const Copy& c : *copies) {
+            auto store = std::make_unique<SqliteStore>();
+            if (!store->open(c.dir + QLatin1String("/index.db"))) {
+                qWarning() << "Batch query: cannot open shard" << c.dir;
+                continue;
+            }
+            targets.push_back({&c.index, &c.phash, &c.variants, store.get(), c.idBase});
+            owners.push_back(&c);
+            stores.push_back(std::move(store));
+        }
+        const auto reports = BatchQuery::run(queries, targets, thumbOpts, opts, progress);
+        if (paths) {
+            for (const auto& r : reports) {
+                for (const auto& m : r.matches) {
+                    if (paths->contains(m.id)) continue;
+                    for (const Copy* c : owners) {
+                        if (LibraryShard::tagOf(c->idBase) != LibraryShard::tagOf(m.id)) continue;
+                        const int slot = c->index.slotForId(LibraryShard::localId(m.id));
+                        if (slot >= 0) paths->insert(m.id, c->index.path(slot));
+                    }
+                }
+            }
+        }
+        return reports;
+    };
+}
+
+QString ThumbnailModel::queryKey(const QString& queryImage) {
+    const QFileInfo fi(queryImage);
+    return QDir::toNativeSeparators(fi.absoluteFilePath()) + QLatin1Char('\n')
+         + QString::number(fi.lastModified().toMSecsSinceEpoch()) + QLatin1Char('\n')
+         + QString::number(fi.size());
+}
+
+QSize ThumbnailModel::queryDims(const QString& queryImage) const {
+    const Row self = locate(QDir::toNativeSeparators(queryImage));
+    if (self.shard >= 0) {
+        const auto d = m_shards[self.shard]->index().dims(self.slot);
+        return QSize(d.width, d.height);
+    }
+    // Header only; EXIF rotation swaps the sides like the decoders do
+    QImageReader reader(queryImage);
+    QSize size = reader.size();
+    if (reader.transformation() & QImageIOHandler::TransformationRotate90) size.transpose();
+    return size;
+}
+
+std::vector<std::vector<char>> ThumbnailModel::admittedSlots(const SearchFilter& filter, const QSize& queryDims) const {
+    std::vector<std::vector<char>> out;
+    if (!filter.isActive()) return out;
+    QElapsedTimer timer;
+    timer.start();
+    const int shardCount = int(m_shards.size());
+    out.resize(size_t(shardCount));
+    forEachShard(shardCount, [&](int s) {
+        out[size_t(s)] = filter.admitted(m_shards[s]->index(), m_shards[s]->root(), queryDims);
+    });
+    qsizetype kept = 0, total = 0;
+    for (const auto& mask : out) {
+        kept += std::count(mask.begin(), mask.end(), char(1));
+        total += qsizetype(mask.size());
+    }
+    qInfo() << "Search filter keeps" << kept << "of" << total << "images (" << timer.elapsed() << "ms)";
+    return out;
+}
+
+void ThumbnailModel::invalidateQueryCache() {
+    // Cached scores only cover the images that existed when they were computed
+    m_similarCache.clear();
 }
 
 void ThumbnailModel::showResults(const QList<ResultItem>& results) {
     beginResetModel();
-    m_items.clear();
-    for (const auto& r : results) m_items.push_back(r.entry);
+    m_rows.clear();
+    m_rows.reserve(results.size());
+    m_showingAll = false;
+    for (const auto& r : results) {
+        const int s = shardIndexForTag(LibraryShard::tagOf(r.id));
+        if (s < 0) continue;
+        const int slot = m_shards[s]->index().slotForId(LibraryShard::localId(r.id));
+        if (slot >= 0) m_rows.push_back({s, slot});
+    }
     endResetModel();
 }
 
 int ThumbnailModel::removePaths(const QStringList& paths) {
     if (paths.isEmpty()) return 0;
-    ensureDb();
-    int removed = 0;
+    // Group by the shard that holds each path
+    std::vector<QStringList> perShard(m_shards.size());
     for (const QString& p : paths) {
-        if (m_store->removeByPath(QDir::toNativeSeparators(p))) {
-            ++removed;
-            // purge memory icon cache
-            m_iconCache.remove(p);
-            m_iconInFlight.remove(p);
-        }
+        const QString native = QDir::toNativeSeparators(p);
+        const Row r = locate(native);
+        if (r.shard >= 0) perShard[size_t(r.shard)].push_back(native);
+        // purge memory icon cache
+        m_iconCache.remove(p);
+        m_iconInFlight.remove(p);
+    }
+    beginResetModel();
+    int removed = 0;
+    for (size_t s = 0; s < perShard.size(); ++s) {
+        if (!perShard[s].isEmpty()) removed += m_shards[s]->removePaths(perShard[s]);
     }
-    // Reload to reflect removals
-    loadAll();
+    invalidateQueryCache();
+    resetRowsToAll();
+    endResetModel();
     return removed;
 }
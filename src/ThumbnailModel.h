@@ -2,7 +2,19 @@
 #include <QtCore>
 #include <QtGui>
 #include <QtWidgets>
-#include "SqliteStore.h"
+#include <limits>
+#include <memory>
+#include <vector>
+#include "LibraryShard.h"
+#include "ThumbnailPyramid.h"
+#include "BatchQuery.h"
+#include "Evaluation.h"
+#include "SignalFusion.h"
+#include "SearchFilter.h"
+#include "EmbeddingModel.h"
+
+class NeighborGraphBuilder;
+class ThumbnailBackfill;
 
 class ThumbnailModel : public QAbstractListModel {
     Q_OBJECT
@@ -15,25 +27,163 @@ public:
     QVariant data(const QModelIndex& index, int role) const override;
     Qt::ItemFlags flags(const QModelIndex& index) const override;
 
+    // Re-read the roots and load every shard
     void loadAll();
+    // Build the lazily built per-shard indexes now instead of on the first query
+    void warmUp();
+    // Fill in missing neighbour lists in the background (see NeighborGraph); call after
+    // loading and after indexing. Requests while a build runs start another one after it.
+    void updateNeighborGraph();
+    // Generate thumbnails and features of rows indexed with the hash-only profile in the
+    // background (see ThumbnailBackfill); call after loading and after indexing
+    void backfillThumbnails();
+    // Show every indexed image again without touching the database
+    void showAll();
     QString pathForIndex(const QModelIndex& idx) const;
+    // Largest already-available thumbnail for path (memory or disk); never decodes the original
+    QPixmap cachedThumbnail(const QString& path) const;
+
+    // Library roots, one shard each (QSettings library/shards). The database of versions
+    // before roots is kept as a legacy shard with an empty root until it is detached.
+    struct RootInfo { QString root; QString dir; int images; bool online; };
+    QList<RootInfo> roots() const;
+    // Register folder as a root (or find the root that already covers it) and return the
+    // shard directory the indexer writes to; empty if folder contains existing roots.
+    // Legacy rows under the new root are dropped, the indexer brings them back into its shard.
+    QString attachRoot(const QString& folder);
+    // Forget a root; deleteData also removes its database and thumbnails (stop an indexer
+    // writing to the shard first). beforeDelete runs once the shard is closed and the registry
+    // saved, so other processes can let go of the files.
+    bool detachRoot(const QString& root, bool deleteData, const std::function<void()>& beforeDelete = {});
+    // Shard directories in the stored registry, which another process may have changed
+    static QStringList registeredShardDirs();
+    // Databases of the library still in an earlier schema; opening one converts it, which is slow
+    static QStringList databasesToUpgrade();
 
-    struct ResultItem { ImageEntry entry; int distance; };
-    QList<ResultItem> searchSimilar(const QString& queryImage, int topK, int maxHamming);
+    // Ids in results and IdRole are global: shard tag above LibraryShard::kTagBits, row id below
+    struct ResultItem { qint64 id; int distance; };
+    // Every search takes an optional SearchFilter; excluded images are never scored
+    QList<ResultItem> searchSimilar(const QString& queryImage, int topK, int maxHamming, const SearchFilter& filter = {});
     void showResults(const QList<ResultItem>& results);
 
+    // pHash-only lookup through the multi-index; distance is the Hamming distance
+    QList<ResultItem> searchHamming(const QString& queryImage, int topK, int maxHamming, const SearchFilter& filter = {});
+
+    // Rank by the weighted fusion of stored signatures only (QSettings group fusion);
+    // distance is (1 - score) * 1000 like searchSimilar
+    QList<ResultItem> searchFused(const QString& queryImage, int topK, const SearchFilter& filter = {});
+
+    // Nearest image embeddings through each shard's HNSW graph (QSettings group embedding);
+    // distance is (1 - cosine) * 1000. Empty when no model is configured or no shard has vectors.
+    // The filter is applied to the graph's best 500, so a narrow filter can return fewer.
+    QList<ResultItem> searchEmbedding(const QString& queryImage, int topK, const SearchFilter& filter = {});
+
+    // Precision/recall of the stored signals against ORB ground truth (see Evaluation), per shard
+    bool evaluate(const Evaluation::Options& opts, QTextStream& out);
+
+    // Crop/letterbox lookup through the region-hash index (hash/tiles); distance is the
+    // best region Hamming distance, images sharing more regions rank first
+    QList<ResultItem> searchCrops(const QString& queryImage, int topK, int maxHamming, const SearchFilter& filter = {});
+
+    // Check many query images against the library in one pass (see BatchQuery)
+    QList<BatchQuery::Report> batchQuery(const QStringList& queries, const BatchQuery::Options& opts,
+                                         const std::function<void(int, int)>& progress = {});
+    // The same as a job for another thread. The in-memory indexes are copied now, since the
+    // model keeps changing meanwhile; the job opens its own connections and fills paths
+    // (global id -> path) for every match, like IndexClient::batchQuery.
+    using BatchJob = std::function<QList<BatchQuery::Report>(const std::function<void(int, int)>& progress,
+                                                             QHash<qint64, QString>* paths)>;
+    BatchJob batchQueryJob(const QStringList& queries, const BatchQuery::Options& opts) const;
+
+    // Re-filter the last search with new limits from memory (no decoding or rescoring).
+    // Only valid while its results are shown; returns false after showAll()/loadAll().
+    bool hasActiveQuery() const { return m_lastQuery.kind != QueryKind::None; }
+    QList<ResultItem> refineQuery(int topK, int maxHamming);
+
+    // Merge rows the indexer wrote into the shard at shardDir
+    void applyIndexed(const QString& shardDir, const QList<ImageEntry>& entries);
+    // Rows the indexer deleted from a shard's database
+    void applyRemoved(const QString& shardDir, const QList<qint64>& ids);
+
     // Remove from database and model; returns number removed
     int removePaths(const QStringList& paths);
 
+    // Stored row for an indexed path (id made global); false if no shard has it
+    bool entryForPath(const QString& path, ImageEntry* entry) const;
+    QString pathForId(qint64 id) const;
+    // Thumbnail directory of the shard that holds (or would hold) path
+    QString thumbDirForPath(const QString& path) const;
+    void saveSnapshot();
+
+signals:
+    // Progress of the thumbnail backfill through the current shard
+    void thumbnailProgress(int done, int total);
+    // A root went online or offline (reachability probes answer in the background)
+    void rootsChanged();
+
 private:
-    void ensureDb();
-    QIcon iconForPath(const QString& path) const;
+    struct Row { int shard; int slot; };
+
+    // Shard whose reachability changes are reported through rootsChanged
+    std::unique_ptr<LibraryShard> makeShard(int tag, const QString& root, const QString& dir);
+    // The registry is shared with other processes; it is only changed entry by entry under a lock
+    void loadRegistry();
+    QString shardDir(int tag) const;
+    int shardIndexForTag(int tag) const;
+    // Shard and slot holding nativePath, or {-1, -1}
+    Row locate(const QString& nativePath) const;
+    QStringView pathView(const Row& r) const { return m_shards[r.shard]->index().pathView(r.slot); }
+    QIcon iconForPath(const QString& path, const QString& thumbDir, bool mayDecode) const;
+
+    void resetRowsToAll();
+    // The query's pHash (one code; empty if unreadable)
+    QVector<quint64> queryHashes(const QString& queryImage);
+    // path + mtime + size, so an edited query file is rescored
+    static QString queryKey(const QString& queryImage);
+    // Width and height of the query as displayed (stored dims for indexed images, else the file header)
+    QSize queryDims(const QString& queryImage) const;
+    // SearchFilter::admitted for every shard (in parallel); empty when filter is inactive
+    std::vector<std::vector<char>> admittedSlots(const SearchFilter& filter, const QSize& queryDims) const;
+    void invalidateQueryCache();
+
+    std::vector<std::unique_ptr<LibraryShard>> m_shards;
+    QVector<Row> m_rows;    // model row -> shard and slot
+    bool m_showingAll{true};
+
+    // Fully scored candidate lists of recent similarity queries, best first
+    enum class QueryKind { None, Similar, Hamming, Region, Fused, Embedding };
+    struct LastQuery {
+        QueryKind kind{QueryKind::None};
+        QList<ResultItem> scored;   // Similar/Region/Fused/Embedding: best 500 candidates; Hamming: matches within radius
+        QVector<quint64> codes;     // Hamming: query pHash
+        int radius{0};
+        SearchFilter filter;        // Hamming: applied again when the radius widens; Similar: for rescoring
+        QSize dims;
+        QString query;              // Similar: rescored when a larger TopK than exact is asked for
+        int exact{std::numeric_limits<int>::max()};   // leading entries of scored known to be final
+    };
+    // Similar lists by query key; items past exact are missing candidates the bound skipped
+    struct CachedScores { QList<ResultItem> items; int exact; };
+    QCache<QString, CachedScores> m_similarCache{8};
+    LastQuery m_lastQuery;
+    // Loaded on the first embedding query that needs to embed a file
+    std::unique_ptr<EmbeddingModel::Extractor> m_embedder;
+    // Vector of an image file the way the indexer embeds it; empty without a model or if unreadable
+    std::vector<float> embedFile(const QString& path, const EmbeddingModel::Options& opts, QSize* decodedSize = nullptr);
+    // evaluate(): indexed images queried from their files, the path of images outside the library
+    void evaluateFileQueries(LibraryShard& shard, const EmbeddingModel::Options& embedOpts,
+                             const Evaluation::Options& opts, QTextStream& out);
 
-    QList<ImageEntry> m_items;
-    std::unique_ptr<SqliteStore> m_store;
     QString m_appData;
+    ThumbnailPyramid::Options m_thumbOpts;
+    NeighborGraphBuilder* m_graph{};
+    bool m_graphAgain{false};
+    ThumbnailBackfill* m_backfill{};
+    bool m_backfillAgain{false};
 
     // Caches to avoid repeated disk IO and scaling during scrolling
     mutable QHash<QString, QIcon> m_iconCache;      // path -> icon
     mutable QSet<QString> m_iconInFlight;           // paths currently generating icons
-};
\ No newline at end of file
+    // Shared by every row still without a thumbnail: one cacheKey, so one scaled pixmap in the delegate
+    QIcon m_placeholderIcon;
+};
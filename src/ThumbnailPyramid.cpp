@@ -0,0 +1,168 @@
+#include "ThumbnailPyramid.h"
+#include <QtGui/QImageWriter>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace {
+static inline int clamp255(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+// Simple and fast 3x3 Gaussian blur of row y of in (ARGB32_Premultiplied) into dst
+static void gaussianBlurRow3x3(const QImage& in, int y, QRgb* dst) {
+    const int w = in.width();
+    const int h = in.height();
+    static const int k[3][3] = {{1,2,1},{2,4,2},{1,2,1}}; // sum=16
+    const QRgb* prev = reinterpret_cast<const QRgb*>(in.constScanLine(y > 0 ? y-1 : y));
+    const QRgb* curr = reinterpret_cast<const QRgb*>(in.constScanLine(y));
+    const QRgb* next = reinterpret_cast<const QRgb*>(in.constScanLine(y < h-1 ? y+1 : y));
+    for (int x = 0; x < w; ++x) {
+        int x0 = x > 0 ? x-1 : x;
+        int x2 = x < w-1 ? x+1 : x;
+        int b = 0, g = 0, r = 0, a = 0;
+        auto acc = [&](const QRgb* line, int xi, int ky){
+            const QRgb p0 = line[x0];
+            const QRgb p1 = line[xi];
+            const QRgb p2 = line[x2];
+            b += k[ky][0]*qBlue(p0) + k[ky][1]*qBlue(p1) + k[ky][2]*qBlue(p2);
+            g += k[ky][0]*qGreen(p0) + k[ky][1]*qGreen(p1) + k[ky][2]*qGreen(p2);
+            r += k[ky][0]*qRed(p0) + k[ky][1]*qRed(p1) + k[ky][2]*qRed(p2);
+            a += k[ky][0]*qAlpha(p0) + k[ky][1]*qAlpha(p1) + k[ky][2]*qAlpha(p2);
+        };
+        acc(prev, x, 0);
+        acc(curr, x, 1);
+        acc(next, x, 2);
+        dst[x] = qRgba(b/16, g/16, r/16, a/16);
+    }
+}
+
+// Unsharp mask to boost perceived sharpness after downscaling
+static QImage unsharpMask(const QImage& src, double amount = 0.5, int threshold = 1) {
+    if (src.isNull() || amount <= 0.0) return src;
+    QImage in = src.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage out(in.size(), in.format());
+    const int w = in.width();
+    const int h = in.height();
+    // The blur is only read one row at a time, so a per-thread row replaces a full blurred copy
+    thread_local std::vector<QRgb> blurRow;
+    blurRow.resize(size_t(w));
+    for (int y = 0; y < h; ++y) {
+        const QRgb* s = reinterpret_cast<const QRgb*>(in.constScanLine(y));
+        gaussianBlurRow3x3(in, y, blurRow.data());
+        const QRgb* b = blurRow.data();
+        QRgb* d = reinterpret_cast<QRgb*>(out.scanLine(y));
+        for (int x = 0; x < w; ++x) {
+            int sr = qRed(s[x]), sg = qGreen(s[x]), sb = qBlue(s[x]), sa = qAlpha(s[x]);
+            int br = qRed(b[x]), bg = qGreen(b[x]), bb = qBlue(b[x]);
+            int dr = sr - br, dg = sg - bg, db = sb - bb;
+            if (std::abs(dr) < threshold) dr = 0;
+            if (std::abs(dg) < threshold) dg = 0;
+            if (std::abs(db) < threshold) db = 0;
+            int rr = clamp255(int(sr + amount * dr));
+            int rg = clamp255(int(sg + amount * dg));
+            int rb = clamp255(int(sb + amount * db));
+            d[x] = qRgba(rr, rg, rb, sa);
+        }
+    }
+    return out;
+}
+
+static QImage resample(const QImage& src, int maxSide) {
+    QSize target = src.size();
+    target.scale(maxSide, maxSide, Qt::KeepAspectRatio);
+    return src.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+static const char* const kKnownFormats[] = {"jpg", "webp"};
+}
+
+ThumbnailPyramid::Options ThumbnailPyramid::Options::fromSettings() {
+    Options o;
+    QSettings s;
+    const QStringList parts = s.value("thumbnails/sizes", "384,256").toString().split(',', Qt::SkipEmptyParts);
+    QList<int> sizes;
+    for (const QString& p : parts) {
+        const int v = p.trimmed().toInt();
+        if (v >= 16 && v <= 2048 && !sizes.contains(v)) sizes.push_back(v);
+    }
+    if (!sizes.isEmpty()) {
+        std::sort(sizes.begin(), sizes.end(), std::greater<int>());
+        o.sizes = sizes;
+    }
+    const QByteArray fmt = s.value("thumbnails/format", "jpg").toString().toLower().toLatin1();
+    if (fmt == "webp") {
+        if (QImageWriter::supportedImageFormats().contains("webp")) o.format = fmt;
+        else qWarning() << "WebP writer not available, falling back to JPEG thumbnails";
+    }
+    o.quality = qBound(1, s.value("thumbnails/quality", 92).toInt(), 100);
+
+    // Remembered so remove() finds old levels by name; listing a thumbnail directory of a
+    // large library per removed image would be far too slow
+    for (const QString& p : s.value("thumbnails/writtenSizes").toString().split(',', Qt::SkipEmptyParts)) {
+        const int v = p.trimmed().toInt();
+        if (v >= 16 && v <= 2048 && !o.writtenSizes.contains(v)) o.writtenSizes.push_back(v);
+    }
+    bool grew = false;
+    for (int v : o.sizes) {
+        if (!o.writtenSizes.contains(v)) { o.writtenSizes.push_back(v); grew = true; }
+    }
+    if (grew) {
+        QStringList written;
+        for (int v : o.writtenSizes) written << QString::number(v);
+        s.setValue("thumbnails/writtenSizes", written.join(','));
+    }
+    return o;
+}
+
+int ThumbnailPyramid::Options::pickSize(int want) const {
+    int best = largest();
+    for (int s : sizes) {
+        if (s >= want) best = s; // sizes are descending, so the last hit is the smallest
+    }
+    return best;
+}
+
+QImage ThumbnailPyramid::downscaleHQ(const QImage& src, int maxSide) {
+    if (src.isNull()) return src;
+    return unsharpMask(resample(src, maxSide), 0.5, 1);
+}
+
+QList<QPair<int, QImage>> ThumbnailPyramid::build(const QImage& src, const Options& opts) {
+    QList<QPair<int, QImage>> levels;
+    if (src.isNull() || opts.sizes.isEmpty()) return levels;
+    // One pass over the full decode; smaller levels resample the unsharpened intermediate
+    // so they are sharpened exactly once.
+    const QImage top = resample(src, opts.largest());
+    for (int size : opts.sizes) {
+        const QImage level = (size == opts.largest()) ? top : resample(top, size);
+        levels.push_back({size, unsharpMask(level, 0.5, 1)});
+    }
+    return levels;
+}
+
+QString ThumbnailPyramid::thumbPath(const QString& thumbDir, const QString& path, int size, const Options& opts) {
+    return thumbDir + "/" + QString::number(qHash(QDir::toNativeSeparators(path)))
+        + "_" + QString::number(size) + "." + opts.suffix();
+}
+
+bool ThumbnailPyramid::generate(const QImage& src, const QString& thumbDir, const QString& path,
+                                const Options& opts, QList<QPair<int, QImage>>* levels) {
+    const auto built = build(src, opts);
+    if (built.isEmpty()) return false;
+    bool ok = true;
+    for (const auto& lv : built) {
+        ok &= lv.second.save(thumbPath(thumbDir, path, lv.first, opts), opts.format.constData(), opts.quality);
+    }
+    if (levels) *levels = built;
+    return ok;
+}
+
+void ThumbnailPyramid::remove(const QString& thumbDir, const QString& path, const Options& opts) {
+    for (const char* fmt : kKnownFormats) {
+        Options o = opts;
+        o.format = fmt;
+        for (int size : opts.writtenSizes) QFile::remove(thumbPath(thumbDir, path, size, o));
+        for (int size : opts.sizes) {
+            if (!opts.writtenSizes.contains(size)) QFile::remove(thumbPath(thumbDir, path, size, o));
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <QtCore>
+#include <QtGui/QImage>
+
+// Thumbnail generation shared by the indexer and the on-demand icon workers.
+// The source is resampled once to the largest configured level; every smaller
+// level is derived from that intermediate instead of the full decode.
+namespace ThumbnailPyramid {
+    struct Options {
+        QList<int> sizes{384, 256};   // sorted descending, unique
+        QByteArray format{"jpg"};     // "jpg" or "webp"
+        int quality{92};
+        // Every size configured so far (thumbnails/writtenSizes): levels of earlier settings
+        // stay on disk until their image is removed
+        QList<int> writtenSizes{384, 256};
+
+        // Reads thumbnails/sizes, thumbnails/format, thumbnails/quality from QSettings and
+        // adds new sizes to thumbnails/writtenSizes
+        static Options fromSettings();
+        QString suffix() const { return QString::fromLatin1(format); }
+        int largest() const { return sizes.isEmpty() ? 0 : sizes.first(); }
+        // Smallest configured level >= want, or the largest one if none is big enough
+        int pickSize(int want) const;
+    };
+
+    // Smooth resample + light unsharp mask
+    QImage downscaleHQ(const QImage& src, int maxSide);
+
+    // Levels in the order of opts.sizes
+    QList<QPair<int, QImage>> build(const QImage& src, const Options& opts);
+
+    // <thumbDir>/<qHash(native path)>_<size>.<ext>
+    QString thumbPath(const QString& thumbDir, const QString& path, int size, const Options& opts);
+
+    // Build and write every level; optionally hands back the generated images
+    bool generate(const QImage& src, const QString& thumbDir, const QString& path,
+                  const Options& opts, QList<QPair<int, QImage>>* levels = nullptr);
+
+    // Remove every level ever written (writtenSizes) in every supported format for path
+    void remove(const QString& thumbDir, const QString& path, const Options& opts);
+}
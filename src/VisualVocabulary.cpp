@@ -0,0 +1,174 @@
+#include "VisualVocabulary.h"
+#include "ImageHash.h"
+#include <QDataStream>
+#include <cstring>
+#include <random>
+
+namespace {
+static inline int hamming256(const quint8* a, const quint8* b) {
+    int d = 0;
+    for (int i = 0; i < VisualVocabulary::kDescBytes; i += 8) {
+        quint64 x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        d += ImageHash::hammingDistance(x, y);
+    }
+    return d;
+}
+
+constexpr quint32 kVocabMagic = 0x564f4331; // "VOC1"
+}
+
+void VisualVocabulary::train(const quint8* descriptors, int count, int branching, int depth, int iterations) {
+    m_nodes.clear();
+    m_words = 0;
+    if (count <= 0) return;
+    m_nodes.emplace_back();
+    std::vector<int> all(count);
+    for (int i = 0; i < count; ++i) all[i] = i;
+    split(0, all, descriptors, qMax(2, branching), qMax(1, depth), qMax(1, iterations));
+}
+
+void VisualVocabulary::split(int node, std::vector<int>& members, const quint8* descriptors,
+                             int branching, int levelsLeft, int iterations) {
+    if (levelsLeft == 0 || int(members.size()) <= branching) {
+        m_nodes[node].word = m_words++;
+        return;
+    }
+    const int n = int(members.size());
+    const int k = branching;
+    std::mt19937 rng(quint32(node) * 2654435761u + quint32(n));
+
+    // k-means++ seeding on Hamming distance
+    std::vector<std::array<quint8, kDescBytes>> centers(k);
+    std::vector<int> nearest(n, kDescBytes * 8 + 1);
+    std::memcpy(centers[0].data(), descriptors + size_t(members[std::uniform_int_distribution<int>(0, n - 1)(rng)]) * kDescBytes, kDescBytes);
+    for (int c = 1; c < k; ++c) {
+        double total = 0;
+        for (int i = 0; i < n; ++i) {
+            const int d = hamming256(descriptors + size_t(members[i]) * kDescBytes, centers[c - 1].data());
+            nearest[i] = qMin(nearest[i], d);
+            total += double(nearest[i]) * nearest[i];
+        }
+        double pick = std::uniform_real_distribution<double>(0.0, total)(rng);
+        int chosen = n - 1;
+        for (int i = 0; i < n; ++i) {
+            pick -= double(nearest[i]) * nearest[i];
+            if (pick <= 0) { chosen = i; break; }
+        }
+        std::memcpy(centers[c].data(), descriptors + size_t(members[chosen]) * kDescBytes, kDescBytes);
+    }
+
+    // k-majority iterations
+    std::vector<int> assign(n, 0);
+    std::vector<std::vector<int>> bitCounts(k, std::vector<int>(kDescBytes * 8));
+    std::vector<int> sizes(k);
+    for (int it = 0; it < iterations; ++it) {
+        bool changed = false;
+        for (int i = 0; i < n; ++i) {
+            const quint8* d = descriptors + size_t(members[i]) * kDescBytes;
+            int best = 0, bestDist = hamming256(d, centers[0].data());
+            for (int c = 1; c < k; ++c) {
+                const int dist = hamming256(d, centers[c].data());
+                if (dist < bestDist) { bestDist = dist; best = c; }
+            }
+            if (assign[i] != best || it == 0) { assign[i] = best; changed = true; }
+        }
+        if (!changed) break;
+        for (int c = 0; c < k; ++c) { std::fill(bitCounts[c].begin(), bitCounts[c].end(), 0); sizes[c] = 0; }
+        for (int i = 0; i < n; ++i) {
+            const quint8* d = descriptors + size_t(members[i]) * kDescBytes;
+            auto& bc = bitCounts[assign[i]];
+            ++sizes[assign[i]];
+            for (int b = 0; b < kDescBytes * 8; ++b) bc[b] += (d[b >> 3] >> (b & 7)) & 1;
+        }
+        for (int c = 0; c < k; ++c) {
+            if (sizes[c] == 0) {
+                // Reseed an empty cluster from a random member
+                std::memcpy(centers[c].data(), descriptors + size_t(members[std::uniform_int_distribution<int>(0, n - 1)(rng)]) * kDescBytes, kDescBytes);
+                continue;
+            }
+            centers[c].fill(0);
+            for (int b = 0; b < kDescBytes * 8; ++b) {
+                if (bitCounts[c][b] * 2 > sizes[c]) centers[c][b >> 3] |= quint8(1u << (b & 7));
+            }
+        }
+    }
+
+    // Children are stored contiguously; empty clusters are dropped
+    std::vector<std::vector<int>> groups(k);
+    for (int i = 0; i < n; ++i) groups[assign[i]].push_back(members[i]);
+    members.clear();
+    members.shrink_to_fit();
+    const int first = int(m_nodes.size());
+    int children = 0;
+    for (int c = 0; c < k; ++c) {
+        if (groups[c].empty()) continue;
+        Node child;
+        child.center = centers[c];
+        m_nodes.push_back(child);
+        ++children;
+    }
+    m_nodes[node].firstChild = first;
+    m_nodes[node].childCount = children;
+    int childIdx = first;
+    for (int c = 0; c < k; ++c) {
+        if (groups[c].empty()) continue;
+        split(childIdx++, groups[c], descriptors, branching, levelsLeft - 1, iterations);
+    }
+}
+
+quint32 VisualVocabulary::quantize(const quint8* desc) const {
+    if (m_nodes.empty()) return 0;
+    int node = 0;
+    while (m_nodes[node].word < 0) {
+        const Node& n = m_nodes[node];
+        int best = n.firstChild, bestDist = hamming256(desc, m_nodes[best].center.data());
+        for (int c = n.firstChild + 1; c < n.firstChild + n.childCount; ++c) {
+            const int d = hamming256(desc, m_nodes[c].center.data());
+            if (d < bestDist) { bestDist = d; best = c; }
+        }
+        node = best;
+    }
+    return quint32(m_nodes[node].word);
+}
+
+std::vector<quint32> VisualVocabulary::quantizeAll(const quint8* descriptors, int count) const {
+    std::vector<quint32> words;
+    words.reserve(count);
+    for (int i = 0; i < count; ++i) words.push_back(quantize(descriptors + size_t(i) * kDescBytes));
+    return words;
+}
+
+QByteArray VisualVocabulary::serialize() const {
+    QByteArray out;
+    QDataStream ds(&out, QIODevice::WriteOnly);
+    ds << kVocabMagic << qint32(m_words) << qint32(m_nodes.size());
+    for (const Node& n : m_nodes) {
+        ds.writeRawData(reinterpret_cast<const char*>(n.center.data()), kDescBytes);
+        ds << n.firstChild << n.childCount << n.word;
+    }
+    return out;
+}
+
+bool VisualVocabulary::deserialize(const QByteArray& data) {
+    QDataStream ds(data);
+    quint32 magic = 0;
+    qint32 words = 0, count = 0;
+    ds >> magic >> words >> count;
+    if (magic != kVocabMagic || count <= 0 || words <= 0) return false;
+    std::vector<Node> nodes(count);
+    for (int i = 0; i < count; ++i) {
+        Node& n = nodes[i];
+        if (ds.readRawData(reinterpret_cast<char*>(n.center.data()), kDescBytes) != kDescBytes) return false;
+        ds >> n.firstChild >> n.childCount >> n.word;
+        // Children always follow their parent, which also rules out cycles
+        const bool leaf = n.word >= 0;
+        if ((!leaf && (n.firstChild <= i || n.childCount <= 0 || n.firstChild + n.childCount > count)) || n.word >= words)
+            return false;
+    }
+    if (ds.status() != QDataStream::Ok) return false;
+    m_nodes = std::move(nodes);
+    m_words = words;
+    return true;
+}
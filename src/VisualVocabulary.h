@@ -0,0 +1,38 @@
+#pragma once
+#include <QtCore>
+#include <array>
+#include <vector>
+
+// Vocabulary tree over 256-bit binary descriptors (ORB).
+// Built by hierarchical k-majority clustering: centers are bitwise majority
+// votes of their members and assignment uses Hamming distance. Leaves are
+// the visual words.
+class VisualVocabulary {
+public:
+    static constexpr int kDescBytes = 32;
+
+    bool isEmpty() const { return m_words == 0; }
+    int wordCount() const { return m_words; }
+
+    // descriptors: count * kDescBytes bytes
+    void train(const quint8* descriptors, int count, int branching = 8, int depth = 4, int iterations = 6);
+    quint32 quantize(const quint8* desc) const;
+    // One word per descriptor row
+    std::vector<quint32> quantizeAll(const quint8* descriptors, int count) const;
+
+    QByteArray serialize() const;
+    bool deserialize(const QByteArray& data);
+
+private:
+    struct Node {
+        std::array<quint8, kDescBytes> center{};
+        qint32 firstChild{-1};
+        qint32 childCount{0};
+        qint32 word{-1};       // >= 0 for leaves
+    };
+    void split(int node, std::vector<int>& members, const quint8* descriptors,
+               int branching, int levelsLeft, int iterations);
+
+    std::vector<Node> m_nodes;   // m_nodes[0] is the root, children stored contiguously
+    int m_words{0};
+};
@@ -1,6 +1,196 @@
 #include <QApplication>
+#include <QCommandLineParser>
 #include <QImageReader>
+#include <atomic>
+#include "Benchmark.h"
+#include "DecodeBudget.h"
 #include "MainWindow.h"
+#include "ThumbnailModel.h"
+#include "IndexClient.h"
+#include "IndexService.h"
+#include "TaskScheduler.h"
+
+static bool openReport(const QCommandLineParser& parser, QFile& out) {
+    if (parser.isSet("report")) {
+        out.setFileName(parser.value("report"));
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+            qWarning() << "Cannot write" << out.fileName();
+            return false;
+        }
+        return true;
+    }
+    return out.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+}
+
+// differ --batch-query <dir> [--report out.csv] [--max-hamming N] [--max-matches N]
+// Checks every image under <dir> against the indexed library without opening the window.
+static int runBatchQuery(const QCommandLineParser& parser) {
+    const QStringList queries = BatchQuery::collect(parser.value("batch-query"));
+    if (queries.isEmpty()) {
+        qWarning() << "No images found in" << parser.value("batch-query");
+        return 1;
+    }
+    BatchQuery::Options opts;
+    if (parser.isSet("max-hamming")) opts.maxHamming = qBound(0, parser.value("max-hamming").toInt(), 64);
+    if (parser.isSet("max-matches")) opts.maxMatches = qMax(1, parser.value("max-matches").toInt());
+
+    // A running service answers from its warm index; otherwise the library is loaded here
+    IndexClient client;
+    if (client.connectToService()) {
+        QList<BatchQuery::Report> reports;
+        QHash<qint64, QString> paths;
+        if (!client.batchQuery(queries, opts, &reports, &paths)) {
+            qWarning() << "Index service failed the batch query";
+            return 1;
+        }
+        QFile out;
+        if (!openReport(parser, out)) return 1;
+        return BatchQuery::writeCsv(&out, reports, [&paths](qint64 id){ return paths.value(id); }) ? 0 : 1;
+    }
+
+    ThumbnailModel model;
+    model.loadAll();
+    // Called from every worker of the query pool; one of them wins each step of 10 %
+    std::atomic<int> lastStep{-1};
+    const auto reports = model.batchQuery(queries, opts, [&lastStep](int done, int total){
+        const int step = done * 10 / total;
+        int seen = lastStep.load();
+        while (step > seen) {
+            if (lastStep.compare_exchange_weak(seen, step)) {
+                qInfo().noquote() << QString("%1/%2").arg(done).arg(total);
+                break;
+            }
+        }
+    });
+
+    QFile out;
+    if (!openReport(parser, out)) return 1;
+    return BatchQuery::writeCsv(&out, reports, [&model](qint64 id){ return model.pathForId(id); }) ? 0 : 1;
+}
+
+// --aspect, --min-width, --min-height, --folder, --from and --to for --query
+static SearchFilter queryFilter(const QCommandLineParser& parser) {
+    SearchFilter filter;
+    if (parser.isSet("aspect")) filter.aspectTolerance = qBound(0.0, parser.value("aspect").toDouble(), 100.0) / 100.0;
+    if (parser.isSet("min-width")) filter.minWidth = qMax(0, parser.value("min-width").toInt());
+    if (parser.isSet("min-height")) filter.minHeight = qMax(0, parser.value("min-height").toInt());
+    if (parser.isSet("folder")) filter.folder = QDir::toNativeSeparators(QFileInfo(parser.value("folder")).absoluteFilePath());
+    // Both ends are whole local days
+    const QDate from = QDate::fromString(parser.value("from"), Qt::ISODate);
+    const QDate to = QDate::fromString(parser.value("to"), Qt::ISODate);
+    if (from.isValid()) filter.modifiedFrom = from.startOfDay().toSecsSinceEpoch();
+    if (to.isValid()) filter.modifiedTo = to.addDays(1).startOfDay().toSecsSinceEpoch() - 1;
+    return filter;
+}
+
+// differ --query <image>... [--mode hamming|similar|fused|crops|embedding] [--top-k N] [--max-hamming N] [--report out.csv]
+//                           [--aspect PCT] [--min-width PX] [--min-height PX] [--folder DIR] [--from DATE] [--to DATE]
+// Prints query,match,distance rows. Through a running service all queries are pipelined on one connection.
+static int runQuery(const QCommandLineParser& parser) {
+    using IndexProtocol::Op;
+    const QStringList queries = parser.positionalArguments();
+    if (queries.isEmpty()) {
+        qWarning() << "--query needs at least one image";
+        return 1;
+    }
+    const QString mode = parser.value("mode");
+    const Op op = mode == "similar" ? Op::SearchSimilar : mode == "fused" ? Op::SearchFused
+                : mode == "crops" ? Op::SearchCrops : mode == "embedding" ? Op::SearchEmbedding : Op::SearchHamming;
+    const int topK = parser.isSet("top-k") ? qBound(1, parser.value("top-k").toInt(), 500) : 20;
+    const int maxHamming = parser.isSet("max-hamming") ? qBound(0, parser.value("max-hamming").toInt(), 64) : 10;
+    const SearchFilter filter = queryFilter(parser);
+
+    QList<QList<IndexProtocol::Hit>> results;
+    IndexClient client;
+    if (client.connectToService()) {
+        if (!client.search(op, queries, topK, maxHamming, &results, filter)) {
+            qWarning() << "Index service connection lost";
+            return 1;
+        }
+    } else {
+        ThumbnailModel model;
+        model.loadAll();
+        for (const QString& q : queries) {
+            QList<ThumbnailModel::ResultItem> items;
+            if (op == Op::SearchSimilar) items = model.searchSimilar(q, topK, maxHamming, filter);
+            else if (op == Op::SearchFused) items = model.searchFused(q, topK, filter);
+            else if (op == Op::SearchCrops) items = model.searchCrops(q, topK, maxHamming, filter);
+            else if (op == Op::SearchEmbedding) items = model.searchEmbedding(q, topK, filter);
+            else items = model.searchHamming(q, topK, maxHamming, filter);
+            QList<IndexProtocol::Hit> hits;
+            for (const auto& r : items) hits.push_back({r.id, r.distance, model.pathForId(r.id)});
+            results.push_back(hits);
+        }
+    }
+
+    QFile out;
+    if (!openReport(parser, out)) return 1;
+    QTextStream ts(&out);
+    ts << "query,match,distance\n";
+    for (int i = 0; i < queries.size(); ++i) {
+        for (const auto& h : results[i])
+            ts << BatchQuery::csvField(QDir::toNativeSeparators(queries[i])) << ',' << BatchQuery::csvField(h.path) << ',' << h.distance << '\n';
+    }
+    ts.flush();
+    return ts.status() == QTextStream::Ok ? 0 : 1;
+}
+
+// differ --serve
+// Keeps the library loaded and answers queries from the GUI and the CLI over a local socket.
+static int runService() {
+    IndexService service;
+    if (!service.start()) return 1;
+    return QCoreApplication::exec();
+}
+
+// differ --evaluate [--eval-queries N] [--orb-threshold T]
+// Prints precision/recall of the stored signals and the configured fusion against ORB.
+static int runEvaluation(const QCommandLineParser& parser) {
+    Evaluation::Options opts;
+    if (parser.isSet("eval-queries")) opts.queries = qMax(1, parser.value("eval-queries").toInt());
+    if (parser.isSet("orb-threshold")) opts.orbThreshold = parser.value("orb-threshold").toDouble();
+    ThumbnailModel model;
+    model.loadAll();
+    QTextStream out(stdout);
+    return model.evaluate(opts, out) ? 0 : 1;
+}
+
+// differ --bench-alloc <dir>
+// Allocations, bytes and time per image for each indexing and search stage.
+static int runAllocationBenchmark(const QCommandLineParser& parser) {
+    QStringList images = BatchQuery::collect(parser.value("bench-alloc"));
+    if (images.size() > 200) images = images.mid(0, 200);
+    QTextStream out(stdout);
+    return Benchmark::allocations(images, ThumbnailPyramid::Options::fromSettings(), out) ? 0 : 1;
+}
+
+// differ --bench-paint
+// Frames per second while scrolling a 10k thumbnail grid (needs a display, or QT_QPA_PLATFORM=offscreen).
+static int runPaintBenchmark() {
+    QTextStream out(stdout);
+    return Benchmark::scrolling(10000, out) ? 0 : 1;
+}
+
+// differ --bench-paths <n>
+// Database size and load time with a full path per row versus directories + file names.
+static int runPathBenchmark(const QCommandLineParser& parser) {
+    QTextStream out(stdout);
+    return Benchmark::pathStorage(qMax(1, parser.value("bench-paths").toInt()), out) ? 0 : 1;
+}
+
+// differ --bench-index <n>
+// Memory per image and Hamming scan bandwidth of the column index against a QList<ImageEntry>.
+static int runIndexBenchmark(const QCommandLineParser& parser) {
+    QTextStream out(stdout);
+    return Benchmark::inMemoryIndex(qMax(1, parser.value("bench-index").toInt()), out) ? 0 : 1;
+}
+
+// differ --bench-mih <n>
+// Multi-index hashing against a linear scan for r = 4..16, with and without dihedral variants.
+static int runMultiIndexBenchmark(const QCommandLineParser& parser) {
+    QTextStream out(stdout);
+    return Benchmark::multiIndex(qMax(1, parser.value("bench-mih").toInt()), out) ? 0 : 1;
+}
 
 int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
@@ -10,7 +200,50 @@ int main(int argc, char *argv[]) {
 
     // Raise image allocation limit to handle large images, but avoid unbounded
     QImageReader::setAllocationLimit(1024); // in megabytes
+    // ... and bound all concurrent decodes together
+    DecodeBudget::configure(DecodeBudget::Options::fromSettings());
+    TaskScheduler::configure(TaskScheduler::Options::fromSettings());
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addOptions({
+        {"batch-query", "Check every image under <dir> against the library and print a CSV report.", "dir"},
+        {"report", "Write the batch report to <file> instead of stdout.", "file"},
+        {"max-hamming", "pHash radius for batch queries (default 10).", "n"},
+        {"max-matches", "Matches reported per query (default 20).", "n"},
+        {"evaluate", "Report precision/recall of the stored signals against ORB ground truth."},
+        {"eval-queries", "Random library images used as queries by --evaluate (default 50).", "n"},
+        {"orb-threshold", "ORB ratio-test score that counts as a match for --evaluate (default 0.2).", "t"},
+        {"serve", "Keep the index resident and answer local clients (GUI, --query, --batch-query)."},
+        {"query", "Look up the image files given as arguments and print query,match,distance rows."},
+        {"mode", "Lookup used by --query: hamming (default), similar, fused, crops or embedding.", "mode"},
+        {"top-k", "Matches per query for --query (default 20).", "n"},
+        {"aspect", "--query: only images whose aspect ratio is within <pct> percent of the query's.", "pct"},
+        {"min-width", "--query: only images at least <px> wide.", "px"},
+        {"min-height", "--query: only images at least <px> tall.", "px"},
+        {"folder", "--query: only images under <dir>.", "dir"},
+        {"from", "--query: only images modified on or after <date> (yyyy-MM-dd).", "date"},
+        {"to", "--query: only images modified on or before <date> (yyyy-MM-dd).", "date"},
+        {"bench-alloc", "Report allocations and time per image for the index and search stages on up to 200 images under <dir>.", "dir"},
+        {"bench-paint", "Report frames per second while scrolling a 10000-image thumbnail grid."},
+        {"bench-index", "Report memory per image and Hamming scan bandwidth of the in-memory index over <n> synthetic images.", "n"},
+        {"bench-mih", "Report radius query time of multi-index hashing against a linear scan over <n> synthetic pHashes.", "n"},
+        {"bench-paths", "Report database size and load time of <n> synthetic images before and after path normalization.", "n"},
+    });
+    parser.addPositionalArgument("images", "Query images for --query.", "[images...]");
+    parser.process(app);
+    if (parser.isSet("batch-query")) return runBatchQuery(parser);
+    if (parser.isSet("evaluate")) return runEvaluation(parser);
+    if (parser.isSet("serve")) return runService();
+    if (parser.isSet("query")) return runQuery(parser);
+    if (parser.isSet("bench-alloc")) return runAllocationBenchmark(parser);
+    if (parser.isSet("bench-paint")) return runPaintBenchmark();
+    if (parser.isSet("bench-paths")) return runPathBenchmark(parser);
+    if (parser.isSet("bench-index")) return runIndexBenchmark(parser);
+    if (parser.isSet("bench-mih")) return runMultiIndexBenchmark(parser);
 
+    TaskScheduler::watchInteraction();
     MainWindow w;
     w.resize(1280, 800);
     w.show();